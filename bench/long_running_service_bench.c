@@ -0,0 +1,422 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Microbenchmarks for each stage of the TimedServiceJob lifecycle.
+ *
+ * The service source is included directly so that its static functions can
+ * be measured without having to export them from the shared library. The
+ * JobsManager functions are replaced by the stubs below so that the numbers
+ * only include the cost of the service's own code and not that of the
+ * job store.
+ *
+ * Build it with "make bench" from the build/unix/<platform> directory and
+ * then run
+ *
+ * 	long_running_service_bench [<number of repeats>]
+ */
+
+#include "../src/long_running_service.c"
+
+#include <stdio.h>
+
+
+/*
+ * The numbers of jobs that each stage is run with.
+ */
+static const uint32 S_JOB_COUNTS [] = { 1, 1000, 100000 };
+
+
+/*
+ * ALLOCATION COUNTING
+ *
+ * These replace the Grassroots memory functions so that every allocation
+ * made by the service, and by the Grassroots code that it calls, can be
+ * counted. The service's own threads allocate too, so the count is
+ * updated atomically.
+ */
+
+static uint64 s_num_allocations = 0;
+
+
+void *AllocMemory (const size_t size)
+{
+	__atomic_add_fetch (&s_num_allocations, 1, __ATOMIC_RELAXED);
+	return malloc (size);
+}
+
+
+void *AllocMemoryArray (const size_t num_items, const size_t size)
+{
+	__atomic_add_fetch (&s_num_allocations, 1, __ATOMIC_RELAXED);
+	return calloc (num_items, size);
+}
+
+
+void *ReallocMemory (void *value_p, const size_t new_size, const size_t UNUSED_PARAM (old_size))
+{
+	__atomic_add_fetch (&s_num_allocations, 1, __ATOMIC_RELAXED);
+	return realloc (value_p, new_size);
+}
+
+
+void FreeMemory (void *value_p)
+{
+	free (value_p);
+}
+
+
+static void *CountingJSONAlloc (size_t size)
+{
+	__atomic_add_fetch (&s_num_allocations, 1, __ATOMIC_RELAXED);
+	return malloc (size);
+}
+
+
+/*
+ * JOBSMANAGER STUBS
+ */
+
+static uint64 s_num_jobs_manager_calls = 0;
+
+
+JobsManager *GetJobsManager (GrassrootsServer * UNUSED_PARAM (grassroots_p))
+{
+	return NULL;
+}
+
+
+bool AddServiceJobToJobsManager (JobsManager * UNUSED_PARAM (manager_p), uuid_t UNUSED_PARAM (job_key), ServiceJob * UNUSED_PARAM (job_p))
+{
+	++ s_num_jobs_manager_calls;
+	return true;
+}
+
+
+ServiceJob *GetServiceJobFromJobsManager (JobsManager * UNUSED_PARAM (manager_p), const uuid_t UNUSED_PARAM (job_key))
+{
+	++ s_num_jobs_manager_calls;
+	return NULL;
+}
+
+
+ServiceJob *RemoveServiceJobFromJobsManager (JobsManager * UNUSED_PARAM (manager_p), const uuid_t UNUSED_PARAM (job_key), bool UNUSED_PARAM (get_job_flag))
+{
+	++ s_num_jobs_manager_calls;
+	return NULL;
+}
+
+
+/*
+ * TIMING
+ */
+
+typedef struct BenchmarkResult
+{
+	const char *br_name_s;
+	uint32 br_num_jobs;
+	uint64 br_elapsed_ns;
+	uint64 br_num_allocations;
+	uint64 br_num_bytes;
+} BenchmarkResult;
+
+
+static uint64 GetTimeInNanoseconds (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return ((uint64) ts.tv_sec) * 1000000000ULL + (uint64) ts.tv_nsec;
+}
+
+
+static void StartBenchmark (BenchmarkResult *result_p, const char *name_s, const uint32 num_jobs)
+{
+	result_p -> br_name_s = name_s;
+	result_p -> br_num_jobs = num_jobs;
+	result_p -> br_num_bytes = 0;
+	result_p -> br_num_allocations = __atomic_load_n (&s_num_allocations, __ATOMIC_RELAXED);
+	result_p -> br_elapsed_ns = GetTimeInNanoseconds ();
+}
+
+
+static void StopBenchmark (BenchmarkResult *result_p)
+{
+	result_p -> br_elapsed_ns = GetTimeInNanoseconds () - (result_p -> br_elapsed_ns);
+	result_p -> br_num_allocations = __atomic_load_n (&s_num_allocations, __ATOMIC_RELAXED) - (result_p -> br_num_allocations);
+}
+
+
+static void PrintBenchmarkResult (const BenchmarkResult *result_p)
+{
+	const double num_ops = (double) (result_p -> br_num_jobs);
+
+	printf ("%-32s %8u %14.1f %12.2f %12.1f\n", result_p -> br_name_s, (unsigned int) (result_p -> br_num_jobs),
+		(double) (result_p -> br_elapsed_ns) / num_ops,
+		(double) (result_p -> br_num_allocations) / num_ops,
+		(double) (result_p -> br_num_bytes) / num_ops);
+}
+
+
+/*
+ * BENCHMARKS
+ */
+
+static TimedServiceJob **AllocateJobs (Service *service_p, const uint32 num_jobs)
+{
+	TimedServiceJob **jobs_pp = (TimedServiceJob **) calloc (num_jobs, sizeof (TimedServiceJob *));
+	const int64 now = GetJobClockTime ();
+	uint32 i;
+
+	for (i = 0; i < num_jobs; ++ i)
+		{
+			jobs_pp [i] = AllocateTimedServiceJob (service_p, NULL, "job", "duration 30", 30 * LRS_NANOS_PER_SECOND);
+			StartTimedServiceJob (jobs_pp [i], now);
+		}
+
+	return jobs_pp;
+}
+
+
+static void FreeJobs (TimedServiceJob **jobs_pp, const uint32 num_jobs)
+{
+	uint32 i;
+
+	for (i = 0; i < num_jobs; ++ i)
+		{
+			if (jobs_pp [i])
+				{
+					FreeTimedServiceJob ((ServiceJob *) jobs_pp [i]);
+				}
+		}
+
+	free (jobs_pp);
+}
+
+
+static void RunAllocationBenchmarks (Service *service_p, const uint32 num_jobs)
+{
+	BenchmarkResult result;
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+	const bool old_compact_names_flag = data_p -> lsd_compact_names_flag;
+	TimedServiceJob **jobs_pp = (TimedServiceJob **) calloc (num_jobs, sizeof (TimedServiceJob *));
+	ServiceJobSet *jobs_p = NULL;
+	uint32 i;
+
+	StartBenchmark (&result, "AllocateTimedServiceJob", num_jobs);
+
+	for (i = 0; i < num_jobs; ++ i)
+		{
+			jobs_pp [i] = AllocateTimedServiceJob (service_p, NULL, "job", "duration 30", 30 * LRS_NANOS_PER_SECOND);
+		}
+
+	StopBenchmark (&result);
+	PrintBenchmarkResult (&result);
+
+	StartBenchmark (&result, "FreeTimedServiceJob", num_jobs);
+	FreeJobs (jobs_pp, num_jobs);
+	StopBenchmark (&result);
+	PrintBenchmarkResult (&result);
+
+	StartBenchmark (&result, "GetServiceJobSet", num_jobs);
+	jobs_p = GetServiceJobSet (service_p, 0, num_jobs, 1, LRS_NANOS_PER_SECOND, JK_SLEEP, 1);
+	StopBenchmark (&result);
+	PrintBenchmarkResult (&result);
+
+	if (jobs_p)
+		{
+			FreeServiceJobSet (jobs_p);
+		}
+
+	service_p -> se_jobs_p = NULL;
+
+	/* The same again but without storing the names and descriptions */
+	data_p -> lsd_compact_names_flag = true;
+
+	StartBenchmark (&result, "GetServiceJobSet (compact)", num_jobs);
+	jobs_p = GetServiceJobSet (service_p, 0, num_jobs, 1, LRS_NANOS_PER_SECOND, JK_SLEEP, 1);
+	StopBenchmark (&result);
+	PrintBenchmarkResult (&result);
+
+	if (jobs_p)
+		{
+			FreeServiceJobSet (jobs_p);
+		}
+
+	service_p -> se_jobs_p = NULL;
+	data_p -> lsd_compact_names_flag = old_compact_names_flag;
+}
+
+
+static void RunJSONBenchmarks (Service *service_p, const uint32 num_jobs)
+{
+	BenchmarkResult result;
+	TimedServiceJob **jobs_pp = AllocateJobs (service_p, num_jobs);
+	json_t **json_pp = (json_t **) calloc (num_jobs, sizeof (json_t *));
+	uint32 i;
+
+	/* These are the hooks that the JobsManager uses to store and load each job */
+	StartBenchmark (&result, "Serialise to JSON", num_jobs);
+
+	for (i = 0; i < num_jobs; ++ i)
+		{
+			json_pp [i] = service_p -> se_serialise_job_json_fn (service_p, (ServiceJob *) jobs_pp [i], false);
+		}
+
+	StopBenchmark (&result);
+
+	/* Count the bytes that the JobsManager would store for each job */
+	for (i = 0; i < num_jobs; ++ i)
+		{
+			if (json_pp [i])
+				{
+					result.br_num_bytes += json_dumpb (json_pp [i], NULL, 0, JSON_COMPACT);
+				}
+		}
+
+	PrintBenchmarkResult (&result);
+
+	StartBenchmark (&result, "Deserialise from JSON", num_jobs);
+
+	for (i = 0; i < num_jobs; ++ i)
+		{
+			if (json_pp [i])
+				{
+					TimedServiceJob *job_p = (TimedServiceJob *) service_p -> se_deserialise_job_json_fn (service_p, json_pp [i]);
+
+					if (job_p)
+						{
+							FreeTimedServiceJob ((ServiceJob *) job_p);
+						}
+				}
+		}
+
+	StopBenchmark (&result);
+	PrintBenchmarkResult (&result);
+
+	for (i = 0; i < num_jobs; ++ i)
+		{
+			if (json_pp [i])
+				{
+					json_decref (json_pp [i]);
+				}
+		}
+
+	free (json_pp);
+	FreeJobs (jobs_pp, num_jobs);
+}
+
+
+static void RunStatusBenchmarks (Service *service_p, const uint32 num_jobs)
+{
+	BenchmarkResult result;
+	TimedServiceJob **jobs_pp = AllocateJobs (service_p, num_jobs);
+	ServiceJobSet *jobs_p = GetServiceJobSet (service_p, 0, num_jobs, 1, LRS_NANOS_PER_SECOND, JK_SLEEP, 1);
+	uint32 i;
+
+	StartBenchmark (&result, "GetTimedServiceJobStatus", num_jobs);
+
+	for (i = 0; i < num_jobs; ++ i)
+		{
+			GetTimedServiceJobStatus ((ServiceJob *) jobs_pp [i]);
+		}
+
+	StopBenchmark (&result);
+	PrintBenchmarkResult (&result);
+
+	if (jobs_p)
+		{
+			TimedServiceJobSetStatus set_status;
+			ServiceJobSetIterator iterator;
+			TimedServiceJob *job_p;
+			const int64 now = GetJobClockTime ();
+
+			InitServiceJobSetIterator (&iterator, jobs_p);
+			job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+
+			while (job_p)
+				{
+					StartTimedServiceJob (job_p, now);
+					job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+				}
+
+			StartBenchmark (&result, "GetTimedServiceJobSetStatus", num_jobs);
+			GetTimedServiceJobSetStatus (jobs_p, GetJobClockTime (), &set_status);
+			StopBenchmark (&result);
+			PrintBenchmarkResult (&result);
+
+			FreeServiceJobSet (jobs_p);
+		}
+
+	service_p -> se_jobs_p = NULL;
+	FreeJobs (jobs_pp, num_jobs);
+}
+
+
+int main (int argc, char *argv [])
+{
+	int num_repeats = 1;
+	ServicesArray *services_p = NULL;
+
+	if (argc > 1)
+		{
+			num_repeats = atoi (argv [1]);
+
+			if (num_repeats < 1)
+				{
+					num_repeats = 1;
+				}
+		}
+
+	/* Count jansson's allocations along with the service's own */
+	json_set_alloc_funcs (CountingJSONAlloc, free);
+
+	services_p = GetServices (NULL, NULL);
+
+	if (services_p)
+		{
+			Service *service_p = * (services_p -> sa_services_pp);
+			int repeat;
+
+			for (repeat = 0; repeat < num_repeats; ++ repeat)
+				{
+					size_t i;
+
+					printf ("%-32s %8s %14s %12s %12s\n", "stage", "jobs", "ns/op", "allocs/op", "bytes/op");
+
+					for (i = 0; i < sizeof (S_JOB_COUNTS) / sizeof (S_JOB_COUNTS [0]); ++ i)
+						{
+							const uint32 num_jobs = S_JOB_COUNTS [i];
+
+							RunAllocationBenchmarks (service_p, num_jobs);
+							RunJSONBenchmarks (service_p, num_jobs);
+							RunStatusBenchmarks (service_p, num_jobs);
+						}
+
+					printf ("JobsManager calls: " UINT64_FMT "\n\n", s_num_jobs_manager_calls);
+				}
+
+			ReleaseServices (services_p);
+		}
+	else
+		{
+			fprintf (stderr, "Failed to get the long running service\n");
+			return 1;
+		}
+
+	return 0;
+}
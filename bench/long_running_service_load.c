@@ -0,0 +1,1026 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * A load test that drives the built service plugin from end to end.
+ *
+ * Unlike the microbenchmarks, this doesn't include the service source.
+ * The shared library is loaded with dlopen () and used through the same
+ * calls that the server makes for each request: GetServices (),
+ * GetServiceParameters (), RunService (), polling the statuses and
+ * writing the results, and finally CloseService () and ReleaseServices ().
+ *
+ * Each client thread sends its requests at an even rate and, as in the
+ * server, each request gets its own Service. The JobsManager is replaced
+ * by the thread-safe in-memory store below. This program is linked with
+ * -rdynamic, and without -fvisibility=hidden, so that the plugin uses it
+ * rather than the one from the server library.
+ *
+ * Build it with "make load_test" from the build/unix/<platform> directory
+ * and then run
+ *
+ * 	long_running_service_load [-p <plugin>] [-c <clients>] [-r <requests per second>]
+ * 		[-d <seconds>] [-n <jobs per request>] [-m <minimum duration in ms>]
+ * 		[-k <job kind>] [-s <status poll interval in ms>] [-i <report interval in seconds>]
+ */
+
+#include <dlfcn.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "long_running_service.h"
+#include "jobs_manager.h"
+#include "service_job_set_iterator.h"
+#include "unsigned_int_parameter.h"
+#include "signed_int_parameter.h"
+#include "boolean_parameter.h"
+#include "string_parameter.h"
+
+
+/*
+ * The names of the service's parameters, see LRS_NUMBER_OF_JOBS and
+ * its neighbours in long_running_service.c
+ */
+static const char * const S_NUMBER_OF_JOBS_S = "Number of Jobs";
+
+static const char * const S_MIN_DURATION_S = "Minimum duration of each job";
+
+static const char * const S_MILLISECOND_DURATIONS_S = "Millisecond durations";
+
+static const char * const S_JOB_KIND_S = "Job kind";
+
+
+/* The number of buckets in the in-memory JobsManager. */
+#define LT_NUM_STORE_BUCKETS (65536)
+
+/* The longest time, in seconds, to wait for a request's jobs to finish. */
+#define LT_MAX_WAIT_SECONDS (600)
+
+
+typedef ServicesArray *(*GetServicesFunction) (User *user_p, GrassrootsServer *grassroots_p);
+
+typedef void (*ReleaseServicesFunction) (ServicesArray *services_p);
+
+typedef uint32 (*GetStatusesFunction) (Service *service_p, const uuid_t *job_ids_p, const uint32 num_jobs, OperationStatus *statuses_p);
+
+typedef bool (*WriteResultsFunction) (Service *service_p, LongRunningResultsWriter writer_fn, void *writer_data_p);
+
+
+/*
+ * The settings from the command line.
+ */
+typedef struct LoadTestConfig
+{
+	const char *ltc_plugin_s;
+	uint32 ltc_num_clients;
+	double ltc_request_rate;
+	uint32 ltc_duration;
+	uint32 ltc_jobs_per_request;
+	int32 ltc_min_duration;
+	const char *ltc_kind_s;
+	uint32 ltc_poll_interval_ms;
+	uint32 ltc_report_interval;
+} LoadTestConfig;
+
+
+/*
+ * The functions from the plugin.
+ */
+typedef struct LoadTestPlugin
+{
+	void *ltp_handle_p;
+	GetServicesFunction ltp_get_services_fn;
+	ReleaseServicesFunction ltp_release_services_fn;
+	GetStatusesFunction ltp_get_statuses_fn;
+	WriteResultsFunction ltp_write_results_fn;
+} LoadTestPlugin;
+
+
+/*
+ * A growable array of latencies in nanoseconds.
+ */
+typedef struct LatencySamples
+{
+	uint64 *ls_values_p;
+	size_t ls_num_values;
+	size_t ls_capacity;
+} LatencySamples;
+
+
+typedef enum LoadTestOperation
+{
+	LTO_RUN,
+	LTO_STATUS,
+	LTO_RESULTS,
+	LTO_REQUEST,
+	LTO_NUM_OPERATIONS
+} LoadTestOperation;
+
+
+static const char * const S_OPERATION_NAMES_SS [LTO_NUM_OPERATIONS] =
+{
+	"run",
+	"status",
+	"results",
+	"request"
+};
+
+
+/*
+ * Everything used by one of the client threads.
+ */
+typedef struct LoadTestClient
+{
+	const LoadTestConfig *ltcl_config_p;
+	const LoadTestPlugin *ltcl_plugin_p;
+	uint32 ltcl_index;
+	pthread_t ltcl_thread;
+	LatencySamples ltcl_samples [LTO_NUM_OPERATIONS];
+	uint64 ltcl_num_failures;
+	uint64 ltcl_num_timeouts;
+	uint64 ltcl_results_bytes;
+} LoadTestClient;
+
+
+/*
+ * One of the jobs in the in-memory JobsManager.
+ */
+typedef struct StoredJob
+{
+	uuid_t sj_id;
+	json_t *sj_json_p;
+	struct StoredJob *sj_next_p;
+} StoredJob;
+
+
+static StoredJob *s_store_pp [LT_NUM_STORE_BUCKETS];
+
+/*
+ * The Service used to rebuild the stored jobs. The Service that stored
+ * a job can be closed as soon as its request has finished, so this one is
+ * kept open for the whole run instead, in the same way that the server
+ * looks up a live Service for each job that it fetches.
+ */
+static Service *s_store_service_p = NULL;
+
+static pthread_mutex_t s_store_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64 s_num_stored_jobs = 0;
+
+
+/* The number of requests that have finished, updated atomically. */
+static uint64 s_num_requests = 0;
+
+static uint64 s_num_jobs = 0;
+
+static volatile bool s_stop_flag = false;
+
+
+static uint64 GetTimeInNanoseconds (void);
+
+static void SleepUntil (const uint64 time_ns);
+
+static uint64 GetResidentSetSize (void);
+
+static bool AddLatencySample (LatencySamples *samples_p, const uint64 value);
+
+static uint64 GetLatencyPercentile (const LatencySamples *samples_p, const uint32 percentile);
+
+static int CompareLatencies (const void *v0_p, const void *v1_p);
+
+static uint32 GetStoreBucket (const uuid_t id);
+
+static bool ParseLoadTestConfig (LoadTestConfig *config_p, int argc, char *argv []);
+
+static bool LoadPlugin (LoadTestPlugin *plugin_p, const char *path_s);
+
+static void *RunLoadTestClient (void *data_p);
+
+static bool RunLoadTestRequest (LoadTestClient *client_p, const uint64 scheduled_ns);
+
+static bool RunLoadTestServiceRequest (LoadTestClient *client_p, Service *service_p, const uint64 scheduled_ns);
+
+static void CloseLoadTestService (const LoadTestPlugin *plugin_p, ServicesArray *services_p);
+
+static bool SetRequestParameters (const LoadTestConfig *config_p, ParameterSet *params_p);
+
+static bool WaitForJobs (LoadTestClient *client_p, Service *service_p, uuid_t *ids_p, const uint32 num_jobs);
+
+static bool CountResultsBytes (const char *data_s, const size_t length, void *writer_data_p);
+
+static void PrintLoadTestReport (LoadTestClient *clients_p, const uint32 num_clients, const uint64 elapsed_ns);
+
+
+
+/*
+ * JOBSMANAGER
+ *
+ * These replace the server's JobsManager. The jobs are kept as JSON,
+ * converted with the Service's own callbacks, the same way that the
+ * server stores them. The callbacks are called without s_store_lock held,
+ * since rebuilding a job can lead back into the store.
+ */
+
+JobsManager *GetJobsManager (GrassrootsServer * UNUSED_PARAM (grassroots_p))
+{
+	return NULL;
+}
+
+
+bool AddServiceJobToJobsManager (JobsManager * UNUSED_PARAM (manager_p), uuid_t job_key, ServiceJob *job_p)
+{
+	Service *service_p = job_p -> sj_service_p;
+	json_t *job_json_p = service_p -> se_serialise_job_json_fn (service_p, job_p, false);
+
+	if (job_json_p)
+		{
+			const uint32 bucket = GetStoreBucket (job_key);
+			StoredJob *stored_p = NULL;
+
+			pthread_mutex_lock (&s_store_lock);
+
+			stored_p = s_store_pp [bucket];
+
+			while (stored_p && (memcmp (stored_p -> sj_id, job_key, sizeof (uuid_t)) != 0))
+				{
+					stored_p = stored_p -> sj_next_p;
+				}
+
+			if (stored_p)
+				{
+					json_decref (stored_p -> sj_json_p);
+				}
+			else
+				{
+					stored_p = (StoredJob *) malloc (sizeof (StoredJob));
+
+					if (!stored_p)
+						{
+							pthread_mutex_unlock (&s_store_lock);
+							json_decref (job_json_p);
+
+							return false;
+						}
+
+					memcpy (stored_p -> sj_id, job_key, sizeof (uuid_t));
+					stored_p -> sj_next_p = s_store_pp [bucket];
+					s_store_pp [bucket] = stored_p;
+
+					++ s_num_stored_jobs;
+				}
+
+			stored_p -> sj_json_p = job_json_p;
+
+			pthread_mutex_unlock (&s_store_lock);
+
+			return true;
+		}
+
+	return false;
+}
+
+
+ServiceJob *GetServiceJobFromJobsManager (JobsManager * UNUSED_PARAM (manager_p), const uuid_t job_key)
+{
+	ServiceJob *job_p = NULL;
+	StoredJob *stored_p = NULL;
+	json_t *job_json_p = NULL;
+
+	pthread_mutex_lock (&s_store_lock);
+
+	stored_p = s_store_pp [GetStoreBucket (job_key)];
+
+	while (stored_p && (memcmp (stored_p -> sj_id, job_key, sizeof (uuid_t)) != 0))
+		{
+			stored_p = stored_p -> sj_next_p;
+		}
+
+	/* Keep the JSON alive in case the job is replaced or removed while it is being rebuilt */
+	if (stored_p)
+		{
+			job_json_p = json_incref (stored_p -> sj_json_p);
+		}
+
+	pthread_mutex_unlock (&s_store_lock);
+
+	if (job_json_p)
+		{
+			job_p = s_store_service_p -> se_deserialise_job_json_fn (s_store_service_p, job_json_p);
+			json_decref (job_json_p);
+		}
+
+	return job_p;
+}
+
+
+ServiceJob *RemoveServiceJobFromJobsManager (JobsManager * UNUSED_PARAM (manager_p), const uuid_t job_key, bool get_job_flag)
+{
+	ServiceJob *job_p = NULL;
+	const uint32 bucket = GetStoreBucket (job_key);
+	StoredJob **stored_pp = NULL;
+	StoredJob *stored_p = NULL;
+
+	pthread_mutex_lock (&s_store_lock);
+
+	stored_pp = s_store_pp + bucket;
+
+	while (*stored_pp && (memcmp ((*stored_pp) -> sj_id, job_key, sizeof (uuid_t)) != 0))
+		{
+			stored_pp = & ((*stored_pp) -> sj_next_p);
+		}
+
+	if (*stored_pp)
+		{
+			stored_p = *stored_pp;
+			*stored_pp = stored_p -> sj_next_p;
+
+			-- s_num_stored_jobs;
+		}
+
+	pthread_mutex_unlock (&s_store_lock);
+
+	if (stored_p)
+		{
+			if (get_job_flag)
+				{
+					job_p = s_store_service_p -> se_deserialise_job_json_fn (s_store_service_p, stored_p -> sj_json_p);
+				}
+
+			json_decref (stored_p -> sj_json_p);
+			free (stored_p);
+		}
+
+	return job_p;
+}
+
+
+static uint32 GetStoreBucket (const uuid_t id)
+{
+	/* The ids are random so their first bytes are already well spread */
+	return (((uint32) id [0]) | (((uint32) id [1]) << 8)) % LT_NUM_STORE_BUCKETS;
+}
+
+
+/*
+ * TIMING AND MEMORY
+ */
+
+static uint64 GetTimeInNanoseconds (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return ((uint64) ts.tv_sec) * 1000000000ULL + (uint64) ts.tv_nsec;
+}
+
+
+static void SleepUntil (const uint64 time_ns)
+{
+	const uint64 now = GetTimeInNanoseconds ();
+
+	if (time_ns > now)
+		{
+			const uint64 wait_ns = time_ns - now;
+			struct timespec ts;
+
+			ts.tv_sec = (time_t) (wait_ns / 1000000000ULL);
+			ts.tv_nsec = (long) (wait_ns % 1000000000ULL);
+
+			nanosleep (&ts, NULL);
+		}
+}
+
+
+/*
+ * Get the resident set size in bytes from /proc, or 0 if it isn't available.
+ */
+static uint64 GetResidentSetSize (void)
+{
+	uint64 rss = 0;
+	FILE *statm_f = fopen ("/proc/self/statm", "r");
+
+	if (statm_f)
+		{
+			unsigned long size;
+			unsigned long resident;
+
+			if (fscanf (statm_f, "%lu %lu", &size, &resident) == 2)
+				{
+					rss = ((uint64) resident) * ((uint64) sysconf (_SC_PAGESIZE));
+				}
+
+			fclose (statm_f);
+		}
+
+	return rss;
+}
+
+
+static bool AddLatencySample (LatencySamples *samples_p, const uint64 value)
+{
+	if (samples_p -> ls_num_values == samples_p -> ls_capacity)
+		{
+			const size_t new_capacity = (samples_p -> ls_capacity) ? (samples_p -> ls_capacity) << 1 : 1024;
+			uint64 *values_p = (uint64 *) realloc (samples_p -> ls_values_p, new_capacity * sizeof (uint64));
+
+			if (!values_p)
+				{
+					return false;
+				}
+
+			samples_p -> ls_values_p = values_p;
+			samples_p -> ls_capacity = new_capacity;
+		}
+
+	samples_p -> ls_values_p [samples_p -> ls_num_values] = value;
+	++ (samples_p -> ls_num_values);
+
+	return true;
+}
+
+
+/*
+ * This must only be called once the samples have been sorted.
+ */
+static uint64 GetLatencyPercentile (const LatencySamples *samples_p, const uint32 percentile)
+{
+	if (samples_p -> ls_num_values > 0)
+		{
+			size_t i = ((samples_p -> ls_num_values) * percentile) / 100;
+
+			if (i >= samples_p -> ls_num_values)
+				{
+					i = samples_p -> ls_num_values - 1;
+				}
+
+			return samples_p -> ls_values_p [i];
+		}
+
+	return 0;
+}
+
+
+static int CompareLatencies (const void *v0_p, const void *v1_p)
+{
+	const uint64 l0 = * ((const uint64 *) v0_p);
+	const uint64 l1 = * ((const uint64 *) v1_p);
+
+	return (l0 < l1) ? -1 : ((l0 > l1) ? 1 : 0);
+}
+
+
+/*
+ * THE CLIENTS
+ */
+
+static void *RunLoadTestClient (void *data_p)
+{
+	LoadTestClient *client_p = (LoadTestClient *) data_p;
+	const LoadTestConfig *config_p = client_p -> ltcl_config_p;
+	const uint64 start_ns = GetTimeInNanoseconds ();
+	const uint64 end_ns = start_ns + ((uint64) (config_p -> ltc_duration)) * 1000000000ULL;
+	uint64 interval_ns = 0;
+	uint64 scheduled_ns;
+
+	/*
+	 * Spread the total rate over the clients and stagger their starts
+	 * so the requests arrive evenly rather than in bursts.
+	 */
+	if (config_p -> ltc_request_rate > 0.0)
+		{
+			interval_ns = (uint64) (1000000000.0 * (config_p -> ltc_num_clients) / (config_p -> ltc_request_rate));
+		}
+
+	scheduled_ns = start_ns + (interval_ns * (client_p -> ltcl_index)) / (config_p -> ltc_num_clients);
+
+	while ((!s_stop_flag) && (scheduled_ns < end_ns))
+		{
+			SleepUntil (scheduled_ns);
+
+			if (!RunLoadTestRequest (client_p, scheduled_ns))
+				{
+					++ (client_p -> ltcl_num_failures);
+				}
+
+			/*
+			 * A closed loop keeps going as fast as it can. In an open one,
+			 * a late request is timed from when it should have been sent
+			 * so that falling behind shows up in the latencies.
+			 */
+			scheduled_ns = interval_ns ? scheduled_ns + interval_ns : GetTimeInNanoseconds ();
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Handle a single request in the same way that the server does, getting
+ * a new Service for it and then closing and releasing that Service once
+ * the response has been written.
+ */
+static bool RunLoadTestRequest (LoadTestClient *client_p, const uint64 scheduled_ns)
+{
+	bool success_flag = false;
+	ServicesArray *services_p = client_p -> ltcl_plugin_p -> ltp_get_services_fn (NULL, NULL);
+
+	if (services_p)
+		{
+			success_flag = RunLoadTestServiceRequest (client_p, * (services_p -> sa_services_pp), scheduled_ns);
+
+			CloseLoadTestService (client_p -> ltcl_plugin_p, services_p);
+		}
+	else
+		{
+			fprintf (stderr, "Client " UINT32_FMT " failed to get the service\n", client_p -> ltcl_index);
+		}
+
+	return success_flag;
+}
+
+
+static void CloseLoadTestService (const LoadTestPlugin *plugin_p, ServicesArray *services_p)
+{
+	Service *service_p = * (services_p -> sa_services_pp);
+
+	/* The server keeps calling this until the Service's jobs have all finished */
+	while (!CloseService (service_p))
+		{
+			SleepUntil (GetTimeInNanoseconds () + 100000000ULL);
+		}
+
+	plugin_p -> ltp_release_services_fn (services_p);
+}
+
+
+static bool RunLoadTestServiceRequest (LoadTestClient *client_p, Service *service_p, const uint64 scheduled_ns)
+{
+	bool success_flag = false;
+	ParameterSet *params_p = GetServiceParameters (service_p, NULL, NULL);
+
+	if (params_p)
+		{
+			/*
+			 * This can be the Service's shared ParameterSet, but since each
+			 * request has its own Service nothing else sees the changed values.
+			 */
+			if (SetRequestParameters (client_p -> ltcl_config_p, params_p))
+				{
+					uint64 t = GetTimeInNanoseconds ();
+					ServiceJobSet *jobs_p = RunService (service_p, params_p, NULL, NULL);
+
+					AddLatencySample (& (client_p -> ltcl_samples [LTO_RUN]), GetTimeInNanoseconds () - t);
+
+					if (jobs_p)
+						{
+							uint32 num_jobs = 0;
+							const uint32 max_jobs = client_p -> ltcl_config_p -> ltc_jobs_per_request;
+							uuid_t *ids_p = (uuid_t *) malloc (max_jobs * sizeof (uuid_t));
+
+							if (ids_p)
+								{
+									ServiceJobSetIterator iterator;
+									ServiceJob *job_p = NULL;
+
+									InitServiceJobSetIterator (&iterator, jobs_p);
+									job_p = GetNextServiceJobFromServiceJobSetIterator (&iterator);
+
+									/* A request that was submitted in the background has a single job */
+									while (job_p && (num_jobs < max_jobs))
+										{
+											memcpy (ids_p [num_jobs], job_p -> sj_id, sizeof (uuid_t));
+											++ num_jobs;
+
+											job_p = GetNextServiceJobFromServiceJobSetIterator (&iterator);
+										}
+
+									if (WaitForJobs (client_p, service_p, ids_p, num_jobs))
+										{
+											t = GetTimeInNanoseconds ();
+											success_flag = client_p -> ltcl_plugin_p -> ltp_write_results_fn (service_p, CountResultsBytes, client_p);
+											AddLatencySample (& (client_p -> ltcl_samples [LTO_RESULTS]), GetTimeInNanoseconds () - t);
+										}
+
+									free (ids_p);
+								}
+
+							/* The server frees each request's jobs once it has sent the response */
+							FreeServiceJobSet (jobs_p);
+							service_p -> se_jobs_p = NULL;
+
+							__atomic_add_fetch (&s_num_jobs, num_jobs, __ATOMIC_RELAXED);
+						}
+				}
+			else
+				{
+					fprintf (stderr, "Failed to set the parameters for a request\n");
+				}
+
+			ReleaseServiceParameters (service_p, params_p);
+		}
+
+	if (success_flag)
+		{
+			AddLatencySample (& (client_p -> ltcl_samples [LTO_REQUEST]), GetTimeInNanoseconds () - scheduled_ns);
+			__atomic_add_fetch (&s_num_requests, 1, __ATOMIC_RELAXED);
+		}
+
+	return success_flag;
+}
+
+
+static bool SetRequestParameters (const LoadTestConfig *config_p, ParameterSet *params_p)
+{
+	const bool ms_flag = true;
+	Parameter *param_p = GetParameterFromParameterSetByName (params_p, S_NUMBER_OF_JOBS_S);
+
+	if (! (param_p && SetUnsignedIntParameterCurrentValue ((UnsignedIntParameter *) param_p, & (config_p -> ltc_jobs_per_request))))
+		{
+			return false;
+		}
+
+	param_p = GetParameterFromParameterSetByName (params_p, S_MIN_DURATION_S);
+
+	if (! (param_p && SetSignedIntParameterCurrentValue ((SignedIntParameter *) param_p, & (config_p -> ltc_min_duration))))
+		{
+			return false;
+		}
+
+	param_p = GetParameterFromParameterSetByName (params_p, S_MILLISECOND_DURATIONS_S);
+
+	if (! (param_p && SetBooleanParameterCurrentValue ((BooleanParameter *) param_p, &ms_flag)))
+		{
+			return false;
+		}
+
+	param_p = GetParameterFromParameterSetByName (params_p, S_JOB_KIND_S);
+
+	if (! (param_p && SetStringParameterCurrentValue ((StringParameter *) param_p, config_p -> ltc_kind_s)))
+		{
+			return false;
+		}
+
+	return true;
+}
+
+
+/*
+ * Poll the statuses of a request's jobs, the way that a client of the
+ * server would, until none of them are still waiting or running.
+ */
+static bool WaitForJobs (LoadTestClient *client_p, Service *service_p, uuid_t *ids_p, const uint32 num_jobs)
+{
+	OperationStatus *statuses_p = (OperationStatus *) malloc (num_jobs * sizeof (OperationStatus));
+
+	if (statuses_p)
+		{
+			const uint64 poll_interval_ns = ((uint64) (client_p -> ltcl_config_p -> ltc_poll_interval_ms)) * 1000000ULL;
+			const uint64 give_up_ns = GetTimeInNanoseconds () + LT_MAX_WAIT_SECONDS * 1000000000ULL;
+			bool finished_flag = false;
+
+			while (!finished_flag)
+				{
+					const uint64 t = GetTimeInNanoseconds ();
+					uint32 i;
+
+					client_p -> ltcl_plugin_p -> ltp_get_statuses_fn (service_p, (const uuid_t *) ids_p, num_jobs, statuses_p);
+					AddLatencySample (& (client_p -> ltcl_samples [LTO_STATUS]), GetTimeInNanoseconds () - t);
+
+					finished_flag = true;
+
+					for (i = 0; i < num_jobs; ++ i)
+						{
+							if ((statuses_p [i] == OS_PENDING) || (statuses_p [i] == OS_STARTED))
+								{
+									finished_flag = false;
+									break;
+								}
+						}
+
+					if (!finished_flag)
+						{
+							if (t > give_up_ns)
+								{
+									++ (client_p -> ltcl_num_timeouts);
+									break;
+								}
+
+							SleepUntil (t + poll_interval_ns);
+						}
+				}
+
+			free (statuses_p);
+
+			return finished_flag;
+		}
+
+	return false;
+}
+
+
+static bool CountResultsBytes (const char * UNUSED_PARAM (data_s), const size_t length, void *writer_data_p)
+{
+	LoadTestClient *client_p = (LoadTestClient *) writer_data_p;
+
+	client_p -> ltcl_results_bytes += length;
+
+	return true;
+}
+
+
+/*
+ * SETUP AND REPORTING
+ */
+
+static bool ParseLoadTestConfig (LoadTestConfig *config_p, int argc, char *argv [])
+{
+	int c;
+
+	config_p -> ltc_plugin_s = "./liblong_running_service.so";
+	config_p -> ltc_num_clients = 4;
+	config_p -> ltc_request_rate = 0.0;
+	config_p -> ltc_duration = 30;
+	config_p -> ltc_jobs_per_request = 10;
+	config_p -> ltc_min_duration = 1;
+	config_p -> ltc_kind_s = "sleep";
+	config_p -> ltc_poll_interval_ms = 10;
+	config_p -> ltc_report_interval = 1;
+
+	while ((c = getopt (argc, argv, "p:c:r:d:n:m:k:s:i:")) != -1)
+		{
+			switch (c)
+				{
+					case 'p':
+						config_p -> ltc_plugin_s = optarg;
+						break;
+
+					case 'c':
+						config_p -> ltc_num_clients = (uint32) strtoul (optarg, NULL, 10);
+						break;
+
+					case 'r':
+						config_p -> ltc_request_rate = strtod (optarg, NULL);
+						break;
+
+					case 'd':
+						config_p -> ltc_duration = (uint32) strtoul (optarg, NULL, 10);
+						break;
+
+					case 'n':
+						config_p -> ltc_jobs_per_request = (uint32) strtoul (optarg, NULL, 10);
+						break;
+
+					case 'm':
+						config_p -> ltc_min_duration = (int32) strtol (optarg, NULL, 10);
+						break;
+
+					case 'k':
+						config_p -> ltc_kind_s = optarg;
+						break;
+
+					case 's':
+						config_p -> ltc_poll_interval_ms = (uint32) strtoul (optarg, NULL, 10);
+						break;
+
+					case 'i':
+						config_p -> ltc_report_interval = (uint32) strtoul (optarg, NULL, 10);
+						break;
+
+					default:
+						return false;
+				}
+		}
+
+	if ((config_p -> ltc_num_clients == 0) || (config_p -> ltc_jobs_per_request == 0) || (config_p -> ltc_report_interval == 0))
+		{
+			return false;
+		}
+
+	return true;
+}
+
+
+static bool LoadPlugin (LoadTestPlugin *plugin_p, const char *path_s)
+{
+	memset (plugin_p, 0, sizeof (LoadTestPlugin));
+
+	plugin_p -> ltp_handle_p = dlopen (path_s, RTLD_NOW | RTLD_LOCAL);
+
+	if (plugin_p -> ltp_handle_p)
+		{
+			plugin_p -> ltp_get_services_fn = (GetServicesFunction) dlsym (plugin_p -> ltp_handle_p, "GetServices");
+			plugin_p -> ltp_release_services_fn = (ReleaseServicesFunction) dlsym (plugin_p -> ltp_handle_p, "ReleaseServices");
+			plugin_p -> ltp_get_statuses_fn = (GetStatusesFunction) dlsym (plugin_p -> ltp_handle_p, "GetLongRunningServiceStatuses");
+			plugin_p -> ltp_write_results_fn = (WriteResultsFunction) dlsym (plugin_p -> ltp_handle_p, "WriteLongRunningResults");
+
+			if ((plugin_p -> ltp_get_services_fn) && (plugin_p -> ltp_release_services_fn) && (plugin_p -> ltp_get_statuses_fn) && (plugin_p -> ltp_write_results_fn))
+				{
+					return true;
+				}
+
+			fprintf (stderr, "\"%s\" is missing some of the service's functions\n", path_s);
+			dlclose (plugin_p -> ltp_handle_p);
+		}
+	else
+		{
+			fprintf (stderr, "Failed to load \"%s\": %s\n", path_s, dlerror ());
+		}
+
+	return false;
+}
+
+
+static void PrintLoadTestReport (LoadTestClient *clients_p, const uint32 num_clients, const uint64 elapsed_ns)
+{
+	const double elapsed_s = ((double) elapsed_ns) / 1000000000.0;
+	uint64 num_failures = 0;
+	uint64 num_timeouts = 0;
+	uint64 results_bytes = 0;
+	uint32 i;
+	int op;
+
+	for (i = 0; i < num_clients; ++ i)
+		{
+			num_failures += clients_p [i].ltcl_num_failures;
+			num_timeouts += clients_p [i].ltcl_num_timeouts;
+			results_bytes += clients_p [i].ltcl_results_bytes;
+		}
+
+	printf ("\n%-10s %10s %12s %12s %12s\n", "operation", "count", "p50 us", "p99 us", "max us");
+
+	for (op = 0; op < LTO_NUM_OPERATIONS; ++ op)
+		{
+			LatencySamples all;
+
+			memset (&all, 0, sizeof (LatencySamples));
+
+			for (i = 0; i < num_clients; ++ i)
+				{
+					const LatencySamples *samples_p = & (clients_p [i].ltcl_samples [op]);
+					size_t j;
+
+					for (j = 0; j < samples_p -> ls_num_values; ++ j)
+						{
+							AddLatencySample (&all, samples_p -> ls_values_p [j]);
+						}
+				}
+
+			qsort (all.ls_values_p, all.ls_num_values, sizeof (uint64), CompareLatencies);
+
+			printf ("%-10s %10lu %12.1f %12.1f %12.1f\n", S_OPERATION_NAMES_SS [op], (unsigned long) all.ls_num_values,
+				(double) GetLatencyPercentile (&all, 50) / 1000.0,
+				(double) GetLatencyPercentile (&all, 99) / 1000.0,
+				(double) GetLatencyPercentile (&all, 100) / 1000.0);
+
+			free (all.ls_values_p);
+		}
+
+	printf ("\nrequests: %lu in %.1fs, %.1f/s\n", (unsigned long) s_num_requests, elapsed_s, ((double) s_num_requests) / elapsed_s);
+	printf ("jobs: %lu, %.1f/s\n", (unsigned long) s_num_jobs, ((double) s_num_jobs) / elapsed_s);
+	printf ("failures: %lu, timeouts: %lu, results bytes: %lu\n", (unsigned long) num_failures, (unsigned long) num_timeouts, (unsigned long) results_bytes);
+	printf ("rss: %.1fMB, jobs still stored: %lu\n", ((double) GetResidentSetSize ()) / (1024.0 * 1024.0), (unsigned long) s_num_stored_jobs);
+}
+
+
+int main (int argc, char *argv [])
+{
+	LoadTestConfig config;
+	LoadTestPlugin plugin;
+	LoadTestClient *clients_p = NULL;
+	ServicesArray *store_services_p = NULL;
+	uint64 start_ns;
+	uint64 elapsed_ns;
+	uint32 num_started = 0;
+	uint32 i;
+
+	if (!ParseLoadTestConfig (&config, argc, argv))
+		{
+			fprintf (stderr, "usage: %s [-p <plugin>] [-c <clients>] [-r <requests per second>] [-d <seconds>] [-n <jobs per request>] [-m <minimum duration in ms>] [-k <job kind>] [-s <status poll interval in ms>] [-i <report interval in seconds>]\n", argv [0]);
+			return 1;
+		}
+
+	if (!LoadPlugin (&plugin, config.ltc_plugin_s))
+		{
+			return 1;
+		}
+
+	store_services_p = plugin.ltp_get_services_fn (NULL, NULL);
+
+	if (!store_services_p)
+		{
+			fprintf (stderr, "Failed to get the service for the job store\n");
+			return 1;
+		}
+
+	s_store_service_p = * (store_services_p -> sa_services_pp);
+
+	clients_p = (LoadTestClient *) calloc (config.ltc_num_clients, sizeof (LoadTestClient));
+
+	if (!clients_p)
+		{
+			fprintf (stderr, "Failed to allocate " UINT32_FMT " clients\n", config.ltc_num_clients);
+			return 1;
+		}
+
+	start_ns = GetTimeInNanoseconds ();
+
+	for (i = 0; i < config.ltc_num_clients; ++ i)
+		{
+			LoadTestClient *client_p = clients_p + i;
+
+			client_p -> ltcl_config_p = &config;
+			client_p -> ltcl_plugin_p = &plugin;
+			client_p -> ltcl_index = i;
+
+			if (pthread_create (& (client_p -> ltcl_thread), NULL, RunLoadTestClient, client_p) == 0)
+				{
+					++ num_started;
+				}
+			else
+				{
+					fprintf (stderr, "Failed to start client " UINT32_FMT "\n", i);
+					break;
+				}
+		}
+
+	if (num_started == config.ltc_num_clients)
+		{
+			const uint64 end_ns = start_ns + ((uint64) config.ltc_duration) * 1000000000ULL;
+			uint64 report_ns = start_ns;
+			uint64 last_requests = 0;
+
+			printf ("%8s %10s %10s %10s %12s\n", "time s", "requests", "req/s", "rss MB", "stored jobs");
+
+			/* Report the progress until the clients have stopped sending */
+			while (report_ns < end_ns)
+				{
+					uint64 num_requests;
+
+					report_ns += ((uint64) config.ltc_report_interval) * 1000000000ULL;
+					SleepUntil (report_ns);
+
+					num_requests = __atomic_load_n (&s_num_requests, __ATOMIC_RELAXED);
+
+					pthread_mutex_lock (&s_store_lock);
+					printf ("%8.1f %10lu %10.1f %10.1f %12lu\n", ((double) (report_ns - start_ns)) / 1000000000.0, (unsigned long) num_requests,
+						((double) (num_requests - last_requests)) / ((double) config.ltc_report_interval),
+						((double) GetResidentSetSize ()) / (1024.0 * 1024.0), (unsigned long) s_num_stored_jobs);
+					pthread_mutex_unlock (&s_store_lock);
+
+					last_requests = num_requests;
+				}
+		}
+	else
+		{
+			s_stop_flag = true;
+		}
+
+	for (i = 0; i < num_started; ++ i)
+		{
+			pthread_join (clients_p [i].ltcl_thread, NULL);
+		}
+
+	elapsed_ns = GetTimeInNanoseconds () - start_ns;
+
+	PrintLoadTestReport (clients_p, num_started, elapsed_ns);
+
+	/* This is the last Service, so closing it also waits for any jobs left from the clients' Services */
+	CloseLoadTestService (&plugin, store_services_p);
+
+	for (i = 0; i < config.ltc_num_clients; ++ i)
+		{
+			int op;
+
+			for (op = 0; op < LTO_NUM_OPERATIONS; ++ op)
+				{
+					free (clients_p [i].ltcl_samples [op].ls_values_p);
+				}
+		}
+
+	free (clients_p);
+
+	/*
+	 * The plugin isn't unloaded since the JobsManager's stored jobs can only
+	 * be rebuilt with its callbacks.
+	 */
+	return 0;
+}
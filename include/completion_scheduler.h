@@ -0,0 +1,184 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief A timer wheel that calls back when jobs reach their end times.
+ */
+
+#ifndef COMPLETION_SCHEDULER_H
+#define COMPLETION_SCHEDULER_H
+
+#include <time.h>
+
+#include <pthread.h>
+
+#include "long_running_service.h"
+
+
+/**
+ * The callback that a CompletionScheduler calls for each job when its
+ * end time has passed. This is called on the CompletionScheduler's own
+ * thread without any of its locks held.
+ *
+ * @param job_id The id of the job that has finished.
+ * @param start The time that the job started in nanoseconds since the epoch.
+ * @param end The time that the job finished in nanoseconds since the epoch.
+ * @param callback_data_p The custom data passed to InitCompletionScheduler ().
+ * @ingroup example_service
+ */
+typedef void (*CompletionSchedulerCallback) (const uuid_t job_id, const int64 start, const int64 end, void *callback_data_p);
+
+
+/**
+ * A job that is waiting to finish.
+ *
+ * @ingroup example_service
+ */
+typedef struct CompletionTimer
+{
+	/** The id of the job. */
+	uuid_t ct_id;
+
+	/** The time that the job started, in nanoseconds since the epoch. */
+	int64 ct_start;
+
+	/** The time that the job finishes, in nanoseconds since the epoch. */
+	int64 ct_end;
+
+	/**
+	 * The number of times that the wheel needs to go all of the way
+	 * round before this timer is due.
+	 */
+	uint32 ct_rounds;
+
+	/** The next timer in the same slot. */
+	struct CompletionTimer *ct_next_p;
+} CompletionTimer;
+
+
+/**
+ * A hashed timer wheel with one slot for each second. Each timer is placed
+ * in the slot for its end time so that every second, only the timers in a
+ * single slot need to be looked at regardless of how many jobs are running.
+ * A background thread turns the wheel and calls the callback for each timer
+ * as it becomes due.
+ *
+ * @ingroup example_service
+ */
+typedef struct CompletionScheduler
+{
+	/** The timers in each slot. */
+	CompletionTimer **cs_slots_pp;
+
+	/** The number of slots in the wheel. */
+	uint32 cs_num_slots;
+
+	/** The number of timers that have not become due yet. */
+	uint32 cs_num_timers;
+
+	/** The timers that have been used and can be reused. */
+	CompletionTimer *cs_free_timers_p;
+
+	/**
+	 * The last second, from GetJobClockTime (), that the wheel has
+	 * been turned up to.
+	 */
+	time_t cs_current_time;
+
+	/** The function to call when a timer becomes due. */
+	CompletionSchedulerCallback cs_callback_fn;
+
+	/** The custom data to pass to cs_callback_fn. */
+	void *cs_callback_data_p;
+
+	/** The thread that turns the wheel. */
+	pthread_t cs_thread;
+
+	/** The lock protecting all of the above. */
+	pthread_mutex_t cs_lock;
+
+	/** Used to wake the thread up when it needs to stop. */
+	pthread_cond_t cs_wake_up;
+
+	/** Should the thread stop? */
+	bool cs_stop_flag;
+} CompletionScheduler;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Initialise a CompletionScheduler and start its thread.
+ *
+ * @param scheduler_p The CompletionScheduler to initialise.
+ * @param num_slots The number of slots in the wheel. Timers further in the future
+ * than this number of seconds still work but they are looked at once more each
+ * time that the wheel goes round.
+ * @param callback_fn The function to call when each timer becomes due.
+ * @param callback_data_p The custom data to pass to callback_fn.
+ * @return <code>true</code> if the CompletionScheduler was initialised successfully,
+ * <code>false</code> otherwise.
+ * @memberof CompletionScheduler
+ */
+LONG_RUNNING_SERVICE_LOCAL bool InitCompletionScheduler (CompletionScheduler *scheduler_p, const uint32 num_slots, CompletionSchedulerCallback callback_fn, void *callback_data_p);
+
+
+/**
+ * Stop a CompletionScheduler's thread and free all of its timers. Any timers
+ * that have not become due are discarded without calling the callback.
+ *
+ * @param scheduler_p The CompletionScheduler to clear.
+ * @memberof CompletionScheduler
+ */
+LONG_RUNNING_SERVICE_LOCAL void ClearCompletionScheduler (CompletionScheduler *scheduler_p);
+
+
+/**
+ * Add a timer for a job. If the job's end time has already passed, the
+ * callback will be called the next time that the wheel turns.
+ *
+ * @param scheduler_p The CompletionScheduler to add the timer to.
+ * @param job_id The id of the job.
+ * @param start The time that the job started in nanoseconds since the epoch.
+ * @param end The time that the job finishes in nanoseconds since the epoch.
+ * @return <code>true</code> if the timer was added successfully,
+ * <code>false</code> otherwise.
+ * @memberof CompletionScheduler
+ */
+LONG_RUNNING_SERVICE_LOCAL bool ScheduleJobCompletion (CompletionScheduler *scheduler_p, const uuid_t job_id, const int64 start, const int64 end);
+
+
+/**
+ * Get the number of timers that have not yet become due.
+ *
+ * @param scheduler_p The CompletionScheduler to check.
+ * @return The number of timers.
+ * @memberof CompletionScheduler
+ */
+LONG_RUNNING_SERVICE_LOCAL uint32 GetNumScheduledCompletions (CompletionScheduler *scheduler_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef COMPLETION_SCHEDULER_H */
@@ -0,0 +1,161 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief A min-heap of job deadlines.
+ */
+
+#ifndef DEADLINE_HEAP_H
+#define DEADLINE_HEAP_H
+
+#include <time.h>
+
+#include "long_running_service.h"
+
+
+/**
+ * A min-heap of the end times of the jobs that a Service has started.
+ * The earliest deadline is always at the top so the deadlines that have
+ * passed can be discarded cheaply, leaving only those for jobs that are
+ * still running.
+ *
+ * A DeadlineHeap is not thread-safe, callers must provide their own locking
+ * if it is shared between threads.
+ *
+ * @ingroup example_service
+ */
+typedef struct DeadlineHeap
+{
+	/** The deadlines, stored as an implicit binary heap. */
+	time_t *dh_deadlines_p;
+
+	/** The number of deadlines currently in the heap. */
+	uint32 dh_size;
+
+	/** The number of deadlines that dh_deadlines_p has space for. */
+	uint32 dh_capacity;
+
+	/** The latest deadline that has been added to the heap. */
+	time_t dh_latest;
+} DeadlineHeap;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Initialise a DeadlineHeap.
+ *
+ * @param heap_p The DeadlineHeap to initialise.
+ * @param initial_capacity The number of deadlines to reserve space for.
+ * @return <code>true</code> if the DeadlineHeap was initialised successfully,
+ * <code>false</code> otherwise.
+ * @memberof DeadlineHeap
+ */
+LONG_RUNNING_SERVICE_LOCAL bool InitDeadlineHeap (DeadlineHeap *heap_p, const uint32 initial_capacity);
+
+
+/**
+ * Free the memory used by a DeadlineHeap's deadlines.
+ *
+ * @param heap_p The DeadlineHeap to clear.
+ * @memberof DeadlineHeap
+ */
+LONG_RUNNING_SERVICE_LOCAL void ClearDeadlineHeap (DeadlineHeap *heap_p);
+
+
+/**
+ * Make sure that a DeadlineHeap has room for a number of additional deadlines
+ * so that adding them will not need any further allocations.
+ *
+ * @param heap_p The DeadlineHeap to expand.
+ * @param num_extra The number of additional deadlines.
+ * @return <code>true</code> if the DeadlineHeap has the required space,
+ * <code>false</code> otherwise.
+ * @memberof DeadlineHeap
+ */
+LONG_RUNNING_SERVICE_LOCAL bool ReserveDeadlineHeap (DeadlineHeap *heap_p, const uint32 num_extra);
+
+
+/**
+ * Add a deadline to a DeadlineHeap.
+ *
+ * @param heap_p The DeadlineHeap to add to.
+ * @param deadline The deadline to add.
+ * @return <code>true</code> if the deadline was added successfully,
+ * <code>false</code> otherwise.
+ * @memberof DeadlineHeap
+ */
+LONG_RUNNING_SERVICE_LOCAL bool AddToDeadlineHeap (DeadlineHeap *heap_p, const time_t deadline);
+
+
+/**
+ * Remove all of the deadlines that are before a given time.
+ *
+ * @param heap_p The DeadlineHeap to prune.
+ * @param now The time to compare the deadlines against.
+ * @return The number of deadlines that were removed.
+ * @memberof DeadlineHeap
+ */
+LONG_RUNNING_SERVICE_LOCAL uint32 RemoveExpiredDeadlines (DeadlineHeap *heap_p, const time_t now);
+
+
+/**
+ * Check whether a DeadlineHeap has any deadlines that have not yet passed.
+ * Since each deadline is only ever removed once, this is constant time
+ * when amortised over all of the calls.
+ *
+ * @param heap_p The DeadlineHeap to check.
+ * @param now The time to compare the deadlines against.
+ * @return <code>true</code> if there are any deadlines at or after now,
+ * <code>false</code> otherwise.
+ * @memberof DeadlineHeap
+ */
+LONG_RUNNING_SERVICE_LOCAL bool HasOutstandingDeadlines (DeadlineHeap *heap_p, const time_t now);
+
+
+/**
+ * Get the earliest outstanding deadline in a DeadlineHeap.
+ *
+ * @param heap_p The DeadlineHeap to check.
+ * @return The earliest deadline or 0 if the DeadlineHeap is empty.
+ * @memberof DeadlineHeap
+ */
+LONG_RUNNING_SERVICE_LOCAL time_t GetEarliestDeadline (const DeadlineHeap *heap_p);
+
+
+/**
+ * Get the latest deadline in a DeadlineHeap, i.e. when the last of the
+ * jobs will finish. Call RemoveExpiredDeadlines () or HasOutstandingDeadlines ()
+ * first to make sure that this is not a deadline that has already passed.
+ *
+ * @param heap_p The DeadlineHeap to check.
+ * @return The latest deadline or 0 if the DeadlineHeap is empty.
+ * @memberof DeadlineHeap
+ */
+LONG_RUNNING_SERVICE_LOCAL time_t GetLatestDeadline (const DeadlineHeap *heap_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef DEADLINE_HEAP_H */
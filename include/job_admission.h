@@ -0,0 +1,466 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief Limits on how many jobs can be requested and run at once.
+ */
+
+#ifndef JOB_ADMISSION_H
+#define JOB_ADMISSION_H
+
+#include <pthread.h>
+
+#include "long_running_service.h"
+#include "job_workers.h"
+
+
+/**
+ * What a JobAdmission decided to do with a request.
+ *
+ * @ingroup example_service
+ */
+typedef enum JobAdmissionResult
+{
+	/** The jobs can start straight away. */
+	JAR_ADMITTED,
+
+	/**
+	 * Starting the jobs now would go over one of the limits on the number
+	 * of jobs running at once, so they must wait to be started by the
+	 * JobAdmission once there is room.
+	 */
+	JAR_DEFERRED,
+
+	/**
+	 * The request can never be admitted, either because it is bigger than
+	 * one of the limits or too many jobs are already waiting.
+	 */
+	JAR_REJECTED
+} JobAdmissionResult;
+
+
+/**
+ * The details that a JobAdmission keeps for each job that it has deferred.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobAdmissionItem
+{
+	/** The id of the job. */
+	uuid_t jai_id;
+
+	/** The duration of the job in nanoseconds. */
+	int64 jai_duration;
+} JobAdmissionItem;
+
+
+/**
+ * The number of jobs that one user has admitted.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobAdmissionUser
+{
+	/** The user, or an empty string for the users that aren't known. */
+	char *jau_user_s;
+
+	/** The number of the user's jobs that are counted as running. */
+	uint32 jau_num_jobs;
+
+	/** The number of reservations for this user that still exist. */
+	uint32 jau_num_reservations;
+
+	/** The next user in the same hash bucket. */
+	struct JobAdmissionUser *jau_next_p;
+} JobAdmissionUser;
+
+
+/**
+ * A group of jobs that have been admitted together. The jobs are counted
+ * against the limits from when they are admitted until each of them has
+ * finished. As each job is started, it is added to the reservation with
+ * AddJobToReservation () and then stops being counted when it is passed
+ * to ReleaseAdmittedJob (). Any jobs that were never added stop being
+ * counted when the reservation is passed to FinishJobReservation ().
+ *
+ * @ingroup example_service
+ */
+typedef struct JobAdmissionReservation
+{
+	/** The user that requested the jobs. */
+	JobAdmissionUser *jar_user_p;
+
+	/** Do the jobs count against the workers' limit? */
+	bool jar_work_flag;
+
+	/** The number of jobs that are still counted. */
+	uint32 jar_num_jobs;
+
+	/** The number of jobs that have been added and not yet released. */
+	uint32 jar_num_added;
+
+	/** Has the reservation been passed to FinishJobReservation ()? */
+	bool jar_finished_flag;
+
+	/** The previous reservation that still exists. */
+	struct JobAdmissionReservation *jar_prev_p;
+
+	/** The next reservation that still exists. */
+	struct JobAdmissionReservation *jar_next_p;
+} JobAdmissionReservation;
+
+
+/**
+ * The callback that a JobAdmission uses to start a deferred request once
+ * there is room for it. This is called on the JobAdmission's own thread
+ * without any of its locks held.
+ *
+ * @param items_p The jobs to start.
+ * @param num_items The number of jobs in items_p.
+ * @param kind The kind of all of the jobs.
+ * @param reservation_p The reservation that the jobs are now counted in. This
+ * may be handed on, but each job must be added to it before it is started and
+ * it must be passed to FinishJobReservation () once all of them have been.
+ * @param callback_data_p The custom data passed to DeferJobs () for this request.
+ * @ingroup example_service
+ */
+typedef void (*JobAdmissionCallback) (const JobAdmissionItem *items_p, const uint32 num_items, const JobKind kind, JobAdmissionReservation *reservation_p, void *callback_data_p);
+
+
+/**
+ * A request whose jobs are waiting to be started.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobAdmissionRequest
+{
+	/** The user that requested the jobs, or an empty string if unknown. */
+	char *jarq_user_s;
+
+	/** The jobs to start. */
+	JobAdmissionItem *jarq_items_p;
+
+	/** The number of jobs in jarq_items_p. */
+	uint32 jarq_num_items;
+
+	/**
+	 * The number of jobs that the request is counted as. This is the same
+	 * as jarq_num_items unless a single item stands for a whole request
+	 * whose jobs haven't been built yet.
+	 */
+	uint32 jarq_num_jobs;
+
+	/** The kind of all of the jobs. */
+	JobKind jarq_kind;
+
+	/** The custom data to pass to the callback when the request is started. */
+	void *jarq_callback_data_p;
+
+	/** The next request in the queue. */
+	struct JobAdmissionRequest *jarq_next_p;
+} JobAdmissionRequest;
+
+
+/**
+ * An entry in a JobAdmission's table of job ids. Each one is either a
+ * deferred job or a job that has been added to a reservation.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobAdmissionJob
+{
+	/** The id of the job. */
+	uuid_t jaj_id;
+
+	/**
+	 * The reservation that the job was added to, or <code>NULL</code> if
+	 * the job is deferred.
+	 */
+	JobAdmissionReservation *jaj_reservation_p;
+
+	/** The number of jobs that this job is counted as. */
+	uint32 jaj_num_jobs;
+
+	/** Is this entry in use? */
+	bool jaj_used_flag;
+} JobAdmissionJob;
+
+
+/**
+ * This decides whether each request for jobs can start straight away,
+ * has to wait or should be refused. Requests that have to wait are
+ * started in the order that they arrived by a background thread as the
+ * earlier jobs finish.
+ *
+ * A job is counted as running from when it is admitted until it is passed
+ * to ReleaseAdmittedJob () once it has finished. The counts are kept as
+ * running totals, with a table of the users' counts and a table of the job
+ * ids, so none of the checks depend on how many jobs are running or waiting.
+ *
+ * For each limit, 0 means that there is no limit.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobAdmission
+{
+	/** The maximum number of jobs in a single request. */
+	uint32 ja_max_jobs_per_request;
+
+	/** The maximum number of jobs that each user can have running at once. */
+	uint32 ja_max_jobs_per_user;
+
+	/**
+	 * The maximum number of jobs that can be running at once. This is also
+	 * the maximum number of jobs that can be waiting to start.
+	 */
+	uint32 ja_max_jobs_in_flight;
+
+	/**
+	 * The maximum number of jobs, other than JK_SLEEP ones, that can be
+	 * running at once. This is the number that the JobWorkers can take.
+	 */
+	uint32 ja_max_work_jobs;
+
+	/** The number of jobs that are counted as running. */
+	uint32 ja_num_admitted;
+
+	/** The number of jobs other than JK_SLEEP ones that are counted as running. */
+	uint32 ja_num_admitted_work;
+
+	/** The hash table of the users with jobs counted as running. */
+	JobAdmissionUser **ja_users_pp;
+
+	/** The reservations that still exist. */
+	JobAdmissionReservation *ja_reservations_p;
+
+	/**
+	 * The hash table, using linear probing, of the deferred jobs and
+	 * of the jobs that have been added to reservations.
+	 */
+	JobAdmissionJob *ja_jobs_p;
+
+	/** The number of entries in ja_jobs_p, this is always a power of 2. */
+	uint32 ja_num_job_slots;
+
+	/** The number of entries in ja_jobs_p that are in use. */
+	uint32 ja_num_job_entries;
+
+	/** The oldest request that is waiting to start. */
+	JobAdmissionRequest *ja_first_request_p;
+
+	/** The newest request that is waiting to start. */
+	JobAdmissionRequest *ja_last_request_p;
+
+	/** The number of jobs in all of the requests that are waiting to start. */
+	uint32 ja_num_deferred;
+
+	/** The function to start each deferred request. */
+	JobAdmissionCallback ja_callback_fn;
+
+	/** The thread that starts the deferred requests. */
+	pthread_t ja_thread;
+
+	/** The lock protecting all of the above. */
+	pthread_mutex_t ja_lock;
+
+	/**
+	 * Used to wake the thread when a request is deferred, when jobs stop
+	 * being counted or when it needs to stop.
+	 */
+	pthread_cond_t ja_wake_up;
+
+	/** Should the thread stop? */
+	bool ja_stop_flag;
+} JobAdmission;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Initialise a JobAdmission, without any limits, and start its thread.
+ *
+ * @param admission_p The JobAdmission to initialise.
+ * @param callback_fn The function to start each deferred request.
+ * @return <code>true</code> if the JobAdmission was initialised successfully,
+ * <code>false</code> otherwise.
+ * @memberof JobAdmission
+ */
+LONG_RUNNING_SERVICE_LOCAL bool InitJobAdmission (JobAdmission *admission_p, JobAdmissionCallback callback_fn);
+
+
+/**
+ * Stop a JobAdmission's thread and free its memory. Any requests that are
+ * still waiting are abandoned without being started.
+ *
+ * @param admission_p The JobAdmission to clear.
+ * @memberof JobAdmission
+ */
+LONG_RUNNING_SERVICE_LOCAL void ClearJobAdmission (JobAdmission *admission_p);
+
+
+/**
+ * Set the limits for a JobAdmission. This must be called before any
+ * jobs are admitted.
+ *
+ * @param admission_p The JobAdmission to set the limits for.
+ * @param max_jobs_per_request The maximum number of jobs in a single request.
+ * @param max_jobs_per_user The maximum number of jobs that each user can have running at once.
+ * @param max_jobs_in_flight The maximum number of jobs that can be running at once.
+ * @param max_work_jobs The maximum number of jobs, other than JK_SLEEP ones, that can
+ * be running at once.
+ * @memberof JobAdmission
+ */
+LONG_RUNNING_SERVICE_LOCAL void SetJobAdmissionLimits (JobAdmission *admission_p, const uint32 max_jobs_per_request, const uint32 max_jobs_per_user, const uint32 max_jobs_in_flight, const uint32 max_work_jobs);
+
+
+/**
+ * Check a request against the limits before any of its jobs are built.
+ *
+ * @param admission_p The JobAdmission to check against.
+ * @param num_jobs The number of jobs requested.
+ * @param kind The kind of all of the jobs.
+ * @return <code>true</code> if the request could ever be admitted,
+ * <code>false</code> if it is too big.
+ * @memberof JobAdmission
+ */
+LONG_RUNNING_SERVICE_LOCAL bool IsJobRequestAllowed (const JobAdmission *admission_p, const uint32 num_jobs, const JobKind kind);
+
+
+/**
+ * Decide whether a request can start now. If it is admitted, its jobs
+ * are counted against the limits straight away.
+ *
+ * @param admission_p The JobAdmission to use.
+ * @param user_s The user making the request or <code>NULL</code> if unknown.
+ * @param num_jobs The number of jobs requested.
+ * @param kind The kind of all of the jobs.
+ * @param reservation_pp If the jobs are admitted, where the reservation that
+ * they are counted in will be stored. This is <code>NULL</code> if there are
+ * no limits to count them against. Each job must be added to it before it is
+ * started and it must be passed to FinishJobReservation () once all of them have been.
+ * @return The JobAdmissionResult. If this is JAR_DEFERRED, the jobs are counted
+ * as waiting and the caller must pass them to DeferJobs () or, if it can't,
+ * give up their places with CancelDeferredJobs ().
+ * @memberof JobAdmission
+ */
+LONG_RUNNING_SERVICE_LOCAL JobAdmissionResult AdmitJobs (JobAdmission *admission_p, const char *user_s, const uint32 num_jobs, const JobKind kind, JobAdmissionReservation **reservation_pp);
+
+
+/**
+ * Add a request, that AdmitJobs () has deferred, to the back of the queue
+ * to be started once there is room for it.
+ *
+ * @param admission_p The JobAdmission to use.
+ * @param user_s The user making the request or <code>NULL</code> if unknown.
+ * @param items_p The jobs to start. These are copied.
+ * @param num_items The number of jobs in items_p.
+ * @param num_jobs The number of jobs to count the request as against the limits.
+ * This is normally num_items, but a single item can stand for all of the jobs of
+ * a request that will only be built once it is started.
+ * @param kind The kind of all of the jobs.
+ * @param callback_data_p The custom data to pass to the callback when the
+ * request is started.
+ * @return <code>true</code> if the request was queued, <code>false</code>
+ * otherwise, in which case the places of all num_jobs jobs are given up.
+ * @memberof JobAdmission
+ */
+LONG_RUNNING_SERVICE_LOCAL bool DeferJobs (JobAdmission *admission_p, const char *user_s, const JobAdmissionItem *items_p, const uint32 num_items, const uint32 num_jobs, const JobKind kind, void *callback_data_p);
+
+
+/**
+ * Give up the places of some jobs that AdmitJobs () deferred but which
+ * won't be passed to DeferJobs ().
+ *
+ * @param admission_p The JobAdmission to use.
+ * @param num_jobs The number of jobs.
+ * @memberof JobAdmission
+ */
+LONG_RUNNING_SERVICE_LOCAL void CancelDeferredJobs (JobAdmission *admission_p, const uint32 num_jobs);
+
+
+/**
+ * Add a job that is about to be started to the reservation that it was
+ * admitted in, so that it is counted until it is passed to ReleaseAdmittedJob ().
+ * This must be done before the job is started, since it could finish at once.
+ * If the job can't be added, it is counted until the reservation is finished
+ * instead.
+ *
+ * @param admission_p The JobAdmission to use.
+ * @param reservation_p The reservation. If this is <code>NULL</code>, nothing is done.
+ * @param job_id The id of the job.
+ * @param num_jobs The number of jobs that the job stands for. This is normally 1,
+ * but a single record can stand for a group of jobs that all finish with it.
+ * @memberof JobAdmission
+ */
+LONG_RUNNING_SERVICE_LOCAL void AddJobToReservation (JobAdmission *admission_p, JobAdmissionReservation *reservation_p, const uuid_t job_id, const uint32 num_jobs);
+
+
+/**
+ * Stop counting all of the jobs in a reservation that weren't added to it
+ * and free the reservation once all of the ones that were have been released.
+ * The reservation must not be used again.
+ *
+ * @param admission_p The JobAdmission to use.
+ * @param reservation_p The reservation. If this is <code>NULL</code>, nothing is done.
+ * @memberof JobAdmission
+ */
+LONG_RUNNING_SERVICE_LOCAL void FinishJobReservation (JobAdmission *admission_p, JobAdmissionReservation *reservation_p);
+
+
+/**
+ * Stop counting a job that has finished, or could not be started after
+ * all, against the limits.
+ *
+ * @param admission_p The JobAdmission to use.
+ * @param job_id The id of the job. If it wasn't added to a reservation,
+ * nothing is done.
+ * @memberof JobAdmission
+ */
+LONG_RUNNING_SERVICE_LOCAL void ReleaseAdmittedJob (JobAdmission *admission_p, const uuid_t job_id);
+
+
+/**
+ * Check whether a job is waiting to be started.
+ *
+ * @param admission_p The JobAdmission to check.
+ * @param job_id The id of the job.
+ * @return <code>true</code> if the job is waiting, <code>false</code> otherwise.
+ * @memberof JobAdmission
+ */
+LONG_RUNNING_SERVICE_LOCAL bool IsJobDeferred (JobAdmission *admission_p, const uuid_t job_id);
+
+
+/**
+ * Get the number of jobs that are either counted as running or waiting to start.
+ *
+ * @param admission_p The JobAdmission to check.
+ * @return The number of jobs.
+ * @memberof JobAdmission
+ */
+LONG_RUNNING_SERVICE_LOCAL uint32 GetNumAdmittedJobs (JobAdmission *admission_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef JOB_ADMISSION_H */
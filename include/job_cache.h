@@ -0,0 +1,185 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief A bounded least-recently-used cache of job times and statuses.
+ */
+
+#ifndef JOB_CACHE_H
+#define JOB_CACHE_H
+
+#include <pthread.h>
+
+#include "long_running_service.h"
+
+
+/**
+ * The details of a job that are kept in a JobCache. These are all that is
+ * needed to work out a job's status and results, so a cached job doesn't
+ * need to be fetched from the JobsManager and rebuilt.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobCacheEntry
+{
+	/** The id of the job. */
+	uuid_t jce_id;
+
+	/** The time that the job started, in nanoseconds since the epoch. */
+	int64 jce_start;
+
+	/** The time that the job finishes, in nanoseconds since the epoch. */
+	int64 jce_end;
+
+	/** The status of the job when it was last checked. */
+	OperationStatus jce_status;
+
+	/** The index of the next entry in the same hash bucket. */
+	uint32 jce_bucket_next;
+
+	/** The index of the next more recently used entry. */
+	uint32 jce_newer;
+
+	/** The index of the next less recently used entry. */
+	uint32 jce_older;
+} JobCacheEntry;
+
+
+/**
+ * A fixed size, thread-safe cache of JobCacheEntries keyed by job id.
+ * When it is full, adding a new job discards the one that was used
+ * least recently. All of the memory is allocated up front so adding
+ * and finding jobs never allocates.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobCache
+{
+	/** The entries, which are linked into both the hash buckets and the usage list. */
+	JobCacheEntry *jc_entries_p;
+
+	/** The index of the first entry in each hash bucket. */
+	uint32 *jc_buckets_p;
+
+	/** The number of entries that jc_entries_p has space for. */
+	uint32 jc_capacity;
+
+	/** The number of entries that are in use. */
+	uint32 jc_size;
+
+	/** The number of hash buckets. This is always a power of 2. */
+	uint32 jc_num_buckets;
+
+	/** The index of the most recently used entry. */
+	uint32 jc_newest;
+
+	/** The index of the least recently used entry. */
+	uint32 jc_oldest;
+
+	/** The lock protecting all of the above. */
+	pthread_mutex_t jc_lock;
+} JobCache;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Initialise a JobCache.
+ *
+ * @param cache_p The JobCache to initialise.
+ * @param capacity The maximum number of jobs to hold. If this is 0, the
+ * cache is disabled and every lookup will miss.
+ * @return <code>true</code> if the JobCache was initialised successfully,
+ * <code>false</code> otherwise.
+ * @memberof JobCache
+ */
+LONG_RUNNING_SERVICE_LOCAL bool InitJobCache (JobCache *cache_p, const uint32 capacity);
+
+
+/**
+ * Free the memory used by a JobCache.
+ *
+ * @param cache_p The JobCache to clear.
+ * @memberof JobCache
+ */
+LONG_RUNNING_SERVICE_LOCAL void ClearJobCache (JobCache *cache_p);
+
+
+/**
+ * Find a job in a JobCache and mark it as the most recently used.
+ *
+ * @param cache_p The JobCache to search.
+ * @param id The id of the job to find.
+ * @param entry_p If the job is found, its details will be copied here.
+ * @return <code>true</code> if the job was found, <code>false</code> otherwise.
+ * @memberof JobCache
+ */
+LONG_RUNNING_SERVICE_LOCAL bool FindJobInCache (JobCache *cache_p, const uuid_t id, JobCacheEntry *entry_p);
+
+
+/**
+ * Add a job to a JobCache, or update it if it is already there, and mark
+ * it as the most recently used. If the JobCache is full, the least recently
+ * used job is discarded to make room.
+ *
+ * @param cache_p The JobCache to add to.
+ * @param id The id of the job.
+ * @param start The time that the job started in nanoseconds since the epoch.
+ * @param end The time that the job finishes in nanoseconds since the epoch.
+ * @param status The current status of the job.
+ * @memberof JobCache
+ */
+LONG_RUNNING_SERVICE_LOCAL void AddJobToCache (JobCache *cache_p, const uuid_t id, const int64 start, const int64 end, const OperationStatus status);
+
+
+/**
+ * Change the status of a cached job, but only if it currently has the
+ * given status. Since this is done atomically, when several threads see
+ * the same change only one of them will succeed and so only that one
+ * needs to act upon it.
+ *
+ * @param cache_p The JobCache holding the job.
+ * @param id The id of the job.
+ * @param old_status The status that the job must currently have.
+ * @param new_status The status to change it to.
+ * @return <code>true</code> if the status was changed, <code>false</code> if the
+ * job is not in the JobCache or its status was not old_status.
+ * @memberof JobCache
+ */
+LONG_RUNNING_SERVICE_LOCAL bool ChangeJobCacheStatus (JobCache *cache_p, const uuid_t id, const OperationStatus old_status, const OperationStatus new_status);
+
+
+/**
+ * Remove a job from a JobCache, if it is there.
+ *
+ * @param cache_p The JobCache holding the job.
+ * @param id The id of the job.
+ * @memberof JobCache
+ */
+LONG_RUNNING_SERVICE_LOCAL void RemoveJobFromCache (JobCache *cache_p, const uuid_t id);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef JOB_CACHE_H */
@@ -0,0 +1,82 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief The clock used for the start and end times of jobs.
+ */
+
+#ifndef JOB_CLOCK_H
+#define JOB_CLOCK_H
+
+#include <time.h>
+
+#include "long_running_service.h"
+
+
+/**
+ * The number of nanoseconds in a second.
+ *
+ * @ingroup example_service
+ */
+#define LRS_NANOS_PER_SECOND (1000000000LL)
+
+
+/**
+ * The number of nanoseconds in a millisecond.
+ *
+ * @ingroup example_service
+ */
+#define LRS_NANOS_PER_MILLISECOND (1000000LL)
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Get the current time for timing jobs, in nanoseconds since the epoch.
+ *
+ * The first call reads the wall clock and from then on, the time is
+ * advanced using the monotonic clock. So the values can still be compared
+ * with those from other processes, but they never go backwards if the
+ * wall clock is stepped while jobs are running.
+ *
+ * @return The current time in nanoseconds.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_LOCAL int64 GetJobClockTime (void);
+
+
+/**
+ * Convert a time from GetJobClockTime () to whole seconds since the epoch,
+ * rounding down.
+ *
+ * @param time_ns The time in nanoseconds.
+ * @return The time in seconds.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_LOCAL time_t GetJobClockSeconds (const int64 time_ns);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef JOB_CLOCK_H */
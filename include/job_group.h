@@ -0,0 +1,286 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief The compact record of the times of all of the jobs in a request.
+ */
+
+#ifndef JOB_GROUP_H
+#define JOB_GROUP_H
+
+#include <pthread.h>
+
+#include "jansson.h"
+
+#include "long_running_service.h"
+
+
+/**
+ * The times of all of the jobs from a single request, stored as one record
+ * rather than a record for each job. All of the jobs in a group start at
+ * the same time, so only the duration of each one needs to be kept and,
+ * since these are whole numbers of a unit, each takes 4 bytes.
+ *
+ * The ids of the jobs in a group are derived from the id of the group, so
+ * given the id of any one of them, the group that holds its times can be
+ * found. These ids are version 8, i.e. custom, uuids where the last 4 bytes
+ * are 0 for the group itself and the index of the job plus 1 for each job.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobGroup
+{
+	/** The number of jobs in the group. */
+	uint32 jg_num_jobs;
+
+	/** The time, from GetJobClockTime (), when all of the jobs started. */
+	int64 jg_start;
+
+	/** The length of each unit of the durations in nanoseconds. */
+	int64 jg_unit;
+
+	/** The duration of each job in units of jg_unit. */
+	uint32 *jg_durations_p;
+} JobGroup;
+
+
+/**
+ * A group that has been read from its parent record, along with its id.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobGroupCacheEntry
+{
+	/** The id of the group. */
+	uuid_t jgce_id;
+
+	/** The group, or <code>NULL</code> if the entry is unused. */
+	JobGroup *jgce_group_p;
+} JobGroupCacheEntry;
+
+
+/**
+ * A small, thread-safe cache of the groups that have been read most
+ * recently. The jobs of a group are often looked up one at a time, each
+ * by a separate request, so this saves fetching and parsing the group's
+ * parent record, which holds the durations of all of its jobs, for each
+ * one of them. Once a group has been stored its times never change, so
+ * an entry stays valid until it is removed or replaced.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobGroupCache
+{
+	/** The entries, which are replaced in turn once they are all used. */
+	JobGroupCacheEntry *jgc_entries_p;
+
+	/** The number of entries. */
+	uint32 jgc_capacity;
+
+	/** The index of the entry that the next group will replace. */
+	uint32 jgc_next;
+
+	/** The lock protecting all of the above. */
+	pthread_mutex_t jgc_lock;
+} JobGroupCache;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Initialise a JobGroup. The durations of its jobs are all 0 until they
+ * are set.
+ *
+ * @param group_p The JobGroup to initialise.
+ * @param num_jobs The number of jobs in the group.
+ * @param start The time, from GetJobClockTime (), when the jobs start.
+ * @param unit The length of each unit of the durations in nanoseconds.
+ * @return <code>true</code> if the JobGroup was initialised successfully,
+ * <code>false</code> otherwise.
+ * @memberof JobGroup
+ */
+LONG_RUNNING_SERVICE_LOCAL bool InitJobGroup (JobGroup *group_p, const uint32 num_jobs, const int64 start, const int64 unit);
+
+
+/**
+ * Free the memory used by a JobGroup.
+ *
+ * @param group_p The JobGroup to clear.
+ * @memberof JobGroup
+ */
+LONG_RUNNING_SERVICE_LOCAL void ClearJobGroup (JobGroup *group_p);
+
+
+/**
+ * Get the start and end times of one of the jobs in a JobGroup.
+ *
+ * @param group_p The JobGroup to get the times from.
+ * @param index The index of the job. This must be less than the number of jobs.
+ * @param start_p Where the start time will be stored.
+ * @param end_p Where the end time will be stored.
+ * @memberof JobGroup
+ */
+LONG_RUNNING_SERVICE_LOCAL void GetJobGroupJobTimes (const JobGroup *group_p, const uint32 index, int64 *start_p, int64 *end_p);
+
+
+/**
+ * Get the time when the last of the jobs in a JobGroup finishes.
+ *
+ * @param group_p The JobGroup to check.
+ * @return The end time.
+ * @memberof JobGroup
+ */
+LONG_RUNNING_SERVICE_LOCAL int64 GetJobGroupEnd (const JobGroup *group_p);
+
+
+/**
+ * Get a JobGroup as JSON.
+ *
+ * @param group_p The JobGroup to get.
+ * @return The JSON which the caller is responsible for freeing with json_decref ()
+ * or <code>NULL</code> upon error.
+ * @memberof JobGroup
+ */
+LONG_RUNNING_SERVICE_LOCAL json_t *GetJobGroupAsJSON (const JobGroup *group_p);
+
+
+/**
+ * Initialise a JobGroup from the JSON created by GetJobGroupAsJSON ().
+ *
+ * @param group_p The JobGroup to initialise.
+ * @param json_p The JSON to read.
+ * @return <code>true</code> if the JobGroup was initialised successfully,
+ * <code>false</code> otherwise.
+ * @memberof JobGroup
+ */
+LONG_RUNNING_SERVICE_LOCAL bool InitJobGroupFromJSON (JobGroup *group_p, const json_t *json_p);
+
+
+/**
+ * Turn a newly generated uuid into one that can be used as the id of a
+ * JobGroup.
+ *
+ * @param id The uuid to change.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_LOCAL void MakeJobGroupId (uuid_t id);
+
+
+/**
+ * Check whether a uuid is the id of a JobGroup.
+ *
+ * @param id The uuid to check.
+ * @return <code>true</code> if the uuid is a group id, <code>false</code> otherwise.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_LOCAL bool IsJobGroupId (const uuid_t id);
+
+
+/**
+ * Get the id of one of the jobs in a JobGroup.
+ *
+ * @param group_id The id of the group.
+ * @param index The index of the job within the group.
+ * @param job_id Where the id of the job will be stored.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_LOCAL void GetJobGroupJobId (const uuid_t group_id, const uint32 index, uuid_t job_id);
+
+
+/**
+ * Find the group that a job belongs to from the job's id.
+ *
+ * @param job_id The id of the job.
+ * @param group_id Where the id of the group will be stored.
+ * @param index_p Where the index of the job within the group will be stored.
+ * @return <code>true</code> if the job belongs to a group, <code>false</code> otherwise.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_LOCAL bool GetJobGroupIdFromJobId (const uuid_t job_id, uuid_t group_id, uint32 *index_p);
+
+
+/**
+ * Initialise a JobGroupCache.
+ *
+ * @param cache_p The JobGroupCache to initialise.
+ * @param capacity The number of groups to hold. This must be greater than 0.
+ * @return <code>true</code> if the JobGroupCache was initialised successfully,
+ * <code>false</code> otherwise.
+ * @memberof JobGroupCache
+ */
+LONG_RUNNING_SERVICE_LOCAL bool InitJobGroupCache (JobGroupCache *cache_p, const uint32 capacity);
+
+
+/**
+ * Free all of the groups in a JobGroupCache along with the JobGroupCache's
+ * own memory.
+ *
+ * @param cache_p The JobGroupCache to clear.
+ * @memberof JobGroupCache
+ */
+LONG_RUNNING_SERVICE_LOCAL void ClearJobGroupCache (JobGroupCache *cache_p);
+
+
+/**
+ * Get the times of one of the jobs in a cached group.
+ *
+ * @param cache_p The JobGroupCache to search.
+ * @param group_id The id of the group.
+ * @param index The index of the job within the group.
+ * @param start_p Where the start time will be stored.
+ * @param end_p Where the end time will be stored.
+ * @return <code>true</code> if the group is in the cache and has a job
+ * with the given index, <code>false</code> otherwise.
+ * @memberof JobGroupCache
+ */
+LONG_RUNNING_SERVICE_LOCAL bool GetCachedJobGroupJobTimes (JobGroupCache *cache_p, const uuid_t group_id, const uint32 index, int64 *start_p, int64 *end_p);
+
+
+/**
+ * Add a group to a JobGroupCache, replacing the group that was added the
+ * longest time ago if the cache is full.
+ *
+ * @param cache_p The JobGroupCache to add the group to.
+ * @param group_id The id of the group.
+ * @param group_p The group, which must have been allocated with AllocMemory ().
+ * The JobGroupCache takes ownership of it and frees it when it is replaced,
+ * or straight away if the group is already cached.
+ * @memberof JobGroupCache
+ */
+LONG_RUNNING_SERVICE_LOCAL void AddJobGroupToCache (JobGroupCache *cache_p, const uuid_t group_id, JobGroup *group_p);
+
+
+/**
+ * Remove a group from a JobGroupCache, if it is there.
+ *
+ * @param cache_p The JobGroupCache to remove the group from.
+ * @param group_id The id of the group.
+ * @memberof JobGroupCache
+ */
+LONG_RUNNING_SERVICE_LOCAL void RemoveJobGroupFromCache (JobGroupCache *cache_p, const uuid_t group_id);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef JOB_GROUP_H */
@@ -0,0 +1,181 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief An append-only, memory-mapped journal of the jobs that are running.
+ */
+
+#ifndef JOB_JOURNAL_H
+#define JOB_JOURNAL_H
+
+#include <pthread.h>
+
+#include "long_running_service.h"
+
+
+/**
+ * A job that was still running according to a JobJournal when it was
+ * opened.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobJournalEntry
+{
+	/** The id of the job. */
+	uuid_t jje_id;
+
+	/** The time that the job started, in nanoseconds since the epoch. */
+	int64 jje_start;
+
+	/** The time that the job finishes, in nanoseconds since the epoch. */
+	int64 jje_end;
+} JobJournalEntry;
+
+
+/**
+ * A file recording when each job starts and finishes, so that after a
+ * restart the jobs that are still running can be found with a single
+ * sequential read rather than by rebuilding every job from the JobsManager.
+ *
+ * The file is a short header followed by fixed-size records, each with a
+ * checksum. It is mapped into memory and records are only ever appended,
+ * so if the process stops part way through writing one, that record
+ * fails its checksum and it and anything after it are ignored. The pages
+ * are written to disk by the kernel, so the journal survives the process
+ * crashing but not necessarily the whole machine.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobJournal
+{
+	/** The open journal file. */
+	int jj_fd;
+
+	/** The mapping of the file. */
+	unsigned char *jj_data_p;
+
+	/** The size of the file and of jj_data_p in bytes. */
+	size_t jj_mapped_size;
+
+	/** The number of bytes of jj_data_p that have been written. */
+	size_t jj_used_size;
+
+	/** The lock protecting all of the above. */
+	pthread_mutex_t jj_lock;
+} JobJournal;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Open a JobJournal, creating its file if needed. Any existing records are
+ * read first to find the jobs that they show as still running. The file is
+ * then rewritten, atomically, with just those jobs so that it doesn't keep
+ * growing from one restart to the next.
+ *
+ * The jobs are only handed back once the journal is open, so that any of
+ * them that finish while the caller is restoring them can be recorded.
+ *
+ * @param journal_p The JobJournal to initialise.
+ * @param path_s The path of the journal file.
+ * @param entries_pp Where the jobs that are still running, sorted by their ids,
+ * will be stored. If there are any, the caller must free these with FreeMemory ().
+ * @param num_entries_p Where the number of jobs that are still running will be stored.
+ * @return <code>true</code> if the JobJournal was opened successfully,
+ * <code>false</code> otherwise.
+ * @memberof JobJournal
+ */
+LONG_RUNNING_SERVICE_LOCAL bool InitJobJournal (JobJournal *journal_p, const char *path_s, JobJournalEntry **entries_pp, uint32 *num_entries_p);
+
+
+/**
+ * Close a JobJournal, writing any outstanding changes to disk.
+ *
+ * @param journal_p The JobJournal to clear.
+ * @memberof JobJournal
+ */
+LONG_RUNNING_SERVICE_LOCAL void ClearJobJournal (JobJournal *journal_p);
+
+
+/**
+ * Get the JobJournal that is shared by every Service in this process,
+ * opening it if this is the first reference to it. Each Service instance
+ * must use this rather than opening the file itself, since reopening it
+ * rewrites the file under any instance that already has it open.
+ *
+ * The jobs that were still running are only handed back to the very first
+ * caller in the process, so that they are recovered exactly once. Every
+ * later caller gets no entries.
+ *
+ * @param path_s The path of the journal file. If the journal is already
+ * open, this must be the same path that it was opened with.
+ * @param entries_pp Where the jobs that are still running, sorted by their ids,
+ * will be stored. If there are any, the caller must free these with FreeMemory ().
+ * @param num_entries_p Where the number of jobs that are still running will be stored.
+ * @return The shared JobJournal or <code>NULL</code> upon error. This must
+ * be given back with ReleaseSharedJobJournal ().
+ * @memberof JobJournal
+ */
+LONG_RUNNING_SERVICE_LOCAL JobJournal *AcquireSharedJobJournal (const char *path_s, JobJournalEntry **entries_pp, uint32 *num_entries_p);
+
+
+/**
+ * Give back a reference to the shared JobJournal. Once the last one has
+ * been released, the journal is closed.
+ *
+ * @param journal_p The JobJournal from AcquireSharedJobJournal ().
+ * @memberof JobJournal
+ */
+LONG_RUNNING_SERVICE_LOCAL void ReleaseSharedJobJournal (JobJournal *journal_p);
+
+
+/**
+ * Record that a job has started.
+ *
+ * @param journal_p The JobJournal to add the record to.
+ * @param job_id The id of the job.
+ * @param start The time that the job started in nanoseconds since the epoch.
+ * @param end The time that the job finishes in nanoseconds since the epoch.
+ * @return <code>true</code> if the record was added successfully,
+ * <code>false</code> otherwise.
+ * @memberof JobJournal
+ */
+LONG_RUNNING_SERVICE_LOCAL bool JournalJobStarted (JobJournal *journal_p, const uuid_t job_id, const int64 start, const int64 end);
+
+
+/**
+ * Record that a job has finished.
+ *
+ * @param journal_p The JobJournal to add the record to.
+ * @param job_id The id of the job.
+ * @return <code>true</code> if the record was added successfully,
+ * <code>false</code> otherwise.
+ * @memberof JobJournal
+ */
+LONG_RUNNING_SERVICE_LOCAL bool JournalJobFinished (JobJournal *journal_p, const uuid_t job_id);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef JOB_JOURNAL_H */
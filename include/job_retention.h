@@ -0,0 +1,211 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief A bounded store of the finished jobs, which are evicted once they expire.
+ */
+
+#ifndef JOB_RETENTION_H
+#define JOB_RETENTION_H
+
+#include <pthread.h>
+
+#include "long_running_service.h"
+
+
+/**
+ * All that is kept of a job once it has finished.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobTombstone
+{
+	/** The id of the job. */
+	uuid_t jt_id;
+
+	/** The time that the job started, in nanoseconds since the epoch. */
+	int64 jt_start;
+
+	/** The time that the job finished, in nanoseconds since the epoch. */
+	int64 jt_end;
+
+	/** The final status of the job. */
+	OperationStatus jt_status;
+
+	/** The time that the tombstone was kept, in nanoseconds since the epoch. */
+	int64 jt_added;
+
+	/** Is the job's full record still in the JobsManager? */
+	bool jt_stored_flag;
+
+	/** The index of the next tombstone in the same hash bucket. */
+	uint32 jt_bucket_next;
+} JobTombstone;
+
+
+/**
+ * The callback that a JobRetention uses to evict a batch of tombstones.
+ * This is called on the JobRetention's own thread without any of its
+ * locks held.
+ *
+ * @param tombstones_p The tombstones that have been evicted.
+ * @param num_tombstones The number of tombstones in tombstones_p.
+ * @param callback_data_p The custom data passed to InitJobRetention ().
+ * @ingroup example_service
+ */
+typedef void (*JobRetentionCallback) (const JobTombstone *tombstones_p, const uint32 num_tombstones, void *callback_data_p);
+
+
+/**
+ * A store of the tombstones of the finished jobs, kept in the order that
+ * they were added, so status requests can still be answered once a job's
+ * full record has gone. There is room for a fixed number of tombstones;
+ * once it is full, adding another evicts the oldest. A background thread,
+ * the compactor, also evicts the tombstones that have been kept for longer
+ * than their time to live. Each evicted tombstone is handed to the
+ * callback so whatever else is kept for the job can be removed too.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobRetention
+{
+	/** The tombstones, which are used as a ring in the order that they were added. */
+	JobTombstone *jr_tombstones_p;
+
+	/** The index of the first tombstone in each hash bucket. */
+	uint32 *jr_buckets_p;
+
+	/** The number of tombstones that jr_tombstones_p has space for. */
+	uint32 jr_capacity;
+
+	/** The number of hash buckets. This is always a power of 2. */
+	uint32 jr_num_buckets;
+
+	/** The index of the oldest tombstone. */
+	uint32 jr_oldest;
+
+	/** The number of tombstones in use. */
+	uint32 jr_size;
+
+	/** How long, in nanoseconds, to keep each tombstone once it has been added. 0 keeps them until there is no room. */
+	int64 jr_ttl;
+
+	/** The tombstones that have been evicted and are waiting for the callback. */
+	JobTombstone *jr_evicted_p;
+
+	/**
+	 * The batch that is being passed to the callback. This swaps places
+	 * with jr_evicted_p each time.
+	 */
+	JobTombstone *jr_evicting_p;
+
+	/** The number of tombstones in jr_evicted_p. */
+	uint32 jr_num_evicted;
+
+	/** The number of tombstones that jr_evicted_p has space for. */
+	uint32 jr_evicted_capacity;
+
+	/** The number of tombstones that jr_evicting_p has space for. */
+	uint32 jr_evicting_capacity;
+
+	/** The function to call for each batch of evicted tombstones. */
+	JobRetentionCallback jr_callback_fn;
+
+	/** The custom data to pass to jr_callback_fn. */
+	void *jr_callback_data_p;
+
+	/** The compactor's thread. */
+	pthread_t jr_thread;
+
+	/** The lock protecting all of the above. */
+	pthread_mutex_t jr_lock;
+
+	/** Used to wake the thread when there are tombstones to evict or it needs to stop. */
+	pthread_cond_t jr_wake_up;
+
+	/** Should the thread stop? */
+	bool jr_stop_flag;
+} JobRetention;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Initialise a JobRetention and start its compactor.
+ *
+ * @param retention_p The JobRetention to initialise.
+ * @param capacity The maximum number of tombstones to keep. This must be greater than 0.
+ * @param ttl How long, in nanoseconds, to keep each tombstone once it has
+ * been added. If this is 0, they are only evicted to make room for others.
+ * @param callback_fn The function to call for each batch of evicted tombstones.
+ * @param callback_data_p The custom data to pass to callback_fn.
+ * @return <code>true</code> if the JobRetention was initialised successfully,
+ * <code>false</code> otherwise.
+ * @memberof JobRetention
+ */
+LONG_RUNNING_SERVICE_LOCAL bool InitJobRetention (JobRetention *retention_p, const uint32 capacity, const int64 ttl, JobRetentionCallback callback_fn, void *callback_data_p);
+
+
+/**
+ * Stop a JobRetention's compactor and free its memory. Every tombstone,
+ * both those that are waiting to be evicted and those that are still kept,
+ * is passed to the callback first so that nothing else kept for their jobs
+ * is left behind.
+ *
+ * @param retention_p The JobRetention to clear.
+ * @memberof JobRetention
+ */
+LONG_RUNNING_SERVICE_LOCAL void ClearJobRetention (JobRetention *retention_p);
+
+
+/**
+ * Keep the tombstone of a job that has finished. If the job already has
+ * one, it is updated in place but keeps its place in the order.
+ *
+ * @param retention_p The JobRetention to add to.
+ * @param id The id of the job.
+ * @param start The time that the job started, in nanoseconds since the epoch.
+ * @param end The time that the job finished, in nanoseconds since the epoch.
+ * @param status The final status of the job.
+ * @param stored_flag Is the job's full record still in the JobsManager?
+ * @memberof JobRetention
+ */
+LONG_RUNNING_SERVICE_LOCAL void AddJobTombstone (JobRetention *retention_p, const uuid_t id, const int64 start, const int64 end, const OperationStatus status, const bool stored_flag);
+
+
+/**
+ * Find the tombstone of a job.
+ *
+ * @param retention_p The JobRetention to search.
+ * @param id The id of the job.
+ * @param tombstone_p Where the tombstone will be copied to if it is found.
+ * @return <code>true</code> if the job's tombstone was found, <code>false</code> otherwise.
+ * @memberof JobRetention
+ */
+LONG_RUNNING_SERVICE_LOCAL bool FindJobTombstone (JobRetention *retention_p, const uuid_t id, JobTombstone *tombstone_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef JOB_RETENTION_H */
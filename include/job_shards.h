@@ -0,0 +1,147 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief A consistent hash ring deciding which server owns each job.
+ */
+
+#ifndef JOB_SHARDS_H
+#define JOB_SHARDS_H
+
+#include "long_running_service.h"
+
+
+/**
+ * One of the points on a JobShards ring.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobShardPoint
+{
+	/** The position of the point on the ring. */
+	uint64 jsp_hash;
+
+	/** The index of the node that the point belongs to. */
+	uint32 jsp_node;
+} JobShardPoint;
+
+
+/**
+ * A consistent hash ring over the names of the servers, or nodes, that
+ * share a JobsManager. Each job belongs to the node with the first point
+ * on the ring at or after the hash of its id. Every node has the same
+ * number of points, spread around the ring, so the jobs are shared out
+ * evenly and adding or removing a node only moves the jobs between it
+ * and its neighbours.
+ *
+ * Only the first 6 bytes of an id are hashed. These are random in a
+ * version 4 uuid and are the same in the ids of a JobGroup and all of
+ * its jobs, so a whole group always belongs to the same node.
+ *
+ * A JobShards doesn't change once it has been initialised, so it can be
+ * used from any number of threads without locking.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobShards
+{
+	/** The names of the nodes. */
+	char **js_node_names_ss;
+
+	/** The number of nodes. */
+	uint32 js_num_nodes;
+
+	/** The index of the node that this process is. */
+	uint32 js_local_node;
+
+	/** The points on the ring, sorted by their hashes. */
+	JobShardPoint *js_points_p;
+
+	/** The number of points on the ring. */
+	uint32 js_num_points;
+} JobShards;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Initialise a JobShards. Every node must be given the same names, although
+ * the order doesn't matter, so that they all agree on which node owns each job.
+ *
+ * @param shards_p The JobShards to initialise.
+ * @param node_names_ss The names of all of the nodes.
+ * @param num_nodes The number of names in node_names_ss.
+ * @param local_node_s The name of the node that this process is. This must be one of node_names_ss.
+ * @return <code>true</code> if the JobShards was initialised successfully,
+ * <code>false</code> otherwise.
+ * @memberof JobShards
+ */
+LONG_RUNNING_SERVICE_LOCAL bool InitJobShards (JobShards *shards_p, const char * const *node_names_ss, const uint32 num_nodes, const char *local_node_s);
+
+
+/**
+ * Free the memory used by a JobShards.
+ *
+ * @param shards_p The JobShards to clear.
+ * @memberof JobShards
+ */
+LONG_RUNNING_SERVICE_LOCAL void ClearJobShards (JobShards *shards_p);
+
+
+/**
+ * Get the node that owns a job.
+ *
+ * @param shards_p The JobShards to check.
+ * @param job_id The id of the job.
+ * @return The index of the node that owns the job.
+ * @memberof JobShards
+ */
+LONG_RUNNING_SERVICE_LOCAL uint32 GetJobShardOwner (const JobShards *shards_p, const uuid_t job_id);
+
+
+/**
+ * Check whether a job belongs to the node that this process is.
+ *
+ * @param shards_p The JobShards to check.
+ * @param job_id The id of the job.
+ * @return <code>true</code> if the job is owned by this node, <code>false</code> otherwise.
+ * @memberof JobShards
+ */
+LONG_RUNNING_SERVICE_LOCAL bool IsLocalJobShard (const JobShards *shards_p, const uuid_t job_id);
+
+
+/**
+ * Get the name of one of the nodes.
+ *
+ * @param shards_p The JobShards to check.
+ * @param node The index of the node.
+ * @return The name of the node.
+ * @memberof JobShards
+ */
+LONG_RUNNING_SERVICE_LOCAL const char *GetJobShardNodeName (const JobShards *shards_p, const uint32 node);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef JOB_SHARDS_H */
@@ -0,0 +1,252 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief A queue of requests whose jobs are built and started in the background.
+ */
+
+#ifndef JOB_SUBMISSIONS_H
+#define JOB_SUBMISSIONS_H
+
+#include <pthread.h>
+
+#include "long_running_service.h"
+#include "job_workers.h"
+#include "job_admission.h"
+
+
+/**
+ * A request whose jobs are waiting to be, or are being, built and started
+ * by a JobSubmissionQueue.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobSubmission
+{
+	/** The id of the record that stands for the whole request. */
+	uuid_t jsb_id;
+
+	/** The number of jobs to build. */
+	uint32 jsb_num_jobs;
+
+	/** The minimum duration of each job in units of jsb_duration_unit. */
+	int32 jsb_min_duration;
+
+	/** The length of each unit of the jobs' durations in nanoseconds. */
+	int64 jsb_duration_unit;
+
+	/** The kind of all of the jobs. */
+	JobKind jsb_kind;
+
+	/** The seed used to derive each job's duration. */
+	uint32 jsb_seed;
+
+	/** The number of jobs that have been started so far. */
+	uint32 jsb_num_started;
+
+	/**
+	 * If this is true, the request is waiting for ReleaseJobSubmission ()
+	 * before it can be run.
+	 */
+	bool jsb_held_flag;
+
+	/**
+	 * The reservation that the jobs were admitted in, or <code>NULL</code>
+	 * if they aren't counted against any limits. The callback adds each job
+	 * to this before starting it and finishes it once they have all been
+	 * started, see AddJobToReservation () and FinishJobReservation ().
+	 */
+	JobAdmissionReservation *jsb_reservation_p;
+
+	/**
+	 * The custom data to pass to the JobSubmissionQueue's callback for
+	 * this request, such as the Service that it was made to.
+	 */
+	void *jsb_callback_data_p;
+
+	/** The next request in the queue. */
+	struct JobSubmission *jsb_next_p;
+} JobSubmission;
+
+
+/**
+ * The callback that a JobSubmissionQueue uses to build and start the jobs
+ * for a request. This is called on the JobSubmissionQueue's own thread
+ * without any of its locks held and should report its progress with
+ * SetJobSubmissionProgress () as it goes.
+ *
+ * @param submission_p The request to run.
+ * @param callback_data_p The custom data that was passed with the request
+ * to QueueJobSubmission ().
+ * @ingroup example_service
+ */
+typedef void (*JobSubmissionCallback) (JobSubmission *submission_p, void *callback_data_p);
+
+
+/**
+ * This lets a request return as soon as it has been accepted, rather than
+ * once all of its jobs have been built, started and stored. The requests
+ * are run one at a time, in the order that they arrived, by a background
+ * thread. Each request carries its own custom data for the callback, so
+ * a single JobSubmissionQueue can be shared by several Services.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobSubmissionQueue
+{
+	/** The oldest request that is waiting to be run. */
+	JobSubmission *jsq_first_p;
+
+	/** The newest request that is waiting to be run. */
+	JobSubmission *jsq_last_p;
+
+	/** The request that the thread is running, if any. */
+	JobSubmission *jsq_current_p;
+
+	/** The time, from GetJobClockTime (), when the last of the started jobs is due to finish. */
+	int64 jsq_latest_end;
+
+	/** The function to run each request. */
+	JobSubmissionCallback jsq_callback_fn;
+
+	/** The thread that runs the requests. */
+	pthread_t jsq_thread;
+
+	/** The lock protecting all of the above. */
+	pthread_mutex_t jsq_lock;
+
+	/** Used to wake the thread when a request is queued or it needs to stop. */
+	pthread_cond_t jsq_wake_up;
+
+	/** Should the thread stop? */
+	bool jsq_stop_flag;
+} JobSubmissionQueue;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Initialise a JobSubmissionQueue and start its thread.
+ *
+ * @param queue_p The JobSubmissionQueue to initialise.
+ * @param callback_fn The function to run each request.
+ * @return <code>true</code> if the JobSubmissionQueue was initialised successfully,
+ * <code>false</code> otherwise.
+ * @memberof JobSubmissionQueue
+ */
+LONG_RUNNING_SERVICE_LOCAL bool InitJobSubmissionQueue (JobSubmissionQueue *queue_p, JobSubmissionCallback callback_fn);
+
+
+/**
+ * Stop a JobSubmissionQueue's thread and free its memory. The requests that
+ * are still waiting are run first, since each of them has already been
+ * accepted, but any that are still held are dropped.
+ *
+ * @param queue_p The JobSubmissionQueue to clear.
+ * @memberof JobSubmissionQueue
+ */
+LONG_RUNNING_SERVICE_LOCAL void ClearJobSubmissionQueue (JobSubmissionQueue *queue_p);
+
+
+/**
+ * Add a request to the back of the queue.
+ *
+ * @param queue_p The JobSubmissionQueue to use.
+ * @param id The id of the record that stands for the whole request.
+ * @param num_jobs The number of jobs to build.
+ * @param min_duration The minimum duration of each job in units of duration_unit.
+ * @param duration_unit The length of each unit of the jobs' durations in nanoseconds.
+ * @param kind The kind of all of the jobs.
+ * @param seed The seed used to derive each job's duration.
+ * @param held_flag If this is <code>true</code>, the request isn't run until it
+ * is passed to ReleaseJobSubmission (). The requests behind it in the queue
+ * are run in the meantime.
+ * @param reservation_p The reservation that the jobs were admitted in. This
+ * should be <code>NULL</code> if held_flag is <code>true</code>, since the
+ * reservation only exists once the request has been admitted.
+ * @param callback_data_p The custom data to pass to the callback when the
+ * request is run.
+ * @return <code>true</code> if the request was queued, <code>false</code> otherwise.
+ * @memberof JobSubmissionQueue
+ */
+LONG_RUNNING_SERVICE_LOCAL bool QueueJobSubmission (JobSubmissionQueue *queue_p, const uuid_t id, const uint32 num_jobs, const int32 min_duration, const int64 duration_unit, const JobKind kind, const uint32 seed, const bool held_flag, JobAdmissionReservation *reservation_p, void *callback_data_p);
+
+
+/**
+ * Let a request that was queued as held be run, or drop it.
+ *
+ * @param queue_p The JobSubmissionQueue to use.
+ * @param id The id of the record that stands for the request.
+ * @param run_flag If this is <code>true</code>, the request will be run,
+ * otherwise it is taken off the queue without being run.
+ * @param reservation_p If the request will be run, the reservation that its
+ * jobs have now been admitted in.
+ * @return <code>true</code> if the request was held and has been released,
+ * <code>false</code> if there is no such held request.
+ * @memberof JobSubmissionQueue
+ */
+LONG_RUNNING_SERVICE_LOCAL bool ReleaseJobSubmission (JobSubmissionQueue *queue_p, const uuid_t id, const bool run_flag, JobAdmissionReservation *reservation_p);
+
+
+/**
+ * Record how far the thread has got with a request.
+ *
+ * @param queue_p The JobSubmissionQueue running the request.
+ * @param submission_p The request.
+ * @param num_started The number of its jobs that have been started so far.
+ * @param latest_end The time, from GetJobClockTime (), when the last of these jobs is due to finish.
+ * @memberof JobSubmissionQueue
+ */
+LONG_RUNNING_SERVICE_LOCAL void SetJobSubmissionProgress (JobSubmissionQueue *queue_p, JobSubmission *submission_p, const uint32 num_started, const int64 latest_end);
+
+
+/**
+ * Get how far a request has got.
+ *
+ * @param queue_p The JobSubmissionQueue to check.
+ * @param id The id of the record that stands for the request.
+ * @param num_jobs_p Where the number of jobs in the request will be stored.
+ * @param num_started_p Where the number of its jobs that have been started so far will be stored.
+ * @return <code>true</code> if the request is still waiting or being run,
+ * <code>false</code> if it isn't in the queue.
+ * @memberof JobSubmissionQueue
+ */
+LONG_RUNNING_SERVICE_LOCAL bool GetJobSubmissionProgress (JobSubmissionQueue *queue_p, const uuid_t id, uint32 *num_jobs_p, uint32 *num_started_p);
+
+
+/**
+ * Check whether a JobSubmissionQueue has any requests left to run or any
+ * of the jobs that it has started could still be running.
+ *
+ * @param queue_p The JobSubmissionQueue to check.
+ * @param now The current time from GetJobClockTime ().
+ * @return <code>true</code> if there is still work outstanding, <code>false</code> otherwise.
+ * @memberof JobSubmissionQueue
+ */
+LONG_RUNNING_SERVICE_LOCAL bool HasOutstandingJobSubmissions (JobSubmissionQueue *queue_p, const int64 now);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef JOB_SUBMISSIONS_H */
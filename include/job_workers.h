@@ -0,0 +1,374 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief A pool of threads that do simulated work for running jobs.
+ */
+
+#ifndef JOB_WORKERS_H
+#define JOB_WORKERS_H
+
+#include <pthread.h>
+
+#include "long_running_service.h"
+
+
+/**
+ * The kinds of load that a job can generate while it is running.
+ *
+ * @ingroup example_service
+ */
+typedef enum JobKind
+{
+	/** The job just waits until its end time, which uses no resources at all. */
+	JK_SLEEP,
+
+	/** The job keeps a worker thread busy with arithmetic until its end time. */
+	JK_CPU,
+
+	/**
+	 * The job repeatedly sweeps through a buffer that is larger than the
+	 * processor's caches, so its speed is limited by the memory bandwidth.
+	 */
+	JK_MEMORY,
+
+	/**
+	 * The job repeatedly writes a temporary file, syncs it to disk and
+	 * reads it back.
+	 */
+	JK_IO,
+
+	/** The number of different JobKinds. */
+	JK_NUM_KINDS
+} JobKind;
+
+
+/**
+ * Where a job is in a JobWorkers.
+ *
+ * @ingroup example_service
+ */
+typedef enum JobWorkState
+{
+	/** The job is waiting for a worker. */
+	JWS_QUEUED,
+
+	/** A worker is generating the job's load. */
+	JWS_RUNNING
+} JobWorkState;
+
+
+/**
+ * The callback that a JobWorkers calls when a job's work has finished.
+ * This is called on the worker thread that did the work without any
+ * of the JobWorkers' locks held, so it may be called from several
+ * threads at once. By the time that it is called, the job no longer
+ * counts against the JobWorkers' maximum number of jobs, so another
+ * job can already be queued in its place.
+ *
+ * @param job_id The id of the job.
+ * @param start The time, from GetJobClockTime (), when the work started.
+ * @param end The time, from GetJobClockTime (), when the work finished.
+ * @param callback_data_p The custom data passed to QueueJobWork () for this job.
+ * @ingroup example_service
+ */
+typedef void (*JobWorkCallback) (const uuid_t job_id, const int64 start, const int64 end, void *callback_data_p);
+
+
+/**
+ * A job that is waiting for or being run by a worker. Once the item is in
+ * the hash table, jwi_start, jwi_state and jwi_next are only accessed with
+ * the lock for the item's bucket held.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobWorkItem
+{
+	/** The id of the job. */
+	uuid_t jwi_id;
+
+	/** The kind of load to generate. */
+	JobKind jwi_kind;
+
+	/** How long in nanoseconds to generate the load for. */
+	int64 jwi_duration;
+
+	/** The time, from GetJobClockTime (), when a worker started the job. */
+	int64 jwi_start;
+
+	/** Where the job is. */
+	JobWorkState jwi_state;
+
+	/** The custom data to pass to the callback when the job's work has finished. */
+	void *jwi_callback_data_p;
+
+	/**
+	 * The index of the next item in the same hash bucket or, for unused
+	 * items, the next free item, in which case it is only ever accessed
+	 * atomically.
+	 */
+	uint32 jwi_next;
+} JobWorkItem;
+
+
+/**
+ * A single worker thread and its queue of jobs. The worker takes jobs from
+ * the front of its queue so they start in the order that they were queued,
+ * and any idle workers steal from the back so they don't contend with it.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobWorkQueue
+{
+	/** The JobWorkers that this queue belongs to. */
+	struct JobWorkers *jwq_workers_p;
+
+	/** The thread that runs the jobs from this queue. */
+	pthread_t jwq_thread;
+
+	/** A ring buffer of the indexes of the queued JobWorkItems. */
+	uint32 *jwq_items_p;
+
+	/** The index in jwq_items_p of the front of the queue. */
+	uint32 jwq_first;
+
+	/**
+	 * The number of items in the queue. This is only changed with the lock
+	 * held, but the other workers can read it without the lock to skip
+	 * queues that are empty.
+	 */
+	uint32 jwq_num_items;
+
+	/** The lock protecting this queue. */
+	pthread_mutex_t jwq_lock;
+} JobWorkQueue;
+
+
+/**
+ * A fixed number of worker threads that generate the load for jobs. Each
+ * worker has its own queue and when that is empty, it steals from the others.
+ *
+ * The number of jobs that can be queued or running at once is fixed when
+ * the JobWorkers is created, so however many jobs are requested, the
+ * amount of memory and threads that they use is bounded.
+ *
+ * There is no lock for the JobWorkers as a whole. Queuing a job only takes
+ * the lock for the part of the hash table that the job is in and then the
+ * lock for the queue that it is added to, so jobs can be queued, started
+ * and released on several threads at once.
+ *
+ * @ingroup example_service
+ */
+typedef struct JobWorkers
+{
+	/** The worker threads and their queues. */
+	JobWorkQueue *jw_queues_p;
+
+	/** The number of worker threads. */
+	uint32 jw_num_threads;
+
+	/** The items for every job that is queued or running. */
+	JobWorkItem *jw_items_p;
+
+	/** The maximum number of jobs that can be queued or running at once. */
+	uint32 jw_max_jobs;
+
+	/**
+	 * The number of JobWorkItems in jw_items_p. A job stops counting
+	 * against jw_max_jobs just before its callback is called, but its item
+	 * is only freed once the callback has returned, so there is an extra
+	 * item for each thread.
+	 */
+	uint32 jw_max_items;
+
+	/**
+	 * The number of jobs that are queued or running, including any that are
+	 * being queued, and whose callbacks haven't been called yet. This is only
+	 * ever accessed atomically.
+	 */
+	uint32 jw_num_jobs;
+
+	/**
+	 * The index of the first unused item, or JW_NONE if they are all in use,
+	 * in the low 32 bits and the number of times that this has changed in the
+	 * high 32 bits. The count means that a thread taking an item can tell if
+	 * another thread has taken and given back the same item in the meantime.
+	 * This is only ever accessed atomically.
+	 */
+	uint64 jw_free_item;
+
+	/** The hash table of the used items keyed by their job ids. */
+	uint32 *jw_buckets_p;
+
+	/** The number of buckets, this is always a power of 2. */
+	uint32 jw_num_buckets;
+
+	/**
+	 * The locks for the hash table's buckets and for the items in them.
+	 * Bucket b uses lock b % jw_num_bucket_locks.
+	 */
+	pthread_mutex_t *jw_bucket_locks_p;
+
+	/** The number of locks in jw_bucket_locks_p, this is always a power of 2. */
+	uint32 jw_num_bucket_locks;
+
+	/**
+	 * The index of the next queue to add a job to. This is only ever
+	 * accessed atomically.
+	 */
+	uint32 jw_next_queue;
+
+	/**
+	 * The number of jobs that are in the queues. This is only ever
+	 * accessed atomically.
+	 */
+	uint32 jw_num_queued;
+
+	/**
+	 * The number of workers that are waiting for jobs, so that queuing a job
+	 * only needs to take jw_idle_lock when there is a worker to wake. This is
+	 * only ever accessed atomically.
+	 */
+	uint32 jw_num_idle;
+
+	/** The function to call when each job's work has finished. */
+	JobWorkCallback jw_callback_fn;
+
+	/** The lock that the idle workers wait on. */
+	pthread_mutex_t jw_idle_lock;
+
+	/** Used to wake the workers when a job is queued or they need to stop. */
+	pthread_cond_t jw_work_available;
+
+	/**
+	 * Should the workers stop? The workers check this between each
+	 * chunk of work so they don't need the lock to read it.
+	 */
+	bool jw_stop_flag;
+} JobWorkers;
+
+
+/** The value used to mark the end of the chains of JobWorkItems. */
+#define JW_NONE (0xFFFFFFFF)
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Initialise a JobWorkers and start its threads.
+ *
+ * @param workers_p The JobWorkers to initialise.
+ * @param num_threads The number of worker threads to start. If this is
+ * 0, the number of online processors is used.
+ * @param max_jobs The maximum number of jobs that can be queued or running
+ * at once.
+ * @param callback_fn The function to call when each job's work has finished.
+ * @return <code>true</code> if the JobWorkers was initialised successfully,
+ * <code>false</code> otherwise.
+ * @memberof JobWorkers
+ */
+LONG_RUNNING_SERVICE_LOCAL bool InitJobWorkers (JobWorkers *workers_p, const uint32 num_threads, const uint32 max_jobs, JobWorkCallback callback_fn);
+
+
+/**
+ * Stop a JobWorkers' threads, abandoning any work that is in progress or
+ * still queued, and free its memory. The callback isn't called for any of
+ * the abandoned jobs.
+ *
+ * @param workers_p The JobWorkers to clear.
+ * @memberof JobWorkers
+ */
+LONG_RUNNING_SERVICE_LOCAL void ClearJobWorkers (JobWorkers *workers_p);
+
+
+/**
+ * Queue a job so that its load is generated for the given duration once
+ * a worker becomes free.
+ *
+ * @param workers_p The JobWorkers to add the job to.
+ * @param job_id The id of the job.
+ * @param kind The kind of load to generate.
+ * @param duration How long in nanoseconds to generate the load for.
+ * @param callback_data_p The custom data to pass to the JobWorkers' callback
+ * when the job's work has finished. Since the same JobWorkers can be used by
+ * several callers, this is how the callback knows whose job it was.
+ * @return <code>true</code> if the job was queued, <code>false</code> if
+ * the maximum number of jobs are already queued or running.
+ * @memberof JobWorkers
+ */
+LONG_RUNNING_SERVICE_LOCAL bool QueueJobWork (JobWorkers *workers_p, const uuid_t job_id, const JobKind kind, const int64 duration, void *callback_data_p);
+
+
+/**
+ * Find out whether a job is queued or running.
+ *
+ * @param workers_p The JobWorkers to check.
+ * @param job_id The id of the job.
+ * @param state_p If the job was found, where its JobWorkState will be stored.
+ * @param start_p If the job is running and this is not <code>NULL</code>, the time
+ * when it started will be stored here.
+ * @return <code>true</code> if the job is queued or running, <code>false</code>
+ * if it has finished or was never queued.
+ * @memberof JobWorkers
+ */
+LONG_RUNNING_SERVICE_LOCAL bool GetJobWorkState (JobWorkers *workers_p, const uuid_t job_id, JobWorkState *state_p, int64 *start_p);
+
+
+/**
+ * Get the number of jobs that are queued or running and whose callbacks
+ * haven't been called yet.
+ *
+ * @param workers_p The JobWorkers to check.
+ * @return The number of jobs.
+ * @memberof JobWorkers
+ */
+LONG_RUNNING_SERVICE_LOCAL uint32 GetNumJobWorkItems (JobWorkers *workers_p);
+
+
+/**
+ * Get the name of a JobKind, as used for the "Job kind" parameter and when
+ * storing jobs.
+ *
+ * @param kind The JobKind.
+ * @return The name or <code>NULL</code> if kind is not valid.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_LOCAL const char *GetJobKindAsString (const JobKind kind);
+
+
+/**
+ * Get the JobKind with the given name.
+ *
+ * @param kind_s The name of the JobKind.
+ * @param kind_p Where the JobKind will be stored.
+ * @return <code>true</code> if kind_s is the name of a JobKind,
+ * <code>false</code> otherwise.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_LOCAL bool GetJobKindFromString (const char *kind_s, JobKind *kind_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef JOB_WORKERS_H */
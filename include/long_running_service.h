@@ -24,6 +24,8 @@
 #ifndef LONG_RUNNING_SERVICE_H
 #define LONG_RUNNING_SERVICE_H
 
+#include <time.h>
+
 #include "service.h"
 #include "library.h"
 
@@ -78,6 +80,91 @@ extern "C"
 #endif
 
 
+/**
+ * The callback used by WriteLongRunningResults () to output each
+ * chunk of the results.
+ *
+ * @param data_s The chunk of data to write. This is not <code>NULL</code>-terminated
+ * and is only valid for the duration of the call.
+ * @param length The length of data_s.
+ * @param writer_data_p The custom data that was passed to WriteLongRunningResults ().
+ * @return <code>true</code> if the data was written successfully, <code>false</code>
+ * to stop writing any more results.
+ * @ingroup example_service
+ */
+typedef bool (*LongRunningResultsWriter) (const char *data_s, const size_t length, void *writer_data_p);
+
+
+/**
+ * The callback that is called when any job in the process finishes.
+ *
+ * @param job_id The id of the job that has finished.
+ * @param status The final status of the job.
+ * @param callback_data_p The custom data that was passed to
+ * SetLongRunningServiceCompletionCallback ().
+ * @ingroup example_service
+ */
+typedef void (*LongRunningJobCompletionCallback) (const uuid_t job_id, const OperationStatus status, void *callback_data_p);
+
+
+/**
+ * The callback that a Service uses to ask another server for the status of
+ * one of the jobs that it owns. The other server should answer with
+ * GetLongRunningServiceOwnedStatus ().
+ *
+ * @param node_s The name of the server that owns the job, as given in the
+ * Service's configuration.
+ * @param job_id The id of the job.
+ * @param status_p Where the status of the job should be stored.
+ * @param forwarder_data_p The custom data that was passed to
+ * SetLongRunningServiceStatusForwarder ().
+ * @return <code>true</code> if the other server gave the status, <code>false</code>
+ * if it couldn't be asked, in which case the status is read from the JobsManager instead.
+ * @ingroup example_service
+ */
+typedef bool (*LongRunningStatusForwarder) (const char *node_s, const uuid_t job_id, OperationStatus *status_p, void *forwarder_data_p);
+
+
+/**
+ * A summary of the statuses of all of the jobs in a group, all of which
+ * have been calculated against the same point in time.
+ *
+ * @ingroup example_service
+ */
+typedef struct LongRunningGroupStatus
+{
+	/** The time, in nanoseconds since the epoch, that the statuses were calculated for. */
+	int64 lrgs_time;
+
+	/** The total number of jobs in the group. */
+	uint32 lrgs_num_jobs;
+
+	/** The number of jobs that are still running. */
+	uint32 lrgs_num_running;
+
+	/** The number of jobs that have succeeded. */
+	uint32 lrgs_num_succeeded;
+
+	/** The number of jobs with any other status. */
+	uint32 lrgs_num_other;
+} LongRunningGroupStatus;
+
+
+/**
+ * How far the background submission of a request's jobs has got.
+ *
+ * @ingroup example_service
+ */
+typedef struct LongRunningSubmissionStatus
+{
+	/** The total number of jobs in the request. */
+	uint32 lrss_num_jobs;
+
+	/** The number of jobs that have been started so far. */
+	uint32 lrss_num_started;
+} LongRunningSubmissionStatus;
+
+
 /**
  * Get the ServicesArray containing the example Service.
  *
@@ -98,6 +185,191 @@ LONG_RUNNING_SERVICE_API ServicesArray *GetServices (User *user_p, GrassrootsSer
  */
 LONG_RUNNING_SERVICE_API void ReleaseServices (ServicesArray *services_p);
 
+
+/**
+ * Write the results for all of the jobs that a Service is running as a JSON
+ * array. Rather than building the whole array in memory, the results are
+ * generated one job at a time and passed to writer_fn as they are ready.
+ *
+ * @param service_p The Service to get the results for.
+ * @param writer_fn The callback to write each chunk of the results.
+ * @param writer_data_p Custom data to pass to each call of writer_fn.
+ * @return <code>true</code> if all of the results were written successfully,
+ * <code>false</code> otherwise.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_API bool WriteLongRunningResults (Service *service_p, LongRunningResultsWriter writer_fn, void *writer_data_p);
+
+
+/**
+ * Get the statuses for a number of jobs in a single call. Any jobs that
+ * the Service has in memory are resolved directly and the rest are
+ * fetched from the JobsManager. All of the statuses are calculated against
+ * the same point in time so they are consistent with each other.
+ *
+ * @param service_p The Service that is running the jobs.
+ * @param job_ids_p The ids of the jobs to get the statuses of.
+ * @param num_jobs The number of ids in job_ids_p.
+ * @param statuses_p The array where the statuses will be stored. This must have
+ * space for num_jobs entries and the status for job_ids_p [i] will be stored
+ * in statuses_p [i]. Any job that could not be found will have a status of OS_ERROR.
+ * @return The number of jobs whose statuses were found.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_API uint32 GetLongRunningServiceStatuses (Service *service_p, const uuid_t *job_ids_p, const uint32 num_jobs, OperationStatus *statuses_p);
+
+
+/**
+ * Get the operational statistics for the server process. These are the
+ * counts of the jobs that have been submitted, rebuilt from the JobsManager
+ * and failed to be stored along with the latency distributions for
+ * submitting jobs, getting their statuses and results, and serialising
+ * and deserialising them. They are shared by every Service in the process
+ * and last for as long as it does. The same statistics are the result of a
+ * request with the "Get statistics" parameter set.
+ *
+ * The latencies are given as the count, mean, median, 99th percentile
+ * and maximum, all in nanoseconds. The percentiles are estimated from
+ * power-of-two sized buckets so they are accurate to within a factor of 2.
+ *
+ * @param service_p Any of the Services in the process.
+ * @return A JSON object of the statistics which the caller is responsible
+ * for freeing with json_decref () or <code>NULL</code> upon error.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_API json_t *GetLongRunningServiceStats (Service *service_p);
+
+
+/**
+ * Set the function to call when each job finishes. Rather than polling for
+ * each job's status, clients can use this to be told as soon as it changes.
+ * Every instance of the Service in the process shares one scheduler, so the
+ * callback is called for the jobs of all of them, not just those of service_p,
+ * and it stays set after service_p has been closed. It is called from the
+ * shared scheduler thread or, for jobs that generate a load, from the worker
+ * thread that ran the job. So it can be called from several threads at once,
+ * it should return quickly and it must be thread-safe.
+ *
+ * By the time the callback is called, the job's final status has been
+ * written back to the JobsManager, or queued to be. Its record is then kept
+ * there until its tombstone is evicted, unless the Service is configured not
+ * to keep any, when the record has already been removed. So the callback
+ * should take the job's final status from its arguments rather than reading
+ * the record back.
+ *
+ * The callback can be changed at any time. A job that finishes while it is
+ * being changed is passed to either the old callback or the new one, each
+ * with its own custom data, but the old one may still be running when this
+ * returns, so its custom data mustn't be freed straight away.
+ *
+ * @param service_p Any instance of the Service.
+ * @param callback_fn The function to call or <code>NULL</code> to not have
+ * any notifications.
+ * @param callback_data_p The custom data to pass to callback_fn.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_API void SetLongRunningServiceCompletionCallback (Service *service_p, LongRunningJobCompletionCallback callback_fn, void *callback_data_p);
+
+
+/**
+ * Get the summary of the statuses of all of the jobs in a group. When the
+ * Service is configured to group the jobs for each request, they are all
+ * stored as a single record so this only needs a single read however many
+ * jobs there are.
+ *
+ * @param service_p The Service that is running the jobs.
+ * @param job_id The id of either the group or any one of its jobs.
+ * @param status_p Where the summary will be stored.
+ * @return <code>true</code> if the group was found, <code>false</code> otherwise.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_API bool GetLongRunningServiceGroupStatus (Service *service_p, const uuid_t job_id, LongRunningGroupStatus *status_p);
+
+
+/**
+ * Set the function used to ask the other servers sharing the JobsManager for
+ * the statuses of the jobs that they own. When the Service is configured with
+ * the names of these servers, each job belongs to one of them and that
+ * server keeps the job in memory. So rather than every server reading the
+ * job from the JobsManager, the others forward their status requests to its
+ * owner. The Service has no way of talking to the other servers itself,
+ * which is why this callback is needed.
+ *
+ * This must be called before the Service is used since it isn't safe
+ * to change the callback while status requests are being handled.
+ *
+ * @param service_p The Service to set the callback for.
+ * @param forwarder_fn The function to call or <code>NULL</code> to read the
+ * statuses of all jobs from the JobsManager.
+ * @param forwarder_data_p The custom data to pass to forwarder_fn.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_API void SetLongRunningServiceStatusForwarder (Service *service_p, LongRunningStatusForwarder forwarder_fn, void *forwarder_data_p);
+
+
+/**
+ * Get the status of a job for another server that has forwarded the request.
+ * This works in the same way as a normal status request except that it is
+ * never forwarded again, even if this server doesn't think that it owns the
+ * job, so requests can't go round in circles while the servers disagree
+ * about who owns what.
+ *
+ * @param service_p The Service that owns the job.
+ * @param job_id The id of the job.
+ * @param status_p Where the status of the job will be stored.
+ * @return <code>true</code> if the job was found, <code>false</code> otherwise.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_API bool GetLongRunningServiceOwnedStatus (Service *service_p, const uuid_t job_id, OperationStatus *status_p);
+
+
+/**
+ * Get the name of the server that owns a job.
+ *
+ * @param service_p The Service to check.
+ * @param job_id The id of the job.
+ * @return The name of the server, which is owned by the Service and must not
+ * be freed, or <code>NULL</code> if the Service hasn't been configured to share
+ * its jobs between servers.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_API const char *GetLongRunningServiceJobOwner (Service *service_p, const uuid_t job_id);
+
+
+/**
+ * Get how far the background submission of a request has got. A request
+ * that is big enough to be submitted in the background returns a single
+ * job that stands for all of its jobs. This stays OS_PENDING until all of
+ * them have been started, after which it runs for as long as they do.
+ *
+ * @param service_p The Service running the request.
+ * @param job_id The id of the job that was returned for the request.
+ * @param status_p Where the progress of the request will be stored.
+ * @return <code>true</code> if the request's jobs are still waiting to be,
+ * or are being, started, <code>false</code> otherwise.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_API bool GetLongRunningServiceSubmissionStatus (Service *service_p, const uuid_t job_id, LongRunningSubmissionStatus *status_p);
+
+
+/**
+ * Get when a Service's running jobs are due to finish. The Service can't
+ * be closed until the last of these has passed, so this says how long
+ * CloseService () will keep failing for.
+ *
+ * @param service_p The Service to check.
+ * @param earliest_p If this isn't <code>NULL</code>, where the time, in
+ * seconds since the epoch, that the first of the jobs is due to finish
+ * will be stored.
+ * @param latest_p If this isn't <code>NULL</code>, where the time, in
+ * seconds since the epoch, that the last of the jobs is due to finish
+ * will be stored.
+ * @return <code>true</code> if any of the Service's jobs are still running,
+ * <code>false</code> otherwise, in which case neither time is stored.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_API bool GetLongRunningServiceJobDeadlines (Service *service_p, time_t *earliest_p, time_t *latest_p);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,227 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief Counters and latency histograms for the long running service.
+ */
+
+#ifndef LONG_RUNNING_STATS_H
+#define LONG_RUNNING_STATS_H
+
+#include "jansson.h"
+
+#include "long_running_service.h"
+
+
+/**
+ * The number of buckets in a LatencyHistogram. Bucket i holds the
+ * latencies from 2^i up to, but not including, 2^(i + 1) nanoseconds
+ * so this covers everything up to about 78 hours.
+ *
+ * @ingroup example_service
+ */
+#define LRS_NUM_LATENCY_BUCKETS (48)
+
+
+/**
+ * The operations whose latencies are recorded.
+ *
+ * @ingroup example_service
+ */
+typedef enum LongRunningStatsOperation
+{
+	/** Running the Service to submit a set of jobs. */
+	LRSO_SUBMIT,
+
+	/** Getting the status of one or more jobs. */
+	LRSO_STATUS,
+
+	/** Getting the results of one or more jobs. */
+	LRSO_RESULTS,
+
+	/** Serialising a job to be stored in the JobsManager. */
+	LRSO_SERIALISE,
+
+	/** Deserialising a job that was stored in the JobsManager. */
+	LRSO_DESERIALISE,
+
+	/** The number of operations. */
+	LRSO_NUM_OPERATIONS
+} LongRunningStatsOperation;
+
+
+/**
+ * The events that are counted.
+ *
+ * @ingroup example_service
+ */
+typedef enum LongRunningStatsCounter
+{
+	/** The number of jobs that have been built by requests. */
+	LRSC_JOBS_SUBMITTED,
+
+	/** The number of jobs that have been rebuilt from the JobsManager. */
+	LRSC_JOBS_DESERIALISED,
+
+	/** The number of jobs that could not be rebuilt from the JobsManager. */
+	LRSC_DESERIALISE_FAILURES,
+
+	/** The number of calls to AddServiceJobToJobsManager () that failed. */
+	LRSC_JOBS_MANAGER_ADD_FAILURES,
+
+	/** The number of finished jobs whose records have been removed from the JobsManager. */
+	LRSC_JOBS_MANAGER_REMOVALS,
+
+	/** The number of finished jobs whose final statuses have been written back to the JobsManager. */
+	LRSC_STATUSES_WRITTEN_BACK,
+
+	/**
+	 * The number of jobs whose completions have been handled by the
+	 * CompletionScheduler or the JobWorkers.
+	 */
+	LRSC_JOBS_COMPLETED,
+
+	/** The number of jobs that couldn't be given to the JobWorkers because they were full. */
+	LRSC_JOBS_FAILED_TO_START,
+
+	/** The number of requests that were refused because they were too big or too many jobs were waiting. */
+	LRSC_REQUESTS_REJECTED,
+
+	/** The number of requests whose jobs had to wait to start because too many jobs were running. */
+	LRSC_REQUESTS_DEFERRED,
+
+	/** The number of running jobs that were recovered from the JobJournal when the Service started. */
+	LRSC_JOBS_RECOVERED,
+
+	/** The number of status requests that were answered by the server that owns the job. */
+	LRSC_STATUSES_FORWARDED,
+
+	/** The number of requests whose jobs were built and started in the background. */
+	LRSC_REQUESTS_QUEUED,
+
+	/** The number of finished jobs whose retained records have been evicted. */
+	LRSC_JOBS_EVICTED,
+
+	/** The number of counters. */
+	LRSC_NUM_COUNTERS
+} LongRunningStatsCounter;
+
+
+/**
+ * A histogram of latencies with logarithmically sized buckets. All of the
+ * fields are updated atomically so a LatencyHistogram can be shared between
+ * threads without any locking.
+ *
+ * @ingroup example_service
+ */
+typedef struct LatencyHistogram
+{
+	/** The number of latencies in each bucket. */
+	uint64 lh_buckets [LRS_NUM_LATENCY_BUCKETS];
+
+	/** The number of latencies that have been recorded. */
+	uint64 lh_count;
+
+	/** The sum of all of the recorded latencies in nanoseconds. */
+	uint64 lh_total_ns;
+
+	/** The largest recorded latency in nanoseconds. */
+	uint64 lh_max_ns;
+} LatencyHistogram;
+
+
+/**
+ * The counters and latency histograms for a Service.
+ *
+ * @ingroup example_service
+ */
+typedef struct LongRunningStats
+{
+	/** The latencies for each LongRunningStatsOperation. */
+	LatencyHistogram lrs_latencies [LRSO_NUM_OPERATIONS];
+
+	/** The value of each LongRunningStatsCounter. */
+	uint64 lrs_counters [LRSC_NUM_COUNTERS];
+} LongRunningStats;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Initialise a LongRunningStats with all of its counters and
+ * histograms set to zero.
+ *
+ * @param stats_p The LongRunningStats to initialise.
+ * @memberof LongRunningStats
+ */
+LONG_RUNNING_SERVICE_LOCAL void InitLongRunningStats (LongRunningStats *stats_p);
+
+
+/**
+ * Get the current time from a monotonic clock to use as the start
+ * of a latency measurement.
+ *
+ * @return The current time in nanoseconds.
+ * @ingroup example_service
+ */
+LONG_RUNNING_SERVICE_LOCAL uint64 GetLongRunningStatsTime (void);
+
+
+/**
+ * Record the latency of an operation.
+ *
+ * @param stats_p The LongRunningStats to update.
+ * @param op The operation that has finished.
+ * @param start_ns The value from GetLongRunningStatsTime () when the
+ * operation began.
+ * @memberof LongRunningStats
+ */
+LONG_RUNNING_SERVICE_LOCAL void AddLongRunningStatsLatency (LongRunningStats *stats_p, const LongRunningStatsOperation op, const uint64 start_ns);
+
+
+/**
+ * Add to one of the counters.
+ *
+ * @param stats_p The LongRunningStats to update.
+ * @param counter The counter to add to.
+ * @param value The amount to add.
+ * @memberof LongRunningStats
+ */
+LONG_RUNNING_SERVICE_LOCAL void IncrementLongRunningStatsCounter (LongRunningStats *stats_p, const LongRunningStatsCounter counter, const uint64 value);
+
+
+/**
+ * Get a JSON snapshot of the counters along with the count, mean,
+ * median, 99th percentile and maximum latency of each operation.
+ *
+ * @param stats_p The LongRunningStats to get.
+ * @return The JSON object or <code>NULL</code> upon error.
+ * @memberof LongRunningStats
+ */
+LONG_RUNNING_SERVICE_LOCAL json_t *GetLongRunningStatsAsJSON (LongRunningStats *stats_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef LONG_RUNNING_STATS_H */
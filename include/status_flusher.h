@@ -0,0 +1,141 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief A background queue that writes job status changes back in batches.
+ */
+
+#ifndef STATUS_FLUSHER_H
+#define STATUS_FLUSHER_H
+
+#include <pthread.h>
+
+#include "long_running_service.h"
+
+
+/**
+ * The callback that a StatusFlusher uses to write back a batch of jobs.
+ * This is called on the StatusFlusher's own thread without any of its
+ * locks held.
+ *
+ * @param job_ids_p The ids of the jobs whose changes need writing back.
+ * @param num_jobs The number of ids in job_ids_p.
+ * @param callback_data_p The custom data passed to InitStatusFlusher ().
+ * @ingroup example_service
+ */
+typedef void (*StatusFlusherCallback) (const uuid_t *job_ids_p, const uint32 num_jobs, void *callback_data_p);
+
+
+/**
+ * A queue of the jobs whose status changes need to be written to the
+ * JobsManager. Rather than the threads that notice these changes having to
+ * update the JobsManager themselves, they are queued here and a background
+ * thread writes them back in batches.
+ *
+ * @ingroup example_service
+ */
+typedef struct StatusFlusher
+{
+	/** The ids of the jobs that are waiting to be written back. */
+	uuid_t *sf_pending_p;
+
+	/**
+	 * The batch that is being written back. This swaps places with
+	 * sf_pending_p each time so neither needs reallocating.
+	 */
+	uuid_t *sf_flushing_p;
+
+	/** The number of ids in sf_pending_p. */
+	uint32 sf_num_pending;
+
+	/** The number of ids that sf_pending_p and sf_flushing_p have space for. */
+	uint32 sf_capacity;
+
+	/** The longest time in milliseconds that an id will wait before being written back. */
+	uint32 sf_interval_ms;
+
+	/** The function that writes each batch back. */
+	StatusFlusherCallback sf_callback_fn;
+
+	/** The custom data to pass to sf_callback_fn. */
+	void *sf_callback_data_p;
+
+	/** The thread that writes the batches back. */
+	pthread_t sf_thread;
+
+	/** The lock protecting all of the above. */
+	pthread_mutex_t sf_lock;
+
+	/** Used to wake the thread when a batch is full or it needs to stop. */
+	pthread_cond_t sf_wake_up;
+
+	/** Should the thread stop? */
+	bool sf_stop_flag;
+} StatusFlusher;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Initialise a StatusFlusher and start its thread.
+ *
+ * @param flusher_p The StatusFlusher to initialise.
+ * @param batch_size The maximum number of jobs in each batch. When this many are
+ * waiting, they are written back straight away.
+ * @param interval_ms The longest time in milliseconds that a job will wait before
+ * it is written back.
+ * @param callback_fn The function to write back each batch.
+ * @param callback_data_p The custom data to pass to callback_fn.
+ * @return <code>true</code> if the StatusFlusher was initialised successfully,
+ * <code>false</code> otherwise.
+ * @memberof StatusFlusher
+ */
+LONG_RUNNING_SERVICE_LOCAL bool InitStatusFlusher (StatusFlusher *flusher_p, const uint32 batch_size, const uint32 interval_ms, StatusFlusherCallback callback_fn, void *callback_data_p);
+
+
+/**
+ * Write back any jobs that are still waiting and then stop the StatusFlusher's
+ * thread and free its memory.
+ *
+ * @param flusher_p The StatusFlusher to clear.
+ * @memberof StatusFlusher
+ */
+LONG_RUNNING_SERVICE_LOCAL void ClearStatusFlusher (StatusFlusher *flusher_p);
+
+
+/**
+ * Add a job to be written back in the next batch.
+ *
+ * @param flusher_p The StatusFlusher to add the job to.
+ * @param job_id The id of the job.
+ * @return <code>true</code> if the job was queued, <code>false</code> if
+ * the queue is full and the caller needs to write the change itself.
+ * @memberof StatusFlusher
+ */
+LONG_RUNNING_SERVICE_LOCAL bool QueueStatusFlush (StatusFlusher *flusher_p, const uuid_t job_id);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif		/* #ifndef STATUS_FLUSHER_H */
@@ -0,0 +1,288 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+#include <string.h>
+
+#include "completion_scheduler.h"
+#include "job_clock.h"
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+static void *RunCompletionScheduler (void *data_p);
+
+static CompletionTimer *TurnCompletionScheduler (CompletionScheduler *scheduler_p, const time_t now);
+
+static void FreeCompletionTimers (CompletionTimer *timer_p);
+
+
+
+bool InitCompletionScheduler (CompletionScheduler *scheduler_p, const uint32 num_slots, CompletionSchedulerCallback callback_fn, void *callback_data_p)
+{
+	memset (scheduler_p, 0, sizeof (CompletionScheduler));
+
+	scheduler_p -> cs_num_slots = (num_slots > 0) ? num_slots : 256;
+	scheduler_p -> cs_callback_fn = callback_fn;
+	scheduler_p -> cs_callback_data_p = callback_data_p;
+	scheduler_p -> cs_current_time = GetJobClockSeconds (GetJobClockTime ());
+
+	scheduler_p -> cs_slots_pp = (CompletionTimer **) AllocMemoryArray (scheduler_p -> cs_num_slots, sizeof (CompletionTimer *));
+
+	if (scheduler_p -> cs_slots_pp)
+		{
+			if (pthread_mutex_init (& (scheduler_p -> cs_lock), NULL) == 0)
+				{
+					if (pthread_cond_init (& (scheduler_p -> cs_wake_up), NULL) == 0)
+						{
+							if (pthread_create (& (scheduler_p -> cs_thread), NULL, RunCompletionScheduler, scheduler_p) == 0)
+								{
+									return true;
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to start completion scheduler thread");
+								}
+
+							pthread_cond_destroy (& (scheduler_p -> cs_wake_up));
+						}
+
+					pthread_mutex_destroy (& (scheduler_p -> cs_lock));
+				}
+
+			FreeMemory (scheduler_p -> cs_slots_pp);
+			scheduler_p -> cs_slots_pp = NULL;
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " UINT32_FMT " slots for completion scheduler", scheduler_p -> cs_num_slots);
+		}
+
+	return false;
+}
+
+
+void ClearCompletionScheduler (CompletionScheduler *scheduler_p)
+{
+	uint32 i;
+
+	pthread_mutex_lock (& (scheduler_p -> cs_lock));
+	scheduler_p -> cs_stop_flag = true;
+	pthread_cond_signal (& (scheduler_p -> cs_wake_up));
+	pthread_mutex_unlock (& (scheduler_p -> cs_lock));
+
+	pthread_join (scheduler_p -> cs_thread, NULL);
+
+	for (i = 0; i < scheduler_p -> cs_num_slots; ++ i)
+		{
+			FreeCompletionTimers (scheduler_p -> cs_slots_pp [i]);
+		}
+
+	FreeCompletionTimers (scheduler_p -> cs_free_timers_p);
+	FreeMemory (scheduler_p -> cs_slots_pp);
+
+	pthread_cond_destroy (& (scheduler_p -> cs_wake_up));
+	pthread_mutex_destroy (& (scheduler_p -> cs_lock));
+
+	scheduler_p -> cs_slots_pp = NULL;
+	scheduler_p -> cs_free_timers_p = NULL;
+	scheduler_p -> cs_num_timers = 0;
+}
+
+
+bool ScheduleJobCompletion (CompletionScheduler *scheduler_p, const uuid_t job_id, const int64 start, const int64 end)
+{
+	CompletionTimer *timer_p = NULL;
+	bool success_flag = false;
+
+	pthread_mutex_lock (& (scheduler_p -> cs_lock));
+
+	if (scheduler_p -> cs_free_timers_p)
+		{
+			timer_p = scheduler_p -> cs_free_timers_p;
+			scheduler_p -> cs_free_timers_p = timer_p -> ct_next_p;
+		}
+	else
+		{
+			timer_p = (CompletionTimer *) AllocMemory (sizeof (CompletionTimer));
+		}
+
+	if (timer_p)
+		{
+			/*
+			 * The wheel only turns once a second, so the timer goes in the
+			 * slot for the first whole second after the job's end time, or
+			 * the next one that the wheel will reach if that has already gone.
+			 */
+			const time_t end_seconds = GetJobClockSeconds (end);
+			const time_t due = (end_seconds >= scheduler_p -> cs_current_time) ? end_seconds + 1 : (scheduler_p -> cs_current_time) + 1;
+			const uint32 slot = (uint32) (due % (scheduler_p -> cs_num_slots));
+
+			memcpy (timer_p -> ct_id, job_id, sizeof (uuid_t));
+			timer_p -> ct_start = start;
+			timer_p -> ct_end = end;
+			timer_p -> ct_rounds = (uint32) ((due - (scheduler_p -> cs_current_time) - 1) / (scheduler_p -> cs_num_slots));
+
+			timer_p -> ct_next_p = scheduler_p -> cs_slots_pp [slot];
+			scheduler_p -> cs_slots_pp [slot] = timer_p;
+
+			++ (scheduler_p -> cs_num_timers);
+			success_flag = true;
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate completion timer");
+		}
+
+	pthread_mutex_unlock (& (scheduler_p -> cs_lock));
+
+	return success_flag;
+}
+
+
+uint32 GetNumScheduledCompletions (CompletionScheduler *scheduler_p)
+{
+	uint32 num_timers;
+
+	pthread_mutex_lock (& (scheduler_p -> cs_lock));
+	num_timers = scheduler_p -> cs_num_timers;
+	pthread_mutex_unlock (& (scheduler_p -> cs_lock));
+
+	return num_timers;
+}
+
+
+/*
+ * The entry point for the scheduler's thread. Once a second, this turns
+ * the wheel up to the current time and then calls the callback for all
+ * of the timers that have become due, outside of the lock so that new
+ * jobs can still be scheduled while the callbacks are running.
+ */
+static void *RunCompletionScheduler (void *data_p)
+{
+	CompletionScheduler *scheduler_p = (CompletionScheduler *) data_p;
+
+	pthread_mutex_lock (& (scheduler_p -> cs_lock));
+
+	while (! (scheduler_p -> cs_stop_flag))
+		{
+			const int64 now = GetJobClockTime ();
+			CompletionTimer *due_p = TurnCompletionScheduler (scheduler_p, GetJobClockSeconds (now));
+
+			if (due_p)
+				{
+					CompletionTimer *timer_p = due_p;
+					CompletionTimer *last_p = NULL;
+
+					pthread_mutex_unlock (& (scheduler_p -> cs_lock));
+
+					while (timer_p)
+						{
+							scheduler_p -> cs_callback_fn (timer_p -> ct_id, timer_p -> ct_start, timer_p -> ct_end, scheduler_p -> cs_callback_data_p);
+
+							last_p = timer_p;
+							timer_p = timer_p -> ct_next_p;
+						}
+
+					pthread_mutex_lock (& (scheduler_p -> cs_lock));
+
+					/* Keep the timers for reuse */
+					last_p -> ct_next_p = scheduler_p -> cs_free_timers_p;
+					scheduler_p -> cs_free_timers_p = due_p;
+				}
+			else
+				{
+					/*
+					 * The condition variable waits against the wall clock, so
+					 * work out how long it is until the job clock reaches the
+					 * next second and wait that long from the wall clock's now.
+					 */
+					const int64 wait_ns = ((((int64) (scheduler_p -> cs_current_time)) + 1) * LRS_NANOS_PER_SECOND) - now;
+					struct timespec wake_up;
+
+					clock_gettime (CLOCK_REALTIME, &wake_up);
+
+					if (wait_ns > 0)
+						{
+							wake_up.tv_sec += (time_t) (wait_ns / LRS_NANOS_PER_SECOND);
+							wake_up.tv_nsec += (long) (wait_ns % LRS_NANOS_PER_SECOND);
+
+							if (wake_up.tv_nsec >= LRS_NANOS_PER_SECOND)
+								{
+									++ wake_up.tv_sec;
+									wake_up.tv_nsec -= LRS_NANOS_PER_SECOND;
+								}
+						}
+
+					pthread_cond_timedwait (& (scheduler_p -> cs_wake_up), & (scheduler_p -> cs_lock), &wake_up);
+				}
+		}
+
+	pthread_mutex_unlock (& (scheduler_p -> cs_lock));
+
+	return NULL;
+}
+
+
+/*
+ * Move the wheel on, one slot at a time, until it reaches now and return
+ * a list of all of the timers that became due along the way. This must
+ * be called with the lock held.
+ */
+static CompletionTimer *TurnCompletionScheduler (CompletionScheduler *scheduler_p, const time_t now)
+{
+	CompletionTimer *due_p = NULL;
+
+	while (scheduler_p -> cs_current_time < now)
+		{
+			CompletionTimer **timer_pp;
+
+			++ (scheduler_p -> cs_current_time);
+			timer_pp = (scheduler_p -> cs_slots_pp) + ((scheduler_p -> cs_current_time) % (scheduler_p -> cs_num_slots));
+
+			while (*timer_pp)
+				{
+					CompletionTimer *timer_p = *timer_pp;
+
+					if (timer_p -> ct_rounds == 0)
+						{
+							*timer_pp = timer_p -> ct_next_p;
+
+							timer_p -> ct_next_p = due_p;
+							due_p = timer_p;
+
+							-- (scheduler_p -> cs_num_timers);
+						}
+					else
+						{
+							-- (timer_p -> ct_rounds);
+							timer_pp = & (timer_p -> ct_next_p);
+						}
+				}
+		}
+
+	return due_p;
+}
+
+
+static void FreeCompletionTimers (CompletionTimer *timer_p)
+{
+	while (timer_p)
+		{
+			CompletionTimer *next_p = timer_p -> ct_next_p;
+
+			FreeMemory (timer_p);
+			timer_p = next_p;
+		}
+}
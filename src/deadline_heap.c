@@ -0,0 +1,199 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+#include <string.h>
+
+#include "deadline_heap.h"
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+static bool ResizeDeadlineHeap (DeadlineHeap *heap_p, const uint32 capacity);
+
+
+
+bool InitDeadlineHeap (DeadlineHeap *heap_p, const uint32 initial_capacity)
+{
+	heap_p -> dh_deadlines_p = NULL;
+	heap_p -> dh_size = 0;
+	heap_p -> dh_capacity = 0;
+	heap_p -> dh_latest = 0;
+
+	return ResizeDeadlineHeap (heap_p, initial_capacity > 0 ? initial_capacity : 16);
+}
+
+
+void ClearDeadlineHeap (DeadlineHeap *heap_p)
+{
+	if (heap_p -> dh_deadlines_p)
+		{
+			FreeMemory (heap_p -> dh_deadlines_p);
+			heap_p -> dh_deadlines_p = NULL;
+		}
+
+	heap_p -> dh_size = 0;
+	heap_p -> dh_capacity = 0;
+	heap_p -> dh_latest = 0;
+}
+
+
+bool ReserveDeadlineHeap (DeadlineHeap *heap_p, const uint32 num_extra)
+{
+	const uint32 required = heap_p -> dh_size + num_extra;
+
+	if (required > heap_p -> dh_capacity)
+		{
+			uint32 capacity = (heap_p -> dh_capacity > 0) ? heap_p -> dh_capacity : 16;
+
+			while (capacity < required)
+				{
+					capacity <<= 1;
+				}
+
+			return ResizeDeadlineHeap (heap_p, capacity);
+		}
+
+	return true;
+}
+
+
+bool AddToDeadlineHeap (DeadlineHeap *heap_p, const time_t deadline)
+{
+	if (ReserveDeadlineHeap (heap_p, 1))
+		{
+			time_t *deadlines_p = heap_p -> dh_deadlines_p;
+			uint32 i = heap_p -> dh_size;
+
+			/* sift the new deadline up to its place */
+			while (i > 0)
+				{
+					const uint32 parent = (i - 1) >> 1;
+
+					if (deadlines_p [parent] <= deadline)
+						{
+							break;
+						}
+
+					deadlines_p [i] = deadlines_p [parent];
+					i = parent;
+				}
+
+			deadlines_p [i] = deadline;
+			++ (heap_p -> dh_size);
+
+			if (deadline > heap_p -> dh_latest)
+				{
+					heap_p -> dh_latest = deadline;
+				}
+
+			return true;
+		}
+
+	return false;
+}
+
+
+uint32 RemoveExpiredDeadlines (DeadlineHeap *heap_p, const time_t now)
+{
+	time_t *deadlines_p = heap_p -> dh_deadlines_p;
+	uint32 num_removed = 0;
+
+	while ((heap_p -> dh_size > 0) && (*deadlines_p < now))
+		{
+			const uint32 size = -- (heap_p -> dh_size);
+			const time_t last = deadlines_p [size];
+			uint32 i = 0;
+
+			/* sift the last deadline down from the top */
+			for (;;)
+				{
+					uint32 child = (i << 1) + 1;
+
+					if (child >= size)
+						{
+							break;
+						}
+
+					if ((child + 1 < size) && (deadlines_p [child + 1] < deadlines_p [child]))
+						{
+							++ child;
+						}
+
+					if (last <= deadlines_p [child])
+						{
+							break;
+						}
+
+					deadlines_p [i] = deadlines_p [child];
+					i = child;
+				}
+
+			deadlines_p [i] = last;
+			++ num_removed;
+		}
+
+	if (heap_p -> dh_size == 0)
+		{
+			heap_p -> dh_latest = 0;
+		}
+
+	return num_removed;
+}
+
+
+bool HasOutstandingDeadlines (DeadlineHeap *heap_p, const time_t now)
+{
+	RemoveExpiredDeadlines (heap_p, now);
+
+	return (heap_p -> dh_size > 0);
+}
+
+
+time_t GetEarliestDeadline (const DeadlineHeap *heap_p)
+{
+	return (heap_p -> dh_size > 0) ? * (heap_p -> dh_deadlines_p) : 0;
+}
+
+
+time_t GetLatestDeadline (const DeadlineHeap *heap_p)
+{
+	return heap_p -> dh_latest;
+}
+
+
+static bool ResizeDeadlineHeap (DeadlineHeap *heap_p, const uint32 capacity)
+{
+	time_t *deadlines_p = (time_t *) AllocMemoryArray (capacity, sizeof (time_t));
+
+	if (deadlines_p)
+		{
+			if (heap_p -> dh_deadlines_p)
+				{
+					memcpy (deadlines_p, heap_p -> dh_deadlines_p, (heap_p -> dh_size) * sizeof (time_t));
+					FreeMemory (heap_p -> dh_deadlines_p);
+				}
+
+			heap_p -> dh_deadlines_p = deadlines_p;
+			heap_p -> dh_capacity = capacity;
+
+			return true;
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate space for " UINT32_FMT " deadlines", capacity);
+		}
+
+	return false;
+}
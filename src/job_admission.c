@@ -0,0 +1,990 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+#include <string.h>
+#include <time.h>
+
+#include "job_admission.h"
+#include "job_clock.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "streams.h"
+
+
+/*
+ * How long the thread waits between checks when nothing has woken it,
+ * just in case it misses a wake up.
+ */
+#define JA_IDLE_WAIT_NS (LRS_NANOS_PER_SECOND)
+
+/* The number of buckets in the table of users. */
+#define JA_NUM_USER_BUCKETS (64)
+
+/* The smallest number of entries in the table of job ids once it is needed. */
+#define JA_MIN_JOB_SLOTS (1024)
+
+
+static void *RunJobAdmission (void *data_p);
+
+static JobAdmissionRequest *TakeStartableJobRequest (JobAdmission *admission_p, JobAdmissionReservation **reservation_pp);
+
+static bool DoJobsFit (const JobAdmission *admission_p, const char *user_s, const uint32 num_jobs, const bool work_flag, bool *global_limit_flag_p);
+
+static JobAdmissionReservation *ReserveJobs (JobAdmission *admission_p, const char *user_s, const uint32 num_jobs, const bool work_flag);
+
+static void UncountJobs (JobAdmission *admission_p, JobAdmissionReservation *reservation_p, const uint32 num_jobs);
+
+static void FreeJobReservationIfDone (JobAdmission *admission_p, JobAdmissionReservation *reservation_p);
+
+static JobAdmissionUser *FindJobAdmissionUser (const JobAdmission *admission_p, const char *user_s);
+
+static JobAdmissionUser *AddJobAdmissionUser (JobAdmission *admission_p, const char *user_s);
+
+static void RemoveJobAdmissionUser (JobAdmission *admission_p, JobAdmissionUser *user_p);
+
+static uint32 GetJobAdmissionUserBucket (const char *user_s);
+
+static bool AddJobAdmissionJob (JobAdmission *admission_p, const uuid_t id, JobAdmissionReservation *reservation_p, const uint32 num_jobs);
+
+static JobAdmissionJob *FindJobAdmissionJob (const JobAdmission *admission_p, const uuid_t id, const bool added_flag);
+
+static void RemoveJobAdmissionJob (JobAdmission *admission_p, JobAdmissionJob *job_p);
+
+static bool GrowJobAdmissionJobs (JobAdmission *admission_p);
+
+static uint32 GetJobAdmissionJobSlot (const JobAdmission *admission_p, const uuid_t id);
+
+static void FreeJobAdmissionRequest (JobAdmissionRequest *request_p);
+
+static const char *GetJobAdmissionUserKey (const char *user_s);
+
+static bool HasJobAdmissionQuotas (const JobAdmission *admission_p);
+
+
+
+bool InitJobAdmission (JobAdmission *admission_p, JobAdmissionCallback callback_fn)
+{
+	memset (admission_p, 0, sizeof (JobAdmission));
+
+	admission_p -> ja_callback_fn = callback_fn;
+	admission_p -> ja_users_pp = (JobAdmissionUser **) AllocMemoryArray (JA_NUM_USER_BUCKETS, sizeof (JobAdmissionUser *));
+
+	if (admission_p -> ja_users_pp)
+		{
+			if (pthread_mutex_init (& (admission_p -> ja_lock), NULL) == 0)
+				{
+					if (pthread_cond_init (& (admission_p -> ja_wake_up), NULL) == 0)
+						{
+							if (pthread_create (& (admission_p -> ja_thread), NULL, RunJobAdmission, admission_p) == 0)
+								{
+									return true;
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to start job admission thread");
+								}
+
+							pthread_cond_destroy (& (admission_p -> ja_wake_up));
+						}
+
+					pthread_mutex_destroy (& (admission_p -> ja_lock));
+				}
+
+			FreeMemory (admission_p -> ja_users_pp);
+			admission_p -> ja_users_pp = NULL;
+		}
+
+	return false;
+}
+
+
+void ClearJobAdmission (JobAdmission *admission_p)
+{
+	JobAdmissionReservation *reservation_p;
+	JobAdmissionRequest *request_p;
+	uint32 i;
+
+	pthread_mutex_lock (& (admission_p -> ja_lock));
+	admission_p -> ja_stop_flag = true;
+	pthread_cond_signal (& (admission_p -> ja_wake_up));
+	pthread_mutex_unlock (& (admission_p -> ja_lock));
+
+	pthread_join (admission_p -> ja_thread, NULL);
+
+	reservation_p = admission_p -> ja_reservations_p;
+	while (reservation_p)
+		{
+			JobAdmissionReservation *next_p = reservation_p -> jar_next_p;
+
+			FreeMemory (reservation_p);
+			reservation_p = next_p;
+		}
+
+	request_p = admission_p -> ja_first_request_p;
+	while (request_p)
+		{
+			JobAdmissionRequest *next_p = request_p -> jarq_next_p;
+
+			FreeJobAdmissionRequest (request_p);
+			request_p = next_p;
+		}
+
+	for (i = 0; i < JA_NUM_USER_BUCKETS; ++ i)
+		{
+			JobAdmissionUser *user_p = admission_p -> ja_users_pp [i];
+
+			while (user_p)
+				{
+					JobAdmissionUser *next_p = user_p -> jau_next_p;
+
+					FreeCopiedString (user_p -> jau_user_s);
+					FreeMemory (user_p);
+					user_p = next_p;
+				}
+		}
+
+	if (admission_p -> ja_jobs_p)
+		{
+			FreeMemory (admission_p -> ja_jobs_p);
+		}
+
+	FreeMemory (admission_p -> ja_users_pp);
+
+	pthread_cond_destroy (& (admission_p -> ja_wake_up));
+	pthread_mutex_destroy (& (admission_p -> ja_lock));
+
+	admission_p -> ja_users_pp = NULL;
+	admission_p -> ja_jobs_p = NULL;
+	admission_p -> ja_num_job_slots = 0;
+	admission_p -> ja_num_job_entries = 0;
+	admission_p -> ja_reservations_p = NULL;
+	admission_p -> ja_first_request_p = NULL;
+	admission_p -> ja_last_request_p = NULL;
+	admission_p -> ja_num_admitted = 0;
+	admission_p -> ja_num_admitted_work = 0;
+	admission_p -> ja_num_deferred = 0;
+}
+
+
+void SetJobAdmissionLimits (JobAdmission *admission_p, const uint32 max_jobs_per_request, const uint32 max_jobs_per_user, const uint32 max_jobs_in_flight, const uint32 max_work_jobs)
+{
+	pthread_mutex_lock (& (admission_p -> ja_lock));
+
+	admission_p -> ja_max_jobs_per_request = max_jobs_per_request;
+	admission_p -> ja_max_jobs_per_user = max_jobs_per_user;
+	admission_p -> ja_max_jobs_in_flight = max_jobs_in_flight;
+	admission_p -> ja_max_work_jobs = max_work_jobs;
+
+	pthread_mutex_unlock (& (admission_p -> ja_lock));
+}
+
+
+bool IsJobRequestAllowed (const JobAdmission *admission_p, const uint32 num_jobs, const JobKind kind)
+{
+	/*
+	 * A request that is bigger than any of the limits could never
+	 * fit, so there is no point waiting for it.
+	 */
+	if ((admission_p -> ja_max_jobs_per_request > 0) && (num_jobs > admission_p -> ja_max_jobs_per_request))
+		{
+			return false;
+		}
+
+	if ((admission_p -> ja_max_jobs_per_user > 0) && (num_jobs > admission_p -> ja_max_jobs_per_user))
+		{
+			return false;
+		}
+
+	if ((admission_p -> ja_max_jobs_in_flight > 0) && (num_jobs > admission_p -> ja_max_jobs_in_flight))
+		{
+			return false;
+		}
+
+	if ((kind != JK_SLEEP) && (admission_p -> ja_max_work_jobs > 0) && (num_jobs > admission_p -> ja_max_work_jobs))
+		{
+			return false;
+		}
+
+	return true;
+}
+
+
+JobAdmissionResult AdmitJobs (JobAdmission *admission_p, const char *user_s, const uint32 num_jobs, const JobKind kind, JobAdmissionReservation **reservation_pp)
+{
+	JobAdmissionResult result = JAR_REJECTED;
+
+	*reservation_pp = NULL;
+
+	if (IsJobRequestAllowed (admission_p, num_jobs, kind))
+		{
+			if (HasJobAdmissionQuotas (admission_p))
+				{
+					bool global_limit_flag = false;
+
+					pthread_mutex_lock (& (admission_p -> ja_lock));
+
+					/*
+					 * Anything already waiting goes first, so only start straight
+					 * away if the queue is empty. The thread will start this
+					 * request as soon as it can if it only has to wait for
+					 * its own user's jobs.
+					 */
+					if ((! (admission_p -> ja_first_request_p)) && (DoJobsFit (admission_p, user_s, num_jobs, (kind != JK_SLEEP), &global_limit_flag)))
+						{
+							*reservation_pp = ReserveJobs (admission_p, user_s, num_jobs, (kind != JK_SLEEP));
+
+							if (*reservation_pp)
+								{
+									result = JAR_ADMITTED;
+								}
+						}
+					else if ((admission_p -> ja_max_jobs_in_flight == 0) || ((admission_p -> ja_num_deferred) + num_jobs <= admission_p -> ja_max_jobs_in_flight))
+						{
+							/*
+							 * Count the jobs as waiting now rather than in DeferJobs so that
+							 * other requests can't take their places in the meantime.
+							 */
+							admission_p -> ja_num_deferred += num_jobs;
+							result = JAR_DEFERRED;
+						}
+
+					pthread_mutex_unlock (& (admission_p -> ja_lock));
+				}
+			else
+				{
+					result = JAR_ADMITTED;
+				}
+		}
+
+	return result;
+}
+
+
+bool DeferJobs (JobAdmission *admission_p, const char *user_s, const JobAdmissionItem *items_p, const uint32 num_items, const uint32 num_jobs, const JobKind kind, void *callback_data_p)
+{
+	JobAdmissionRequest *request_p = (JobAdmissionRequest *) AllocMemory (sizeof (JobAdmissionRequest));
+
+	if (request_p)
+		{
+			memset (request_p, 0, sizeof (JobAdmissionRequest));
+
+			request_p -> jarq_user_s = EasyCopyToNewString (GetJobAdmissionUserKey (user_s));
+			request_p -> jarq_items_p = (JobAdmissionItem *) AllocMemoryArray (num_items, sizeof (JobAdmissionItem));
+
+			if ((request_p -> jarq_user_s) && (request_p -> jarq_items_p))
+				{
+					uint32 i;
+
+					memcpy (request_p -> jarq_items_p, items_p, num_items * sizeof (JobAdmissionItem));
+					request_p -> jarq_num_items = num_items;
+					request_p -> jarq_num_jobs = num_jobs;
+					request_p -> jarq_kind = kind;
+					request_p -> jarq_callback_data_p = callback_data_p;
+
+					pthread_mutex_lock (& (admission_p -> ja_lock));
+
+					/* Index the jobs so that IsJobDeferred doesn't need to search the queue */
+					for (i = 0; i < num_items; ++ i)
+						{
+							if (!AddJobAdmissionJob (admission_p, items_p [i].jai_id, NULL, 0))
+								{
+									break;
+								}
+						}
+
+					if (i == num_items)
+						{
+							if (admission_p -> ja_last_request_p)
+								{
+									admission_p -> ja_last_request_p -> jarq_next_p = request_p;
+								}
+							else
+								{
+									admission_p -> ja_first_request_p = request_p;
+								}
+
+							admission_p -> ja_last_request_p = request_p;
+
+							pthread_cond_signal (& (admission_p -> ja_wake_up));
+							pthread_mutex_unlock (& (admission_p -> ja_lock));
+
+							return true;
+						}
+
+					while (i > 0)
+						{
+							JobAdmissionJob *job_p;
+
+							-- i;
+							job_p = FindJobAdmissionJob (admission_p, items_p [i].jai_id, false);
+
+							if (job_p)
+								{
+									RemoveJobAdmissionJob (admission_p, job_p);
+								}
+						}
+
+					pthread_mutex_unlock (& (admission_p -> ja_lock));
+				}
+
+			FreeJobAdmissionRequest (request_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to defer " UINT32_FMT " jobs", num_jobs);
+	CancelDeferredJobs (admission_p, num_jobs);
+
+	return false;
+}
+
+
+void CancelDeferredJobs (JobAdmission *admission_p, const uint32 num_jobs)
+{
+	pthread_mutex_lock (& (admission_p -> ja_lock));
+
+	admission_p -> ja_num_deferred = (admission_p -> ja_num_deferred > num_jobs) ? (admission_p -> ja_num_deferred) - num_jobs : 0;
+
+	/* A request that was behind these in the global limit may fit now */
+	if (admission_p -> ja_first_request_p)
+		{
+			pthread_cond_signal (& (admission_p -> ja_wake_up));
+		}
+
+	pthread_mutex_unlock (& (admission_p -> ja_lock));
+}
+
+
+void AddJobToReservation (JobAdmission *admission_p, JobAdmissionReservation *reservation_p, const uuid_t job_id, const uint32 num_jobs)
+{
+	if (reservation_p)
+		{
+			uint32 num_to_add;
+
+			pthread_mutex_lock (& (admission_p -> ja_lock));
+
+			/* Never count more jobs than were admitted */
+			num_to_add = (reservation_p -> jar_num_jobs) - (reservation_p -> jar_num_added);
+
+			if (num_jobs < num_to_add)
+				{
+					num_to_add = num_jobs;
+				}
+
+			if ((num_to_add > 0) && AddJobAdmissionJob (admission_p, job_id, reservation_p, num_to_add))
+				{
+					reservation_p -> jar_num_added += num_to_add;
+				}
+
+			pthread_mutex_unlock (& (admission_p -> ja_lock));
+		}
+}
+
+
+void FinishJobReservation (JobAdmission *admission_p, JobAdmissionReservation *reservation_p)
+{
+	if (reservation_p)
+		{
+			pthread_mutex_lock (& (admission_p -> ja_lock));
+
+			UncountJobs (admission_p, reservation_p, (reservation_p -> jar_num_jobs) - (reservation_p -> jar_num_added));
+			reservation_p -> jar_finished_flag = true;
+			FreeJobReservationIfDone (admission_p, reservation_p);
+
+			pthread_mutex_unlock (& (admission_p -> ja_lock));
+		}
+}
+
+
+void ReleaseAdmittedJob (JobAdmission *admission_p, const uuid_t job_id)
+{
+	JobAdmissionJob *job_p;
+
+	pthread_mutex_lock (& (admission_p -> ja_lock));
+
+	job_p = FindJobAdmissionJob (admission_p, job_id, true);
+
+	if (job_p)
+		{
+			JobAdmissionReservation *reservation_p = job_p -> jaj_reservation_p;
+			const uint32 num_jobs = job_p -> jaj_num_jobs;
+
+			RemoveJobAdmissionJob (admission_p, job_p);
+
+			reservation_p -> jar_num_added -= num_jobs;
+			UncountJobs (admission_p, reservation_p, num_jobs);
+			FreeJobReservationIfDone (admission_p, reservation_p);
+		}
+
+	pthread_mutex_unlock (& (admission_p -> ja_lock));
+}
+
+
+bool IsJobDeferred (JobAdmission *admission_p, const uuid_t job_id)
+{
+	bool deferred_flag;
+
+	pthread_mutex_lock (& (admission_p -> ja_lock));
+	deferred_flag = (FindJobAdmissionJob (admission_p, job_id, false) != NULL);
+	pthread_mutex_unlock (& (admission_p -> ja_lock));
+
+	return deferred_flag;
+}
+
+
+uint32 GetNumAdmittedJobs (JobAdmission *admission_p)
+{
+	uint32 num_jobs;
+
+	pthread_mutex_lock (& (admission_p -> ja_lock));
+	num_jobs = (admission_p -> ja_num_admitted) + (admission_p -> ja_num_deferred);
+	pthread_mutex_unlock (& (admission_p -> ja_lock));
+
+	return num_jobs;
+}
+
+
+static void *RunJobAdmission (void *data_p)
+{
+	JobAdmission *admission_p = (JobAdmission *) data_p;
+
+	pthread_mutex_lock (& (admission_p -> ja_lock));
+
+	while (! (admission_p -> ja_stop_flag))
+		{
+			JobAdmissionReservation *reservation_p = NULL;
+			JobAdmissionRequest *request_p = TakeStartableJobRequest (admission_p, &reservation_p);
+
+			if (request_p)
+				{
+					pthread_mutex_unlock (& (admission_p -> ja_lock));
+
+					/* The callback takes over the reservation */
+					admission_p -> ja_callback_fn (request_p -> jarq_items_p, request_p -> jarq_num_items, request_p -> jarq_kind, reservation_p, request_p -> jarq_callback_data_p);
+					FreeJobAdmissionRequest (request_p);
+
+					pthread_mutex_lock (& (admission_p -> ja_lock));
+				}
+			else
+				{
+					/*
+					 * Nothing can start until some jobs stop being counted, which
+					 * wakes us up. The condition variable waits against the wall clock.
+					 */
+					struct timespec wake_up;
+
+					clock_gettime (CLOCK_REALTIME, &wake_up);
+					wake_up.tv_sec += (time_t) (JA_IDLE_WAIT_NS / LRS_NANOS_PER_SECOND);
+
+					pthread_cond_timedwait (& (admission_p -> ja_wake_up), & (admission_p -> ja_lock), &wake_up);
+				}
+		}
+
+	pthread_mutex_unlock (& (admission_p -> ja_lock));
+
+	return NULL;
+}
+
+
+/*
+ * Find the first waiting request that can start now, reserve its jobs and
+ * take it off the queue. Requests that are only waiting for their own
+ * user's jobs to finish are skipped over, but once a request is found that
+ * is waiting for a global limit, nothing after it can start so that big
+ * requests aren't starved by a stream of smaller ones. This must be called
+ * with the lock held.
+ */
+static JobAdmissionRequest *TakeStartableJobRequest (JobAdmission *admission_p, JobAdmissionReservation **reservation_pp)
+{
+	JobAdmissionRequest **request_pp = & (admission_p -> ja_first_request_p);
+	JobAdmissionRequest *previous_p = NULL;
+
+	while (*request_pp)
+		{
+			JobAdmissionRequest *request_p = *request_pp;
+			const bool work_flag = (request_p -> jarq_kind != JK_SLEEP);
+			bool global_limit_flag = false;
+
+			if (DoJobsFit (admission_p, request_p -> jarq_user_s, request_p -> jarq_num_jobs, work_flag, &global_limit_flag))
+				{
+					*reservation_pp = ReserveJobs (admission_p, request_p -> jarq_user_s, request_p -> jarq_num_jobs, work_flag);
+
+					if (*reservation_pp)
+						{
+							uint32 i;
+
+							*request_pp = request_p -> jarq_next_p;
+
+							if (admission_p -> ja_last_request_p == request_p)
+								{
+									admission_p -> ja_last_request_p = previous_p;
+								}
+
+							for (i = 0; i < request_p -> jarq_num_items; ++ i)
+								{
+									JobAdmissionJob *job_p = FindJobAdmissionJob (admission_p, request_p -> jarq_items_p [i].jai_id, false);
+
+									if (job_p)
+										{
+											RemoveJobAdmissionJob (admission_p, job_p);
+										}
+								}
+
+							admission_p -> ja_num_deferred -= request_p -> jarq_num_jobs;
+							request_p -> jarq_next_p = NULL;
+
+							return request_p;
+						}
+
+					/* Out of memory so try again later */
+					break;
+				}
+			else if (global_limit_flag)
+				{
+					break;
+				}
+
+			previous_p = request_p;
+			request_pp = & (request_p -> jarq_next_p);
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Check whether some more jobs would fit within the quotas and, if not,
+ * whether it is a global limit that they are over. This must be called
+ * with the lock held.
+ */
+static bool DoJobsFit (const JobAdmission *admission_p, const char *user_s, const uint32 num_jobs, const bool work_flag, bool *global_limit_flag_p)
+{
+	if ((admission_p -> ja_max_jobs_in_flight > 0) && (((uint64) (admission_p -> ja_num_admitted)) + num_jobs > admission_p -> ja_max_jobs_in_flight))
+		{
+			*global_limit_flag_p = true;
+			return false;
+		}
+
+	if (work_flag && (admission_p -> ja_max_work_jobs > 0) && (((uint64) (admission_p -> ja_num_admitted_work)) + num_jobs > admission_p -> ja_max_work_jobs))
+		{
+			*global_limit_flag_p = true;
+			return false;
+		}
+
+	if (admission_p -> ja_max_jobs_per_user > 0)
+		{
+			const JobAdmissionUser *user_p = FindJobAdmissionUser (admission_p, user_s);
+			const uint64 num_for_user = ((uint64) (user_p ? user_p -> jau_num_jobs : 0)) + num_jobs;
+
+			if (num_for_user > admission_p -> ja_max_jobs_per_user)
+				{
+					return false;
+				}
+		}
+
+	return true;
+}
+
+
+/*
+ * Count some jobs against the quotas until they are released. This must be
+ * called with the lock held.
+ */
+static JobAdmissionReservation *ReserveJobs (JobAdmission *admission_p, const char *user_s, const uint32 num_jobs, const bool work_flag)
+{
+	JobAdmissionReservation *reservation_p = (JobAdmissionReservation *) AllocMemory (sizeof (JobAdmissionReservation));
+
+	if (reservation_p)
+		{
+			JobAdmissionUser *user_p = FindJobAdmissionUser (admission_p, user_s);
+
+			if (!user_p)
+				{
+					user_p = AddJobAdmissionUser (admission_p, user_s);
+				}
+
+			if (user_p)
+				{
+					memset (reservation_p, 0, sizeof (JobAdmissionReservation));
+
+					reservation_p -> jar_user_p = user_p;
+					reservation_p -> jar_work_flag = work_flag;
+					reservation_p -> jar_num_jobs = num_jobs;
+
+					reservation_p -> jar_next_p = admission_p -> ja_reservations_p;
+
+					if (admission_p -> ja_reservations_p)
+						{
+							admission_p -> ja_reservations_p -> jar_prev_p = reservation_p;
+						}
+
+					admission_p -> ja_reservations_p = reservation_p;
+
+					user_p -> jau_num_jobs += num_jobs;
+					++ (user_p -> jau_num_reservations);
+
+					admission_p -> ja_num_admitted += num_jobs;
+
+					if (work_flag)
+						{
+							admission_p -> ja_num_admitted_work += num_jobs;
+						}
+
+					return reservation_p;
+				}
+
+			FreeMemory (reservation_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to reserve " UINT32_FMT " jobs", num_jobs);
+
+	return NULL;
+}
+
+
+/*
+ * Stop counting some of a reservation's jobs and, if a request is waiting,
+ * wake the thread since it may fit now. This must be called with the lock held.
+ */
+static void UncountJobs (JobAdmission *admission_p, JobAdmissionReservation *reservation_p, const uint32 num_jobs)
+{
+	if (num_jobs > 0)
+		{
+			reservation_p -> jar_num_jobs -= num_jobs;
+			reservation_p -> jar_user_p -> jau_num_jobs -= num_jobs;
+			admission_p -> ja_num_admitted -= num_jobs;
+
+			if (reservation_p -> jar_work_flag)
+				{
+					admission_p -> ja_num_admitted_work -= num_jobs;
+				}
+
+			if (admission_p -> ja_first_request_p)
+				{
+					pthread_cond_signal (& (admission_p -> ja_wake_up));
+				}
+		}
+}
+
+
+/*
+ * Free a reservation once it has been finished and none of its jobs are
+ * counted any more. This must be called with the lock held.
+ */
+static void FreeJobReservationIfDone (JobAdmission *admission_p, JobAdmissionReservation *reservation_p)
+{
+	if ((reservation_p -> jar_finished_flag) && (reservation_p -> jar_num_jobs == 0))
+		{
+			JobAdmissionUser *user_p = reservation_p -> jar_user_p;
+
+			if (reservation_p -> jar_prev_p)
+				{
+					reservation_p -> jar_prev_p -> jar_next_p = reservation_p -> jar_next_p;
+				}
+			else
+				{
+					admission_p -> ja_reservations_p = reservation_p -> jar_next_p;
+				}
+
+			if (reservation_p -> jar_next_p)
+				{
+					reservation_p -> jar_next_p -> jar_prev_p = reservation_p -> jar_prev_p;
+				}
+
+			-- (user_p -> jau_num_reservations);
+
+			if ((user_p -> jau_num_reservations == 0) && (user_p -> jau_num_jobs == 0))
+				{
+					RemoveJobAdmissionUser (admission_p, user_p);
+				}
+
+			FreeMemory (reservation_p);
+		}
+}
+
+
+static JobAdmissionUser *FindJobAdmissionUser (const JobAdmission *admission_p, const char *user_s)
+{
+	const char *key_s = GetJobAdmissionUserKey (user_s);
+	JobAdmissionUser *user_p = admission_p -> ja_users_pp [GetJobAdmissionUserBucket (key_s)];
+
+	while (user_p && (strcmp (user_p -> jau_user_s, key_s) != 0))
+		{
+			user_p = user_p -> jau_next_p;
+		}
+
+	return user_p;
+}
+
+
+static JobAdmissionUser *AddJobAdmissionUser (JobAdmission *admission_p, const char *user_s)
+{
+	JobAdmissionUser *user_p = (JobAdmissionUser *) AllocMemory (sizeof (JobAdmissionUser));
+
+	if (user_p)
+		{
+			const char *key_s = GetJobAdmissionUserKey (user_s);
+
+			user_p -> jau_user_s = EasyCopyToNewString (key_s);
+
+			if (user_p -> jau_user_s)
+				{
+					const uint32 bucket = GetJobAdmissionUserBucket (key_s);
+
+					user_p -> jau_num_jobs = 0;
+					user_p -> jau_num_reservations = 0;
+					user_p -> jau_next_p = admission_p -> ja_users_pp [bucket];
+					admission_p -> ja_users_pp [bucket] = user_p;
+
+					return user_p;
+				}
+
+			FreeMemory (user_p);
+		}
+
+	return NULL;
+}
+
+
+static void RemoveJobAdmissionUser (JobAdmission *admission_p, JobAdmissionUser *user_p)
+{
+	JobAdmissionUser **user_pp = (admission_p -> ja_users_pp) + GetJobAdmissionUserBucket (user_p -> jau_user_s);
+
+	while (*user_pp != user_p)
+		{
+			user_pp = & ((*user_pp) -> jau_next_p);
+		}
+
+	*user_pp = user_p -> jau_next_p;
+
+	FreeCopiedString (user_p -> jau_user_s);
+	FreeMemory (user_p);
+}
+
+
+/*
+ * The djb2 string hash.
+ */
+static uint32 GetJobAdmissionUserBucket (const char *user_s)
+{
+	uint32 hash = 5381;
+
+	while (*user_s)
+		{
+			hash = (hash * 33) ^ (unsigned char) (*user_s);
+			++ user_s;
+		}
+
+	return hash % JA_NUM_USER_BUCKETS;
+}
+
+
+/*
+ * Add a job to the table of job ids, growing the table if it is more than
+ * half full. This must be called with the lock held.
+ */
+static bool AddJobAdmissionJob (JobAdmission *admission_p, const uuid_t id, JobAdmissionReservation *reservation_p, const uint32 num_jobs)
+{
+	JobAdmissionJob *job_p;
+	uint32 slot;
+
+	if (((admission_p -> ja_num_job_entries) + 1) * 2 > admission_p -> ja_num_job_slots)
+		{
+			if (!GrowJobAdmissionJobs (admission_p))
+				{
+					return false;
+				}
+		}
+
+	slot = GetJobAdmissionJobSlot (admission_p, id);
+
+	while (admission_p -> ja_jobs_p [slot].jaj_used_flag)
+		{
+			slot = (slot + 1) & ((admission_p -> ja_num_job_slots) - 1);
+		}
+
+	job_p = (admission_p -> ja_jobs_p) + slot;
+
+	memcpy (job_p -> jaj_id, id, sizeof (uuid_t));
+	job_p -> jaj_reservation_p = reservation_p;
+	job_p -> jaj_num_jobs = num_jobs;
+	job_p -> jaj_used_flag = true;
+
+	++ (admission_p -> ja_num_job_entries);
+
+	return true;
+}
+
+
+/*
+ * Find a job in the table of job ids. If added_flag is true, only a job that
+ * has been added to a reservation is found, otherwise only a deferred one is.
+ * This must be called with the lock held.
+ */
+static JobAdmissionJob *FindJobAdmissionJob (const JobAdmission *admission_p, const uuid_t id, const bool added_flag)
+{
+	if (admission_p -> ja_num_job_entries > 0)
+		{
+			uint32 slot = GetJobAdmissionJobSlot (admission_p, id);
+
+			while (admission_p -> ja_jobs_p [slot].jaj_used_flag)
+				{
+					JobAdmissionJob *job_p = (admission_p -> ja_jobs_p) + slot;
+
+					if ((memcmp (job_p -> jaj_id, id, sizeof (uuid_t)) == 0) && ((job_p -> jaj_reservation_p != NULL) == added_flag))
+						{
+							return job_p;
+						}
+
+					slot = (slot + 1) & ((admission_p -> ja_num_job_slots) - 1);
+				}
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Remove an entry from the table of job ids, moving back any of the
+ * entries after it that would otherwise no longer be found. This must
+ * be called with the lock held.
+ */
+static void RemoveJobAdmissionJob (JobAdmission *admission_p, JobAdmissionJob *job_p)
+{
+	const uint32 mask = (admission_p -> ja_num_job_slots) - 1;
+	uint32 hole = (uint32) (job_p - (admission_p -> ja_jobs_p));
+	uint32 slot = hole;
+
+	for (;;)
+		{
+			uint32 home;
+
+			slot = (slot + 1) & mask;
+
+			if (! (admission_p -> ja_jobs_p [slot].jaj_used_flag))
+				{
+					break;
+				}
+
+			home = GetJobAdmissionJobSlot (admission_p, admission_p -> ja_jobs_p [slot].jaj_id);
+
+			/* Leave the entry where it is if its home is between the hole and it */
+			if ((hole <= slot) ? ((hole < home) && (home <= slot)) : ((hole < home) || (home <= slot)))
+				{
+					continue;
+				}
+
+			admission_p -> ja_jobs_p [hole] = admission_p -> ja_jobs_p [slot];
+			hole = slot;
+		}
+
+	admission_p -> ja_jobs_p [hole].jaj_used_flag = false;
+	-- (admission_p -> ja_num_job_entries);
+}
+
+
+static bool GrowJobAdmissionJobs (JobAdmission *admission_p)
+{
+	const uint32 num_old_slots = admission_p -> ja_num_job_slots;
+	const uint32 num_new_slots = (num_old_slots > 0) ? num_old_slots * 2 : JA_MIN_JOB_SLOTS;
+	JobAdmissionJob *old_jobs_p = admission_p -> ja_jobs_p;
+	JobAdmissionJob *new_jobs_p;
+	uint32 i;
+
+	if (num_new_slots <= num_old_slots)
+		{
+			return false;
+		}
+
+	new_jobs_p = (JobAdmissionJob *) AllocMemoryArray (num_new_slots, sizeof (JobAdmissionJob));
+
+	if (!new_jobs_p)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to grow the job admission table to " UINT32_FMT " entries", num_new_slots);
+			return false;
+		}
+
+	memset (new_jobs_p, 0, num_new_slots * sizeof (JobAdmissionJob));
+
+	admission_p -> ja_jobs_p = new_jobs_p;
+	admission_p -> ja_num_job_slots = num_new_slots;
+	admission_p -> ja_num_job_entries = 0;
+
+	for (i = 0; i < num_old_slots; ++ i)
+		{
+			if (old_jobs_p [i].jaj_used_flag)
+				{
+					uint32 slot = GetJobAdmissionJobSlot (admission_p, old_jobs_p [i].jaj_id);
+
+					while (new_jobs_p [slot].jaj_used_flag)
+						{
+							slot = (slot + 1) & (num_new_slots - 1);
+						}
+
+					new_jobs_p [slot] = old_jobs_p [i];
+					++ (admission_p -> ja_num_job_entries);
+				}
+		}
+
+	if (old_jobs_p)
+		{
+			FreeMemory (old_jobs_p);
+		}
+
+	return true;
+}
+
+
+/*
+ * Since uuids are random, their first few bytes are already well
+ * distributed and can be used as the hash directly.
+ */
+static uint32 GetJobAdmissionJobSlot (const JobAdmission *admission_p, const uuid_t id)
+{
+	uint32 hash;
+
+	memcpy (&hash, id, sizeof (uint32));
+
+	return hash & ((admission_p -> ja_num_job_slots) - 1);
+}
+
+
+static void FreeJobAdmissionRequest (JobAdmissionRequest *request_p)
+{
+	if (request_p -> jarq_user_s)
+		{
+			FreeCopiedString (request_p -> jarq_user_s);
+		}
+
+	if (request_p -> jarq_items_p)
+		{
+			FreeMemory (request_p -> jarq_items_p);
+		}
+
+	FreeMemory (request_p);
+}
+
+
+/*
+ * Jobs from users that we don't know share a single quota.
+ */
+static const char *GetJobAdmissionUserKey (const char *user_s)
+{
+	return user_s ? user_s : "";
+}
+
+
+static bool HasJobAdmissionQuotas (const JobAdmission *admission_p)
+{
+	return ((admission_p -> ja_max_jobs_per_user > 0) || (admission_p -> ja_max_jobs_in_flight > 0) || (admission_p -> ja_max_work_jobs > 0));
+}
@@ -0,0 +1,422 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+#include <string.h>
+
+#include "job_cache.h"
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+/* The index used to mark the end of a list of entries */
+#define JC_NONE ((uint32) 0xFFFFFFFF)
+
+
+static uint32 GetJobCacheBucket (const JobCache *cache_p, const uuid_t id);
+
+static uint32 GetJobCacheEntryIndex (const JobCache *cache_p, const uuid_t id, const uint32 bucket);
+
+static void UnlinkJobCacheEntry (JobCache *cache_p, const uint32 index);
+
+static void LinkNewestJobCacheEntry (JobCache *cache_p, const uint32 index);
+
+static void RemoveJobCacheEntryFromBucket (JobCache *cache_p, const uint32 index);
+
+static void MoveJobCacheEntry (JobCache *cache_p, const uint32 from, const uint32 to);
+
+
+
+bool InitJobCache (JobCache *cache_p, const uint32 capacity)
+{
+	cache_p -> jc_entries_p = NULL;
+	cache_p -> jc_buckets_p = NULL;
+	cache_p -> jc_capacity = 0;
+	cache_p -> jc_size = 0;
+	cache_p -> jc_num_buckets = 0;
+	cache_p -> jc_newest = JC_NONE;
+	cache_p -> jc_oldest = JC_NONE;
+
+	if (pthread_mutex_init (& (cache_p -> jc_lock), NULL) == 0)
+		{
+			uint32 num_buckets = 1;
+
+			if (capacity == 0)
+				{
+					return true;
+				}
+
+			/* Keep the load factor at or below 1 */
+			while ((num_buckets < capacity) && (num_buckets < 0x80000000))
+				{
+					num_buckets <<= 1;
+				}
+
+			cache_p -> jc_entries_p = (JobCacheEntry *) AllocMemoryArray (capacity, sizeof (JobCacheEntry));
+
+			if (cache_p -> jc_entries_p)
+				{
+					cache_p -> jc_buckets_p = (uint32 *) AllocMemoryArray (num_buckets, sizeof (uint32));
+
+					if (cache_p -> jc_buckets_p)
+						{
+							uint32 i;
+
+							for (i = 0; i < num_buckets; ++ i)
+								{
+									cache_p -> jc_buckets_p [i] = JC_NONE;
+								}
+
+							cache_p -> jc_capacity = capacity;
+							cache_p -> jc_num_buckets = num_buckets;
+
+							return true;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " UINT32_FMT " buckets for job cache", num_buckets);
+						}
+
+					FreeMemory (cache_p -> jc_entries_p);
+					cache_p -> jc_entries_p = NULL;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " UINT32_FMT " entries for job cache", capacity);
+				}
+
+			pthread_mutex_destroy (& (cache_p -> jc_lock));
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create job cache lock");
+		}
+
+	return false;
+}
+
+
+void ClearJobCache (JobCache *cache_p)
+{
+	if (cache_p -> jc_buckets_p)
+		{
+			FreeMemory (cache_p -> jc_buckets_p);
+			cache_p -> jc_buckets_p = NULL;
+		}
+
+	if (cache_p -> jc_entries_p)
+		{
+			FreeMemory (cache_p -> jc_entries_p);
+			cache_p -> jc_entries_p = NULL;
+		}
+
+	cache_p -> jc_capacity = 0;
+	cache_p -> jc_size = 0;
+	cache_p -> jc_num_buckets = 0;
+	cache_p -> jc_newest = JC_NONE;
+	cache_p -> jc_oldest = JC_NONE;
+
+	pthread_mutex_destroy (& (cache_p -> jc_lock));
+}
+
+
+bool FindJobInCache (JobCache *cache_p, const uuid_t id, JobCacheEntry *entry_p)
+{
+	bool found_flag = false;
+
+	if (cache_p -> jc_capacity > 0)
+		{
+			uint32 index;
+
+			pthread_mutex_lock (& (cache_p -> jc_lock));
+
+			index = GetJobCacheEntryIndex (cache_p, id, GetJobCacheBucket (cache_p, id));
+
+			if (index != JC_NONE)
+				{
+					if (index != cache_p -> jc_newest)
+						{
+							UnlinkJobCacheEntry (cache_p, index);
+							LinkNewestJobCacheEntry (cache_p, index);
+						}
+
+					memcpy (entry_p, (cache_p -> jc_entries_p) + index, sizeof (JobCacheEntry));
+					found_flag = true;
+				}
+
+			pthread_mutex_unlock (& (cache_p -> jc_lock));
+		}
+
+	return found_flag;
+}
+
+
+void AddJobToCache (JobCache *cache_p, const uuid_t id, const int64 start, const int64 end, const OperationStatus status)
+{
+	if (cache_p -> jc_capacity > 0)
+		{
+			const uint32 bucket = GetJobCacheBucket (cache_p, id);
+			uint32 index;
+			JobCacheEntry *entry_p;
+
+			pthread_mutex_lock (& (cache_p -> jc_lock));
+
+			index = GetJobCacheEntryIndex (cache_p, id, bucket);
+
+			if (index != JC_NONE)
+				{
+					UnlinkJobCacheEntry (cache_p, index);
+				}
+			else
+				{
+					if (cache_p -> jc_size < cache_p -> jc_capacity)
+						{
+							index = cache_p -> jc_size;
+							++ (cache_p -> jc_size);
+						}
+					else
+						{
+							/* Reuse the least recently used entry */
+							index = cache_p -> jc_oldest;
+
+							RemoveJobCacheEntryFromBucket (cache_p, index);
+							UnlinkJobCacheEntry (cache_p, index);
+						}
+
+					entry_p = (cache_p -> jc_entries_p) + index;
+					memcpy (entry_p -> jce_id, id, sizeof (uuid_t));
+
+					entry_p -> jce_bucket_next = cache_p -> jc_buckets_p [bucket];
+					cache_p -> jc_buckets_p [bucket] = index;
+				}
+
+			entry_p = (cache_p -> jc_entries_p) + index;
+			entry_p -> jce_start = start;
+			entry_p -> jce_end = end;
+			entry_p -> jce_status = status;
+
+			LinkNewestJobCacheEntry (cache_p, index);
+
+			pthread_mutex_unlock (& (cache_p -> jc_lock));
+		}
+}
+
+
+bool ChangeJobCacheStatus (JobCache *cache_p, const uuid_t id, const OperationStatus old_status, const OperationStatus new_status)
+{
+	bool changed_flag = false;
+
+	if (cache_p -> jc_capacity > 0)
+		{
+			uint32 index;
+
+			pthread_mutex_lock (& (cache_p -> jc_lock));
+
+			index = GetJobCacheEntryIndex (cache_p, id, GetJobCacheBucket (cache_p, id));
+
+			if (index != JC_NONE)
+				{
+					JobCacheEntry *entry_p = (cache_p -> jc_entries_p) + index;
+
+					if (entry_p -> jce_status == old_status)
+						{
+							entry_p -> jce_status = new_status;
+							changed_flag = true;
+						}
+				}
+
+			pthread_mutex_unlock (& (cache_p -> jc_lock));
+		}
+
+	return changed_flag;
+}
+
+
+void RemoveJobFromCache (JobCache *cache_p, const uuid_t id)
+{
+	if (cache_p -> jc_capacity > 0)
+		{
+			uint32 index;
+
+			pthread_mutex_lock (& (cache_p -> jc_lock));
+
+			index = GetJobCacheEntryIndex (cache_p, id, GetJobCacheBucket (cache_p, id));
+
+			if (index != JC_NONE)
+				{
+					const uint32 last = (cache_p -> jc_size) - 1;
+
+					RemoveJobCacheEntryFromBucket (cache_p, index);
+					UnlinkJobCacheEntry (cache_p, index);
+
+					/* Keep the entries in use contiguous so AddJobToCache () can fill from the end */
+					if (index != last)
+						{
+							MoveJobCacheEntry (cache_p, last, index);
+						}
+
+					-- (cache_p -> jc_size);
+				}
+
+			pthread_mutex_unlock (& (cache_p -> jc_lock));
+		}
+}
+
+
+/*
+ * Since uuids are random, their first few bytes are already well
+ * distributed and can be used as the hash directly.
+ */
+static uint32 GetJobCacheBucket (const JobCache *cache_p, const uuid_t id)
+{
+	uint32 hash;
+
+	memcpy (&hash, id, sizeof (uint32));
+
+	return hash & ((cache_p -> jc_num_buckets) - 1);
+}
+
+
+static uint32 GetJobCacheEntryIndex (const JobCache *cache_p, const uuid_t id, const uint32 bucket)
+{
+	uint32 index = cache_p -> jc_buckets_p [bucket];
+
+	while (index != JC_NONE)
+		{
+			const JobCacheEntry *entry_p = (cache_p -> jc_entries_p) + index;
+
+			if (memcmp (entry_p -> jce_id, id, sizeof (uuid_t)) == 0)
+				{
+					return index;
+				}
+
+			index = entry_p -> jce_bucket_next;
+		}
+
+	return JC_NONE;
+}
+
+
+/*
+ * Take an entry out of the usage list.
+ */
+static void UnlinkJobCacheEntry (JobCache *cache_p, const uint32 index)
+{
+	JobCacheEntry *entry_p = (cache_p -> jc_entries_p) + index;
+
+	if (entry_p -> jce_newer != JC_NONE)
+		{
+			cache_p -> jc_entries_p [entry_p -> jce_newer].jce_older = entry_p -> jce_older;
+		}
+	else
+		{
+			cache_p -> jc_newest = entry_p -> jce_older;
+		}
+
+	if (entry_p -> jce_older != JC_NONE)
+		{
+			cache_p -> jc_entries_p [entry_p -> jce_older].jce_newer = entry_p -> jce_newer;
+		}
+	else
+		{
+			cache_p -> jc_oldest = entry_p -> jce_newer;
+		}
+
+	entry_p -> jce_newer = JC_NONE;
+	entry_p -> jce_older = JC_NONE;
+}
+
+
+/*
+ * Put an entry, which must not currently be in the usage list, at its front.
+ */
+static void LinkNewestJobCacheEntry (JobCache *cache_p, const uint32 index)
+{
+	JobCacheEntry *entry_p = (cache_p -> jc_entries_p) + index;
+
+	entry_p -> jce_newer = JC_NONE;
+	entry_p -> jce_older = cache_p -> jc_newest;
+
+	if (cache_p -> jc_newest != JC_NONE)
+		{
+			cache_p -> jc_entries_p [cache_p -> jc_newest].jce_newer = index;
+		}
+	else
+		{
+			cache_p -> jc_oldest = index;
+		}
+
+	cache_p -> jc_newest = index;
+}
+
+
+static void RemoveJobCacheEntryFromBucket (JobCache *cache_p, const uint32 index)
+{
+	JobCacheEntry *entry_p = (cache_p -> jc_entries_p) + index;
+	uint32 *next_p = (cache_p -> jc_buckets_p) + GetJobCacheBucket (cache_p, entry_p -> jce_id);
+
+	while (*next_p != JC_NONE)
+		{
+			if (*next_p == index)
+				{
+					*next_p = entry_p -> jce_bucket_next;
+					return;
+				}
+
+			next_p = & (cache_p -> jc_entries_p [*next_p].jce_bucket_next);
+		}
+}
+
+
+/*
+ * Move an entry into an unused slot, updating everything that refers to it.
+ */
+static void MoveJobCacheEntry (JobCache *cache_p, const uint32 from, const uint32 to)
+{
+	JobCacheEntry *entry_p = (cache_p -> jc_entries_p) + to;
+	uint32 *next_p;
+
+	memcpy (entry_p, (cache_p -> jc_entries_p) + from, sizeof (JobCacheEntry));
+
+	next_p = (cache_p -> jc_buckets_p) + GetJobCacheBucket (cache_p, entry_p -> jce_id);
+
+	while (*next_p != JC_NONE)
+		{
+			if (*next_p == from)
+				{
+					*next_p = to;
+					break;
+				}
+
+			next_p = & (cache_p -> jc_entries_p [*next_p].jce_bucket_next);
+		}
+
+	if (entry_p -> jce_newer != JC_NONE)
+		{
+			cache_p -> jc_entries_p [entry_p -> jce_newer].jce_older = to;
+		}
+	else
+		{
+			cache_p -> jc_newest = to;
+		}
+
+	if (entry_p -> jce_older != JC_NONE)
+		{
+			cache_p -> jc_entries_p [entry_p -> jce_older].jce_newer = to;
+		}
+	else
+		{
+			cache_p -> jc_oldest = to;
+		}
+}
@@ -0,0 +1,74 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+#include <pthread.h>
+
+#include "job_clock.h"
+
+
+/*
+ * The wall clock and monotonic clock readings taken at the same moment,
+ * the first time that GetJobClockTime () is called.
+ */
+static int64 s_wall_clock_origin = 0;
+
+static int64 s_monotonic_origin = 0;
+
+static pthread_once_t s_clock_once = PTHREAD_ONCE_INIT;
+
+
+static int64 GetClockNanoseconds (const clockid_t clock_id);
+
+static void InitJobClock (void);
+
+
+
+int64 GetJobClockTime (void)
+{
+	pthread_once (&s_clock_once, InitJobClock);
+
+	return s_wall_clock_origin + (GetClockNanoseconds (CLOCK_MONOTONIC) - s_monotonic_origin);
+}
+
+
+time_t GetJobClockSeconds (const int64 time_ns)
+{
+	int64 seconds = time_ns / LRS_NANOS_PER_SECOND;
+
+	/* Division rounds towards zero, so fix up any times before the epoch */
+	if ((time_ns < 0) && ((time_ns % LRS_NANOS_PER_SECOND) != 0))
+		{
+			-- seconds;
+		}
+
+	return (time_t) seconds;
+}
+
+
+static int64 GetClockNanoseconds (const clockid_t clock_id)
+{
+	struct timespec ts;
+
+	clock_gettime (clock_id, &ts);
+
+	return (((int64) ts.tv_sec) * LRS_NANOS_PER_SECOND) + (int64) ts.tv_nsec;
+}
+
+
+static void InitJobClock (void)
+{
+	s_wall_clock_origin = GetClockNanoseconds (CLOCK_REALTIME);
+	s_monotonic_origin = GetClockNanoseconds (CLOCK_MONOTONIC);
+}
@@ -0,0 +1,428 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+#include <string.h>
+
+#include "job_group.h"
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+/* The keys used in the JSON from GetJobGroupAsJSON. */
+static const char * const S_START_S = "start_ns";
+
+static const char * const S_UNIT_S = "unit_ns";
+
+static const char * const S_DURATIONS_S = "durations";
+
+
+/*
+ * The byte of a uuid whose top 4 bits are its version, the version used
+ * for the ids of groups and their jobs and where in the uuid the index
+ * of each job is stored.
+ */
+#define JG_VERSION_BYTE (6)
+
+#define JG_VERSION (0x80)
+
+#define JG_INDEX_OFFSET (12)
+
+
+static bool GetJSONIntegerValue (const json_t *json_p, const char * const key_s, json_int_t *value_p);
+
+static uint32 GetJobGroupIdIndex (const uuid_t id);
+
+static uint32 GetJobGroupCacheEntryIndex (const JobGroupCache *cache_p, const uuid_t group_id);
+
+static void FreeJobGroup (JobGroup *group_p);
+
+
+
+bool InitJobGroup (JobGroup *group_p, const uint32 num_jobs, const int64 start, const int64 unit)
+{
+	group_p -> jg_durations_p = (uint32 *) AllocMemoryArray (num_jobs > 0 ? num_jobs : 1, sizeof (uint32));
+
+	if (group_p -> jg_durations_p)
+		{
+			group_p -> jg_num_jobs = num_jobs;
+			group_p -> jg_start = start;
+			group_p -> jg_unit = unit;
+
+			return true;
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate the durations for a JobGroup of " UINT32_FMT " jobs", num_jobs);
+
+	return false;
+}
+
+
+void ClearJobGroup (JobGroup *group_p)
+{
+	FreeMemory (group_p -> jg_durations_p);
+	group_p -> jg_durations_p = NULL;
+	group_p -> jg_num_jobs = 0;
+}
+
+
+void GetJobGroupJobTimes (const JobGroup *group_p, const uint32 index, int64 *start_p, int64 *end_p)
+{
+	*start_p = group_p -> jg_start;
+	*end_p = (group_p -> jg_start) + ((int64) (group_p -> jg_durations_p [index])) * (group_p -> jg_unit);
+}
+
+
+int64 GetJobGroupEnd (const JobGroup *group_p)
+{
+	uint32 max_duration = 0;
+	uint32 i;
+
+	for (i = 0; i < group_p -> jg_num_jobs; ++ i)
+		{
+			if (group_p -> jg_durations_p [i] > max_duration)
+				{
+					max_duration = group_p -> jg_durations_p [i];
+				}
+		}
+
+	return (group_p -> jg_start) + ((int64) max_duration) * (group_p -> jg_unit);
+}
+
+
+json_t *GetJobGroupAsJSON (const JobGroup *group_p)
+{
+	json_t *group_json_p = json_object ();
+
+	if (group_json_p)
+		{
+			json_t *durations_p = json_array ();
+
+			if (durations_p)
+				{
+					if (json_object_set_new (group_json_p, S_DURATIONS_S, durations_p) == 0)
+						{
+							uint32 i;
+
+							for (i = 0; i < group_p -> jg_num_jobs; ++ i)
+								{
+									if (json_array_append_new (durations_p, json_integer ((json_int_t) (group_p -> jg_durations_p [i]))) != 0)
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add duration " UINT32_FMT " of " UINT32_FMT " to JobGroup JSON", i, group_p -> jg_num_jobs);
+											break;
+										}
+								}
+
+							if (i == group_p -> jg_num_jobs)
+								{
+									if ((json_object_set_new (group_json_p, S_START_S, json_integer ((json_int_t) (group_p -> jg_start))) == 0) &&
+										(json_object_set_new (group_json_p, S_UNIT_S, json_integer ((json_int_t) (group_p -> jg_unit))) == 0))
+										{
+											return group_json_p;
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add the times to JobGroup JSON");
+										}
+								}
+						}
+					else
+						{
+							json_decref (durations_p);
+						}
+				}
+
+			json_decref (group_json_p);
+		}		/* if (group_json_p) */
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create JobGroup JSON");
+		}
+
+	return NULL;
+}
+
+
+bool InitJobGroupFromJSON (JobGroup *group_p, const json_t *json_p)
+{
+	const json_t *durations_p = json_object_get (json_p, S_DURATIONS_S);
+	json_int_t start;
+	json_int_t unit;
+
+	if (durations_p && json_is_array (durations_p) && GetJSONIntegerValue (json_p, S_START_S, &start) && GetJSONIntegerValue (json_p, S_UNIT_S, &unit))
+		{
+			const size_t num_jobs = json_array_size (durations_p);
+
+			if ((num_jobs <= UINT32_MAX) && InitJobGroup (group_p, (uint32) num_jobs, (int64) start, (int64) unit))
+				{
+					size_t i;
+
+					for (i = 0; i < num_jobs; ++ i)
+						{
+							const json_t *duration_p = json_array_get (durations_p, i);
+
+							if (duration_p && json_is_integer (duration_p) && (json_integer_value (duration_p) >= 0) && (json_integer_value (duration_p) <= UINT32_MAX))
+								{
+									group_p -> jg_durations_p [i] = (uint32) json_integer_value (duration_p);
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Invalid duration " SIZET_FMT " in JobGroup JSON", i);
+									ClearJobGroup (group_p);
+									return false;
+								}
+						}
+
+					return true;
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "JobGroup JSON is missing its times");
+		}
+
+	return false;
+}
+
+
+void MakeJobGroupId (uuid_t id)
+{
+	id [JG_VERSION_BYTE] = (id [JG_VERSION_BYTE] & 0x0F) | JG_VERSION;
+	memset (id + JG_INDEX_OFFSET, 0, sizeof (uuid_t) - JG_INDEX_OFFSET);
+}
+
+
+bool IsJobGroupId (const uuid_t id)
+{
+	return (((id [JG_VERSION_BYTE] & 0xF0) == JG_VERSION) && (GetJobGroupIdIndex (id) == 0));
+}
+
+
+void GetJobGroupJobId (const uuid_t group_id, const uint32 index, uuid_t job_id)
+{
+	const uint32 value = index + 1;
+
+	memcpy (job_id, group_id, JG_INDEX_OFFSET);
+
+	job_id [JG_INDEX_OFFSET] = (unsigned char) (value >> 24);
+	job_id [JG_INDEX_OFFSET + 1] = (unsigned char) (value >> 16);
+	job_id [JG_INDEX_OFFSET + 2] = (unsigned char) (value >> 8);
+	job_id [JG_INDEX_OFFSET + 3] = (unsigned char) value;
+}
+
+
+bool GetJobGroupIdFromJobId (const uuid_t job_id, uuid_t group_id, uint32 *index_p)
+{
+	if ((job_id [JG_VERSION_BYTE] & 0xF0) == JG_VERSION)
+		{
+			const uint32 value = GetJobGroupIdIndex (job_id);
+
+			if (value > 0)
+				{
+					memcpy (group_id, job_id, JG_INDEX_OFFSET);
+					memset (group_id + JG_INDEX_OFFSET, 0, sizeof (uuid_t) - JG_INDEX_OFFSET);
+					*index_p = value - 1;
+
+					return true;
+				}
+		}
+
+	return false;
+}
+
+
+bool InitJobGroupCache (JobGroupCache *cache_p, const uint32 capacity)
+{
+	cache_p -> jgc_entries_p = (JobGroupCacheEntry *) AllocMemoryArray (capacity, sizeof (JobGroupCacheEntry));
+	cache_p -> jgc_capacity = 0;
+	cache_p -> jgc_next = 0;
+
+	if (cache_p -> jgc_entries_p)
+		{
+			if (pthread_mutex_init (& (cache_p -> jgc_lock), NULL) == 0)
+				{
+					uint32 i;
+
+					for (i = 0; i < capacity; ++ i)
+						{
+							cache_p -> jgc_entries_p [i].jgce_group_p = NULL;
+						}
+
+					cache_p -> jgc_capacity = capacity;
+
+					return true;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create job group cache lock");
+				}
+
+			FreeMemory (cache_p -> jgc_entries_p);
+			cache_p -> jgc_entries_p = NULL;
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " UINT32_FMT " job group cache entries", capacity);
+		}
+
+	return false;
+}
+
+
+void ClearJobGroupCache (JobGroupCache *cache_p)
+{
+	uint32 i;
+
+	for (i = 0; i < cache_p -> jgc_capacity; ++ i)
+		{
+			if (cache_p -> jgc_entries_p [i].jgce_group_p)
+				{
+					FreeJobGroup (cache_p -> jgc_entries_p [i].jgce_group_p);
+				}
+		}
+
+	FreeMemory (cache_p -> jgc_entries_p);
+	cache_p -> jgc_entries_p = NULL;
+	cache_p -> jgc_capacity = 0;
+
+	pthread_mutex_destroy (& (cache_p -> jgc_lock));
+}
+
+
+bool GetCachedJobGroupJobTimes (JobGroupCache *cache_p, const uuid_t group_id, const uint32 index, int64 *start_p, int64 *end_p)
+{
+	bool found_flag = false;
+	uint32 i;
+
+	pthread_mutex_lock (& (cache_p -> jgc_lock));
+
+	i = GetJobGroupCacheEntryIndex (cache_p, group_id);
+
+	if (i < cache_p -> jgc_capacity)
+		{
+			const JobGroup *group_p = cache_p -> jgc_entries_p [i].jgce_group_p;
+
+			if (index < group_p -> jg_num_jobs)
+				{
+					GetJobGroupJobTimes (group_p, index, start_p, end_p);
+					found_flag = true;
+				}
+		}
+
+	pthread_mutex_unlock (& (cache_p -> jgc_lock));
+
+	return found_flag;
+}
+
+
+void AddJobGroupToCache (JobGroupCache *cache_p, const uuid_t group_id, JobGroup *group_p)
+{
+	JobGroup *old_group_p = group_p;
+
+	pthread_mutex_lock (& (cache_p -> jgc_lock));
+
+	/* Another thread may have read the same group at the same time */
+	if (GetJobGroupCacheEntryIndex (cache_p, group_id) == cache_p -> jgc_capacity)
+		{
+			JobGroupCacheEntry *entry_p = (cache_p -> jgc_entries_p) + (cache_p -> jgc_next);
+
+			old_group_p = entry_p -> jgce_group_p;
+
+			memcpy (entry_p -> jgce_id, group_id, sizeof (uuid_t));
+			entry_p -> jgce_group_p = group_p;
+
+			cache_p -> jgc_next = ((cache_p -> jgc_next) + 1) % (cache_p -> jgc_capacity);
+		}
+
+	pthread_mutex_unlock (& (cache_p -> jgc_lock));
+
+	/* The groups can be large, so they are freed without the lock */
+	if (old_group_p)
+		{
+			FreeJobGroup (old_group_p);
+		}
+}
+
+
+void RemoveJobGroupFromCache (JobGroupCache *cache_p, const uuid_t group_id)
+{
+	JobGroup *group_p = NULL;
+	uint32 i;
+
+	pthread_mutex_lock (& (cache_p -> jgc_lock));
+
+	i = GetJobGroupCacheEntryIndex (cache_p, group_id);
+
+	if (i < cache_p -> jgc_capacity)
+		{
+			group_p = cache_p -> jgc_entries_p [i].jgce_group_p;
+			cache_p -> jgc_entries_p [i].jgce_group_p = NULL;
+		}
+
+	pthread_mutex_unlock (& (cache_p -> jgc_lock));
+
+	if (group_p)
+		{
+			FreeJobGroup (group_p);
+		}
+}
+
+
+static bool GetJSONIntegerValue (const json_t *json_p, const char * const key_s, json_int_t *value_p)
+{
+	const json_t *value_json_p = json_object_get (json_p, key_s);
+
+	if (value_json_p && json_is_integer (value_json_p))
+		{
+			*value_p = json_integer_value (value_json_p);
+			return true;
+		}
+
+	return false;
+}
+
+
+static uint32 GetJobGroupIdIndex (const uuid_t id)
+{
+	return (((uint32) id [JG_INDEX_OFFSET]) << 24) | (((uint32) id [JG_INDEX_OFFSET + 1]) << 16) | (((uint32) id [JG_INDEX_OFFSET + 2]) << 8) | ((uint32) id [JG_INDEX_OFFSET + 3]);
+}
+
+
+/*
+ * Find the entry for a group in a JobGroupCache. The caller must hold the
+ * cache's lock. If the group isn't cached, the cache's capacity is returned.
+ */
+static uint32 GetJobGroupCacheEntryIndex (const JobGroupCache *cache_p, const uuid_t group_id)
+{
+	uint32 i;
+
+	for (i = 0; i < cache_p -> jgc_capacity; ++ i)
+		{
+			const JobGroupCacheEntry *entry_p = (cache_p -> jgc_entries_p) + i;
+
+			if ((entry_p -> jgce_group_p) && (memcmp (entry_p -> jgce_id, group_id, sizeof (uuid_t)) == 0))
+				{
+					return i;
+				}
+		}
+
+	return cache_p -> jgc_capacity;
+}
+
+
+static void FreeJobGroup (JobGroup *group_p)
+{
+	ClearJobGroup (group_p);
+	FreeMemory (group_p);
+}
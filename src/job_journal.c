@@ -0,0 +1,639 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "job_journal.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "streams.h"
+
+
+/*
+ * The file starts with these bytes followed by the version of the layout
+ * and padding up to JJ_HEADER_SIZE.
+ */
+static const unsigned char JJ_MAGIC [] = { 'L', 'R', 'S', 'W' };
+
+static const uint8 JJ_VERSION = 1;
+
+#define JJ_HEADER_SIZE (8)
+
+/*
+ * Each record is:
+ *
+ * type (1) + padding (3) + checksum (4) + uuid (16) + start (8) + end (8)
+ *
+ * The checksum covers every other byte of the record. A type of 0 marks
+ * the end of the records, since the unused part of the file is all 0s.
+ */
+#define JJ_RECORD_SIZE (40)
+
+#define JJ_CHECKSUM_OFFSET (4)
+
+#define JJ_ID_OFFSET (8)
+
+#define JJ_START_OFFSET (JJ_ID_OFFSET + sizeof (uuid_t))
+
+#define JJ_END_OFFSET (JJ_START_OFFSET + sizeof (int64))
+
+/* The types of record. */
+#define JJ_RECORD_STARTED (1)
+
+#define JJ_RECORD_FINISHED (2)
+
+/* The smallest size of the file. It doubles each time that it fills up. */
+#define JJ_INITIAL_SIZE ((size_t) 1 << 20)
+
+/* The suffix of the file that the journal is rewritten to before replacing the original. */
+static const char * const JJ_TEMPORARY_SUFFIX_S = ".tmp";
+
+
+/*
+ * A record read back from the file along with its position, so that
+ * the records for each job are still in the order they were written once
+ * they have been sorted by id.
+ */
+typedef struct JobJournalRecord
+{
+	JobJournalEntry jjr_entry;
+
+	size_t jjr_index;
+
+	uint8 jjr_type;
+} JobJournalRecord;
+
+
+/*
+ * The journal that every Service in the process shares, along with the
+ * number of references to it and the path that it was opened with.
+ */
+static JobJournal s_shared_journal;
+
+static uint32 s_shared_journal_refs = 0;
+
+static char *s_shared_journal_path_s = NULL;
+
+/* Have the running jobs from the shared journal been handed out yet? */
+static bool s_shared_journal_recovered_flag = false;
+
+static pthread_mutex_t s_shared_journal_lock;
+
+static pthread_once_t s_shared_journal_once = PTHREAD_ONCE_INIT;
+
+
+static void InitSharedJobJournalLock (void);
+
+static bool ReadJobJournalEntries (const char *path_s, JobJournalEntry **entries_pp, uint32 *num_entries_p);
+
+static bool ReadJobJournalRecords (const unsigned char *data_p, const size_t size, JobJournalRecord **records_pp, size_t *num_records_p);
+
+static int CompareJobJournalRecords (const void *v0_p, const void *v1_p);
+
+static bool RewriteJobJournal (JobJournal *journal_p, const char *path_s, const JobJournalEntry *entries_p, const uint32 num_entries);
+
+static bool MapJobJournal (JobJournal *journal_p, const size_t size);
+
+static bool AppendJobJournalRecord (JobJournal *journal_p, const uint8 type, const uuid_t job_id, const int64 start, const int64 end);
+
+static void WriteJobJournalRecord (unsigned char *record_p, const uint8 type, const uuid_t job_id, const int64 start, const int64 end);
+
+static uint32 GetJobJournalRecordChecksum (const unsigned char *record_p);
+
+
+
+bool InitJobJournal (JobJournal *journal_p, const char *path_s, JobJournalEntry **entries_pp, uint32 *num_entries_p)
+{
+	journal_p -> jj_fd = -1;
+	journal_p -> jj_data_p = NULL;
+	journal_p -> jj_mapped_size = 0;
+	journal_p -> jj_used_size = 0;
+
+	if (pthread_mutex_init (& (journal_p -> jj_lock), NULL) == 0)
+		{
+			if (ReadJobJournalEntries (path_s, entries_pp, num_entries_p))
+				{
+					if (RewriteJobJournal (journal_p, path_s, *entries_pp, *num_entries_p))
+						{
+							return true;
+						}
+
+					if (*entries_pp)
+						{
+							FreeMemory (*entries_pp);
+							*entries_pp = NULL;
+						}
+
+					*num_entries_p = 0;
+				}
+
+			pthread_mutex_destroy (& (journal_p -> jj_lock));
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to open job journal \"%s\"", path_s);
+
+	return false;
+}
+
+
+void ClearJobJournal (JobJournal *journal_p)
+{
+	if (journal_p -> jj_data_p)
+		{
+			msync (journal_p -> jj_data_p, journal_p -> jj_mapped_size, MS_SYNC);
+			munmap (journal_p -> jj_data_p, journal_p -> jj_mapped_size);
+			journal_p -> jj_data_p = NULL;
+		}
+
+	if (journal_p -> jj_fd != -1)
+		{
+			close (journal_p -> jj_fd);
+			journal_p -> jj_fd = -1;
+		}
+
+	pthread_mutex_destroy (& (journal_p -> jj_lock));
+
+	journal_p -> jj_mapped_size = 0;
+	journal_p -> jj_used_size = 0;
+}
+
+
+JobJournal *AcquireSharedJobJournal (const char *path_s, JobJournalEntry **entries_pp, uint32 *num_entries_p)
+{
+	JobJournal *journal_p = NULL;
+
+	*entries_pp = NULL;
+	*num_entries_p = 0;
+
+	pthread_once (&s_shared_journal_once, InitSharedJobJournalLock);
+	pthread_mutex_lock (&s_shared_journal_lock);
+
+	if (s_shared_journal_refs > 0)
+		{
+			if (strcmp (s_shared_journal_path_s, path_s) != 0)
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "The job journal is already open as \"%s\", so \"%s\" won't be used", s_shared_journal_path_s, path_s);
+				}
+
+			++ s_shared_journal_refs;
+			journal_p = &s_shared_journal;
+		}
+	else
+		{
+			s_shared_journal_path_s = EasyCopyToNewString (path_s);
+
+			if (s_shared_journal_path_s)
+				{
+					JobJournalEntry *entries_p = NULL;
+					uint32 num_entries = 0;
+
+					if (InitJobJournal (&s_shared_journal, path_s, &entries_p, &num_entries))
+						{
+							/*
+							 * If the journal has been opened and closed before, any jobs that
+							 * it still shows as running were recovered then.
+							 */
+							if (s_shared_journal_recovered_flag)
+								{
+									if (entries_p)
+										{
+											FreeMemory (entries_p);
+										}
+								}
+							else
+								{
+									*entries_pp = entries_p;
+									*num_entries_p = num_entries;
+									s_shared_journal_recovered_flag = true;
+								}
+
+							s_shared_journal_refs = 1;
+							journal_p = &s_shared_journal;
+						}
+					else
+						{
+							FreeCopiedString (s_shared_journal_path_s);
+							s_shared_journal_path_s = NULL;
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to copy job journal path \"%s\"", path_s);
+				}
+		}
+
+	pthread_mutex_unlock (&s_shared_journal_lock);
+
+	return journal_p;
+}
+
+
+void ReleaseSharedJobJournal (JobJournal *journal_p)
+{
+	pthread_mutex_lock (&s_shared_journal_lock);
+
+	if (s_shared_journal_refs > 0)
+		{
+			-- s_shared_journal_refs;
+
+			if (s_shared_journal_refs == 0)
+				{
+					ClearJobJournal (journal_p);
+
+					FreeCopiedString (s_shared_journal_path_s);
+					s_shared_journal_path_s = NULL;
+				}
+		}
+
+	pthread_mutex_unlock (&s_shared_journal_lock);
+}
+
+
+bool JournalJobStarted (JobJournal *journal_p, const uuid_t job_id, const int64 start, const int64 end)
+{
+	return AppendJobJournalRecord (journal_p, JJ_RECORD_STARTED, job_id, start, end);
+}
+
+
+bool JournalJobFinished (JobJournal *journal_p, const uuid_t job_id)
+{
+	return AppendJobJournalRecord (journal_p, JJ_RECORD_FINISHED, job_id, 0, 0);
+}
+
+
+/*
+ * Read the journal file, if there is one, and get the jobs whose last
+ * record shows that they started. A missing or empty file has no jobs.
+ */
+static bool ReadJobJournalEntries (const char *path_s, JobJournalEntry **entries_pp, uint32 *num_entries_p)
+{
+	bool success_flag = true;
+	int fd = open (path_s, O_RDONLY);
+
+	*entries_pp = NULL;
+	*num_entries_p = 0;
+
+	if (fd != -1)
+		{
+			struct stat st;
+
+			if (fstat (fd, &st) == 0)
+				{
+					const size_t size = (size_t) st.st_size;
+
+					if (size > 0)
+						{
+							unsigned char *data_p = (unsigned char *) mmap (NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+							if (data_p != MAP_FAILED)
+								{
+									JobJournalRecord *records_p = NULL;
+									size_t num_records = 0;
+
+									success_flag = ReadJobJournalRecords (data_p, size, &records_p, &num_records);
+
+									if (records_p)
+										{
+											JobJournalEntry *entries_p = (JobJournalEntry *) AllocMemoryArray (num_records, sizeof (JobJournalEntry));
+
+											if (entries_p)
+												{
+													uint32 num_entries = 0;
+													size_t i;
+
+													/* Keep the last record for each job, and only if it started */
+													qsort (records_p, num_records, sizeof (JobJournalRecord), CompareJobJournalRecords);
+
+													for (i = 0; i < num_records; ++ i)
+														{
+															const JobJournalRecord *record_p = records_p + i;
+
+															if ((i + 1 < num_records) && (memcmp (record_p -> jjr_entry.jje_id, (record_p + 1) -> jjr_entry.jje_id, sizeof (uuid_t)) == 0))
+																{
+																	/* A later record for the same job supersedes this one */
+																}
+															else if ((record_p -> jjr_type == JJ_RECORD_STARTED) && (num_entries < UINT32_MAX))
+																{
+																	entries_p [num_entries] = record_p -> jjr_entry;
+																	++ num_entries;
+																}
+														}
+
+													if (num_entries > 0)
+														{
+															*entries_pp = entries_p;
+															*num_entries_p = num_entries;
+														}
+													else
+														{
+															FreeMemory (entries_p);
+														}
+												}
+											else
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " job journal entries", num_records);
+													success_flag = false;
+												}
+
+											FreeMemory (records_p);
+										}
+
+									munmap (data_p, size);
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to map job journal \"%s\"", path_s);
+									success_flag = false;
+								}
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get the size of job journal \"%s\"", path_s);
+					success_flag = false;
+				}
+
+			close (fd);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Read the valid records from a journal, stopping at the first one that is
+ * unused or fails its checksum. If the file isn't a journal, it is treated
+ * as having no records. This only fails if the records can't be allocated.
+ */
+static bool ReadJobJournalRecords (const unsigned char *data_p, const size_t size, JobJournalRecord **records_pp, size_t *num_records_p)
+{
+	*records_pp = NULL;
+	*num_records_p = 0;
+
+	if ((size >= JJ_HEADER_SIZE) && (memcmp (data_p, JJ_MAGIC, sizeof (JJ_MAGIC)) == 0) && (data_p [sizeof (JJ_MAGIC)] == JJ_VERSION))
+		{
+			const size_t max_records = (size - JJ_HEADER_SIZE) / JJ_RECORD_SIZE;
+			const unsigned char *record_p = data_p + JJ_HEADER_SIZE;
+			size_t num_records = 0;
+			uint32 checksum;
+
+			while (num_records < max_records)
+				{
+					memcpy (&checksum, record_p + JJ_CHECKSUM_OFFSET, sizeof (uint32));
+
+					if (((*record_p != JJ_RECORD_STARTED) && (*record_p != JJ_RECORD_FINISHED)) || (checksum != GetJobJournalRecordChecksum (record_p)))
+						{
+							break;
+						}
+
+					++ num_records;
+					record_p += JJ_RECORD_SIZE;
+				}
+
+			if (num_records > 0)
+				{
+					JobJournalRecord *records_p = (JobJournalRecord *) AllocMemoryArray (num_records, sizeof (JobJournalRecord));
+
+					if (records_p)
+						{
+							size_t i;
+
+							record_p = data_p + JJ_HEADER_SIZE;
+
+							for (i = 0; i < num_records; ++ i, record_p += JJ_RECORD_SIZE)
+								{
+									JobJournalRecord *dest_p = records_p + i;
+
+									dest_p -> jjr_type = *record_p;
+									dest_p -> jjr_index = i;
+									memcpy (dest_p -> jjr_entry.jje_id, record_p + JJ_ID_OFFSET, sizeof (uuid_t));
+									memcpy (& (dest_p -> jjr_entry.jje_start), record_p + JJ_START_OFFSET, sizeof (int64));
+									memcpy (& (dest_p -> jjr_entry.jje_end), record_p + JJ_END_OFFSET, sizeof (int64));
+								}
+
+							*records_pp = records_p;
+							*num_records_p = num_records;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " job journal records", num_records);
+							return false;
+						}
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Ignoring job journal of " SIZET_FMT " bytes without a valid header", size);
+		}
+
+	return true;
+}
+
+
+/*
+ * Sort records by their job ids and then by the order they were written in.
+ */
+static int CompareJobJournalRecords (const void *v0_p, const void *v1_p)
+{
+	const JobJournalRecord *record_0_p = (const JobJournalRecord *) v0_p;
+	const JobJournalRecord *record_1_p = (const JobJournalRecord *) v1_p;
+	int res = memcmp (record_0_p -> jjr_entry.jje_id, record_1_p -> jjr_entry.jje_id, sizeof (uuid_t));
+
+	if (res == 0)
+		{
+			res = (record_0_p -> jjr_index < record_1_p -> jjr_index) ? -1 : ((record_0_p -> jjr_index > record_1_p -> jjr_index) ? 1 : 0);
+		}
+
+	return res;
+}
+
+
+/*
+ * Write a new journal with a record for each of the given jobs into a
+ * temporary file which then replaces the original. So if this is
+ * interrupted, the original journal is still intact.
+ */
+static bool RewriteJobJournal (JobJournal *journal_p, const char *path_s, const JobJournalEntry *entries_p, const uint32 num_entries)
+{
+	bool success_flag = false;
+	char *temp_path_s = ConcatenateStrings (path_s, JJ_TEMPORARY_SUFFIX_S);
+
+	if (temp_path_s)
+		{
+			journal_p -> jj_fd = open (temp_path_s, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+			if (journal_p -> jj_fd != -1)
+				{
+					const size_t used_size = JJ_HEADER_SIZE + ((size_t) num_entries) * JJ_RECORD_SIZE;
+					size_t size = JJ_INITIAL_SIZE;
+
+					/* Leave room for at least as many records again */
+					while (size < 2 * used_size)
+						{
+							size <<= 1;
+						}
+
+					if (MapJobJournal (journal_p, size))
+						{
+							unsigned char *record_p = (journal_p -> jj_data_p) + JJ_HEADER_SIZE;
+							uint32 i;
+
+							memcpy (journal_p -> jj_data_p, JJ_MAGIC, sizeof (JJ_MAGIC));
+							journal_p -> jj_data_p [sizeof (JJ_MAGIC)] = JJ_VERSION;
+
+							for (i = 0; i < num_entries; ++ i, record_p += JJ_RECORD_SIZE)
+								{
+									WriteJobJournalRecord (record_p, JJ_RECORD_STARTED, entries_p [i].jje_id, entries_p [i].jje_start, entries_p [i].jje_end);
+								}
+
+							journal_p -> jj_used_size = used_size;
+
+							if ((msync (journal_p -> jj_data_p, journal_p -> jj_mapped_size, MS_SYNC) == 0) && (rename (temp_path_s, path_s) == 0))
+								{
+									success_flag = true;
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to replace job journal \"%s\" with \"%s\"", path_s, temp_path_s);
+								}
+
+							if (!success_flag)
+								{
+									munmap (journal_p -> jj_data_p, journal_p -> jj_mapped_size);
+									journal_p -> jj_data_p = NULL;
+									journal_p -> jj_mapped_size = 0;
+								}
+						}
+
+					if (!success_flag)
+						{
+							close (journal_p -> jj_fd);
+							journal_p -> jj_fd = -1;
+							unlink (temp_path_s);
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create job journal \"%s\"", temp_path_s);
+				}
+
+			FreeCopiedString (temp_path_s);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Resize the journal file and map the whole of it. The new mapping is made
+ * before the old one is removed, so if this fails, the journal is unchanged
+ * apart from the size of its file.
+ */
+static bool MapJobJournal (JobJournal *journal_p, const size_t size)
+{
+	if (ftruncate (journal_p -> jj_fd, (off_t) size) == 0)
+		{
+			unsigned char *data_p = (unsigned char *) mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, journal_p -> jj_fd, 0);
+
+			if (data_p != MAP_FAILED)
+				{
+					if (journal_p -> jj_data_p)
+						{
+							munmap (journal_p -> jj_data_p, journal_p -> jj_mapped_size);
+						}
+
+					journal_p -> jj_data_p = data_p;
+					journal_p -> jj_mapped_size = size;
+
+					return true;
+				}
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to map " SIZET_FMT " bytes of job journal", size);
+
+	return false;
+}
+
+
+static bool AppendJobJournalRecord (JobJournal *journal_p, const uint8 type, const uuid_t job_id, const int64 start, const int64 end)
+{
+	bool success_flag = false;
+
+	pthread_mutex_lock (& (journal_p -> jj_lock));
+
+	if (journal_p -> jj_data_p)
+		{
+			if (((journal_p -> jj_used_size) + JJ_RECORD_SIZE <= (journal_p -> jj_mapped_size)) || MapJobJournal (journal_p, 2 * (journal_p -> jj_mapped_size)))
+				{
+					WriteJobJournalRecord ((journal_p -> jj_data_p) + (journal_p -> jj_used_size), type, job_id, start, end);
+					journal_p -> jj_used_size += JJ_RECORD_SIZE;
+
+					success_flag = true;
+				}
+		}
+
+	pthread_mutex_unlock (& (journal_p -> jj_lock));
+
+	return success_flag;
+}
+
+
+static void WriteJobJournalRecord (unsigned char *record_p, const uint8 type, const uuid_t job_id, const int64 start, const int64 end)
+{
+	uint32 checksum;
+
+	*record_p = type;
+	memset (record_p + 1, 0, JJ_CHECKSUM_OFFSET - 1);
+	memcpy (record_p + JJ_ID_OFFSET, job_id, sizeof (uuid_t));
+	memcpy (record_p + JJ_START_OFFSET, &start, sizeof (int64));
+	memcpy (record_p + JJ_END_OFFSET, &end, sizeof (int64));
+
+	checksum = GetJobJournalRecordChecksum (record_p);
+	memcpy (record_p + JJ_CHECKSUM_OFFSET, &checksum, sizeof (uint32));
+}
+
+
+/*
+ * A 32-bit FNV-1a hash of every byte of a record apart from the checksum itself.
+ */
+static uint32 GetJobJournalRecordChecksum (const unsigned char *record_p)
+{
+	uint32 hash = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < JJ_RECORD_SIZE; ++ i)
+		{
+			if ((i < JJ_CHECKSUM_OFFSET) || (i >= JJ_CHECKSUM_OFFSET + sizeof (uint32)))
+				{
+					hash ^= record_p [i];
+					hash *= 16777619U;
+				}
+		}
+
+	return hash;
+}
+
+
+static void InitSharedJobJournalLock (void)
+{
+	pthread_mutex_init (&s_shared_journal_lock, NULL);
+}
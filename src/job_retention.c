@@ -0,0 +1,413 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+#include <string.h>
+#include <time.h>
+
+#include "job_retention.h"
+#include "job_clock.h"
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+/* The index used to mark the end of a hash bucket */
+#define JR_NONE ((uint32) 0xFFFFFFFF)
+
+/* How often, in milliseconds, the compactor looks for expired tombstones. */
+#define JR_COMPACT_INTERVAL_MS (1000)
+
+/* The number of evicted tombstones that wakes the compactor early. */
+#define JR_EVICTION_BATCH_SIZE (256)
+
+
+static void *RunJobRetentionCompactor (void *data_p);
+
+static uint32 GetJobTombstoneBucket (const JobRetention *retention_p, const uuid_t id);
+
+static uint32 GetJobTombstoneIndex (const JobRetention *retention_p, const uuid_t id, const uint32 bucket);
+
+static void EvictOldestJobTombstone (JobRetention *retention_p);
+
+static void EvictExpiredJobTombstones (JobRetention *retention_p, const int64 now);
+
+static void FlushEvictedJobTombstones (JobRetention *retention_p);
+
+
+
+bool InitJobRetention (JobRetention *retention_p, const uint32 capacity, const int64 ttl, JobRetentionCallback callback_fn, void *callback_data_p)
+{
+	uint32 num_buckets = 1;
+
+	memset (retention_p, 0, sizeof (JobRetention));
+
+	if (capacity == 0)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "A job retention needs room for at least one job");
+			return false;
+		}
+
+	/* Keep the load factor at or below 1 */
+	while ((num_buckets < capacity) && (num_buckets < 0x80000000))
+		{
+			num_buckets <<= 1;
+		}
+
+	retention_p -> jr_ttl = ttl;
+	retention_p -> jr_callback_fn = callback_fn;
+	retention_p -> jr_callback_data_p = callback_data_p;
+
+	retention_p -> jr_tombstones_p = (JobTombstone *) AllocMemoryArray (capacity, sizeof (JobTombstone));
+
+	if (retention_p -> jr_tombstones_p)
+		{
+			retention_p -> jr_buckets_p = (uint32 *) AllocMemoryArray (num_buckets, sizeof (uint32));
+
+			if (retention_p -> jr_buckets_p)
+				{
+					retention_p -> jr_evicted_p = (JobTombstone *) AllocMemoryArray (JR_EVICTION_BATCH_SIZE, sizeof (JobTombstone));
+
+					if (retention_p -> jr_evicted_p)
+						{
+							retention_p -> jr_evicting_p = (JobTombstone *) AllocMemoryArray (JR_EVICTION_BATCH_SIZE, sizeof (JobTombstone));
+
+							if (retention_p -> jr_evicting_p)
+								{
+									uint32 i;
+
+									for (i = 0; i < num_buckets; ++ i)
+										{
+											retention_p -> jr_buckets_p [i] = JR_NONE;
+										}
+
+									retention_p -> jr_capacity = capacity;
+									retention_p -> jr_num_buckets = num_buckets;
+									retention_p -> jr_evicted_capacity = JR_EVICTION_BATCH_SIZE;
+									retention_p -> jr_evicting_capacity = JR_EVICTION_BATCH_SIZE;
+
+									if (pthread_mutex_init (& (retention_p -> jr_lock), NULL) == 0)
+										{
+											if (pthread_cond_init (& (retention_p -> jr_wake_up), NULL) == 0)
+												{
+													if (pthread_create (& (retention_p -> jr_thread), NULL, RunJobRetentionCompactor, retention_p) == 0)
+														{
+															return true;
+														}
+													else
+														{
+															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to start job retention compactor thread");
+														}
+
+													pthread_cond_destroy (& (retention_p -> jr_wake_up));
+												}
+
+											pthread_mutex_destroy (& (retention_p -> jr_lock));
+										}
+
+									FreeMemory (retention_p -> jr_evicting_p);
+								}
+
+							FreeMemory (retention_p -> jr_evicted_p);
+						}
+
+					FreeMemory (retention_p -> jr_buckets_p);
+				}
+
+			FreeMemory (retention_p -> jr_tombstones_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise job retention for " UINT32_FMT " jobs", capacity);
+
+	memset (retention_p, 0, sizeof (JobRetention));
+
+	return false;
+}
+
+
+void ClearJobRetention (JobRetention *retention_p)
+{
+	pthread_mutex_lock (& (retention_p -> jr_lock));
+	retention_p -> jr_stop_flag = true;
+	pthread_cond_signal (& (retention_p -> jr_wake_up));
+	pthread_mutex_unlock (& (retention_p -> jr_lock));
+
+	/* The thread evicts every tombstone that is left before it exits */
+	pthread_join (retention_p -> jr_thread, NULL);
+
+	pthread_cond_destroy (& (retention_p -> jr_wake_up));
+	pthread_mutex_destroy (& (retention_p -> jr_lock));
+
+	FreeMemory (retention_p -> jr_evicting_p);
+	FreeMemory (retention_p -> jr_evicted_p);
+	FreeMemory (retention_p -> jr_buckets_p);
+	FreeMemory (retention_p -> jr_tombstones_p);
+
+	memset (retention_p, 0, sizeof (JobRetention));
+}
+
+
+void AddJobTombstone (JobRetention *retention_p, const uuid_t id, const int64 start, const int64 end, const OperationStatus status, const bool stored_flag)
+{
+	const uint32 bucket = GetJobTombstoneBucket (retention_p, id);
+	const int64 now = GetJobClockTime ();
+	JobTombstone *tombstone_p = NULL;
+	uint32 index;
+
+	pthread_mutex_lock (& (retention_p -> jr_lock));
+
+	index = GetJobTombstoneIndex (retention_p, id, bucket);
+
+	if (index == JR_NONE)
+		{
+			if (retention_p -> jr_size == retention_p -> jr_capacity)
+				{
+					EvictOldestJobTombstone (retention_p);
+				}
+
+			index = ((retention_p -> jr_oldest) + (retention_p -> jr_size)) % (retention_p -> jr_capacity);
+			++ (retention_p -> jr_size);
+
+			tombstone_p = (retention_p -> jr_tombstones_p) + index;
+			memcpy (tombstone_p -> jt_id, id, sizeof (uuid_t));
+			tombstone_p -> jt_added = now;
+
+			tombstone_p -> jt_bucket_next = retention_p -> jr_buckets_p [bucket];
+			retention_p -> jr_buckets_p [bucket] = index;
+		}
+	else
+		{
+			tombstone_p = (retention_p -> jr_tombstones_p) + index;
+		}
+
+	tombstone_p -> jt_start = start;
+	tombstone_p -> jt_end = end;
+	tombstone_p -> jt_status = status;
+	tombstone_p -> jt_stored_flag = stored_flag;
+
+	if (retention_p -> jr_num_evicted >= JR_EVICTION_BATCH_SIZE)
+		{
+			pthread_cond_signal (& (retention_p -> jr_wake_up));
+		}
+
+	pthread_mutex_unlock (& (retention_p -> jr_lock));
+}
+
+
+bool FindJobTombstone (JobRetention *retention_p, const uuid_t id, JobTombstone *tombstone_p)
+{
+	bool found_flag = false;
+	uint32 index;
+
+	pthread_mutex_lock (& (retention_p -> jr_lock));
+
+	index = GetJobTombstoneIndex (retention_p, id, GetJobTombstoneBucket (retention_p, id));
+
+	if (index != JR_NONE)
+		{
+			memcpy (tombstone_p, (retention_p -> jr_tombstones_p) + index, sizeof (JobTombstone));
+			found_flag = true;
+		}
+
+	pthread_mutex_unlock (& (retention_p -> jr_lock));
+
+	return found_flag;
+}
+
+
+/*
+ * The entry point for the compactor's thread. This wakes up every
+ * JR_COMPACT_INTERVAL_MS, or sooner if a batch of tombstones has been
+ * evicted to make room, and hands everything that has been evicted to
+ * the callback.
+ */
+static void *RunJobRetentionCompactor (void *data_p)
+{
+	JobRetention *retention_p = (JobRetention *) data_p;
+
+	pthread_mutex_lock (& (retention_p -> jr_lock));
+
+	while (! (retention_p -> jr_stop_flag))
+		{
+			if (retention_p -> jr_num_evicted < JR_EVICTION_BATCH_SIZE)
+				{
+					struct timespec wake_up;
+
+					clock_gettime (CLOCK_REALTIME, &wake_up);
+
+					wake_up.tv_sec += JR_COMPACT_INTERVAL_MS / 1000;
+					wake_up.tv_nsec += ((long) (JR_COMPACT_INTERVAL_MS % 1000)) * 1000000L;
+
+					if (wake_up.tv_nsec >= 1000000000L)
+						{
+							++ wake_up.tv_sec;
+							wake_up.tv_nsec -= 1000000000L;
+						}
+
+					pthread_cond_timedwait (& (retention_p -> jr_wake_up), & (retention_p -> jr_lock), &wake_up);
+				}
+
+			if (retention_p -> jr_ttl > 0)
+				{
+					EvictExpiredJobTombstones (retention_p, GetJobClockTime ());
+				}
+
+			FlushEvictedJobTombstones (retention_p);
+		}
+
+	/*
+	 * Nothing will evict the tombstones that are still kept once we have
+	 * gone, so evict them all now, a batch at a time.
+	 */
+	do
+		{
+			while ((retention_p -> jr_size > 0) && (retention_p -> jr_num_evicted < JR_EVICTION_BATCH_SIZE))
+				{
+					EvictOldestJobTombstone (retention_p);
+				}
+
+			FlushEvictedJobTombstones (retention_p);
+		}
+	while (retention_p -> jr_size > 0);
+
+	pthread_mutex_unlock (& (retention_p -> jr_lock));
+
+	return NULL;
+}
+
+
+/*
+ * Since uuids are random, their first few bytes are already well
+ * distributed and can be used as the hash directly.
+ */
+static uint32 GetJobTombstoneBucket (const JobRetention *retention_p, const uuid_t id)
+{
+	uint32 hash;
+
+	memcpy (&hash, id, sizeof (uint32));
+
+	return hash & ((retention_p -> jr_num_buckets) - 1);
+}
+
+
+static uint32 GetJobTombstoneIndex (const JobRetention *retention_p, const uuid_t id, const uint32 bucket)
+{
+	uint32 index = retention_p -> jr_buckets_p [bucket];
+
+	while (index != JR_NONE)
+		{
+			const JobTombstone *tombstone_p = (retention_p -> jr_tombstones_p) + index;
+
+			if (memcmp (tombstone_p -> jt_id, id, sizeof (uuid_t)) == 0)
+				{
+					return index;
+				}
+
+			index = tombstone_p -> jt_bucket_next;
+		}
+
+	return JR_NONE;
+}
+
+
+/*
+ * Move the oldest tombstone onto the list waiting for the callback. This
+ * must be called with the lock held and at least one tombstone in use.
+ */
+static void EvictOldestJobTombstone (JobRetention *retention_p)
+{
+	const uint32 index = retention_p -> jr_oldest;
+	const JobTombstone *tombstone_p = (retention_p -> jr_tombstones_p) + index;
+	uint32 *next_p = (retention_p -> jr_buckets_p) + GetJobTombstoneBucket (retention_p, tombstone_p -> jt_id);
+
+	while (*next_p != JR_NONE)
+		{
+			if (*next_p == index)
+				{
+					*next_p = tombstone_p -> jt_bucket_next;
+					break;
+				}
+
+			next_p = & (retention_p -> jr_tombstones_p [*next_p].jt_bucket_next);
+		}
+
+	if (retention_p -> jr_num_evicted == retention_p -> jr_evicted_capacity)
+		{
+			const uint32 new_capacity = (retention_p -> jr_evicted_capacity) << 1;
+			JobTombstone *evicted_p = (JobTombstone *) AllocMemoryArray (new_capacity, sizeof (JobTombstone));
+
+			if (evicted_p)
+				{
+					memcpy (evicted_p, retention_p -> jr_evicted_p, (retention_p -> jr_num_evicted) * sizeof (JobTombstone));
+					FreeMemory (retention_p -> jr_evicted_p);
+
+					retention_p -> jr_evicted_p = evicted_p;
+					retention_p -> jr_evicted_capacity = new_capacity;
+				}
+		}
+
+	if (retention_p -> jr_num_evicted < retention_p -> jr_evicted_capacity)
+		{
+			memcpy ((retention_p -> jr_evicted_p) + (retention_p -> jr_num_evicted), tombstone_p, sizeof (JobTombstone));
+			++ (retention_p -> jr_num_evicted);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to make room to evict a job, anything else kept for it won't be removed");
+		}
+
+	retention_p -> jr_oldest = ((retention_p -> jr_oldest) + 1) % (retention_p -> jr_capacity);
+	-- (retention_p -> jr_size);
+}
+
+
+/*
+ * The tombstones are kept in the order that they were added, so the
+ * expired ones are always the oldest. This must be called with the lock held.
+ */
+static void EvictExpiredJobTombstones (JobRetention *retention_p, const int64 now)
+{
+	while ((retention_p -> jr_size > 0) && ((retention_p -> jr_tombstones_p [retention_p -> jr_oldest].jt_added) + (retention_p -> jr_ttl) <= now))
+		{
+			EvictOldestJobTombstone (retention_p);
+		}
+}
+
+
+/*
+ * Swap the evicted tombstones out and pass them to the callback. This must
+ * be called with the lock held, which is released while the callback runs
+ * so more jobs can be added in the meantime.
+ */
+static void FlushEvictedJobTombstones (JobRetention *retention_p)
+{
+	const uint32 num_evicted = retention_p -> jr_num_evicted;
+
+	if (num_evicted > 0)
+		{
+			JobTombstone *batch_p = retention_p -> jr_evicted_p;
+			const uint32 batch_capacity = retention_p -> jr_evicted_capacity;
+
+			retention_p -> jr_evicted_p = retention_p -> jr_evicting_p;
+			retention_p -> jr_evicted_capacity = retention_p -> jr_evicting_capacity;
+			retention_p -> jr_evicting_p = batch_p;
+			retention_p -> jr_evicting_capacity = batch_capacity;
+			retention_p -> jr_num_evicted = 0;
+
+			pthread_mutex_unlock (& (retention_p -> jr_lock));
+
+			retention_p -> jr_callback_fn (batch_p, num_evicted, retention_p -> jr_callback_data_p);
+
+			pthread_mutex_lock (& (retention_p -> jr_lock));
+		}
+}
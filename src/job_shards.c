@@ -0,0 +1,274 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "job_shards.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "streams.h"
+
+
+/* The number of points that each node has on the ring. */
+#define JS_POINTS_PER_NODE (160)
+
+/* The number of bytes at the start of an id that are hashed. */
+#define JS_ID_HASH_SIZE (6)
+
+/* The starting value for the FNV-1a hashes. */
+#define JS_FNV_OFFSET_BASIS (14695981039346656037ULL)
+
+
+static int CompareNodeNames (const void *v0_p, const void *v1_p);
+
+static int CompareJobShardPoints (const void *v0_p, const void *v1_p);
+
+static uint64 HashJobShardBytes (uint64 hash, const unsigned char *data_p, const size_t length);
+
+static uint64 MixJobShardHash (uint64 hash);
+
+
+
+bool InitJobShards (JobShards *shards_p, const char * const *node_names_ss, const uint32 num_nodes, const char *local_node_s)
+{
+	memset (shards_p, 0, sizeof (JobShards));
+
+	if (num_nodes == 0)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "No nodes to share the jobs between");
+			return false;
+		}
+
+	shards_p -> js_node_names_ss = (char **) AllocMemoryArray (num_nodes, sizeof (char *));
+
+	if (shards_p -> js_node_names_ss)
+		{
+			bool success_flag = true;
+			uint32 i;
+
+			for (i = 0; i < num_nodes; ++ i)
+				{
+					shards_p -> js_node_names_ss [i] = EasyCopyToNewString (node_names_ss [i]);
+
+					if (shards_p -> js_node_names_ss [i])
+						{
+							++ (shards_p -> js_num_nodes);
+						}
+					else
+						{
+							success_flag = false;
+							break;
+						}
+				}
+
+			if (success_flag)
+				{
+					/*
+					 * Sort the names so that the indexes of the nodes, and which of
+					 * them wins if two points collide, don't depend upon the order
+					 * that each server was given them in.
+					 */
+					qsort (shards_p -> js_node_names_ss, num_nodes, sizeof (char *), CompareNodeNames);
+
+					shards_p -> js_local_node = num_nodes;
+
+					for (i = 0; i < num_nodes; ++ i)
+						{
+							if ((i > 0) && (strcmp (shards_p -> js_node_names_ss [i - 1], shards_p -> js_node_names_ss [i]) == 0))
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Node \"%s\" is listed more than once", shards_p -> js_node_names_ss [i]);
+									success_flag = false;
+								}
+
+							if (strcmp (shards_p -> js_node_names_ss [i], local_node_s) == 0)
+								{
+									shards_p -> js_local_node = i;
+								}
+						}
+
+					if (shards_p -> js_local_node == num_nodes)
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "This node, \"%s\", is not one of the " UINT32_FMT " nodes", local_node_s, num_nodes);
+							success_flag = false;
+						}
+				}
+
+			if (success_flag)
+				{
+					shards_p -> js_points_p = (JobShardPoint *) AllocMemoryArray (((size_t) num_nodes) * JS_POINTS_PER_NODE, sizeof (JobShardPoint));
+
+					if (shards_p -> js_points_p)
+						{
+							for (i = 0; i < num_nodes; ++ i)
+								{
+									const char *name_s = shards_p -> js_node_names_ss [i];
+									const uint64 name_hash = HashJobShardBytes (JS_FNV_OFFSET_BASIS, (const unsigned char *) name_s, strlen (name_s));
+									uint32 j;
+
+									for (j = 0; j < JS_POINTS_PER_NODE; ++ j)
+										{
+											JobShardPoint *point_p = (shards_p -> js_points_p) + (shards_p -> js_num_points);
+											unsigned char index [4];
+
+											index [0] = (unsigned char) (j >> 24);
+											index [1] = (unsigned char) (j >> 16);
+											index [2] = (unsigned char) (j >> 8);
+											index [3] = (unsigned char) j;
+
+											point_p -> jsp_hash = MixJobShardHash (HashJobShardBytes (name_hash, index, sizeof (index)));
+											point_p -> jsp_node = i;
+
+											++ (shards_p -> js_num_points);
+										}
+								}
+
+							qsort (shards_p -> js_points_p, shards_p -> js_num_points, sizeof (JobShardPoint), CompareJobShardPoints);
+
+							return true;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate the ring for " UINT32_FMT " nodes", num_nodes);
+						}
+				}
+		}
+
+	ClearJobShards (shards_p);
+
+	return false;
+}
+
+
+void ClearJobShards (JobShards *shards_p)
+{
+	if (shards_p -> js_node_names_ss)
+		{
+			uint32 i;
+
+			for (i = 0; i < shards_p -> js_num_nodes; ++ i)
+				{
+					FreeCopiedString (shards_p -> js_node_names_ss [i]);
+				}
+
+			FreeMemory (shards_p -> js_node_names_ss);
+			shards_p -> js_node_names_ss = NULL;
+		}
+
+	if (shards_p -> js_points_p)
+		{
+			FreeMemory (shards_p -> js_points_p);
+			shards_p -> js_points_p = NULL;
+		}
+
+	shards_p -> js_num_nodes = 0;
+	shards_p -> js_num_points = 0;
+}
+
+
+uint32 GetJobShardOwner (const JobShards *shards_p, const uuid_t job_id)
+{
+	const uint64 hash = MixJobShardHash (HashJobShardBytes (JS_FNV_OFFSET_BASIS, job_id, JS_ID_HASH_SIZE));
+	uint32 low = 0;
+	uint32 high = shards_p -> js_num_points;
+
+	/* Find the first point at or after the hash ... */
+	while (low < high)
+		{
+			const uint32 mid = low + ((high - low) >> 1);
+
+			if (shards_p -> js_points_p [mid].jsp_hash < hash)
+				{
+					low = mid + 1;
+				}
+			else
+				{
+					high = mid;
+				}
+		}
+
+	/* ... going back round to the start of the ring if there isn't one */
+	if (low == shards_p -> js_num_points)
+		{
+			low = 0;
+		}
+
+	return shards_p -> js_points_p [low].jsp_node;
+}
+
+
+bool IsLocalJobShard (const JobShards *shards_p, const uuid_t job_id)
+{
+	return (GetJobShardOwner (shards_p, job_id) == shards_p -> js_local_node);
+}
+
+
+const char *GetJobShardNodeName (const JobShards *shards_p, const uint32 node)
+{
+	return shards_p -> js_node_names_ss [node];
+}
+
+
+static int CompareNodeNames (const void *v0_p, const void *v1_p)
+{
+	return strcmp (* ((const char * const *) v0_p), * ((const char * const *) v1_p));
+}
+
+
+static int CompareJobShardPoints (const void *v0_p, const void *v1_p)
+{
+	const JobShardPoint *point_0_p = (const JobShardPoint *) v0_p;
+	const JobShardPoint *point_1_p = (const JobShardPoint *) v1_p;
+
+	if (point_0_p -> jsp_hash != point_1_p -> jsp_hash)
+		{
+			return (point_0_p -> jsp_hash < point_1_p -> jsp_hash) ? -1 : 1;
+		}
+
+	return (point_0_p -> jsp_node < point_1_p -> jsp_node) ? -1 : ((point_0_p -> jsp_node > point_1_p -> jsp_node) ? 1 : 0);
+}
+
+
+/*
+ * Add some bytes to a 64-bit FNV-1a hash.
+ */
+static uint64 HashJobShardBytes (uint64 hash, const unsigned char *data_p, const size_t length)
+{
+	size_t i;
+
+	for (i = 0; i < length; ++ i)
+		{
+			hash ^= data_p [i];
+			hash *= 1099511628211ULL;
+		}
+
+	return hash;
+}
+
+
+/*
+ * FNV-1a on its own leaves the short inputs used here clustered, so the
+ * bits are spread over the whole range with the splitmix64 finaliser.
+ */
+static uint64 MixJobShardHash (uint64 hash)
+{
+	hash ^= hash >> 30;
+	hash *= 0xBF58476D1CE4E5B9ULL;
+	hash ^= hash >> 27;
+	hash *= 0x94D049BB133111EBULL;
+	hash ^= hash >> 31;
+
+	return hash;
+}
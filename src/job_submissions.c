@@ -0,0 +1,325 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+#include <string.h>
+
+#include "job_submissions.h"
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+static void *RunJobSubmissionQueue (void *data_p);
+
+static const JobSubmission *FindJobSubmission (const JobSubmissionQueue *queue_p, const uuid_t id);
+
+static JobSubmission *TakeRunnableJobSubmission (JobSubmissionQueue *queue_p);
+
+
+
+bool InitJobSubmissionQueue (JobSubmissionQueue *queue_p, JobSubmissionCallback callback_fn)
+{
+	memset (queue_p, 0, sizeof (JobSubmissionQueue));
+
+	queue_p -> jsq_callback_fn = callback_fn;
+
+	if (pthread_mutex_init (& (queue_p -> jsq_lock), NULL) == 0)
+		{
+			if (pthread_cond_init (& (queue_p -> jsq_wake_up), NULL) == 0)
+				{
+					if (pthread_create (& (queue_p -> jsq_thread), NULL, RunJobSubmissionQueue, queue_p) == 0)
+						{
+							return true;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to start job submission thread");
+						}
+
+					pthread_cond_destroy (& (queue_p -> jsq_wake_up));
+				}
+
+			pthread_mutex_destroy (& (queue_p -> jsq_lock));
+		}
+
+	return false;
+}
+
+
+void ClearJobSubmissionQueue (JobSubmissionQueue *queue_p)
+{
+	pthread_mutex_lock (& (queue_p -> jsq_lock));
+	queue_p -> jsq_stop_flag = true;
+	pthread_cond_signal (& (queue_p -> jsq_wake_up));
+	pthread_mutex_unlock (& (queue_p -> jsq_lock));
+
+	/* The thread only stops once there is nothing left in the queue that it can run */
+	pthread_join (queue_p -> jsq_thread, NULL);
+
+	while (queue_p -> jsq_first_p)
+		{
+			JobSubmission *next_p = queue_p -> jsq_first_p -> jsb_next_p;
+
+			FreeMemory (queue_p -> jsq_first_p);
+			queue_p -> jsq_first_p = next_p;
+		}
+
+	queue_p -> jsq_last_p = NULL;
+
+	pthread_cond_destroy (& (queue_p -> jsq_wake_up));
+	pthread_mutex_destroy (& (queue_p -> jsq_lock));
+}
+
+
+bool QueueJobSubmission (JobSubmissionQueue *queue_p, const uuid_t id, const uint32 num_jobs, const int32 min_duration, const int64 duration_unit, const JobKind kind, const uint32 seed, const bool held_flag, JobAdmissionReservation *reservation_p, void *callback_data_p)
+{
+	JobSubmission *submission_p = (JobSubmission *) AllocMemory (sizeof (JobSubmission));
+
+	if (submission_p)
+		{
+			memcpy (submission_p -> jsb_id, id, sizeof (uuid_t));
+			submission_p -> jsb_num_jobs = num_jobs;
+			submission_p -> jsb_min_duration = min_duration;
+			submission_p -> jsb_duration_unit = duration_unit;
+			submission_p -> jsb_kind = kind;
+			submission_p -> jsb_seed = seed;
+			submission_p -> jsb_num_started = 0;
+			submission_p -> jsb_held_flag = held_flag;
+			submission_p -> jsb_reservation_p = reservation_p;
+			submission_p -> jsb_callback_data_p = callback_data_p;
+			submission_p -> jsb_next_p = NULL;
+
+			pthread_mutex_lock (& (queue_p -> jsq_lock));
+
+			if (queue_p -> jsq_last_p)
+				{
+					queue_p -> jsq_last_p -> jsb_next_p = submission_p;
+				}
+			else
+				{
+					queue_p -> jsq_first_p = submission_p;
+				}
+
+			queue_p -> jsq_last_p = submission_p;
+
+			pthread_cond_signal (& (queue_p -> jsq_wake_up));
+			pthread_mutex_unlock (& (queue_p -> jsq_lock));
+
+			return true;
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate submission for " UINT32_FMT " jobs", num_jobs);
+
+	return false;
+}
+
+
+bool ReleaseJobSubmission (JobSubmissionQueue *queue_p, const uuid_t id, const bool run_flag, JobAdmissionReservation *reservation_p)
+{
+	JobSubmission **submission_pp = & (queue_p -> jsq_first_p);
+	JobSubmission *previous_p = NULL;
+	bool released_flag = false;
+
+	pthread_mutex_lock (& (queue_p -> jsq_lock));
+
+	while ((*submission_pp) && (!released_flag))
+		{
+			JobSubmission *submission_p = *submission_pp;
+
+			if ((submission_p -> jsb_held_flag) && (memcmp (submission_p -> jsb_id, id, sizeof (uuid_t)) == 0))
+				{
+					if (run_flag)
+						{
+							submission_p -> jsb_held_flag = false;
+							submission_p -> jsb_reservation_p = reservation_p;
+							pthread_cond_signal (& (queue_p -> jsq_wake_up));
+						}
+					else
+						{
+							*submission_pp = submission_p -> jsb_next_p;
+
+							if (queue_p -> jsq_last_p == submission_p)
+								{
+									queue_p -> jsq_last_p = previous_p;
+								}
+
+							FreeMemory (submission_p);
+						}
+
+					released_flag = true;
+				}
+			else
+				{
+					previous_p = submission_p;
+					submission_pp = & (submission_p -> jsb_next_p);
+				}
+		}
+
+	pthread_mutex_unlock (& (queue_p -> jsq_lock));
+
+	return released_flag;
+}
+
+
+void SetJobSubmissionProgress (JobSubmissionQueue *queue_p, JobSubmission *submission_p, const uint32 num_started, const int64 latest_end)
+{
+	pthread_mutex_lock (& (queue_p -> jsq_lock));
+
+	submission_p -> jsb_num_started = num_started;
+
+	if (latest_end > queue_p -> jsq_latest_end)
+		{
+			queue_p -> jsq_latest_end = latest_end;
+		}
+
+	pthread_mutex_unlock (& (queue_p -> jsq_lock));
+}
+
+
+bool GetJobSubmissionProgress (JobSubmissionQueue *queue_p, const uuid_t id, uint32 *num_jobs_p, uint32 *num_started_p)
+{
+	const JobSubmission *submission_p;
+	bool found_flag = false;
+
+	pthread_mutex_lock (& (queue_p -> jsq_lock));
+
+	submission_p = FindJobSubmission (queue_p, id);
+
+	if (submission_p)
+		{
+			*num_jobs_p = submission_p -> jsb_num_jobs;
+			*num_started_p = submission_p -> jsb_num_started;
+			found_flag = true;
+		}
+
+	pthread_mutex_unlock (& (queue_p -> jsq_lock));
+
+	return found_flag;
+}
+
+
+bool HasOutstandingJobSubmissions (JobSubmissionQueue *queue_p, const int64 now)
+{
+	bool outstanding_flag;
+
+	pthread_mutex_lock (& (queue_p -> jsq_lock));
+	outstanding_flag = (queue_p -> jsq_first_p) || (queue_p -> jsq_current_p) || (queue_p -> jsq_latest_end > now);
+	pthread_mutex_unlock (& (queue_p -> jsq_lock));
+
+	return outstanding_flag;
+}
+
+
+static void *RunJobSubmissionQueue (void *data_p)
+{
+	JobSubmissionQueue *queue_p = (JobSubmissionQueue *) data_p;
+
+	pthread_mutex_lock (& (queue_p -> jsq_lock));
+
+	while (true)
+		{
+			JobSubmission *submission_p = TakeRunnableJobSubmission (queue_p);
+
+			if (submission_p)
+				{
+					/* Keep the request where GetJobSubmissionProgress () can see it while it runs */
+					queue_p -> jsq_current_p = submission_p;
+
+					pthread_mutex_unlock (& (queue_p -> jsq_lock));
+
+					queue_p -> jsq_callback_fn (submission_p, submission_p -> jsb_callback_data_p);
+
+					pthread_mutex_lock (& (queue_p -> jsq_lock));
+
+					queue_p -> jsq_current_p = NULL;
+					FreeMemory (submission_p);
+				}
+			else if (queue_p -> jsq_stop_flag)
+				{
+					break;
+				}
+			else
+				{
+					pthread_cond_wait (& (queue_p -> jsq_wake_up), & (queue_p -> jsq_lock));
+				}
+		}
+
+	pthread_mutex_unlock (& (queue_p -> jsq_lock));
+
+	return NULL;
+}
+
+
+/*
+ * Take the first request that isn't being held off the queue. This must
+ * be called with the lock held.
+ */
+static JobSubmission *TakeRunnableJobSubmission (JobSubmissionQueue *queue_p)
+{
+	JobSubmission **submission_pp = & (queue_p -> jsq_first_p);
+	JobSubmission *previous_p = NULL;
+
+	while (*submission_pp)
+		{
+			JobSubmission *submission_p = *submission_pp;
+
+			if (! (submission_p -> jsb_held_flag))
+				{
+					*submission_pp = submission_p -> jsb_next_p;
+
+					if (queue_p -> jsq_last_p == submission_p)
+						{
+							queue_p -> jsq_last_p = previous_p;
+						}
+
+					submission_p -> jsb_next_p = NULL;
+
+					return submission_p;
+				}
+
+			previous_p = submission_p;
+			submission_pp = & (submission_p -> jsb_next_p);
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Find a request that is either running or waiting to run. This must be
+ * called with the lock held.
+ */
+static const JobSubmission *FindJobSubmission (const JobSubmissionQueue *queue_p, const uuid_t id)
+{
+	const JobSubmission *submission_p = queue_p -> jsq_current_p;
+
+	if (submission_p && (memcmp (submission_p -> jsb_id, id, sizeof (uuid_t)) == 0))
+		{
+			return submission_p;
+		}
+
+	submission_p = queue_p -> jsq_first_p;
+
+	while (submission_p)
+		{
+			if (memcmp (submission_p -> jsb_id, id, sizeof (uuid_t)) == 0)
+				{
+					return submission_p;
+				}
+
+			submission_p = submission_p -> jsb_next_p;
+		}
+
+	return NULL;
+}
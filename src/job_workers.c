@@ -0,0 +1,901 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "job_workers.h"
+#include "job_clock.h"
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+/*
+ * The size of the buffer that each worker sweeps for JK_MEMORY jobs. This
+ * needs to be bigger than the last level cache of anything we are likely
+ * to run on.
+ */
+#define JW_MEMORY_BUFFER_SIZE (64 * 1024 * 1024)
+
+/* The size of each block that is written and read for JK_IO jobs. */
+#define JW_IO_BLOCK_SIZE (1024 * 1024)
+
+/* The number of blocks in the temporary file for JK_IO jobs. */
+#define JW_IO_NUM_BLOCKS (16)
+
+/* The number of iterations of the JK_CPU loop between each check of the time. */
+#define JW_CPU_BATCH_SIZE (1 << 16)
+
+/*
+ * The most locks that the hash table is split between. Each one covers
+ * every 64th bucket, so threads queuing, starting and releasing different
+ * jobs rarely need the same lock.
+ */
+#define JW_NUM_BUCKET_LOCKS (64)
+
+
+/*
+ * The buffers that a worker thread reuses from one job to the next.
+ */
+typedef struct JobWorkerBuffers
+{
+	/* The buffer for JK_MEMORY jobs, allocated the first time it is needed. */
+	uint64 *jwb_memory_p;
+
+	/* The block for JK_IO jobs, allocated the first time it is needed. */
+	unsigned char *jwb_io_block_p;
+} JobWorkerBuffers;
+
+
+static const char * const S_KIND_NAMES [JK_NUM_KINDS] =
+{
+	"sleep",
+	"cpu",
+	"memory",
+	"io"
+};
+
+
+/*
+ * The results of the simulated work are written here so that the compiler
+ * can't optimise the work away.
+ */
+static volatile uint64 s_work_sink = 0;
+
+
+static void *RunJobWorker (void *data_p);
+
+static void StopJobWorkers (JobWorkers *workers_p, const uint32 num_started);
+
+static uint32 TakeJobWork (JobWorkers *workers_p, JobWorkQueue *own_queue_p);
+
+static uint32 PopJobWorkQueue (JobWorkQueue *queue_p, const bool front_flag, const uint32 capacity);
+
+static void ReleaseJobWorkItem (JobWorkers *workers_p, const uint32 index);
+
+static uint32 TakeFreeJobWorkItem (JobWorkers *workers_p);
+
+static uint32 GetJobWorkBucket (const JobWorkers *workers_p, const uuid_t id);
+
+static pthread_mutex_t *GetJobWorkBucketLock (JobWorkers *workers_p, const uint32 bucket);
+
+static bool DoJobWork (JobWorkers *workers_p, const JobKind kind, const int64 end, JobWorkerBuffers *buffers_p);
+
+static void DoCPUWork (JobWorkers *workers_p, const int64 end);
+
+static void DoMemoryWork (JobWorkers *workers_p, const int64 end, JobWorkerBuffers *buffers_p);
+
+static void DoIOWork (JobWorkers *workers_p, const int64 end, JobWorkerBuffers *buffers_p);
+
+static void WaitForJobWorkEnd (JobWorkers *workers_p, const int64 end);
+
+static bool IsJobWorkFinished (const JobWorkers *workers_p, const int64 end);
+
+
+
+bool InitJobWorkers (JobWorkers *workers_p, const uint32 num_threads, const uint32 max_jobs, JobWorkCallback callback_fn)
+{
+	uint32 num_queues = 0;
+	uint32 num_locks = 0;
+	uint32 i;
+
+	memset (workers_p, 0, sizeof (JobWorkers));
+
+	workers_p -> jw_num_threads = num_threads;
+	workers_p -> jw_max_jobs = (max_jobs > 0) ? max_jobs : 1;
+	workers_p -> jw_free_item = JW_NONE;
+	workers_p -> jw_callback_fn = callback_fn;
+
+	if (workers_p -> jw_num_threads == 0)
+		{
+			const long num_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+			workers_p -> jw_num_threads = (num_cpus > 0) ? (uint32) num_cpus : 1;
+		}
+
+	workers_p -> jw_max_items = ((workers_p -> jw_max_jobs) < UINT32_MAX - (workers_p -> jw_num_threads)) ? (workers_p -> jw_max_jobs) + (workers_p -> jw_num_threads) : UINT32_MAX - 1;
+
+	/* Keep the load factor at or below 1 */
+	workers_p -> jw_num_buckets = 1;
+
+	while ((workers_p -> jw_num_buckets < workers_p -> jw_max_items) && (workers_p -> jw_num_buckets < 0x80000000))
+		{
+			workers_p -> jw_num_buckets <<= 1;
+		}
+
+	workers_p -> jw_num_bucket_locks = (workers_p -> jw_num_buckets < JW_NUM_BUCKET_LOCKS) ? workers_p -> jw_num_buckets : JW_NUM_BUCKET_LOCKS;
+
+	workers_p -> jw_items_p = (JobWorkItem *) AllocMemoryArray (workers_p -> jw_max_items, sizeof (JobWorkItem));
+	workers_p -> jw_buckets_p = (uint32 *) AllocMemoryArray (workers_p -> jw_num_buckets, sizeof (uint32));
+	workers_p -> jw_bucket_locks_p = (pthread_mutex_t *) AllocMemoryArray (workers_p -> jw_num_bucket_locks, sizeof (pthread_mutex_t));
+	workers_p -> jw_queues_p = (JobWorkQueue *) AllocMemoryArray (workers_p -> jw_num_threads, sizeof (JobWorkQueue));
+
+	if ((workers_p -> jw_items_p) && (workers_p -> jw_buckets_p) && (workers_p -> jw_bucket_locks_p) && (workers_p -> jw_queues_p))
+		{
+			/* Chain all of the items together as the free list */
+			for (i = 0; i < workers_p -> jw_max_items; ++ i)
+				{
+					workers_p -> jw_items_p [i].jwi_next = (i + 1 < workers_p -> jw_max_items) ? i + 1 : JW_NONE;
+				}
+
+			workers_p -> jw_free_item = 0;
+
+			for (i = 0; i < workers_p -> jw_num_buckets; ++ i)
+				{
+					workers_p -> jw_buckets_p [i] = JW_NONE;
+				}
+
+			while ((num_locks < workers_p -> jw_num_bucket_locks) && (pthread_mutex_init ((workers_p -> jw_bucket_locks_p) + num_locks, NULL) == 0))
+				{
+					++ num_locks;
+				}
+
+			/*
+			 * Since any of the jobs could end up in the same queue, each one
+			 * needs space for all of them.
+			 */
+			while ((num_locks == workers_p -> jw_num_bucket_locks) && (num_queues < workers_p -> jw_num_threads))
+				{
+					JobWorkQueue *queue_p = (workers_p -> jw_queues_p) + num_queues;
+
+					queue_p -> jwq_workers_p = workers_p;
+					queue_p -> jwq_first = 0;
+					queue_p -> jwq_num_items = 0;
+					queue_p -> jwq_items_p = (uint32 *) AllocMemoryArray (workers_p -> jw_max_items, sizeof (uint32));
+
+					if (! (queue_p -> jwq_items_p))
+						{
+							break;
+						}
+
+					if (pthread_mutex_init (& (queue_p -> jwq_lock), NULL) != 0)
+						{
+							FreeMemory (queue_p -> jwq_items_p);
+							break;
+						}
+
+					++ num_queues;
+				}
+
+			if (num_queues == workers_p -> jw_num_threads)
+				{
+					if (pthread_mutex_init (& (workers_p -> jw_idle_lock), NULL) == 0)
+						{
+							if (pthread_cond_init (& (workers_p -> jw_work_available), NULL) == 0)
+								{
+									for (i = 0; i < workers_p -> jw_num_threads; ++ i)
+										{
+											JobWorkQueue *queue_p = (workers_p -> jw_queues_p) + i;
+
+											if (pthread_create (& (queue_p -> jwq_thread), NULL, RunJobWorker, queue_p) != 0)
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to start job worker thread " UINT32_FMT, i);
+													break;
+												}
+										}
+
+									if (i == workers_p -> jw_num_threads)
+										{
+											return true;
+										}
+
+									/* Stop the threads that did start */
+									StopJobWorkers (workers_p, i);
+
+									pthread_cond_destroy (& (workers_p -> jw_work_available));
+								}
+
+							pthread_mutex_destroy (& (workers_p -> jw_idle_lock));
+						}
+				}
+
+			while (num_queues > 0)
+				{
+					-- num_queues;
+
+					pthread_mutex_destroy (& (workers_p -> jw_queues_p [num_queues].jwq_lock));
+					FreeMemory (workers_p -> jw_queues_p [num_queues].jwq_items_p);
+				}
+
+			while (num_locks > 0)
+				{
+					-- num_locks;
+
+					pthread_mutex_destroy ((workers_p -> jw_bucket_locks_p) + num_locks);
+				}
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise " UINT32_FMT " job workers for " UINT32_FMT " jobs", workers_p -> jw_num_threads, workers_p -> jw_max_jobs);
+
+	if (workers_p -> jw_queues_p)
+		{
+			FreeMemory (workers_p -> jw_queues_p);
+			workers_p -> jw_queues_p = NULL;
+		}
+
+	if (workers_p -> jw_bucket_locks_p)
+		{
+			FreeMemory (workers_p -> jw_bucket_locks_p);
+			workers_p -> jw_bucket_locks_p = NULL;
+		}
+
+	if (workers_p -> jw_buckets_p)
+		{
+			FreeMemory (workers_p -> jw_buckets_p);
+			workers_p -> jw_buckets_p = NULL;
+		}
+
+	if (workers_p -> jw_items_p)
+		{
+			FreeMemory (workers_p -> jw_items_p);
+			workers_p -> jw_items_p = NULL;
+		}
+
+	workers_p -> jw_num_threads = 0;
+
+	return false;
+}
+
+
+void ClearJobWorkers (JobWorkers *workers_p)
+{
+	uint32 i;
+
+	StopJobWorkers (workers_p, workers_p -> jw_num_threads);
+
+	for (i = 0; i < workers_p -> jw_num_threads; ++ i)
+		{
+			JobWorkQueue *queue_p = (workers_p -> jw_queues_p) + i;
+
+			pthread_mutex_destroy (& (queue_p -> jwq_lock));
+			FreeMemory (queue_p -> jwq_items_p);
+		}
+
+	for (i = 0; i < workers_p -> jw_num_bucket_locks; ++ i)
+		{
+			pthread_mutex_destroy ((workers_p -> jw_bucket_locks_p) + i);
+		}
+
+	pthread_cond_destroy (& (workers_p -> jw_work_available));
+	pthread_mutex_destroy (& (workers_p -> jw_idle_lock));
+
+	FreeMemory (workers_p -> jw_queues_p);
+	FreeMemory (workers_p -> jw_bucket_locks_p);
+	FreeMemory (workers_p -> jw_buckets_p);
+	FreeMemory (workers_p -> jw_items_p);
+
+	workers_p -> jw_queues_p = NULL;
+	workers_p -> jw_bucket_locks_p = NULL;
+	workers_p -> jw_buckets_p = NULL;
+	workers_p -> jw_items_p = NULL;
+	workers_p -> jw_num_threads = 0;
+	workers_p -> jw_num_bucket_locks = 0;
+	workers_p -> jw_num_jobs = 0;
+	workers_p -> jw_num_queued = 0;
+}
+
+
+bool QueueJobWork (JobWorkers *workers_p, const uuid_t job_id, const JobKind kind, const int64 duration, void *callback_data_p)
+{
+	uint32 index;
+	JobWorkItem *item_p;
+	JobWorkQueue *queue_p;
+	pthread_mutex_t *lock_p;
+	uint32 bucket;
+
+	if (__atomic_load_n (& (workers_p -> jw_stop_flag), __ATOMIC_ACQUIRE))
+		{
+			return false;
+		}
+
+	/*
+	 * Count the job before taking an item for it. At most one item for
+	 * each thread can be in use by a job that no longer counts, so if
+	 * there is room, the free list is certain to have one.
+	 */
+	if (__atomic_add_fetch (& (workers_p -> jw_num_jobs), 1, __ATOMIC_ACQ_REL) > workers_p -> jw_max_jobs)
+		{
+			__atomic_sub_fetch (& (workers_p -> jw_num_jobs), 1, __ATOMIC_ACQ_REL);
+			return false;
+		}
+
+	index = TakeFreeJobWorkItem (workers_p);
+	item_p = (workers_p -> jw_items_p) + index;
+	bucket = GetJobWorkBucket (workers_p, job_id);
+	lock_p = GetJobWorkBucketLock (workers_p, bucket);
+
+	memcpy (item_p -> jwi_id, job_id, sizeof (uuid_t));
+	item_p -> jwi_kind = kind;
+	item_p -> jwi_duration = duration;
+	item_p -> jwi_callback_data_p = callback_data_p;
+
+	pthread_mutex_lock (lock_p);
+	item_p -> jwi_start = 0;
+	item_p -> jwi_state = JWS_QUEUED;
+	item_p -> jwi_next = workers_p -> jw_buckets_p [bucket];
+	workers_p -> jw_buckets_p [bucket] = index;
+	pthread_mutex_unlock (lock_p);
+
+	/* Share the jobs out between the queues in turn */
+	queue_p = (workers_p -> jw_queues_p) + (__atomic_fetch_add (& (workers_p -> jw_next_queue), 1, __ATOMIC_RELAXED) % (workers_p -> jw_num_threads));
+
+	pthread_mutex_lock (& (queue_p -> jwq_lock));
+	queue_p -> jwq_items_p [((queue_p -> jwq_first) + (queue_p -> jwq_num_items)) % (workers_p -> jw_max_items)] = index;
+	__atomic_add_fetch (& (queue_p -> jwq_num_items), 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock (& (queue_p -> jwq_lock));
+
+	__atomic_add_fetch (& (workers_p -> jw_num_queued), 1, __ATOMIC_SEQ_CST);
+
+	/*
+	 * An idle worker counts itself before it checks jw_num_queued, so either
+	 * it sees this job or we see it and wake it.
+	 */
+	if (__atomic_load_n (& (workers_p -> jw_num_idle), __ATOMIC_SEQ_CST) > 0)
+		{
+			pthread_mutex_lock (& (workers_p -> jw_idle_lock));
+			pthread_cond_signal (& (workers_p -> jw_work_available));
+			pthread_mutex_unlock (& (workers_p -> jw_idle_lock));
+		}
+
+	return true;
+}
+
+
+bool GetJobWorkState (JobWorkers *workers_p, const uuid_t job_id, JobWorkState *state_p, int64 *start_p)
+{
+	bool found_flag = false;
+	const uint32 bucket = GetJobWorkBucket (workers_p, job_id);
+	pthread_mutex_t *lock_p = GetJobWorkBucketLock (workers_p, bucket);
+	uint32 index;
+
+	pthread_mutex_lock (lock_p);
+
+	index = workers_p -> jw_buckets_p [bucket];
+
+	while (index != JW_NONE)
+		{
+			const JobWorkItem *item_p = (workers_p -> jw_items_p) + index;
+
+			if (memcmp (item_p -> jwi_id, job_id, sizeof (uuid_t)) == 0)
+				{
+					*state_p = item_p -> jwi_state;
+
+					if (start_p && (item_p -> jwi_state == JWS_RUNNING))
+						{
+							*start_p = item_p -> jwi_start;
+						}
+
+					found_flag = true;
+					break;
+				}
+
+			index = item_p -> jwi_next;
+		}
+
+	pthread_mutex_unlock (lock_p);
+
+	return found_flag;
+}
+
+
+uint32 GetNumJobWorkItems (JobWorkers *workers_p)
+{
+	return __atomic_load_n (& (workers_p -> jw_num_jobs), __ATOMIC_ACQUIRE);
+}
+
+
+const char *GetJobKindAsString (const JobKind kind)
+{
+	if ((kind >= JK_SLEEP) && (kind < JK_NUM_KINDS))
+		{
+			return S_KIND_NAMES [kind];
+		}
+
+	return NULL;
+}
+
+
+bool GetJobKindFromString (const char *kind_s, JobKind *kind_p)
+{
+	if (kind_s)
+		{
+			int i;
+
+			for (i = 0; i < JK_NUM_KINDS; ++ i)
+				{
+					if (strcmp (kind_s, S_KIND_NAMES [i]) == 0)
+						{
+							*kind_p = (JobKind) i;
+							return true;
+						}
+				}
+		}
+
+	return false;
+}
+
+
+/*
+ * The entry point for each worker thread. This runs the jobs from its own
+ * queue, or from the others once that is empty, until it is told to stop.
+ */
+static void *RunJobWorker (void *data_p)
+{
+	JobWorkQueue *own_queue_p = (JobWorkQueue *) data_p;
+	JobWorkers *workers_p = own_queue_p -> jwq_workers_p;
+	JobWorkerBuffers buffers;
+
+	memset (&buffers, 0, sizeof (JobWorkerBuffers));
+
+	while (!__atomic_load_n (& (workers_p -> jw_stop_flag), __ATOMIC_ACQUIRE))
+		{
+			const uint32 index = TakeJobWork (workers_p, own_queue_p);
+
+			if (index != JW_NONE)
+				{
+					JobWorkItem *item_p = (workers_p -> jw_items_p) + index;
+					pthread_mutex_t *lock_p = GetJobWorkBucketLock (workers_p, GetJobWorkBucket (workers_p, item_p -> jwi_id));
+					uuid_t job_id;
+					JobKind kind;
+					void *callback_data_p;
+					int64 start;
+					int64 end;
+					bool finished_flag;
+
+					/* Only the state and start time can be read by other threads */
+					memcpy (job_id, item_p -> jwi_id, sizeof (uuid_t));
+					kind = item_p -> jwi_kind;
+					callback_data_p = item_p -> jwi_callback_data_p;
+					start = GetJobClockTime ();
+					end = start + (item_p -> jwi_duration);
+
+					pthread_mutex_lock (lock_p);
+					item_p -> jwi_start = start;
+					item_p -> jwi_state = JWS_RUNNING;
+					pthread_mutex_unlock (lock_p);
+
+					finished_flag = DoJobWork (workers_p, kind, end, &buffers);
+
+					/* Make room for another job before the caller hears that this one has finished */
+					__atomic_sub_fetch (& (workers_p -> jw_num_jobs), 1, __ATOMIC_ACQ_REL);
+
+					if (finished_flag)
+						{
+							/*
+							 * The job is still in the table while the callback runs, so
+							 * anything that checks on it in the meantime still sees it
+							 * as running rather than finding nothing.
+							 */
+							if (workers_p -> jw_callback_fn)
+								{
+									workers_p -> jw_callback_fn (job_id, start, GetJobClockTime (), callback_data_p);
+								}
+						}
+
+					ReleaseJobWorkItem (workers_p, index);
+				}
+			else
+				{
+					pthread_mutex_lock (& (workers_p -> jw_idle_lock));
+					__atomic_add_fetch (& (workers_p -> jw_num_idle), 1, __ATOMIC_SEQ_CST);
+
+					while ((__atomic_load_n (& (workers_p -> jw_num_queued), __ATOMIC_SEQ_CST) == 0) && (!__atomic_load_n (& (workers_p -> jw_stop_flag), __ATOMIC_ACQUIRE)))
+						{
+							pthread_cond_wait (& (workers_p -> jw_work_available), & (workers_p -> jw_idle_lock));
+						}
+
+					__atomic_sub_fetch (& (workers_p -> jw_num_idle), 1, __ATOMIC_SEQ_CST);
+					pthread_mutex_unlock (& (workers_p -> jw_idle_lock));
+				}
+		}
+
+	if (buffers.jwb_memory_p)
+		{
+			FreeMemory (buffers.jwb_memory_p);
+		}
+
+	if (buffers.jwb_io_block_p)
+		{
+			FreeMemory (buffers.jwb_io_block_p);
+		}
+
+	return NULL;
+}
+
+
+static void StopJobWorkers (JobWorkers *workers_p, const uint32 num_started)
+{
+	uint32 i;
+
+	pthread_mutex_lock (& (workers_p -> jw_idle_lock));
+	__atomic_store_n (& (workers_p -> jw_stop_flag), true, __ATOMIC_RELEASE);
+	pthread_cond_broadcast (& (workers_p -> jw_work_available));
+	pthread_mutex_unlock (& (workers_p -> jw_idle_lock));
+
+	for (i = 0; i < num_started; ++ i)
+		{
+			pthread_join (workers_p -> jw_queues_p [i].jwq_thread, NULL);
+		}
+}
+
+
+/*
+ * Get the index of the next job for a worker to run, taking it from the
+ * front of the worker's own queue if it can or stealing it from the back
+ * of another one otherwise. The other queues are tried in turn, starting
+ * with the next one along, so the workers don't all go to the same one.
+ *
+ * Returns JW_NONE if all of the queues are empty.
+ */
+static uint32 TakeJobWork (JobWorkers *workers_p, JobWorkQueue *own_queue_p)
+{
+	const uint32 own_index = (uint32) (own_queue_p - (workers_p -> jw_queues_p));
+	uint32 index = PopJobWorkQueue (own_queue_p, true, workers_p -> jw_max_items);
+	uint32 i;
+
+	for (i = 1; (index == JW_NONE) && (i < workers_p -> jw_num_threads); ++ i)
+		{
+			JobWorkQueue *queue_p = (workers_p -> jw_queues_p) + ((own_index + i) % (workers_p -> jw_num_threads));
+
+			index = PopJobWorkQueue (queue_p, false, workers_p -> jw_max_items);
+		}
+
+	if (index != JW_NONE)
+		{
+			__atomic_sub_fetch (& (workers_p -> jw_num_queued), 1, __ATOMIC_RELEASE);
+		}
+
+	return index;
+}
+
+
+/*
+ * Remove an item from either the front or the back of a queue, returning
+ * its index or JW_NONE if the queue is empty.
+ */
+static uint32 PopJobWorkQueue (JobWorkQueue *queue_p, const bool front_flag, const uint32 capacity)
+{
+	uint32 index = JW_NONE;
+
+	/* Don't bother taking the lock for a queue that looks empty */
+	if (__atomic_load_n (& (queue_p -> jwq_num_items), __ATOMIC_RELAXED) == 0)
+		{
+			return JW_NONE;
+		}
+
+	pthread_mutex_lock (& (queue_p -> jwq_lock));
+
+	if (queue_p -> jwq_num_items > 0)
+		{
+			__atomic_sub_fetch (& (queue_p -> jwq_num_items), 1, __ATOMIC_RELAXED);
+
+			if (front_flag)
+				{
+					index = queue_p -> jwq_items_p [queue_p -> jwq_first];
+					queue_p -> jwq_first = ((queue_p -> jwq_first) + 1) % capacity;
+				}
+			else
+				{
+					index = queue_p -> jwq_items_p [((queue_p -> jwq_first) + (queue_p -> jwq_num_items)) % capacity];
+				}
+		}
+
+	pthread_mutex_unlock (& (queue_p -> jwq_lock));
+
+	return index;
+}
+
+
+/*
+ * Remove a finished or abandoned item from the hash table and put it
+ * back on the free list.
+ */
+static void ReleaseJobWorkItem (JobWorkers *workers_p, const uint32 index)
+{
+	JobWorkItem *item_p = (workers_p -> jw_items_p) + index;
+	const uint32 bucket = GetJobWorkBucket (workers_p, item_p -> jwi_id);
+	pthread_mutex_t *lock_p = GetJobWorkBucketLock (workers_p, bucket);
+	uint32 *link_p;
+	uint64 head;
+	uint64 new_head;
+
+	pthread_mutex_lock (lock_p);
+
+	link_p = (workers_p -> jw_buckets_p) + bucket;
+
+	while (*link_p != index)
+		{
+			link_p = & (workers_p -> jw_items_p [*link_p].jwi_next);
+		}
+
+	*link_p = item_p -> jwi_next;
+
+	pthread_mutex_unlock (lock_p);
+
+	head = __atomic_load_n (& (workers_p -> jw_free_item), __ATOMIC_ACQUIRE);
+
+	do
+		{
+			__atomic_store_n (& (item_p -> jwi_next), (uint32) head, __ATOMIC_RELAXED);
+			new_head = (((head >> 32) + 1) << 32) | index;
+		}
+	while (!__atomic_compare_exchange_n (& (workers_p -> jw_free_item), &head, new_head, true, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+}
+
+
+/*
+ * Take an item from the free list. The caller must already have counted
+ * the job in jw_num_jobs, so there is always one to take.
+ */
+static uint32 TakeFreeJobWorkItem (JobWorkers *workers_p)
+{
+	uint64 head = __atomic_load_n (& (workers_p -> jw_free_item), __ATOMIC_ACQUIRE);
+	uint32 index;
+	uint64 new_head;
+
+	do
+		{
+			index = (uint32) head;
+
+			/*
+			 * If another thread takes this item first, the next index read
+			 * here may be stale but the count in the head will have changed
+			 * so the exchange fails and we try again.
+			 */
+			new_head = (((head >> 32) + 1) << 32) | __atomic_load_n (& (workers_p -> jw_items_p [index].jwi_next), __ATOMIC_RELAXED);
+		}
+	while (!__atomic_compare_exchange_n (& (workers_p -> jw_free_item), &head, new_head, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+	return index;
+}
+
+
+/*
+ * Since uuids are random, their first few bytes are already well
+ * distributed and can be used as the hash directly.
+ */
+static uint32 GetJobWorkBucket (const JobWorkers *workers_p, const uuid_t id)
+{
+	uint32 hash;
+
+	memcpy (&hash, id, sizeof (uint32));
+
+	return hash & ((workers_p -> jw_num_buckets) - 1);
+}
+
+
+static pthread_mutex_t *GetJobWorkBucketLock (JobWorkers *workers_p, const uint32 bucket)
+{
+	return (workers_p -> jw_bucket_locks_p) + (bucket & ((workers_p -> jw_num_bucket_locks) - 1));
+}
+
+
+/*
+ * Generate a job's load until its end time. If the load can't be
+ * generated for any reason, the worker just waits out the rest
+ * of the job's time instead.
+ *
+ * Returns false if the workers were stopped before the job finished.
+ */
+static bool DoJobWork (JobWorkers *workers_p, const JobKind kind, const int64 end, JobWorkerBuffers *buffers_p)
+{
+	switch (kind)
+		{
+			case JK_CPU:
+				DoCPUWork (workers_p, end);
+				break;
+
+			case JK_MEMORY:
+				DoMemoryWork (workers_p, end, buffers_p);
+				break;
+
+			case JK_IO:
+				DoIOWork (workers_p, end, buffers_p);
+				break;
+
+			default:
+				break;
+		}
+
+	WaitForJobWorkEnd (workers_p, end);
+
+	return !__atomic_load_n (& (workers_p -> jw_stop_flag), __ATOMIC_ACQUIRE);
+}
+
+
+/*
+ * Keep the processor busy with a chain of dependent multiplications
+ * until the job's end time.
+ */
+static void DoCPUWork (JobWorkers *workers_p, const int64 end)
+{
+	uint64 value = (uint64) end;
+
+	while (!IsJobWorkFinished (workers_p, end))
+		{
+			uint32 i;
+
+			for (i = 0; i < JW_CPU_BATCH_SIZE; ++ i)
+				{
+					value ^= value >> 31;
+					value *= 0x9E3779B97F4A7C15ULL;
+				}
+		}
+
+	__atomic_store_n (&s_work_sink, value, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Read and write every cache line of a large buffer until the job's end time.
+ */
+static void DoMemoryWork (JobWorkers *workers_p, const int64 end, JobWorkerBuffers *buffers_p)
+{
+	const size_t num_values = JW_MEMORY_BUFFER_SIZE / sizeof (uint64);
+	uint64 sum = 0;
+
+	if (! (buffers_p -> jwb_memory_p))
+		{
+			buffers_p -> jwb_memory_p = (uint64 *) AllocMemory (JW_MEMORY_BUFFER_SIZE);
+
+			if (buffers_p -> jwb_memory_p)
+				{
+					memset (buffers_p -> jwb_memory_p, 0, JW_MEMORY_BUFFER_SIZE);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " bytes for memory work", (size_t) JW_MEMORY_BUFFER_SIZE);
+					return;
+				}
+		}
+
+	while (!IsJobWorkFinished (workers_p, end))
+		{
+			uint64 *value_p = buffers_p -> jwb_memory_p;
+			size_t i;
+
+			/* A uint64 every 64 bytes touches each cache line once */
+			for (i = 0; i < num_values; i += 8, value_p += 8)
+				{
+					sum += *value_p;
+					*value_p = sum;
+				}
+		}
+
+	__atomic_store_n (&s_work_sink, sum, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Write a temporary file, sync it to disk and read it back, over and
+ * over until the job's end time.
+ */
+static void DoIOWork (JobWorkers *workers_p, const int64 end, JobWorkerBuffers *buffers_p)
+{
+	FILE *file_p = NULL;
+	uint64 sum = 0;
+
+	if (! (buffers_p -> jwb_io_block_p))
+		{
+			buffers_p -> jwb_io_block_p = (unsigned char *) AllocMemory (JW_IO_BLOCK_SIZE);
+
+			if (buffers_p -> jwb_io_block_p)
+				{
+					memset (buffers_p -> jwb_io_block_p, 0xA5, JW_IO_BLOCK_SIZE);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " bytes for I/O work", (size_t) JW_IO_BLOCK_SIZE);
+					return;
+				}
+		}
+
+	/* The file is deleted as soon as it is closed */
+	file_p = tmpfile ();
+
+	if (!file_p)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create temporary file for I/O work");
+			return;
+		}
+
+	while (!IsJobWorkFinished (workers_p, end))
+		{
+			uint32 i;
+
+			rewind (file_p);
+
+			for (i = 0; (i < JW_IO_NUM_BLOCKS) && (!IsJobWorkFinished (workers_p, end)); ++ i)
+				{
+					if (fwrite (buffers_p -> jwb_io_block_p, 1, JW_IO_BLOCK_SIZE, file_p) != JW_IO_BLOCK_SIZE)
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to write block " UINT32_FMT " for I/O work", i);
+							fclose (file_p);
+							return;
+						}
+				}
+
+			fflush (file_p);
+			fsync (fileno (file_p));
+
+			rewind (file_p);
+
+			for (i = 0; (i < JW_IO_NUM_BLOCKS) && (!IsJobWorkFinished (workers_p, end)); ++ i)
+				{
+					if (fread (buffers_p -> jwb_io_block_p, 1, JW_IO_BLOCK_SIZE, file_p) != JW_IO_BLOCK_SIZE)
+						{
+							/* The write loop may have stopped early */
+							break;
+						}
+
+					sum += buffers_p -> jwb_io_block_p [i];
+				}
+		}
+
+	fclose (file_p);
+
+	__atomic_store_n (&s_work_sink, sum, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Sleep until a job's end time, waking up regularly to check whether
+ * the workers have been told to stop.
+ */
+static void WaitForJobWorkEnd (JobWorkers *workers_p, const int64 end)
+{
+	while (!IsJobWorkFinished (workers_p, end))
+		{
+			const int64 remaining = end - GetJobClockTime ();
+			struct timespec wait;
+
+			wait.tv_sec = 0;
+			wait.tv_nsec = (long) ((remaining < 10 * LRS_NANOS_PER_MILLISECOND) ? remaining : 10 * LRS_NANOS_PER_MILLISECOND);
+
+			if (wait.tv_nsec > 0)
+				{
+					nanosleep (&wait, NULL);
+				}
+		}
+}
+
+
+static bool IsJobWorkFinished (const JobWorkers *workers_p, const int64 end)
+{
+	return (__atomic_load_n (& (workers_p -> jw_stop_flag), __ATOMIC_ACQUIRE) || (GetJobClockTime () >= end));
+}
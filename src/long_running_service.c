@@ -13,9 +13,12 @@
 ** See the License for the specific language governing permissions and
 ** limitations under the License.
 */
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include <pthread.h>
+
 #include "long_running_service.h"
 #include "memory_allocations.h"
 #include "string_utils.h"
@@ -24,9 +27,25 @@
 
 #include "signed_int_parameter.h"
 #include "unsigned_int_parameter.h"
+#include "boolean_parameter.h"
+#include "string_parameter.h"
 
 #include "uuid_util.h"
 
+#include "completion_scheduler.h"
+#include "deadline_heap.h"
+#include "job_cache.h"
+#include "job_clock.h"
+#include "job_workers.h"
+#include "job_admission.h"
+#include "job_group.h"
+#include "job_journal.h"
+#include "job_retention.h"
+#include "job_shards.h"
+#include "job_submissions.h"
+#include "status_flusher.h"
+#include "long_running_stats.h"
+
 /*
  * This service is an example to show how job data can be persisted between separate
  * requests. It mimics real world jobs by running a user-specified number of jobs that
@@ -38,16 +57,19 @@
  */
 typedef struct TimeInterval
 {
-	/* The start time of the job. */
-	time_t ti_start;
+	/*
+	 * The start time of the job, in nanoseconds since the epoch as
+	 * given by GetJobClockTime ().
+	 */
+	int64 ti_start;
 
-	/* The finish time of the job. */
-	time_t ti_end;
+	/* The finish time of the job, in nanoseconds since the epoch. */
+	int64 ti_end;
 
 	/*
-	 * The duration of the job, simply ti_end - ti_start.
+	 * The duration of the job in nanoseconds, simply ti_end - ti_start.
 	 */
-	time_t ti_duration;
+	int64 ti_duration;
 } TimeInterval;
 
 
@@ -61,904 +83,5894 @@ typedef struct TimedServiceJob
 	ServiceJob tsj_job;
 
 	/*
-	 * A pointer to the TimeInterval that is used to mimic the running of a real task.
+	 * The TimeInterval that is used to mimic the running of a real task. This
+	 * is stored inline so that each job only needs a single allocation.
 	 */
-	TimeInterval *tsj_interval_p;
+	TimeInterval tsj_interval;
+
+	/*
+	 * If this job was allocated as part of a block for a ServiceJobSet,
+	 * this is the TimedServiceJobArena that it came from, otherwise it
+	 * is NULL.
+	 */
+	struct TimedServiceJobArena *tsj_arena_p;
+
+	/* The kind of load that the job generates while it is running. */
+	JobKind tsj_kind;
 
 	/* Has the TimedServiceJob been added to the JobsManager yet? */
 	bool tsj_added_flag;
 
-	/* The process */
-	int32 tsj_process_id;
-} TimedServiceJob;
-
+	/*
+	 * Was this job queued on this process's JobWorkers? This isn't stored
+	 * with the job since it only applies to the process that ran it.
+	 */
+	bool tsj_worked_flag;
 
+	/*
+	 * Is this a copy of the job that was loaded from the JobsManager? If so,
+	 * it already has everything that the stored record has, so there is no
+	 * need to read the record again, see RefreshDeferredTimedServiceJob.
+	 */
+	bool tsj_loaded_flag;
 
+	/*
+	 * If this is true, the job's name and description aren't stored in
+	 * tsj_job. Instead they are produced from tsj_index and the job's
+	 * duration whenever they are needed, see GetTimedServiceJobName.
+	 */
+	bool tsj_compact_names_flag;
 
+	/* Is the duration in the job's description in milliseconds rather than seconds? */
+	bool tsj_duration_ms_flag;
 
-/*
- * The ServiceData that this Service will use. Since we don't have any custom configuration
- * we could just use the base structure, ServiceData, instead but we want to show how to
- * extend it as that will be the common situation.
- */
-typedef struct
-{
-	ServiceData lsd_base_data;
-	uint32 lsd_default_number_of_jobs;
+	/* The index of the job within the request that created it. */
+	uint32 tsj_index;
 
-} LongRunningServiceData;
+	/*
+	 * If this is the parent record for all of the jobs from a request, see
+	 * StartGroupedTimedServiceJobs, these are their times, otherwise it is NULL.
+	 */
+	JobGroup *tsj_group_p;
 
+	/*
+	 * If this is the record for a request whose jobs are submitted in the
+	 * background, see SubmitTimedServiceJobs, these are the number of its
+	 * jobs and how many of them were started, otherwise they are both 0.
+	 */
+	uint32 tsj_submission_num_jobs;
+	uint32 tsj_submission_num_started;
 
-/*
- * STATIC DATATYPES
- */
+	/* The process */
+	int32 tsj_process_id;
+} TimedServiceJob;
 
 
 /*
- * To store the persistent data for our tasks, we will use the
- * keys shown below.
+ * Rather than allocating each TimedServiceJob separately, GetServiceJobSet
+ * reserves all of the jobs that it needs in a single block. The block is
+ * reference counted: each job taken from it holds a reference as does the
+ * code that created it. When the last of these is released, which will be
+ * when the ServiceJobSet holding the jobs is freed, so is the block.
  */
+typedef struct TimedServiceJobArena
+{
+	/* The block of TimedServiceJobs. */
+	TimedServiceJob *tsja_jobs_p;
 
+	/* The number of TimedServiceJobs in the block. */
+	uint32 tsja_num_jobs;
 
-static const char * const LRS_SERVICE_JOB_TYPE_S = "long running service job";
-
+	/* The number of TimedServiceJobs that have been handed out so far. */
+	uint32 tsja_num_used;
 
-/* This is the key used to specify the start time of the task. */
-static const char * const LRS_START_S = "start";
+	/* The number of outstanding references to the block. */
+	uint32 tsja_num_references;
+} TimedServiceJobArena;
 
-/* This is the key used to specify the end time of the task. */
-static const char * const LRS_END_S = "end";
 
 /*
- * This is the key used to specify whether the task has been added
- * to the JobsManager yet.
+ * A summary of the statuses of the TimedServiceJobs within a ServiceJobSet,
+ * all of which have been calculated against the same point in time.
  */
-static const char * const LRS_ADDED_FLAG_S = "added_to_job_manager";
+typedef struct TimedServiceJobSetStatus
+{
+	/* The time, from GetJobClockTime (), that the statuses were calculated for. */
+	int64 tsjss_time;
 
+	/* The total number of jobs in the ServiceJobSet. */
+	uint32 tsjss_num_jobs;
 
-/*
- * We will have a single parameter that specifies how many tasks we want to
- * simulate.
- */
-static NamedParameterType LRS_MIN_DURATION = { "Minimum duration of each job", PT_SIGNED_INT };
+	/* The number of jobs that are either OS_PENDING or OS_STARTED. */
+	uint32 tsjss_num_running;
+
+	/* The number of jobs that have OS_SUCCEEDED. */
+	uint32 tsjss_num_succeeded;
+
+	/* The number of jobs with any other status. */
+	uint32 tsjss_num_other;
+} TimedServiceJobSetStatus;
 
-static NamedParameterType LRS_NUMBER_OF_JOBS = { "Number of Jobs", PT_UNSIGNED_INT };
 
 /*
- * STATIC PROTOTYPES
- * =================
- *
- * These are the functions that the function pointers in our generated Service structure
- * will point to.
+ * The details needed to build a contiguous range of the TimedServiceJobs
+ * for a ServiceJobSet. GetServiceJobSet splits large requests over a number
+ * of these, each run on its own thread.
  */
+typedef struct TimedServiceJobBuilder
+{
+	/* The Service that the jobs are for. */
+	Service *tsjb_service_p;
 
-static LongRunningServiceData *AllocateLongRunningServiceData (Service *service_p);
+	/* The arena that holds the jobs. */
+	TimedServiceJobArena *tsjb_arena_p;
 
-static void FreeLongRunningServiceData (LongRunningServiceData *data_p);
+	/* The index of the first job in the range. */
+	uint32 tsjb_first_index;
 
-static const char *GetLongRunningServiceName (const Service *service_p);
+	/*
+	 * The index of the first job in the arena within the whole request,
+	 * for requests that are built in several pieces.
+	 */
+	uint32 tsjb_index_offset;
 
-static const char *GetLongRunningServiceAlias (const Service *service_p);
+	/* The number of jobs in the range. */
+	uint32 tsjb_num_jobs;
 
-static const char *GetLongRunningServiceDescription (const Service *service_p);
+	/* The minimum duration for each job. */
+	int32 tsjb_min_duration;
 
-static ParameterSet *GetLongRunningServiceParameters (Service *service_p, DataResource *resource_p, User *user_p);
+	/*
+	 * The number of different durations, starting from tsjb_min_duration,
+	 * that the jobs can have.
+	 */
+	uint32 tsjb_duration_range;
 
-static void ReleaseLongRunningServiceParameters (Service *service_p, ParameterSet *params_p);
+	/*
+	 * The length in nanoseconds of each unit of tsjb_min_duration and
+	 * of the random part of each job's duration.
+	 */
+	int64 tsjb_duration_unit;
 
-static bool GetLongRunningServiceParameterTypesForNamedParameters (const Service *service_p, const char *param_name_s, ParameterType *pt_p);
+	/* The kind of load that each job generates. */
+	JobKind tsjb_kind;
 
+	/* Should the jobs have compact names and descriptions? */
+	bool tsjb_compact_names_flag;
 
-static ServiceJobSet *RunLongRunningService (Service *service_p, ParameterSet *param_set_p, User *user_p, ProvidersStateTable *providers_p);
+	/*
+	 * The seed used to derive each job's duration. The duration is
+	 * worked out from this and the job's index, rather than from any
+	 * shared state, so the results don't depend upon how the jobs are
+	 * divided between the threads.
+	 */
+	uint32 tsjb_seed;
 
-static ParameterSet *IsFileForLongRunningService (Service *service_p, DataResource *resource_p, Handler *handler_p);
+	/* The number of jobs that were built successfully. */
+	uint32 tsjb_num_built;
 
-static bool CloseLongRunningService (Service *service_p);
+	/* Was this range built on its own thread that needs to be joined? */
+	bool tsjb_threaded_flag;
+} TimedServiceJobBuilder;
 
-static json_t *GetLongRunningResultsAsJSON (Service *service_p, const uuid_t service_id);
 
-static OperationStatus GetLongRunningServiceStatus (Service *service_p, const uuid_t service_id);
+/*
+ * Used by GetLongRunningServiceStatuses to keep track of where each of
+ * the requested ids came from once they have been sorted.
+ */
+typedef struct JobStatusRequest
+{
+	/* The id of the requested job. */
+	const unsigned char *jsr_id_p;
 
-static unsigned char *SerialiseTimedServiceJob (ServiceJob *job_p, unsigned int *value_length_p);
+	/* The index of the id in the caller's array. */
+	uint32 jsr_index;
 
-static void StartTimedServiceJob (TimedServiceJob *job_p);
+	/* Has the status for this job been found yet? */
+	bool jsr_found_flag;
+} JobStatusRequest;
 
 
-static OperationStatus GetTimedServiceJobStatus (ServiceJob *job_p);
+/*
+ * The server calls GetServices () for each request that it handles, so
+ * there can be many instances of this Service in the process at once. The
+ * parts of them that would otherwise be duplicated for each one are kept
+ * here instead and shared by all of them. The first Service to be configured
+ * creates these, using its own configuration, and the last one to be closed
+ * frees them, see AcquireSharedLongRunningData.
+ */
+typedef struct LongRunningSharedData
+{
+	/*
+	 * The times and statuses of the jobs that have been fetched from
+	 * the JobsManager most recently, so that repeated status and results
+	 * requests for them don't need to fetch and rebuild them each time.
+	 */
+	JobCache lss_job_cache;
 
+	/* The number of jobs that lss_job_cache can hold. */
+	uint32 lss_job_cache_size;
 
-static ServiceJobSet *GetServiceJobSet (Service *service_p, const uint32 num_jobs, const int32 min_duration);
+	/*
+	 * The queue of finished jobs whose statuses are waiting to be written
+	 * back to the JobsManager. A single thread does this for every Service,
+	 * since the jobs that it writes back don't belong to any one of them.
+	 */
+	StatusFlusher lss_flusher;
 
+	/*
+	 * The number of changes that lss_flusher writes back in each batch
+	 * and the longest that any of them waits in milliseconds.
+	 */
+	uint32 lss_flush_batch_size;
 
-static TimedServiceJob *AllocateTimedServiceJob (Service *service_p, const char * const job_name_s, const char * const job_description_s, const time_t duration);
+	uint32 lss_flush_interval_ms;
 
+	/*
+	 * If this is true, then when a read notices that a job has finished,
+	 * the change is queued on lss_flusher to be written back to the
+	 * JobsManager in the background. If it is false, the read updates
+	 * the JobsManager itself before returning.
+	 */
+	bool lss_lazy_write_back_flag;
 
-static void FreeTimedServiceJob (ServiceJob *job_p);
+	/*
+	 * The timer wheel that marks every Service's jobs as finished as soon
+	 * as they end rather than waiting for them to be polled. Everything
+	 * that finishing a job needs is in here, so a job can finish after the
+	 * Service that started it has been closed.
+	 */
+	CompletionScheduler lss_completions;
 
+	/* The number of slots in lss_completions' wheel. */
+	uint32 lss_num_completion_slots;
 
-static json_t *GetTimedServiceJobAsJSON (TimedServiceJob *job_p);
+	/*
+	 * The function to call when each job finishes, if any, and the custom
+	 * data to pass to it. Unlike the rest of these, they are kept when the
+	 * shared parts are freed, so they last for as long as the process.
+	 */
+	LongRunningJobCompletionCallback lss_completion_fn;
 
+	void *lss_completion_data_p;
 
-static TimedServiceJob *GetTimedServiceJobFromJSON (Service *service_p, const json_t *json_p);
+	/*
+	 * This guards lss_completion_fn and lss_completion_data_p so that a
+	 * finishing job always sees them as a matching pair, even when they
+	 * are changed while jobs are finishing.
+	 */
+	pthread_mutex_t lss_completion_lock;
 
+	/*
+	 * The record of when each job starts and finishes, so that after a
+	 * restart the running jobs' completions can be rebuilt without reading
+	 * them all back from the JobsManager. This is NULL if there is no journal.
+	 */
+	JobJournal *lss_journal_p;
 
-static ServiceJob *BuildTimedServiceJob (Service *service_p, const json_t *service_job_json_p);
+	/*
+	 * The deadlines of the jobs that were recovered from lss_journal_p,
+	 * which don't belong to any Service. These are guarded by
+	 * s_shared_data_lock, and lss_deadlines_flag says whether they have
+	 * been started.
+	 */
+	DeadlineHeap lss_deadlines;
 
+	bool lss_deadlines_flag;
 
-static json_t *BuildTimedServiceJobJSON (Service *service_p, ServiceJob *service_job_p, bool omit_results_flag);
+	/*
+	 * The threads that generate the load for any jobs that aren't
+	 * JK_SLEEP. Each job is queued with the Service that started it,
+	 * so the callback updates that Service's jobs.
+	 */
+	JobWorkers lss_workers;
 
+	/* Have lss_workers been started? */
+	bool lss_workers_flag;
 
-static void CustomiseTimedServiceJob (Service *service_p, ServiceJob *job_p);
+	/*
+	 * The number of threads for lss_workers, 0 means a thread for
+	 * each processor.
+	 */
+	uint32 lss_num_worker_threads;
 
+	/*
+	 * The maximum number of jobs that can be queued or running on
+	 * lss_workers at once. Any more than this fail to start rather than
+	 * being queued without limit.
+	 */
+	uint32 lss_max_worker_jobs;
 
-static bool UpdateTimedServiceJob (struct ServiceJob *job_p);
+	/*
+	 * The requests whose jobs are built and started in the background
+	 * rather than before RunLongRunningService returns. Each request is
+	 * queued with the Service that it was made to, which stays open until
+	 * its jobs have been started, see lsd_num_submissions.
+	 */
+	JobSubmissionQueue lss_submissions;
 
+	/* Is lss_submissions running? */
+	bool lss_submissions_flag;
 
-static ServiceMetadata *GetLongRunningServiceMetadata (Service *service_p);
+	/*
+	 * This decides whether each request's jobs start straight away,
+	 * wait until some of the running jobs have finished or are refused.
+	 * Each deferred request is queued with the Service that received it,
+	 * so that Service starts the jobs once there is room for them.
+	 */
+	JobAdmission lss_admission;
 
+	/* Has lss_admission been started? */
+	bool lss_admission_flag;
 
-/*
- * API FUNCTIONS
- */
-ServicesArray *GetServices (User *user_p, GrassrootsServer *grassroots_p)
-{
-	Service *service_p = (Service *) AllocMemory (sizeof (Service));
+	/*
+	 * The limits for lss_admission, 0 means that there is no limit. The
+	 * JobWorkers' maximum number of jobs is a limit too, so that the jobs
+	 * that generate a load wait for room on the workers rather than failing
+	 * to start.
+	 */
+	uint32 lss_max_jobs_per_request;
 
-	if (service_p)
-		{
-			/*
-			 * Since we only have a single Service, create a ServicesArray with
-			 * 1 item.
-			 */
-			ServicesArray *services_p = AllocateServicesArray (1);
-			
-			if (services_p)
-				{		
-					ServiceData *data_p = (ServiceData *) AllocateLongRunningServiceData (service_p);
-					
-					if (data_p)
-						{
-							/*
-							 * Set up our Service structure and ServiceData.
-							 */
-							if (InitialiseService (service_p,
-								GetLongRunningServiceName,
-								GetLongRunningServiceDescription,
-								GetLongRunningServiceAlias,
-								NULL,
-								RunLongRunningService,
-								IsFileForLongRunningService,
-								GetLongRunningServiceParameters,
-								GetLongRunningServiceParameterTypesForNamedParameters,
-								ReleaseLongRunningServiceParameters,
-								CloseLongRunningService,
-								CustomiseTimedServiceJob,
-								true,
-								SY_ASYNCHRONOUS_DETACHED,
-								data_p,
-								GetLongRunningServiceMetadata,
-								NULL,
-								grassroots_p))
-								{
-									* (services_p -> sa_services_pp) = service_p;
+	uint32 lss_max_jobs_per_user;
 
+	uint32 lss_max_jobs_in_flight;
 
-									/*
-									 * We are going to store the data representing the asynchronous tasks
-									 * in the JobsManager and so we need to specify the callback functions
-									 * that we will use to convert our ServiceJobs to and from their JSON
-									 * representations.
-									 */
-									service_p -> se_deserialise_job_json_fn = BuildTimedServiceJob;
-									service_p -> se_serialise_job_json_fn = BuildTimedServiceJobJSON;
+	/*
+	 * The tombstones of the finished jobs of every Service. Status and
+	 * results requests for them are answered from here and, once a
+	 * tombstone is evicted, anything else kept for its job is removed too.
+	 * Since any Service can be asked about any job, they can't be kept by
+	 * the Service that ran the job, which could be closed long before the
+	 * job's tombstone is evicted.
+	 */
+	JobRetention lss_retention;
 
-									return services_p;
-								}
-						}
+	/* Is lss_retention running? */
+	bool lss_retention_flag;
 
-					FreeServicesArray (services_p);
-				}
+	/* The number of tombstones for lss_retention to keep, 0 means that none are kept. */
+	uint32 lss_max_completed_jobs;
 
-			FreeService (service_p);
-		}
+	/*
+	 * How long, in seconds, that lss_retention keeps each tombstone. If this
+	 * is 0, they are only evicted to make room for newer ones.
+	 */
+	uint32 lss_completed_job_ttl;
 
-	return NULL;
-}
+	/*
+	 * The groups whose parent records have been read most recently, so
+	 * that the jobs in a group can be looked up one at a time without
+	 * fetching and parsing the parent record for each of them.
+	 */
+	JobGroupCache lss_group_cache;
 
+	/* Is lss_group_cache available? */
+	bool lss_group_cache_flag;
 
-void ReleaseServices (ServicesArray *services_p)
-{
-	FreeServicesArray (services_p);
-}
+	/*
+	 * The server that all of the Services belong to, whose JobsManager
+	 * lss_retention removes the evicted jobs' records from.
+	 */
+	GrassrootsServer *lss_grassroots_p;
+} LongRunningSharedData;
 
 
 /*
- * STATIC FUNCTIONS 
+ * The ServiceData that this Service will use. Since we don't have any custom configuration
+ * we could just use the base structure, ServiceData, instead but we want to show how to
+ * extend it as that will be the common situation.
  */
- 
-
-static LongRunningServiceData *AllocateLongRunningServiceData (Service * UNUSED_PARAM (service_p))
+typedef struct
 {
-	LongRunningServiceData *data_p = (LongRunningServiceData *) AllocMemory (sizeof (LongRunningServiceData));
+	ServiceData lsd_base_data;
 
-	if (data_p)
-		{
-			data_p -> lsd_default_number_of_jobs = 3;
-			return data_p;
-		}
+	/* The default value for the "Number of Jobs" parameter. */
+	uint32 lsd_default_number_of_jobs;
 
-	return NULL;
-}
+	/*
+	 * The number of different durations that the jobs for a request can
+	 * have, starting from the minimum duration.
+	 */
+	uint32 lsd_duration_range;
 
+	/*
+	 * Should the jobs have their names and descriptions produced when
+	 * they are needed rather than storing them in each job?
+	 */
+	bool lsd_compact_names_flag;
 
-static void FreeLongRunningServiceData (LongRunningServiceData *data_p)
-{
-	FreeMemory (data_p);
-}
+	/*
+	 * Should all of the jobs from a request share a single parent record in
+	 * the JobsManager, which holds all of their times, along with a small
+	 * alias record for each job so that the server can still find it?
+	 */
+	bool lsd_group_jobs_flag;
 
- 
-static bool CloseLongRunningService (Service *service_p)
-{
-	bool close_flag = true;
-	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
-	ServiceJobSetIterator iterator;
-	ServiceJob *job_p = NULL;
-	bool loop_flag = true;
+	/*
+	 * The end times of all of the jobs that this Service has started
+	 * so that we can tell whether any are still running without having
+	 * to check each one in turn.
+	 */
+	DeadlineHeap lsd_deadlines;
 
 	/*
-	 * Check whether any jobs are still running.
+	 * This guards lsd_deadlines, which is used by the threads handling
+	 * the requests as well as when the Service is closed.
 	 */
-	if (service_p -> se_jobs_p)
-		{
-			InitServiceJobSetIterator (&iterator, service_p -> se_jobs_p);
+	pthread_mutex_t lsd_deadlines_lock;
 
-			job_p = GetNextServiceJobFromServiceJobSetIterator (&iterator);
-			loop_flag = (job_p != NULL);
+	/*
+	 * The maximum number of threads that GetServiceJobSet will use to
+	 * build the jobs for a request.
+	 */
+	uint32 lsd_num_build_threads;
 
-			while (loop_flag)
-				{
-					OperationStatus status = GetTimedServiceJobStatus (job_p);
+	/*
+	 * Requests for fewer than this number of jobs are built on the
+	 * calling thread.
+	 */
+	uint32 lsd_parallel_build_threshold;
 
-					if (status == OS_PENDING || status == OS_STARTED)
-						{
-							close_flag = false;
-							loop_flag = false;
-						}
-					else
-						{
-							job_p = GetNextServiceJobFromServiceJobSetIterator (&iterator);
+	/*
+	 * The parts that are shared with every other instance of this Service
+	 * in the process, or NULL until the Service has been configured.
+	 */
+	LongRunningSharedData *lsd_shared_p;
 
-							if (!job_p)
-								{
-									loop_flag = false;
-								}
-						}
-				}
-		}
+	/*
+	 * The number of jobs that the shared JobCache should hold. This is only
+	 * used if this is the first Service to be configured.
+	 */
+	uint32 lsd_job_cache_size;
+
+	/*
+	 * The number of slots in the shared CompletionScheduler's wheel. This
+	 * is only used if this is the first Service to be configured.
+	 */
+	uint32 lsd_num_completion_slots;
+
+	/*
+	 * Should the shared StatusFlusher write back the jobs that have
+	 * finished, and how many does it write back in each batch and how long,
+	 * in milliseconds, can each of them wait? These are only used if this
+	 * is the first Service to be configured.
+	 */
+	bool lsd_lazy_write_back_flag;
+
+	uint32 lsd_flush_batch_size;
+
+	uint32 lsd_flush_interval_ms;
+
+	/*
+	 * Has lsd_shared_p been acquired? This is done once the configuration
+	 * has been loaded, since the sizes of the shared parts come from it.
+	 */
+	bool lsd_configured_flag;
+
+	/*
+	 * The number of this Service's jobs that are queued or running on the
+	 * shared JobWorkers. The Service can't be freed until these have
+	 * finished since the workers call back into it. This is only ever
+	 * accessed atomically.
+	 */
+	uint32 lsd_num_worker_jobs;
+
+	/*
+	 * The number of threads and jobs for the shared JobWorkers. These are
+	 * only used if this is the first Service to be configured.
+	 */
+	uint32 lsd_num_worker_threads;
+
+	uint32 lsd_max_worker_jobs;
+
+	/*
+	 * The number of this Service's requests that are waiting for the shared
+	 * JobAdmission to start them. The Service can't be freed until these have
+	 * been started since the JobAdmission calls back into it. This is only
+	 * ever accessed atomically.
+	 */
+	uint32 lsd_num_deferred_requests;
+
+	/*
+	 * The limits for the shared JobAdmission, 0 means that there is no limit.
+	 * These are only used if this is the first Service to be configured.
+	 */
+	uint32 lsd_max_jobs_per_request;
+
+	uint32 lsd_max_jobs_per_user;
+
+	uint32 lsd_max_jobs_in_flight;
+
+	/*
+	 * The path of the shared JobJournal, which is only opened if this is
+	 * the first Service to be configured. This is NULL if there is no journal.
+	 */
+	const char *lsd_journal_path_s;
+
+	/*
+	 * Which of the servers sharing the JobsManager owns each job. Each
+	 * server creates its jobs with ids that it owns and keeps them in its
+	 * JobCache, and asks the owner for the status of anyone else's.
+	 */
+	JobShards lsd_shards;
+
+	/* Is the Service sharing its jobs with other servers? */
+	bool lsd_shards_flag;
+
+	/* The function to ask another server for the status of one of its jobs, if any. */
+	LongRunningStatusForwarder lsd_forwarder_fn;
+
+	/* The custom data to pass to lsd_forwarder_fn. */
+	void *lsd_forwarder_data_p;
+
+	/*
+	 * The number of jobs that a request needs before it is handed to the
+	 * shared JobSubmissionQueue. If this is 0, every request is run straight
+	 * away, and if this is the first Service to be configured, the queue
+	 * isn't started at all.
+	 */
+	uint32 lsd_asynchronous_submission_threshold;
+
+	/* The number of jobs that the JobSubmissionQueue builds and starts at a time. */
+	uint32 lsd_submission_chunk_size;
+
+	/*
+	 * The number of this Service's requests that are on the shared
+	 * JobSubmissionQueue. This is updated atomically, since the queue's
+	 * thread lowers it once it has started a request's jobs.
+	 */
+	uint32 lsd_num_submissions;
+
+	/*
+	 * The number of tombstones for the shared JobRetention to keep and how
+	 * long, in seconds, to keep each one. These are only used if this is the
+	 * first Service to be configured.
+	 */
+	uint32 lsd_max_completed_jobs;
+
+	uint32 lsd_completed_job_ttl;
+
+} LongRunningServiceData;
+
+
+/*
+ * STATIC DATATYPES
+ */
+
+
+/*
+ * To store the persistent data for our tasks, we will use the
+ * keys shown below.
+ */
+
+
+static const char * const LRS_SERVICE_JOB_TYPE_S = "long running service job";
+
+
+/* This is the key used to specify the start time of the task. */
+static const char * const LRS_START_S = "start";
+
+/* This is the key used to specify the end time of the task. */
+static const char * const LRS_END_S = "end";
+
+/*
+ * These are the keys for the start and end times of the task in nanoseconds.
+ * The whole seconds are still stored under LRS_START_S and LRS_END_S so that
+ * older versions of this service can read the jobs.
+ */
+static const char * const LRS_START_NS_S = "start_ns";
+
+static const char * const LRS_END_NS_S = "end_ns";
+
+/* This is the key used to specify the JobKind of the task. */
+static const char * const LRS_KIND_S = "kind";
+
+/*
+ * This is the key used to specify whether the task has been added
+ * to the JobsManager yet.
+ */
+static const char * const LRS_ADDED_FLAG_S = "added_to_job_manager";
+
+/*
+ * This is the key used to store the times of all of the jobs in a
+ * group in its parent record.
+ */
+static const char * const LRS_GROUP_S = "group";
+
+/*
+ * These are the keys used to report the progress of a request whose
+ * jobs are submitted in the background.
+ */
+static const char * const LRS_SUBMISSION_S = "submission";
+
+static const char * const LRS_SUBMISSION_NUM_JOBS_S = "num_jobs";
+
+static const char * const LRS_SUBMISSION_NUM_STARTED_S = "num_started";
+
+
+/*
+ * The keys in the service's configuration file for the default number of jobs,
+ * the range of their durations, how they are built, how they are stored and
+ * whether their names are compact.
+ */
+static const char * const LRS_CONFIG_DEFAULT_NUMBER_OF_JOBS_S = "default_number_of_jobs";
+
+static const char * const LRS_CONFIG_DURATION_RANGE_S = "duration_range";
+
+static const char * const LRS_CONFIG_BUILD_THREADS_S = "build_threads";
+
+static const char * const LRS_CONFIG_PARALLEL_BUILD_THRESHOLD_S = "parallel_build_threshold";
+
+static const char * const LRS_CONFIG_COMPACT_JOB_NAMES_S = "compact_job_names";
+
+/*
+ * The keys in the service's configuration file for the sizes of the job cache,
+ * the batches of status changes and the completion timer wheel.
+ */
+static const char * const LRS_CONFIG_JOB_CACHE_SIZE_S = "job_cache_size";
+
+static const char * const LRS_CONFIG_FLUSH_BATCH_SIZE_S = "status_flush_batch_size";
+
+static const char * const LRS_CONFIG_FLUSH_INTERVAL_S = "status_flush_interval_ms";
+
+static const char * const LRS_CONFIG_COMPLETION_SLOTS_S = "completion_slots";
+
+
+/*
+ * The key in the service's configuration file for choosing whether finished
+ * jobs are written back to the JobsManager in the background.
+ */
+static const char * const LRS_CONFIG_LAZY_WRITE_BACK_S = "lazy_status_write_back";
+
+
+/*
+ * The key in the service's configuration file for choosing whether all of
+ * the jobs from a request are stored as a single record.
+ */
+static const char * const LRS_CONFIG_GROUP_JOBS_S = "group_jobs";
+
+/*
+ * The keys in the service's configuration file for the number of worker threads
+ * and how many jobs they can have queued or running at once.
+ */
+static const char * const LRS_CONFIG_WORKER_THREADS_S = "worker_threads";
+
+static const char * const LRS_CONFIG_MAX_WORKER_JOBS_S = "max_worker_jobs";
+
+/*
+ * The keys in the service's configuration file for the limits on how many
+ * jobs can be in a single request, can be running for each user and can be
+ * running in total.
+ */
+static const char * const LRS_CONFIG_MAX_JOBS_PER_REQUEST_S = "max_jobs_per_request";
+
+static const char * const LRS_CONFIG_MAX_JOBS_PER_USER_S = "max_jobs_per_user";
+
+static const char * const LRS_CONFIG_MAX_JOBS_IN_FLIGHT_S = "max_jobs_in_flight";
+
+
+/*
+ * The key in the service's configuration file for the path of the journal
+ * of running jobs. If this isn't set, there is no journal.
+ */
+static const char * const LRS_CONFIG_JOURNAL_PATH_S = "journal_path";
+
+
+/*
+ * The keys in the service's configuration file for the names of all of
+ * the servers sharing the jobs, and for which of them this server is.
+ * Unless there are at least two names, the jobs aren't shared.
+ */
+static const char * const LRS_CONFIG_NODES_S = "nodes";
+
+static const char * const LRS_CONFIG_NODE_NAME_S = "node_name";
+
+/* How many ids to try for a new job before settling for one that another server owns. */
+static const uint32 LRS_MAX_ID_ATTEMPTS = 256;
+
+
+/*
+ * The keys in the service's configuration file for the number of jobs
+ * that a request needs before its jobs are built and started in the
+ * background, and for how many of them are done at a time.
+ */
+static const char * const LRS_CONFIG_ASYNCHRONOUS_SUBMISSION_THRESHOLD_S = "asynchronous_submission_threshold";
+
+static const char * const LRS_CONFIG_SUBMISSION_CHUNK_SIZE_S = "submission_chunk_size";
+
+/*
+ * The keys in the service's configuration file for the number of finished
+ * jobs to keep and for how long, in seconds, to keep each of them.
+ */
+static const char * const LRS_CONFIG_MAX_COMPLETED_JOBS_S = "max_completed_jobs";
+
+static const char * const LRS_CONFIG_COMPLETED_JOB_TTL_S = "completed_job_ttl_s";
+
+/* The description of the job that holds the statistics, see GetStatsServiceJobSet. */
+static const char * const LRS_STATS_DESCRIPTION_S = "The counters and latencies for every request that this server process has handled";
+
+/* The description of the record that stands for a request submitted in the background. */
+static const char * const LRS_SUBMISSION_DESCRIPTION_S = "The jobs for a request that are being started in the background";
+
+
+/*
+ * The size of the buffers used for the compact names and descriptions,
+ * which is big enough for "duration " followed by any int32 and " ms".
+ * Anything longer is truncated rather than overrunning them.
+ */
+#define LRS_JOB_STRING_BUFFER_SIZE (32)
+
+
+/* The number of groups whose parent records are kept in lss_group_cache */
+#define LRS_GROUP_CACHE_SIZE (16)
+
+
+/*
+ * We will have a single parameter that specifies how many tasks we want to
+ * simulate.
+ */
+static NamedParameterType LRS_MIN_DURATION = { "Minimum duration of each job", PT_SIGNED_INT };
+
+static NamedParameterType LRS_NUMBER_OF_JOBS = { "Number of Jobs", PT_UNSIGNED_INT };
+
+/*
+ * An optional seed for the job durations. Using the same seed for the same
+ * number of jobs gives the same durations so that runs can be repeated.
+ */
+static NamedParameterType LRS_SEED = { "Random seed", PT_UNSIGNED_INT };
+
+/*
+ * If this is set, the job durations are in milliseconds rather than seconds
+ * so that short jobs can be simulated.
+ */
+static NamedParameterType LRS_MILLISECOND_DURATIONS = { "Millisecond durations", PT_BOOLEAN };
+
+/*
+ * The kind of load that each job generates while it is running. By default
+ * the jobs just sleep, but they can also use the processor, the memory
+ * bandwidth or the disk so that the throughput of the whole system can be
+ * measured.
+ */
+static NamedParameterType LRS_JOB_KIND = { "Job kind", PT_STRING };
+
+/*
+ * If this is set, the request doesn't run any jobs and instead gets the
+ * statistics for the whole server process, see GetStatsServiceJobSet.
+ */
+static NamedParameterType LRS_GET_STATS = { "Get statistics", PT_BOOLEAN };
+
+
+/* The counters and latency histograms for every Service in the process */
+static LongRunningStats s_process_stats;
+
+static pthread_once_t s_process_stats_once = PTHREAD_ONCE_INIT;
+
+
+/*
+ * The parts that every Service in the process shares, how many Services
+ * are using them and the lock that guards both, see AcquireSharedLongRunningData.
+ */
+static LongRunningSharedData s_shared_data;
+
+static uint32 s_shared_data_refs = 0;
+
+static pthread_mutex_t s_shared_data_lock;
+
+static pthread_once_t s_shared_data_once = PTHREAD_ONCE_INIT;
+
+
+/*
+ * STATIC PROTOTYPES
+ * =================
+ *
+ * These are the functions that the function pointers in our generated Service structure
+ * will point to.
+ */
+
+static LongRunningServiceData *AllocateLongRunningServiceData (Service *service_p);
+
+static bool ConfigureLongRunningService (Service *service_p);
+
+static void GetPositiveConfigValue (const json_t *config_p, const char * const key_s, uint32 *value_p);
+
+static void ConfigureTimedServiceJobShards (LongRunningServiceData *data_p, const json_t *config_p);
+
+static void FreeLongRunningServiceData (LongRunningServiceData *data_p);
+
+static LongRunningSharedData *AcquireSharedLongRunningData (LongRunningServiceData *data_p, GrassrootsServer *grassroots_p);
+
+static bool ReleaseSharedLongRunningData (LongRunningSharedData *shared_p);
+
+static bool HasOutstandingSharedTimedServiceJobs (LongRunningSharedData *shared_p);
+
+static void InitSharedLongRunningDataLock (void);
+
+static const char *GetLongRunningServiceName (const Service *service_p);
+
+static const char *GetLongRunningServiceAlias (const Service *service_p);
+
+static const char *GetLongRunningServiceDescription (const Service *service_p);
+
+static ParameterSet *GetLongRunningServiceParameters (Service *service_p, DataResource *resource_p, User *user_p);
+
+static void ReleaseLongRunningServiceParameters (Service *service_p, ParameterSet *params_p);
+
+static bool AddJobKindOptions (StringParameter *param_p);
+
+static bool GetLongRunningServiceParameterTypesForNamedParameters (const Service *service_p, const char *param_name_s, ParameterType *pt_p);
+
+
+static ServiceJobSet *RunLongRunningService (Service *service_p, ParameterSet *param_set_p, User *user_p, ProvidersStateTable *providers_p);
+
+static ParameterSet *IsFileForLongRunningService (Service *service_p, DataResource *resource_p, Handler *handler_p);
+
+static bool CloseLongRunningService (Service *service_p);
+
+static json_t *GetLongRunningResultsAsJSON (Service *service_p, const uuid_t service_id);
+
+static json_t *GetTimedServiceJobResultAsJSON (TimedServiceJob *job_p);
+
+static json_t *GetJobResultAsJSON (Service *service_p, const uuid_t job_id, const int64 start, const int64 end, const TimedServiceJob *job_p);
+
+static OperationStatus GetLongRunningServiceStatus (Service *service_p, const uuid_t service_id);
+
+static int CompareJobStatusRequests (const void *v0_p, const void *v1_p);
+
+static uint32 SetJobStatusRequestStatuses (JobStatusRequest *requests_p, const uint32 num_requests, JobStatusRequest *match_p, const OperationStatus status, OperationStatus *statuses_p);
+
+static void UpdateDeserialisedTimedServiceJobStatus (TimedServiceJob *job_p);
+
+static void WriteBackFinishedTimedServiceJob (LongRunningSharedData *shared_p, const uuid_t job_id);
+
+static void StoreFinishedTimedServiceJobs (const uuid_t *job_ids_p, const uint32 num_jobs, void *data_p);
+
+static void RetainTimedServiceJob (LongRunningSharedData *shared_p, const uuid_t job_id, const int64 start, const int64 end, const OperationStatus status, const bool stored_flag);
+
+static void EvictTimedServiceJobTombstones (const JobTombstone *tombstones_p, const uint32 num_tombstones, void *data_p);
+
+static uint32 RemoveFinishedTimedServiceJob (LongRunningSharedData *shared_p, const uuid_t job_id);
+
+static bool FindTimedServiceJobTombstone (Service *service_p, const uuid_t job_id, JobTombstone *tombstone_p);
+
+static bool GetRetainedTimedServiceJobStatus (Service *service_p, const uuid_t job_id, OperationStatus *status_p);
+
+static void StartTimedServiceJob (TimedServiceJob *job_p, const int64 now);
+
+static void SetTimedServiceJobTimes (TimedServiceJob *job_p, const int64 start, const int64 end);
+
+
+static OperationStatus GetTimedServiceJobStatus (ServiceJob *job_p);
+
+
+static OperationStatus GetTimedServiceJobStatusAtTime (ServiceJob *job_p, const int64 now);
+
+
+static OperationStatus GetTimeIntervalStatus (const int64 start, const int64 end, const int64 now);
+
+
+static bool GetTimedServiceJobWorkStatus (Service *service_p, const uuid_t job_id, OperationStatus *status_p);
+
+
+static bool GetCachedTimedServiceJob (Service *service_p, const uuid_t job_id, const int64 now, JobCacheEntry *entry_p);
+
+
+static void AddTimedServiceJobToCache (Service *service_p, TimedServiceJob *job_p);
+
+
+static void CacheTimedServiceJobs (Service *service_p, ServiceJobSet *jobs_p);
+
+
+static void ClaimTimedServiceJobId (TimedServiceJob *job_p, Service *service_p);
+
+
+static bool ForwardTimedServiceJobStatus (Service *service_p, const uuid_t job_id, OperationStatus *status_p);
+
+
+static bool GetTimedServiceJobCurrentStatus (Service *service_p, const uuid_t job_id, const bool forward_flag, OperationStatus *status_p);
+
+
+static void ScheduleTimedServiceJobCompletions (Service *service_p, ServiceJobSet *jobs_p, JobAdmissionReservation *reservation_p);
+
+
+static uint32 QueueTimedServiceJobWork (Service *service_p, ServiceJobSet *jobs_p, JobsManager *jobs_manager_p, JobAdmissionReservation *reservation_p);
+
+static bool QueueTimedServiceJobWorkItem (Service *service_p, const uuid_t job_id, const JobKind kind, const int64 duration, JobAdmissionReservation *reservation_p);
+
+
+static void DeferTimedServiceJobs (Service *service_p, ServiceJobSet *jobs_p, const uint32 num_jobs, JobsManager *jobs_manager_p, const char *user_s, const JobKind kind);
+
+
+static int64 StartTimedServiceJobSet (Service *service_p, ServiceJobSet *jobs_p, const uint32 num_jobs, const JobKind kind, const int64 now, const bool deadlines_flag, JobsManager *jobs_manager_p, JobAdmissionReservation *reservation_p);
+
+
+static ServiceJobSet *SubmitTimedServiceJobs (Service *service_p, const uint32 num_jobs, const int32 min_duration, const int64 duration_unit, const JobKind kind, const uint32 seed, const bool deferred_flag, const char *user_s, const int64 max_duration, JobsManager *jobs_manager_p, JobAdmissionReservation *reservation_p);
+
+
+static void RunTimedServiceJobSubmission (JobSubmission *submission_p, void *data_p);
+
+
+static void FinishTimedServiceJobSubmission (Service *service_p, const JobSubmission *submission_p, const uint32 num_started, const int64 start, const int64 end, JobsManager *jobs_manager_p);
+
+
+static bool IsTimedServiceJobSubmissionQueued (Service *service_p, const uuid_t job_id);
+
+
+static bool StartGroupedTimedServiceJobs (Service *service_p, ServiceJobSet *jobs_p, const uint32 num_jobs, const int64 now, const int64 duration_unit, JobsManager *jobs_manager_p, JobAdmissionReservation *reservation_p);
+
+
+static uint32 AddTimedServiceJobGroupAliases (JobsManager *jobs_manager_p, ServiceJobSet *jobs_p);
+
+
+static TimedServiceJob *GetTimedServiceJobGroup (Service *service_p, const uuid_t group_id);
+
+
+static bool GetGroupedTimedServiceJobStatus (Service *service_p, const uuid_t group_id, const uint32 index, const int64 now, OperationStatus *status_p);
+
+
+static bool GetGroupedTimedServiceJobTimes (Service *service_p, const uuid_t group_id, const uint32 index, int64 *start_p, int64 *end_p);
+
+
+static void StartDeferredTimedServiceJobs (const JobAdmissionItem *items_p, const uint32 num_items, const JobKind kind, JobAdmissionReservation *reservation_p, void *data_p);
+
+static void AddTimedServiceJobToReservation (Service *service_p, JobAdmissionReservation *reservation_p, const uuid_t job_id, const uint32 num_jobs);
+
+static void ReleaseTimedServiceJobAdmission (LongRunningSharedData *shared_p, const uuid_t job_id);
+
+static void FinishTimedServiceJobReservation (Service *service_p, JobAdmissionReservation *reservation_p);
+
+static bool DeferTimedServiceJobRequest (Service *service_p, const char *user_s, const JobAdmissionItem *items_p, const uint32 num_items, const uint32 num_jobs, const JobKind kind);
+
+
+static void RefreshDeferredTimedServiceJob (TimedServiceJob *job_p);
+
+
+static void CompleteTimedServiceJob (const uuid_t job_id, const int64 start, const int64 end, void *data_p);
+
+static void CompleteWorkedTimedServiceJob (const uuid_t job_id, const int64 start, const int64 end, void *data_p);
+
+
+static bool ScheduleTimedServiceJobCompletion (Service *service_p, const uuid_t job_id, const int64 start, const int64 end, JobAdmissionReservation *reservation_p, const uint32 num_jobs);
+
+
+static void ReserveTimedServiceJobDeadlines (LongRunningServiceData *data_p, const uint32 num_jobs);
+
+
+static bool AddTimedServiceJobDeadline (LongRunningServiceData *data_p, const int64 end);
+
+
+static bool HasOutstandingTimedServiceJobDeadlines (LongRunningServiceData *data_p);
+
+
+static void RecoverJournalledTimedServiceJobs (LongRunningSharedData *shared_p, const JobJournalEntry *entries_p, const uint32 num_entries);
+
+
+static void GetTimedServiceJobSetStatus (ServiceJobSet *jobs_p, const int64 now, TimedServiceJobSetStatus *status_p);
+
+
+static ServiceJobSet *GetServiceJobSet (Service *service_p, const uint32 first_index, const uint32 num_jobs, const int32 min_duration, const int64 duration_unit, const JobKind kind, const uint32 seed);
+
+
+static uint32 AddEachTimedServiceJobToJobsManager (JobsManager *jobs_manager_p, ServiceJobSet *jobs_p);
+
+
+static TimedServiceJob *AllocateTimedServiceJob (Service *service_p, TimedServiceJobArena *arena_p, const char * const job_name_s, const char * const job_description_s, const int64 duration);
+
+
+static bool InitTimedServiceJob (TimedServiceJob *job_p, Service *service_p, TimedServiceJobArena *arena_p, const char * const job_name_s, const char * const job_description_s, const int64 duration);
+
+static const char *GetTimedServiceJobName (const TimedServiceJob *job_p, char *buffer_s);
+
+static const char *GetTimedServiceJobDescription (const TimedServiceJob *job_p, char *buffer_s);
+
+static bool AddCompactTimedServiceJobNamesToJSON (const TimedServiceJob *job_p, json_t *json_p);
+
+static bool AddTimedServiceJobGroupToJSON (const TimedServiceJob *job_p, json_t *json_p);
+
+static bool GetTimedServiceJobGroupFromJSON (TimedServiceJob *job_p, const json_t *json_p);
+
+static bool AddTimedServiceJobSubmissionToJSON (Service *service_p, const uuid_t job_id, const TimedServiceJob *job_p, json_t *json_p);
+
+static void GetTimedServiceJobSubmissionFromJSON (TimedServiceJob *job_p, const json_t *json_p);
+
+static bool IsFixedTimedServiceJobStatus (const OperationStatus status);
+
+
+static void *BuildTimedServiceJobs (void *data_p);
+
+
+static uint64 GetJobRandomValue (const uint64 seed, const uint32 index);
+
+
+static uint32 GetNewJobSeed (void);
+
+
+static TimedServiceJobArena *AllocateTimedServiceJobArena (const uint32 num_jobs);
+
+
+static void TakeTimedServiceJobsFromArena (TimedServiceJobArena *arena_p, const uint32 num_jobs);
+
+
+static void ReleaseTimedServiceJobArena (TimedServiceJobArena *arena_p);
+
+
+static void FreeTimedServiceJob (ServiceJob *job_p);
+
+
+static json_t *GetTimedServiceJobAsJSON (TimedServiceJob *job_p);
+
+
+static TimedServiceJob *GetTimedServiceJobFromJSON (Service *service_p, const json_t *json_p);
+
+
+static bool GetJSONJobTime (const json_t *json_p, const char * const ns_key_s, const char * const seconds_key_s, int64 *time_p);
+
+
+static ServiceJob *BuildTimedServiceJob (Service *service_p, const json_t *service_job_json_p);
+
+
+static json_t *BuildTimedServiceJobJSON (Service *service_p, ServiceJob *service_job_p, bool omit_results_flag);
+
+
+static void AddDeserialisationStats (Service *service_p, const TimedServiceJob *job_p, const uint64 start_ns);
+
+
+static void CustomiseTimedServiceJob (Service *service_p, ServiceJob *job_p);
+
+
+static bool UpdateTimedServiceJob (struct ServiceJob *job_p);
+
+
+static ServiceMetadata *GetLongRunningServiceMetadata (Service *service_p);
+
+
+static LongRunningStats *GetProcessStats (void);
+
+
+static void InitProcessStats (void);
+
+
+static ServiceJobSet *GetStatsServiceJobSet (Service *service_p);
+
+
+/*
+ * API FUNCTIONS
+ */
+ServicesArray *GetServices (User *user_p, GrassrootsServer *grassroots_p)
+{
+	Service *service_p = (Service *) AllocMemory (sizeof (Service));
+
+	if (service_p)
+		{
+			/*
+			 * Since we only have a single Service, create a ServicesArray with
+			 * 1 item.
+			 */
+			ServicesArray *services_p = AllocateServicesArray (1);
+			
+			if (services_p)
+				{		
+					ServiceData *data_p = (ServiceData *) AllocateLongRunningServiceData (service_p);
+					
+					if (data_p)
+						{
+							/*
+							 * Set up our Service structure and ServiceData.
+							 */
+							if (InitialiseService (service_p,
+								GetLongRunningServiceName,
+								GetLongRunningServiceDescription,
+								GetLongRunningServiceAlias,
+								NULL,
+								RunLongRunningService,
+								IsFileForLongRunningService,
+								GetLongRunningServiceParameters,
+								GetLongRunningServiceParameterTypesForNamedParameters,
+								ReleaseLongRunningServiceParameters,
+								CloseLongRunningService,
+								CustomiseTimedServiceJob,
+								true,
+								SY_ASYNCHRONOUS_DETACHED,
+								data_p,
+								GetLongRunningServiceMetadata,
+								NULL,
+								grassroots_p))
+								{
+									/*
+									 * We are going to store the data representing the asynchronous tasks
+									 * in the JobsManager and so we need to specify the callback functions
+									 * that we will use to convert our ServiceJobs to and from their JSON
+									 * representations.
+									 */
+									service_p -> se_deserialise_job_json_fn = BuildTimedServiceJob;
+									service_p -> se_serialise_job_json_fn = BuildTimedServiceJobJSON;
+
+									/*
+									 * The configuration is only available once the Service has
+									 * been initialised, so everything that depends upon it is
+									 * started now.
+									 */
+									if (ConfigureLongRunningService (service_p))
+										{
+											* (services_p -> sa_services_pp) = service_p;
+
+											return services_p;
+										}
+								}
+						}
+
+					FreeServicesArray (services_p);
+				}
+
+			FreeService (service_p);
+		}
+
+	return NULL;
+}
+
+
+void ReleaseServices (ServicesArray *services_p)
+{
+	FreeServicesArray (services_p);
+}
+
+
+/*
+ * STATIC FUNCTIONS 
+ */
+ 
+
+static LongRunningServiceData *AllocateLongRunningServiceData (Service * UNUSED_PARAM (service_p))
+{
+	LongRunningServiceData *data_p = (LongRunningServiceData *) AllocMemory (sizeof (LongRunningServiceData));
+
+	if (data_p)
+		{
+			if (pthread_mutex_init (& (data_p -> lsd_deadlines_lock), NULL) == 0)
+				{
+					if (InitDeadlineHeap (& (data_p -> lsd_deadlines), 0))
+						{
+							/*
+							 * These are the defaults for anything not set in the configuration,
+							 * which ConfigureLongRunningService loads once it is available.
+							 */
+							data_p -> lsd_default_number_of_jobs = 3;
+							data_p -> lsd_duration_range = 60;
+							data_p -> lsd_compact_names_flag = false;
+							data_p -> lsd_group_jobs_flag = false;
+							data_p -> lsd_num_build_threads = 4;
+							data_p -> lsd_parallel_build_threshold = 1024;
+
+							data_p -> lsd_lazy_write_back_flag = true;
+
+							data_p -> lsd_configured_flag = false;
+							data_p -> lsd_shared_p = NULL;
+							data_p -> lsd_job_cache_size = 4096;
+							data_p -> lsd_flush_batch_size = 256;
+							data_p -> lsd_flush_interval_ms = 100;
+							data_p -> lsd_num_completion_slots = 256;
+
+							data_p -> lsd_num_worker_jobs = 0;
+							data_p -> lsd_num_worker_threads = 0;
+							data_p -> lsd_max_worker_jobs = 4096;
+
+							data_p -> lsd_num_deferred_requests = 0;
+							data_p -> lsd_max_jobs_per_request = 100000;
+							data_p -> lsd_max_jobs_per_user = 0;
+							data_p -> lsd_max_jobs_in_flight = 1000000;
+
+							data_p -> lsd_journal_path_s = NULL;
+
+							data_p -> lsd_shards_flag = false;
+							data_p -> lsd_forwarder_fn = NULL;
+							data_p -> lsd_forwarder_data_p = NULL;
+
+							data_p -> lsd_num_submissions = 0;
+							data_p -> lsd_asynchronous_submission_threshold = 0;
+							data_p -> lsd_submission_chunk_size = 4096;
+
+							data_p -> lsd_max_completed_jobs = 65536;
+							data_p -> lsd_completed_job_ttl = 3600;
+
+							return data_p;
+						}
+
+					pthread_mutex_destroy (& (data_p -> lsd_deadlines_lock));
+				}
+
+			FreeMemory (data_p);
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Load any settings from the Service's configuration and then start
+ * the parts of the Service whose sizes come from it. This is done once,
+ * when the Service is created, so nothing needs to look at the configuration
+ * again while handling requests.
+ *
+ * Returns true if the Service is ready to run jobs. The JobWorkers and the
+ * JobAdmission are optional, so the Service can still run without them.
+ */
+static bool ConfigureLongRunningService (Service *service_p)
+{
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+	const json_t *config_p = data_p -> lsd_base_data.sd_config_p;
+
+	if (config_p)
+		{
+			bool b;
+			uint32 u;
+
+			GetPositiveConfigValue (config_p, LRS_CONFIG_DEFAULT_NUMBER_OF_JOBS_S, & (data_p -> lsd_default_number_of_jobs));
+			GetPositiveConfigValue (config_p, LRS_CONFIG_DURATION_RANGE_S, & (data_p -> lsd_duration_range));
+			GetPositiveConfigValue (config_p, LRS_CONFIG_PARALLEL_BUILD_THRESHOLD_S, & (data_p -> lsd_parallel_build_threshold));
+
+			/* A single build thread means that every request is built on the calling thread */
+			GetPositiveConfigValue (config_p, LRS_CONFIG_BUILD_THREADS_S, & (data_p -> lsd_num_build_threads));
+
+			GetPositiveConfigValue (config_p, LRS_CONFIG_JOB_CACHE_SIZE_S, & (data_p -> lsd_job_cache_size));
+			GetPositiveConfigValue (config_p, LRS_CONFIG_FLUSH_BATCH_SIZE_S, & (data_p -> lsd_flush_batch_size));
+			GetPositiveConfigValue (config_p, LRS_CONFIG_FLUSH_INTERVAL_S, & (data_p -> lsd_flush_interval_ms));
+			GetPositiveConfigValue (config_p, LRS_CONFIG_COMPLETION_SLOTS_S, & (data_p -> lsd_num_completion_slots));
+
+			data_p -> lsd_journal_path_s = GetJSONString (config_p, LRS_CONFIG_JOURNAL_PATH_S);
+
+			if (GetJSONBoolean (config_p, LRS_CONFIG_COMPACT_JOB_NAMES_S, &b))
+				{
+					data_p -> lsd_compact_names_flag = b;
+				}
+
+			if (GetJSONBoolean (config_p, LRS_CONFIG_LAZY_WRITE_BACK_S, &b))
+				{
+					data_p -> lsd_lazy_write_back_flag = b;
+				}
+
+			if (GetJSONBoolean (config_p, LRS_CONFIG_GROUP_JOBS_S, &b))
+				{
+					data_p -> lsd_group_jobs_flag = b;
+				}
+
+			if (GetJSONUnsignedInteger (config_p, LRS_CONFIG_WORKER_THREADS_S, &u))
+				{
+					data_p -> lsd_num_worker_threads = u;
+				}
+
+			GetPositiveConfigValue (config_p, LRS_CONFIG_MAX_WORKER_JOBS_S, & (data_p -> lsd_max_worker_jobs));
+
+			if (GetJSONUnsignedInteger (config_p, LRS_CONFIG_MAX_JOBS_PER_REQUEST_S, &u))
+				{
+					data_p -> lsd_max_jobs_per_request = u;
+				}
+
+			if (GetJSONUnsignedInteger (config_p, LRS_CONFIG_MAX_JOBS_PER_USER_S, &u))
+				{
+					data_p -> lsd_max_jobs_per_user = u;
+				}
+
+			if (GetJSONUnsignedInteger (config_p, LRS_CONFIG_MAX_JOBS_IN_FLIGHT_S, &u))
+				{
+					data_p -> lsd_max_jobs_in_flight = u;
+				}
+
+			if (GetJSONUnsignedInteger (config_p, LRS_CONFIG_ASYNCHRONOUS_SUBMISSION_THRESHOLD_S, &u))
+				{
+					data_p -> lsd_asynchronous_submission_threshold = u;
+				}
+
+			GetPositiveConfigValue (config_p, LRS_CONFIG_SUBMISSION_CHUNK_SIZE_S, & (data_p -> lsd_submission_chunk_size));
+
+			if (GetJSONUnsignedInteger (config_p, LRS_CONFIG_MAX_COMPLETED_JOBS_S, &u))
+				{
+					data_p -> lsd_max_completed_jobs = u;
+				}
+
+			if (GetJSONUnsignedInteger (config_p, LRS_CONFIG_COMPLETED_JOB_TTL_S, &u))
+				{
+					data_p -> lsd_completed_job_ttl = u;
+				}
+
+			ConfigureTimedServiceJobShards (data_p, config_p);
+		}
+
+	/*
+	 * The other servers ask this one about the jobs that it owns, so make
+	 * room in the cache for every job that it can have running, on top of
+	 * the jobs that it would cache anyway, rather than letting a big request
+	 * push its own jobs out.
+	 */
+	if (data_p -> lsd_shards_flag)
+		{
+			if (data_p -> lsd_max_jobs_in_flight > 0)
+				{
+					const uint64 cache_size = ((uint64) (data_p -> lsd_job_cache_size)) + (data_p -> lsd_max_jobs_in_flight);
+
+					data_p -> lsd_job_cache_size = (cache_size < UINT32_MAX) ? (uint32) cache_size : UINT32_MAX;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "%s is 0 so only " UINT32_FMT " of this server's jobs can be kept for the other servers' status requests", LRS_CONFIG_MAX_JOBS_IN_FLIGHT_S, data_p -> lsd_job_cache_size);
+				}
+		}
+
+	data_p -> lsd_shared_p = AcquireSharedLongRunningData (data_p, GetGrassrootsServerFromService (service_p));
+
+	if (data_p -> lsd_shared_p)
+		{
+			data_p -> lsd_configured_flag = true;
+
+			return true;
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to start the job cache, status flusher and completion scheduler for " UINT32_FMT ", " UINT32_FMT " and " UINT32_FMT " jobs", data_p -> lsd_job_cache_size, data_p -> lsd_flush_batch_size, data_p -> lsd_num_completion_slots);
+
+	return false;
+}
+
+
+/*
+ * Read an unsigned value from the configuration which, if it is set,
+ * must be greater than 0.
+ */
+static void GetPositiveConfigValue (const json_t *config_p, const char * const key_s, uint32 *value_p)
+{
+	uint32 u;
+
+	if (GetJSONUnsignedInteger (config_p, key_s, &u))
+		{
+			if (u > 0)
+				{
+					*value_p = u;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "%s must be greater than 0, using " UINT32_FMT, key_s, *value_p);
+				}
+		}
+}
+
+
+/*
+ * Read the names of the servers that share the jobs, and which of them
+ * this one is, from the configuration.
+ */
+static void ConfigureTimedServiceJobShards (LongRunningServiceData *data_p, const json_t *config_p)
+{
+	const json_t *nodes_p = json_object_get (config_p, LRS_CONFIG_NODES_S);
+
+	if (nodes_p && json_is_array (nodes_p) && (json_array_size (nodes_p) > 1))
+		{
+			const char *node_s = GetJSONString (config_p, LRS_CONFIG_NODE_NAME_S);
+
+			if (node_s)
+				{
+					const size_t num_nodes = json_array_size (nodes_p);
+					const char **names_ss = (const char **) AllocMemoryArray (num_nodes, sizeof (const char *));
+
+					if (names_ss)
+						{
+							size_t i;
+
+							for (i = 0; i < num_nodes; ++ i)
+								{
+									names_ss [i] = json_string_value (json_array_get (nodes_p, i));
+
+									if (! (names_ss [i]))
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Entry " SIZET_FMT " of %s is not a string, the jobs won't be shared", i, LRS_CONFIG_NODES_S);
+											break;
+										}
+								}
+
+							if (i == num_nodes)
+								{
+									data_p -> lsd_shards_flag = InitJobShards (& (data_p -> lsd_shards), names_ss, (uint32) num_nodes, node_s);
+								}
+
+							FreeMemory (names_ss);
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "%s is set without %s, the jobs won't be shared", LRS_CONFIG_NODES_S, LRS_CONFIG_NODE_NAME_S);
+				}
+		}
+}
+
+
+/*
+ * Get the parts that every Service in the process shares, creating them if
+ * this is the first Service to ask for them. They are sized from the first
+ * Service's configuration, so any other Service configured with different
+ * sizes still shares the ones that already exist. Each successful call must
+ * be matched by a call to ReleaseSharedLongRunningData ().
+ *
+ * The first Service also opens the JobJournal, if it has one, and recovers
+ * the jobs in it, since they can only be handed out once in the process.
+ */
+static LongRunningSharedData *AcquireSharedLongRunningData (LongRunningServiceData *data_p, GrassrootsServer *grassroots_p)
+{
+	LongRunningSharedData *shared_p = NULL;
+
+	pthread_once (&s_shared_data_once, InitSharedLongRunningDataLock);
+	pthread_mutex_lock (&s_shared_data_lock);
+
+	if (s_shared_data_refs > 0)
+		{
+			if (s_shared_data.lss_job_cache_size != data_p -> lsd_job_cache_size)
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "The job cache already holds " UINT32_FMT " jobs, so " UINT32_FMT " won't be used", s_shared_data.lss_job_cache_size, data_p -> lsd_job_cache_size);
+				}
+
+			if ((s_shared_data.lss_flush_batch_size != data_p -> lsd_flush_batch_size) || (s_shared_data.lss_flush_interval_ms != data_p -> lsd_flush_interval_ms) || (s_shared_data.lss_lazy_write_back_flag != data_p -> lsd_lazy_write_back_flag))
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "The status flusher already writes back " UINT32_FMT " jobs every " UINT32_FMT " ms, %s, so this Service's settings won't be used", s_shared_data.lss_flush_batch_size, s_shared_data.lss_flush_interval_ms, (s_shared_data.lss_lazy_write_back_flag) ? "lazily" : "synchronously");
+				}
+
+			if (s_shared_data.lss_num_completion_slots != data_p -> lsd_num_completion_slots)
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "The completion scheduler already has " UINT32_FMT " slots, so " UINT32_FMT " won't be used", s_shared_data.lss_num_completion_slots, data_p -> lsd_num_completion_slots);
+				}
+
+			if ((data_p -> lsd_journal_path_s) && (! (s_shared_data.lss_journal_p)))
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "The job journal can only be opened by the first Service, so \"%s\" won't be used", data_p -> lsd_journal_path_s);
+				}
+
+			if ((s_shared_data.lss_num_worker_threads != data_p -> lsd_num_worker_threads) || (s_shared_data.lss_max_worker_jobs != data_p -> lsd_max_worker_jobs))
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "The job workers already have " UINT32_FMT " threads for " UINT32_FMT " jobs, so " UINT32_FMT " threads for " UINT32_FMT " jobs won't be used", s_shared_data.lss_num_worker_threads, s_shared_data.lss_max_worker_jobs, data_p -> lsd_num_worker_threads, data_p -> lsd_max_worker_jobs);
+				}
+
+			if ((data_p -> lsd_asynchronous_submission_threshold > 0) && (! (s_shared_data.lss_submissions_flag)))
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "The job submission queue isn't running, so every request will be run straight away");
+				}
+
+			if ((s_shared_data.lss_max_jobs_per_request != data_p -> lsd_max_jobs_per_request) || (s_shared_data.lss_max_jobs_per_user != data_p -> lsd_max_jobs_per_user) || (s_shared_data.lss_max_jobs_in_flight != data_p -> lsd_max_jobs_in_flight))
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "The job limits are already " UINT32_FMT " per request, " UINT32_FMT " per user and " UINT32_FMT " in total, so this Service's limits won't be used", s_shared_data.lss_max_jobs_per_request, s_shared_data.lss_max_jobs_per_user, s_shared_data.lss_max_jobs_in_flight);
+				}
+
+			if ((s_shared_data.lss_max_completed_jobs != data_p -> lsd_max_completed_jobs) || (s_shared_data.lss_completed_job_ttl != data_p -> lsd_completed_job_ttl))
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "The finished jobs are already kept for up to " UINT32_FMT " jobs for " UINT32_FMT " seconds, so " UINT32_FMT " jobs for " UINT32_FMT " seconds won't be used", s_shared_data.lss_max_completed_jobs, s_shared_data.lss_completed_job_ttl, data_p -> lsd_max_completed_jobs, data_p -> lsd_completed_job_ttl);
+				}
+
+			++ s_shared_data_refs;
+			shared_p = &s_shared_data;
+		}
+	else
+		{
+			if (InitJobCache (& (s_shared_data.lss_job_cache), data_p -> lsd_job_cache_size))
+				{
+					s_shared_data.lss_job_cache_size = data_p -> lsd_job_cache_size;
+					s_shared_data.lss_grassroots_p = grassroots_p;
+					s_shared_data.lss_lazy_write_back_flag = data_p -> lsd_lazy_write_back_flag;
+					s_shared_data.lss_flush_batch_size = data_p -> lsd_flush_batch_size;
+					s_shared_data.lss_flush_interval_ms = data_p -> lsd_flush_interval_ms;
+
+					if (InitStatusFlusher (& (s_shared_data.lss_flusher), s_shared_data.lss_flush_batch_size, s_shared_data.lss_flush_interval_ms, StoreFinishedTimedServiceJobs, &s_shared_data))
+						{
+							s_shared_data.lss_num_completion_slots = data_p -> lsd_num_completion_slots;
+
+							if (InitCompletionScheduler (& (s_shared_data.lss_completions), s_shared_data.lss_num_completion_slots, CompleteTimedServiceJob, &s_shared_data))
+								{
+									s_shared_data.lss_num_worker_threads = data_p -> lsd_num_worker_threads;
+									s_shared_data.lss_max_worker_jobs = data_p -> lsd_max_worker_jobs;
+
+									/* The workers are optional, so the Services can still run without them */
+									s_shared_data.lss_workers_flag = InitJobWorkers (& (s_shared_data.lss_workers), s_shared_data.lss_num_worker_threads, s_shared_data.lss_max_worker_jobs, CompleteWorkedTimedServiceJob);
+
+									if (! (s_shared_data.lss_workers_flag))
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to start the job workers, only \"%s\" jobs can be run", GetJobKindAsString (JK_SLEEP));
+										}
+
+									/* The submission queue is optional as well */
+									s_shared_data.lss_submissions_flag = false;
+
+									if (data_p -> lsd_asynchronous_submission_threshold > 0)
+										{
+											s_shared_data.lss_submissions_flag = InitJobSubmissionQueue (& (s_shared_data.lss_submissions), RunTimedServiceJobSubmission);
+
+											if (! (s_shared_data.lss_submissions_flag))
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to start the job submission queue, every request will be run straight away");
+												}
+										}
+
+									s_shared_data.lss_max_jobs_per_request = data_p -> lsd_max_jobs_per_request;
+									s_shared_data.lss_max_jobs_per_user = data_p -> lsd_max_jobs_per_user;
+									s_shared_data.lss_max_jobs_in_flight = data_p -> lsd_max_jobs_in_flight;
+
+									/* The admission is optional too */
+									s_shared_data.lss_admission_flag = InitJobAdmission (& (s_shared_data.lss_admission), StartDeferredTimedServiceJobs);
+
+									if (s_shared_data.lss_admission_flag)
+										{
+											const uint32 max_work_jobs = (s_shared_data.lss_workers_flag) ? s_shared_data.lss_max_worker_jobs : 0;
+
+											SetJobAdmissionLimits (& (s_shared_data.lss_admission), s_shared_data.lss_max_jobs_per_request, s_shared_data.lss_max_jobs_per_user, s_shared_data.lss_max_jobs_in_flight, max_work_jobs);
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to start the job admission, there will be no limits on the number of jobs");
+										}
+
+									s_shared_data.lss_max_completed_jobs = data_p -> lsd_max_completed_jobs;
+									s_shared_data.lss_completed_job_ttl = data_p -> lsd_completed_job_ttl;
+									s_shared_data.lss_retention_flag = false;
+
+									if (s_shared_data.lss_max_completed_jobs > 0)
+										{
+											s_shared_data.lss_retention_flag = InitJobRetention (& (s_shared_data.lss_retention), s_shared_data.lss_max_completed_jobs, ((int64) (s_shared_data.lss_completed_job_ttl)) * LRS_NANOS_PER_SECOND, EvictTimedServiceJobTombstones, &s_shared_data);
+
+											if (! (s_shared_data.lss_retention_flag))
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to start the job retention, the records of finished jobs will be removed as soon as they finish");
+												}
+										}
+
+									s_shared_data.lss_group_cache_flag = InitJobGroupCache (& (s_shared_data.lss_group_cache), LRS_GROUP_CACHE_SIZE);
+
+									if (! (s_shared_data.lss_group_cache_flag))
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to create the job group cache, the parent record of a group will be read for each of its jobs");
+										}
+
+									/*
+									 * The journal's jobs are put straight into the cache and the
+									 * completions, so it is opened last.
+									 */
+									s_shared_data.lss_journal_p = NULL;
+									s_shared_data.lss_deadlines_flag = false;
+
+									if (data_p -> lsd_journal_path_s)
+										{
+											JobJournalEntry *entries_p = NULL;
+											uint32 num_entries = 0;
+
+											/* Only the first Service in the process gets the jobs to recover */
+											s_shared_data.lss_journal_p = AcquireSharedJobJournal (data_p -> lsd_journal_path_s, &entries_p, &num_entries);
+
+											if (s_shared_data.lss_journal_p)
+												{
+													if (entries_p)
+														{
+															RecoverJournalledTimedServiceJobs (&s_shared_data, entries_p, num_entries);
+															FreeMemory (entries_p);
+														}
+												}
+											else
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to open the job journal \"%s\", the running jobs won't be recovered after a restart", data_p -> lsd_journal_path_s);
+												}
+										}
+
+									s_shared_data_refs = 1;
+									shared_p = &s_shared_data;
+								}
+							else
+								{
+									ClearStatusFlusher (& (s_shared_data.lss_flusher));
+								}
+						}
+					else
+						{
+							ClearJobCache (& (s_shared_data.lss_job_cache));
+						}
+				}
+		}
+
+	pthread_mutex_unlock (&s_shared_data_lock);
+
+	return shared_p;
+}
+
+
+/*
+ * Give up a Service's use of the shared parts, freeing them once no
+ * Service is using them any more.
+ *
+ * The last Service can't give them up while any of the jobs recovered from
+ * the journal are still running, or the CompletionScheduler still has jobs
+ * to finish, since these are never handed out again. Returns true if the
+ * Service no longer uses the shared parts.
+ */
+static bool ReleaseSharedLongRunningData (LongRunningSharedData *shared_p)
+{
+	bool released_flag = true;
+
+	pthread_mutex_lock (&s_shared_data_lock);
+
+	if ((s_shared_data_refs == 1) && HasOutstandingSharedTimedServiceJobs (shared_p))
+		{
+			released_flag = false;
+		}
+	else if (s_shared_data_refs > 0)
+		{
+			-- s_shared_data_refs;
+
+			if (s_shared_data_refs == 0)
+				{
+					/*
+					 * Every Service waits for its own submissions, its own
+					 * deferred requests and for its own jobs on the workers
+					 * before it is closed, so none of them are left by now and
+					 * this just stops the submission queue's thread. The
+					 * scheduler's thread uses everything else, so it is
+					 * stopped next.
+					 */
+					if (shared_p -> lss_submissions_flag)
+						{
+							ClearJobSubmissionQueue (& (shared_p -> lss_submissions));
+							shared_p -> lss_submissions_flag = false;
+						}
+
+					ClearCompletionScheduler (& (shared_p -> lss_completions));
+
+					if (shared_p -> lss_admission_flag)
+						{
+							ClearJobAdmission (& (shared_p -> lss_admission));
+							shared_p -> lss_admission_flag = false;
+						}
+
+					if (shared_p -> lss_workers_flag)
+						{
+							ClearJobWorkers (& (shared_p -> lss_workers));
+							shared_p -> lss_workers_flag = false;
+						}
+
+					/* Nothing else adds to the journal once the scheduler and workers have stopped */
+					if (shared_p -> lss_journal_p)
+						{
+							ReleaseSharedJobJournal (shared_p -> lss_journal_p);
+							shared_p -> lss_journal_p = NULL;
+						}
+
+					if (shared_p -> lss_deadlines_flag)
+						{
+							ClearDeadlineHeap (& (shared_p -> lss_deadlines));
+							shared_p -> lss_deadlines_flag = false;
+						}
+
+					/*
+					 * Write back the statuses that are still waiting before the
+					 * records are removed below, since nothing else can queue
+					 * any more of them now.
+					 */
+					ClearStatusFlusher (& (shared_p -> lss_flusher));
+
+					/*
+					 * Nothing will remove the records of the finished jobs once the
+					 * retention has gone, so this evicts all of them. It uses the
+					 * caches, so it is stopped before they are cleared.
+					 */
+					if (shared_p -> lss_retention_flag)
+						{
+							ClearJobRetention (& (shared_p -> lss_retention));
+							shared_p -> lss_retention_flag = false;
+						}
+
+					if (shared_p -> lss_group_cache_flag)
+						{
+							ClearJobGroupCache (& (shared_p -> lss_group_cache));
+							shared_p -> lss_group_cache_flag = false;
+						}
+
+					ClearJobCache (& (shared_p -> lss_job_cache));
+				}
+		}
+
+	pthread_mutex_unlock (&s_shared_data_lock);
+
+	return released_flag;
+}
+
+
+/*
+ * Check whether any jobs that no Service is waiting for are still running.
+ * This is called with s_shared_data_lock held.
+ */
+static bool HasOutstandingSharedTimedServiceJobs (LongRunningSharedData *shared_p)
+{
+	if ((shared_p -> lss_deadlines_flag) && HasOutstandingDeadlines (& (shared_p -> lss_deadlines), GetJobClockSeconds (GetJobClockTime ())))
+		{
+			return true;
+		}
+
+	return (GetNumScheduledCompletions (& (shared_p -> lss_completions)) > 0);
+}
+
+
+static void InitSharedLongRunningDataLock (void)
+{
+	pthread_mutex_init (&s_shared_data_lock, NULL);
+	pthread_mutex_init (& (s_shared_data.lss_completion_lock), NULL);
+}
+
+
+static void FreeLongRunningServiceData (LongRunningServiceData *data_p)
+{
+	/*
+	 * This Service's deferred requests, submissions and jobs on the shared
+	 * workers have all finished before it can be closed, and the shared
+	 * parts have already been given up, see CloseLongRunningService.
+	 */
+
+	if (data_p -> lsd_shards_flag)
+		{
+			ClearJobShards (& (data_p -> lsd_shards));
+		}
+
+	ClearDeadlineHeap (& (data_p -> lsd_deadlines));
+	pthread_mutex_destroy (& (data_p -> lsd_deadlines_lock));
+	FreeMemory (data_p);
+}
+
+ 
+static bool CloseLongRunningService (Service *service_p)
+{
+	bool close_flag = true;
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+
+	/*
+	 * Check whether any jobs are still running. A submission adds the
+	 * deadline of its jobs and gives up its workers' jobs before it
+	 * stops being counted, so it is checked first.
+	 */
+	if (__atomic_load_n (& (data_p -> lsd_num_submissions), __ATOMIC_ACQUIRE) > 0)
+		{
+			/* The JobSubmissionQueue is still starting some of this Service's jobs */
+			close_flag = false;
+		}
+	else if (HasOutstandingTimedServiceJobDeadlines (data_p))
+		{
+			close_flag = false;
+		}
+	else if (__atomic_load_n (& (data_p -> lsd_num_worker_jobs), __ATOMIC_ACQUIRE) > 0)
+		{
+			close_flag = false;
+		}
+	else if (__atomic_load_n (& (data_p -> lsd_num_deferred_requests), __ATOMIC_ACQUIRE) > 0)
+		{
+			/* There are jobs waiting to start */
+			close_flag = false;
+		}
+	else if (service_p -> se_jobs_p)
+		{
+			/*
+			 * Lastly, check the jobs from this Service's request that are
+			 * still in memory, all against the same time.
+			 */
+			TimedServiceJobSetStatus set_status;
+
+			GetTimedServiceJobSetStatus (service_p -> se_jobs_p, GetJobClockTime (), &set_status);
+
+			if (set_status.tsjss_num_running > 0)
+				{
+					close_flag = false;
+				}
+		}
+
+	/*
+	 * The jobs that have passed their deadlines are finished by the shared
+	 * CompletionScheduler, which doesn't need this Service, unless it is the
+	 * last one, see ReleaseSharedLongRunningData.
+	 */
+	if ((close_flag) && (data_p -> lsd_configured_flag))
+		{
+			close_flag = ReleaseSharedLongRunningData (data_p -> lsd_shared_p);
+		}
+
+	if (close_flag)
+		{
+			FreeLongRunningServiceData (data_p);
+		}
+
+	return close_flag;
+}
+ 
+ 
+static const char *GetLongRunningServiceName (const Service * UNUSED_PARAM (service_p))
+{
+	return "Long Running service";
+}
+
+
+static const char *GetLongRunningServiceDescription (const Service * UNUSED_PARAM (service_p))
+{
+	return "A service to test long-running asynchronous services";
+}
+
+
+static const char *GetLongRunningServiceAlias (const Service * UNUSED_PARAM (service_p))
+{
+	return "example" SERVICE_GROUP_ALIAS_SEPARATOR "run";
+}
+
+/*
+ * Each caller gets its own ParameterSet since the server sets the
+ * current values of the parameters on it for the request being run.
+ */
+static ParameterSet *GetLongRunningServiceParameters (Service *service_p, DataResource * UNUSED_PARAM (resource_p), User * UNUSED_PARAM (user_p))
+{
+	ParameterSet *param_set_p = AllocateParameterSet ("LongRunning service parameters", "The parameters used for the LongRunning service");
+	
+	if (param_set_p)
+		{
+			/*
+			 * We will have a single parameter specifying the number of jobs to run.
+			 */
+			Parameter *param_p = NULL;
+			LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+
+			if ((param_p = EasyCreateAndAddUnsignedIntParameterToParameterSet (service_p -> se_data_p, param_set_p, NULL, LRS_NUMBER_OF_JOBS.npt_name_s, "Number of jobs", "Number of jobs to run",  & (data_p -> lsd_default_number_of_jobs), PL_ALL)) != NULL)
+				{
+					param_p -> pa_required_flag = true;
+
+					if ((param_p = EasyCreateAndAddSignedIntParameterToParameterSet (service_p -> se_data_p, param_set_p, NULL, LRS_MIN_DURATION.npt_type, LRS_MIN_DURATION.npt_name_s, "Minimum time", "Minimum duration of each job",  NULL, PL_ALL)) != NULL)
+						{
+							if ((param_p = EasyCreateAndAddUnsignedIntParameterToParameterSet (service_p -> se_data_p, param_set_p, NULL, LRS_SEED.npt_name_s, "Random seed", "The seed used to generate the job durations. Leave this empty to use a different seed each time",  NULL, PL_ADVANCED)) != NULL)
+								{
+									bool ms_flag = false;
+
+									if ((param_p = EasyCreateAndAddBooleanParameterToParameterSet (service_p -> se_data_p, param_set_p, NULL, LRS_MILLISECOND_DURATIONS.npt_name_s, "Millisecond durations", "Measure the job durations in milliseconds rather than seconds",  &ms_flag, PL_ADVANCED)) != NULL)
+										{
+											if ((param_p = EasyCreateAndAddStringParameterToParameterSet (service_p -> se_data_p, param_set_p, NULL, LRS_JOB_KIND.npt_type, LRS_JOB_KIND.npt_name_s, "Job kind", "The load that each job generates while it is running",  GetJobKindAsString (JK_SLEEP), PL_ADVANCED)) != NULL)
+												{
+													if (AddJobKindOptions ((StringParameter *) param_p))
+														{
+															bool stats_flag = false;
+
+															if ((param_p = EasyCreateAndAddBooleanParameterToParameterSet (service_p -> se_data_p, param_set_p, NULL, LRS_GET_STATS.npt_name_s, "Get statistics", "Rather than running any jobs, get the counters and latencies for every request that the server process has handled",  &stats_flag, PL_ADVANCED)) != NULL)
+																{
+																	return param_set_p;
+																}
+														}
+												}
+										}
+								}
+						}
+				}
+
+			FreeParameterSet (param_set_p);
+		}		/* if (param_set_p) */
+		
+	return NULL;
+}
+
+
+static bool GetLongRunningServiceParameterTypesForNamedParameters (const Service *service_p, const char *param_name_s, ParameterType *pt_p)
+{
+	bool success_flag = false;
+
+	if (strcmp (param_name_s, LRS_NUMBER_OF_JOBS.npt_name_s) == 0)
+		{
+			*pt_p = LRS_NUMBER_OF_JOBS.npt_type;
+			success_flag = true;
+		}
+	else if (strcmp (param_name_s, LRS_MIN_DURATION.npt_name_s) == 0)
+		{
+			*pt_p = LRS_MIN_DURATION.npt_type;
+			success_flag = true;
+		}
+	else if (strcmp (param_name_s, LRS_SEED.npt_name_s) == 0)
+		{
+			*pt_p = LRS_SEED.npt_type;
+			success_flag = true;
+		}
+	else if (strcmp (param_name_s, LRS_MILLISECOND_DURATIONS.npt_name_s) == 0)
+		{
+			*pt_p = LRS_MILLISECOND_DURATIONS.npt_type;
+			success_flag = true;
+		}
+	else if (strcmp (param_name_s, LRS_JOB_KIND.npt_name_s) == 0)
+		{
+			*pt_p = LRS_JOB_KIND.npt_type;
+			success_flag = true;
+		}
+	else if (strcmp (param_name_s, LRS_GET_STATS.npt_name_s) == 0)
+		{
+			*pt_p = LRS_GET_STATS.npt_type;
+			success_flag = true;
+		}
+
+	return success_flag;
+}
+
+static void ReleaseLongRunningServiceParameters (Service * UNUSED_PARAM (service_p), ParameterSet *params_p)
+{
+	FreeParameterSet (params_p);
+}
+
+
+/*
+ * Add each of the JobKinds as an option for the "Job kind" parameter.
+ */
+static bool AddJobKindOptions (StringParameter *param_p)
+{
+	static const char * const descriptions_ss [JK_NUM_KINDS] =
+	{
+		"Wait without using any resources",
+		"Keep a processor busy",
+		"Sweep through a buffer larger than the processor caches",
+		"Write a temporary file to disk and read it back"
+	};
+	int i;
+
+	for (i = 0; i < JK_NUM_KINDS; ++ i)
+		{
+			if (!CreateAndAddStringParameterOption (param_p, GetJobKindAsString ((JobKind) i), descriptions_ss [i]))
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add option \"%s\" to %s", GetJobKindAsString ((JobKind) i), LRS_JOB_KIND.npt_name_s);
+					return false;
+				}
+		}
+
+	return true;
+}
+
+
+static json_t *GetLongRunningResultsAsJSON (Service *service_p, const uuid_t job_id)
+{
+	const uint64 start_ns = GetLongRunningStatsTime ();
+	json_t *resource_json_p = NULL;
+	json_t *results_array_p = NULL;
+	JobCacheEntry entry;
+	JobTombstone tombstone;
+	uuid_t group_id;
+	uint32 index;
+	int64 start;
+	int64 end;
+
+	/* The times of the jobs in a group are only stored in the group's parent record */
+	if (GetJobGroupIdFromJobId (job_id, group_id, &index) && GetGroupedTimedServiceJobTimes (service_p, group_id, index, &start, &end))
+		{
+			resource_json_p = GetJobResultAsJSON (service_p, job_id, start, end, NULL);
+		}
+	else if (GetCachedTimedServiceJob (service_p, job_id, GetJobClockTime (), &entry))
+		{
+			resource_json_p = GetJobResultAsJSON (service_p, job_id, entry.jce_start, entry.jce_end, NULL);
+		}
+	else if (FindTimedServiceJobTombstone (service_p, job_id, &tombstone))
+		{
+			resource_json_p = GetJobResultAsJSON (service_p, job_id, tombstone.jt_start, tombstone.jt_end, NULL);
+		}
+	else
+		{
+			GrassrootsServer *grassroots_p = GetGrassrootsServerFromService (service_p);
+			JobsManager *jobs_mananger_p = GetJobsManager (grassroots_p);
+			TimedServiceJob *job_p = (TimedServiceJob *) GetServiceJobFromJobsManager (jobs_mananger_p, job_id);
+
+			if (job_p)
+				{
+					AddTimedServiceJobToCache (service_p, job_p);
+					resource_json_p = GetTimedServiceJobResultAsJSON (job_p);
+
+					FreeServiceJob ((ServiceJob *) job_p);
+				}		/* if (job_p) */
+			else
+				{
+					char job_id_s [UUID_STRING_BUFFER_SIZE];
+
+					ConvertUUIDToString (job_id, job_id_s);
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get job data for \"%s\"", job_id_s);
+				}
+		}
+
+	if (resource_json_p)
+		{
+			results_array_p = json_array ();
+
+			if (results_array_p)
+				{
+					if (json_array_append_new (results_array_p, resource_json_p) != 0)
+						{
+							json_decref (resource_json_p);
+							json_decref (results_array_p);
+							results_array_p = NULL;
+						}
+				}
+			else
+				{
+					json_decref (resource_json_p);
+				}
+		}
+
+	AddLongRunningStatsLatency (GetProcessStats (), LRSO_RESULTS, start_ns);
+
+	return results_array_p;
+}
+
+
+/*
+ * Get the result for a TimedServiceJob wrapped up as an inline DataResource.
+ */
+static json_t *GetTimedServiceJobResultAsJSON (TimedServiceJob *job_p)
+{
+	return GetJobResultAsJSON (job_p -> tsj_job.sj_service_p, job_p -> tsj_job.sj_id, job_p -> tsj_interval.ti_start, job_p -> tsj_interval.ti_end, job_p);
+}
+
+
+/*
+ * Get the result for a job from just its times, so this can be used for
+ * cached jobs as well as full TimedServiceJobs. job_p is the full job if
+ * it has been loaded and NULL otherwise.
+ */
+static json_t *GetJobResultAsJSON (Service *service_p, const uuid_t job_id, const int64 start, const int64 end, const TimedServiceJob *job_p)
+{
+	json_error_t error;
+	json_t *result_p = json_pack_ex (&error, 0, "{s:I,s:I,s:I,s:I}",
+		LRS_START_S, (json_int_t) GetJobClockSeconds (start),
+		LRS_END_S, (json_int_t) GetJobClockSeconds (end),
+		LRS_START_NS_S, (json_int_t) start,
+		LRS_END_NS_S, (json_int_t) end);
+	char job_id_s [UUID_STRING_BUFFER_SIZE];
+
+	if (result_p)
+		{
+			json_t *resource_json_p = NULL;
+
+			if (!AddTimedServiceJobSubmissionToJSON (service_p, job_id, job_p, result_p))
+				{
+					json_decref (result_p);
+					return NULL;
+				}
+
+			resource_json_p = GetDataResourceAsJSONByParts (PROTOCOL_INLINE_S, NULL, "Long Runner", result_p);
+
+			/* The resource holds its own reference to result_p */
+			json_decref (result_p);
+
+			if (resource_json_p)
+				{
+					return resource_json_p;
+				}
+			else
+				{
+					ConvertUUIDToString (job_id, job_id_s);
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create resource for results of \"%s\"", job_id_s);
+				}
+		}
+	else
+		{
+			ConvertUUIDToString (job_id, job_id_s);
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create results for \"%s\", \"%s\"", job_id_s, error.text);
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Write the results for all of a Service's jobs as a JSON array through writer_fn.
+ * Only a single job's results are ever held in memory at once and the output
+ * buffer is reused from one job to the next.
+ */
+bool WriteLongRunningResults (Service *service_p, LongRunningResultsWriter writer_fn, void *writer_data_p)
+{
+	const uint64 start_ns = GetLongRunningStatsTime ();
+	bool success_flag = writer_fn ("[", 1, writer_data_p);
+
+	if (success_flag && (service_p -> se_jobs_p))
+		{
+			ServiceJobSetIterator iterator;
+			TimedServiceJob *job_p = NULL;
+			char *buffer_s = NULL;
+			size_t buffer_size = 0;
+			bool first_flag = true;
+
+			InitServiceJobSetIterator (&iterator, service_p -> se_jobs_p);
+			job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+
+			while (job_p && success_flag)
+				{
+					json_t *resource_json_p = GetTimedServiceJobResultAsJSON (job_p);
+
+					if (resource_json_p)
+						{
+							size_t length = json_dumpb (resource_json_p, buffer_s, buffer_size, JSON_COMPACT);
+
+							if (length > buffer_size)
+								{
+									/* The buffer isn't big enough so grow it and try again */
+									char *new_buffer_s = (char *) AllocMemory (length);
+
+									if (new_buffer_s)
+										{
+											if (buffer_s)
+												{
+													FreeMemory (buffer_s);
+												}
+
+											buffer_s = new_buffer_s;
+											buffer_size = length;
+
+											length = json_dumpb (resource_json_p, buffer_s, buffer_size, JSON_COMPACT);
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " bytes for results", length);
+											success_flag = false;
+										}
+								}
+
+							if (success_flag)
+								{
+									if ((length == 0) || (length > buffer_size))
+										{
+											char name_s [LRS_JOB_STRING_BUFFER_SIZE];
+
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to write results for \"%s\"", GetTimedServiceJobName (job_p, name_s));
+											success_flag = false;
+										}
+									else if (!first_flag && !writer_fn (",", 1, writer_data_p))
+										{
+											success_flag = false;
+										}
+									else
+										{
+											success_flag = writer_fn (buffer_s, length, writer_data_p);
+										}
+								}
+
+							first_flag = false;
+							json_decref (resource_json_p);
+						}
+					else
+						{
+							success_flag = false;
+						}
+
+					job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+				}		/* while (job_p && success_flag) */
+
+			if (buffer_s)
+				{
+					FreeMemory (buffer_s);
+				}
+		}
+
+	if (success_flag)
+		{
+			success_flag = writer_fn ("]", 1, writer_data_p);
+		}
+
+	AddLongRunningStatsLatency (GetProcessStats (), LRSO_RESULTS, start_ns);
+
+	return success_flag;
+}
+
+
+/*
+ * This is where we create our TimedServiceJob structures prior to running the Service.
+ */
+static ServiceJobSet *GetServiceJobSet (Service *service_p, const uint32 first_index, const uint32 num_jobs, const int32 min_duration, const int64 duration_unit, const JobKind kind, const uint32 seed)
+{
+	/*
+	 * If we were just runnig a single generic ServiceJob, we could use the
+	 * AllocateSimpleServiceJobSet() function. However we need multiple custom
+	 * ServiceJobs, so we need to build these.
+	 */
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+	ServiceJobSet *jobs_p = NULL;
+	TimedServiceJobArena *arena_p = NULL;
+	TimedServiceJobBuilder *builders_p = NULL;
+	pthread_t *threads_p = NULL;
+	uint32 num_builders = 1;
+	uint32 num_built = 0;
+	uint32 i;
+
+	if ((num_jobs >= data_p -> lsd_parallel_build_threshold) && (data_p -> lsd_num_build_threads > 1))
+		{
+			num_builders = (num_jobs < data_p -> lsd_num_build_threads) ? num_jobs : data_p -> lsd_num_build_threads;
+		}
+
+	builders_p = (TimedServiceJobBuilder *) AllocMemoryArray (num_builders, sizeof (TimedServiceJobBuilder));
+
+	if (!builders_p)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " UINT32_FMT " TimedServiceJobBuilders", num_builders);
+			return NULL;
+		}
+
+	if (num_builders > 1)
+		{
+			threads_p = (pthread_t *) AllocMemoryArray (num_builders, sizeof (pthread_t));
+
+			if (!threads_p)
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to allocate threads, building " UINT32_FMT " jobs serially", num_jobs);
+					num_builders = 1;
+				}
+		}
+
+	arena_p = AllocateTimedServiceJobArena (num_jobs);
+
+	if (!arena_p)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate TimedServiceJobArena for " UINT32_FMT " jobs", num_jobs);
+
+			if (threads_p)
+				{
+					FreeMemory (threads_p);
+				}
+
+			FreeMemory (builders_p);
+			return NULL;
+		}
+
+	/*
+	 * Reserve all of the jobs in the arena up front so that the builders
+	 * can fill in their own ranges without having to coordinate.
+	 */
+	TakeTimedServiceJobsFromArena (arena_p, num_jobs);
+
+	for (i = 0; i < num_builders; ++ i)
+		{
+			TimedServiceJobBuilder *builder_p = builders_p + i;
+			const uint32 range_start = (uint32) (((uint64) num_jobs * i) / num_builders);
+			const uint32 range_end = (uint32) (((uint64) num_jobs * (i + 1)) / num_builders);
+
+			builder_p -> tsjb_service_p = service_p;
+			builder_p -> tsjb_arena_p = arena_p;
+			builder_p -> tsjb_first_index = range_start;
+			builder_p -> tsjb_index_offset = first_index;
+			builder_p -> tsjb_num_jobs = range_end - range_start;
+			builder_p -> tsjb_min_duration = min_duration;
+			builder_p -> tsjb_duration_range = data_p -> lsd_duration_range;
+			builder_p -> tsjb_duration_unit = duration_unit;
+			builder_p -> tsjb_kind = kind;
+			builder_p -> tsjb_compact_names_flag = data_p -> lsd_compact_names_flag;
+			builder_p -> tsjb_seed = seed;
+			builder_p -> tsjb_num_built = 0;
+			builder_p -> tsjb_threaded_flag = false;
+		}
+
+	/*
+	 * Run the first range on this thread and the rest on their own threads. If
+	 * a thread can't be started, we just build its range here instead.
+	 */
+	for (i = 1; i < num_builders; ++ i)
+		{
+			if (pthread_create (threads_p + i, NULL, BuildTimedServiceJobs, builders_p + i) == 0)
+				{
+					builders_p [i].tsjb_threaded_flag = true;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to start builder thread " UINT32_FMT ", building its jobs serially", i);
+					BuildTimedServiceJobs (builders_p + i);
+				}
+		}
+
+	BuildTimedServiceJobs (builders_p);
+
+	for (i = 1; i < num_builders; ++ i)
+		{
+			if (builders_p [i].tsjb_threaded_flag)
+				{
+					pthread_join (threads_p [i], NULL);
+				}
+		}
+
+	for (i = 0; i < num_builders; ++ i)
+		{
+			num_built += builders_p [i].tsjb_num_built;
+		}
+
+	if (num_built == num_jobs)
+		{
+			jobs_p = AllocateServiceJobSet (service_p);
+
+			if (jobs_p)
+				{
+					/*
+					 * Add the jobs in index order so that the ServiceJobSet is the same
+					 * regardless of how many threads built it.
+					 */
+					for (i = 0; i < num_jobs; ++ i)
+						{
+							TimedServiceJob *job_p = (arena_p -> tsja_jobs_p) + i;
+
+							if (!AddServiceJobToServiceJobSet (jobs_p, (ServiceJob *) job_p))
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add TimedServiceJob to ServiceJobSet");
+									break;
+								}
+						}
+
+					if (i < num_jobs)
+						{
+							/* Free the jobs that didn't make it into the ServiceJobSet ... */
+							for ( ; i < num_jobs; ++ i)
+								{
+									FreeTimedServiceJob ((ServiceJob *) ((arena_p -> tsja_jobs_p) + i));
+								}
+
+							/* ... and then those that did */
+							FreeServiceJobSet (jobs_p);
+							jobs_p = NULL;
+						}
+				}		/* if (jobs_p) */
+			else
+				{
+					for (i = 0; i < num_jobs; ++ i)
+						{
+							FreeTimedServiceJob ((ServiceJob *) ((arena_p -> tsja_jobs_p) + i));
+						}
+				}
+		}		/* if (num_built == num_jobs) */
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Only built " UINT32_FMT " of " UINT32_FMT " TimedServiceJobs", num_built, num_jobs);
+
+			for (i = 0; i < num_builders; ++ i)
+				{
+					const TimedServiceJobBuilder *builder_p = builders_p + i;
+					uint32 j;
+
+					for (j = 0; j < builder_p -> tsjb_num_built; ++ j)
+						{
+							FreeTimedServiceJob ((ServiceJob *) ((arena_p -> tsja_jobs_p) + (builder_p -> tsjb_first_index) + j));
+						}
+
+					/* Release the references for the jobs that were never built */
+					for ( ; j < builder_p -> tsjb_num_jobs; ++ j)
+						{
+							ReleaseTimedServiceJobArena (arena_p);
+						}
+				}
+		}
+
+	/*
+	 * Each of our jobs holds its own reference to the arena
+	 * so we can drop ours.
+	 */
+	ReleaseTimedServiceJobArena (arena_p);
+
+	if (threads_p)
+		{
+			FreeMemory (threads_p);
+		}
+
+	FreeMemory (builders_p);
+
+	return jobs_p;
+}
+
+
+/*
+ * Build the range of TimedServiceJobs described by a TimedServiceJobBuilder
+ * in their reserved places in its arena. This is called either directly
+ * or as the entry point for a builder thread.
+ */
+static void *BuildTimedServiceJobs (void *data_p)
+{
+	TimedServiceJobBuilder *builder_p = (TimedServiceJobBuilder *) data_p;
+	TimedServiceJob *job_p = (builder_p -> tsjb_arena_p -> tsja_jobs_p) + (builder_p -> tsjb_first_index);
+	const uint32 end_index = (builder_p -> tsjb_first_index) + (builder_p -> tsjb_num_jobs);
+	uint32 i;
+
+	for (i = builder_p -> tsjb_first_index; i < end_index; ++ i, ++ job_p)
+		{
+			const uint32 index = i + (builder_p -> tsjb_index_offset);
+
+			/*
+			 * Get a duration for our task that is between the minimum duration
+			 * and one unit less than the range more than that.
+			 */
+			const int64 duration = ((int64) (builder_p -> tsjb_min_duration)) + (int64) (GetJobRandomValue (builder_p -> tsjb_seed, index) % (builder_p -> tsjb_duration_range));
+			bool success_flag;
+
+			if (builder_p -> tsjb_compact_names_flag)
+				{
+					success_flag = InitTimedServiceJob (job_p, builder_p -> tsjb_service_p, builder_p -> tsjb_arena_p, NULL, NULL, duration * (builder_p -> tsjb_duration_unit));
+					job_p -> tsj_compact_names_flag = true;
+				}
+			else
+				{
+					char job_name_s [LRS_JOB_STRING_BUFFER_SIZE];
+					char job_description_s [LRS_JOB_STRING_BUFFER_SIZE];
+
+					snprintf (job_name_s, LRS_JOB_STRING_BUFFER_SIZE, "job " UINT32_FMT, index);
+
+					if (builder_p -> tsjb_duration_unit == LRS_NANOS_PER_SECOND)
+						{
+							snprintf (job_description_s, LRS_JOB_STRING_BUFFER_SIZE, "duration " INT64_FMT, duration);
+						}
+					else
+						{
+							snprintf (job_description_s, LRS_JOB_STRING_BUFFER_SIZE, "duration " INT64_FMT " ms", duration);
+						}
+
+					success_flag = InitTimedServiceJob (job_p, builder_p -> tsjb_service_p, builder_p -> tsjb_arena_p, job_name_s, job_description_s, duration * (builder_p -> tsjb_duration_unit));
+				}
+
+			/*
+			 * Stop at the first failure, since only the first tsjb_num_built
+			 * jobs of the range are freed if the request can't be built.
+			 */
+			if (!success_flag)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise TimedServiceJob " UINT32_FMT, index);
+					break;
+				}
+
+			ClaimTimedServiceJobId (job_p, builder_p -> tsjb_service_p);
+
+			job_p -> tsj_kind = builder_p -> tsjb_kind;
+			job_p -> tsj_index = index;
+			job_p -> tsj_duration_ms_flag = (builder_p -> tsjb_duration_unit != LRS_NANOS_PER_SECOND);
+
+			++ (builder_p -> tsjb_num_built);
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Get a pseudo-random value for the job with the given index. This uses
+ * the splitmix64 finaliser so it needs no shared state and so can be
+ * called from any thread.
+ */
+static uint64 GetJobRandomValue (const uint64 seed, const uint32 index)
+{
+	uint64 z = seed + (((uint64) index + 1) * 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+	return z ^ (z >> 31);
+}
+
+
+/*
+ * Get a seed for a request that didn't specify one. Rather than using
+ * rand (), which shares its state between all threads, this mixes the
+ * current time with a counter that is unique to each call. The seed is
+ * cut down to the width of the "Random seed" parameter so that the one
+ * that is logged can be passed back in to repeat the run.
+ */
+static uint32 GetNewJobSeed (void)
+{
+	static uint32 s_counter = 0;
+	const uint32 count = __atomic_fetch_add (&s_counter, 1, __ATOMIC_RELAXED);
+
+	return (uint32) GetJobRandomValue ((uint64) time (NULL), count);
+}
+
+
+/*
+ * Add each of the TimedServiceJobs in a ServiceJobSet to the JobsManager once they
+ * have all been built and started. The JobsManager has no call for adding several
+ * jobs at once, so this still makes one AddServiceJobToJobsManager () call per job.
+ * Each job's tsj_added_flag is set to whether it was successfully added.
+ *
+ * Returns the number of jobs that could not be added.
+ */
+static uint32 AddEachTimedServiceJobToJobsManager (JobsManager *jobs_manager_p, ServiceJobSet *jobs_p)
+{
+	ServiceJobSetIterator iterator;
+	TimedServiceJob *job_p = NULL;
+	uint32 num_failures = 0;
+
+	InitServiceJobSetIterator (&iterator, jobs_p);
+	job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+
+	while (job_p)
+		{
+			/*
+			 * Set the flag before adding the job so that the stored
+			 * copy records that it is in the JobsManager.
+			 */
+			job_p -> tsj_added_flag = true;
+
+			if (!AddServiceJobToJobsManager (jobs_manager_p, job_p -> tsj_job.sj_id, (ServiceJob *) job_p))
+				{
+					char job_id_s [UUID_STRING_BUFFER_SIZE];
+
+					ConvertUUIDToString (job_p -> tsj_job.sj_id, job_id_s);
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add job \"%s\" to JobsManager", job_id_s);
+
+					job_p -> tsj_added_flag = false;
+					++ num_failures;
+				}
+
+			job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+		}		/* while (job_p) */
+
+	return num_failures;
+}
+
+
+static ServiceJobSet *RunLongRunningService (Service *service_p, ParameterSet *param_set_p, User *user_p, ProvidersStateTable * UNUSED_PARAM (providers_p))
+{
+	const uint64 start_ns = GetLongRunningStatsTime ();
+	LongRunningStats *stats_p = GetProcessStats ();
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+	LongRunningSharedData *shared_p = data_p -> lsd_shared_p;
+	const char *user_s = user_p ? user_p -> us_email_s : NULL;
+	const uint32 *num_tasks_p = NULL;
+	const bool *stats_flag_p = NULL;
+
+	/*
+	 * The ServiceJobSet from the previous request must not be handed back
+	 * for this one if it is refused or has no jobs.
+	 */
+	service_p -> se_jobs_p = NULL;
+
+	if (GetCurrentBooleanParameterValueFromParameterSet (param_set_p, LRS_GET_STATS.npt_name_s, &stats_flag_p) && stats_flag_p && (*stats_flag_p))
+		{
+			service_p -> se_jobs_p = GetStatsServiceJobSet (service_p);
+		}
+	else if (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, LRS_NUMBER_OF_JOBS.npt_name_s, &num_tasks_p))
+		{
+			if (num_tasks_p != NULL)
+				{
+					if (*num_tasks_p > 0)
+						{
+							const int32 *min_duration_p = NULL;
+							const uint32 *seed_p = NULL;
+							const bool *ms_flag_p = NULL;
+							const char *kind_s = NULL;
+							int64 duration_unit = LRS_NANOS_PER_SECOND;
+							JobKind kind = JK_SLEEP;
+							JobAdmissionResult admission = JAR_ADMITTED;
+							int64 max_duration;
+							uint32 seed;
+
+							GetCurrentSignedIntParameterValueFromParameterSet (param_set_p, LRS_MIN_DURATION.npt_name_s, &min_duration_p);
+
+							if (GetCurrentBooleanParameterValueFromParameterSet (param_set_p, LRS_MILLISECOND_DURATIONS.npt_name_s, &ms_flag_p) && ms_flag_p && (*ms_flag_p))
+								{
+									duration_unit = LRS_NANOS_PER_MILLISECOND;
+								}
+
+							if (GetCurrentStringParameterValueFromParameterSet (param_set_p, LRS_JOB_KIND.npt_name_s, &kind_s) && kind_s)
+								{
+									if (!GetJobKindFromString (kind_s, &kind))
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Unknown job kind \"%s\", using \"%s\"", kind_s, GetJobKindAsString (kind));
+										}
+								}
+
+							if (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, LRS_SEED.npt_name_s, &seed_p) && (seed_p != NULL))
+								{
+									seed = *seed_p;
+								}
+							else
+								{
+									seed = GetNewJobSeed ();
+								}
+
+							/* The longest that any of the jobs can take, see BuildTimedServiceJobs */
+							max_duration = (((int64) (min_duration_p ? *min_duration_p : 1)) + (data_p -> lsd_duration_range) - 1) * duration_unit;
+
+							/*
+							 * Refuse any request that could never be admitted before
+							 * building any of its jobs so that it costs next to nothing.
+							 */
+							if (min_duration_p && (*min_duration_p < 0))
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Refusing " UINT32_FMT " jobs for \"%s\", the %s of " INT32_FMT " is negative", *num_tasks_p, user_s ? user_s : "", LRS_MIN_DURATION.npt_name_s, *min_duration_p);
+								}
+							else if ((shared_p -> lss_admission_flag) && (!IsJobRequestAllowed (& (shared_p -> lss_admission), *num_tasks_p, kind)))
+								{
+									IncrementLongRunningStatsCounter (stats_p, LRSC_REQUESTS_REJECTED, 1);
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Refusing " UINT32_FMT " %s jobs for \"%s\", the limits are " UINT32_FMT " jobs per request, " UINT32_FMT " per user, " UINT32_FMT " in total and " UINT32_FMT " on the workers", *num_tasks_p, GetJobKindAsString (kind), user_s ? user_s : "", shared_p -> lss_max_jobs_per_request, shared_p -> lss_max_jobs_per_user, shared_p -> lss_max_jobs_in_flight, shared_p -> lss_admission.ja_max_work_jobs);
+								}
+							else
+								{
+									const int32 min_duration = min_duration_p ? *min_duration_p : 1;
+									GrassrootsServer *grassroots_p = GetGrassrootsServerFromService (service_p);
+									JobsManager *jobs_manager_p = GetJobsManager (grassroots_p);
+									ServiceJobSet *jobs_p = NULL;
+									JobAdmissionReservation *reservation_p = NULL;
+									bool submitted_flag = false;
+
+									/* Log the seed so that this run can be repeated */
+									PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "Running " UINT32_FMT " %s jobs with seed " UINT32_FMT, *num_tasks_p, GetJobKindAsString (kind), seed);
+
+									/*
+									 * Admit the request before building any of its jobs so that a big
+									 * one that can start straight away can be handed to the
+									 * JobSubmissionQueue without building them here at all.
+									 */
+									if (shared_p -> lss_admission_flag)
+										{
+											admission = AdmitJobs (& (shared_p -> lss_admission), user_s, *num_tasks_p, kind, &reservation_p);
+										}
+
+									/*
+									 * Grouped requests need all of their jobs' times at once, so they
+									 * are always built here if they can start straight away.
+									 */
+									if ((shared_p -> lss_submissions_flag) && (data_p -> lsd_asynchronous_submission_threshold > 0) && (*num_tasks_p >= data_p -> lsd_asynchronous_submission_threshold) &&
+										((admission == JAR_DEFERRED) || ((admission == JAR_ADMITTED) && ! ((data_p -> lsd_group_jobs_flag) && (kind == JK_SLEEP)))))
+										{
+											/*
+											 * If this fails for a request that can start straight away, its
+											 * jobs are built and started here instead.
+											 */
+											jobs_p = SubmitTimedServiceJobs (service_p, *num_tasks_p, min_duration, duration_unit, kind, seed, (admission == JAR_DEFERRED), user_s, max_duration, jobs_manager_p, reservation_p);
+											submitted_flag = true;
+										}
+
+									if (jobs_p)
+										{
+											/* The JobSubmissionQueue has the request and its reservation */
+											reservation_p = NULL;
+										}
+									else if (submitted_flag && (admission == JAR_DEFERRED))
+										{
+											/* SubmitTimedServiceJobs has already given up the places that the jobs were waiting in */
+										}
+									else if (admission == JAR_REJECTED)
+										{
+											/* So many jobs are already waiting that there is no room for these */
+											IncrementLongRunningStatsCounter (stats_p, LRSC_REQUESTS_REJECTED, 1);
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Refusing " UINT32_FMT " jobs for \"%s\", too many jobs are already waiting to start", *num_tasks_p, user_s ? user_s : "");
+										}
+									else
+										{
+											jobs_p = GetServiceJobSet (service_p, 0, *num_tasks_p, min_duration, duration_unit, kind, seed);
+
+											if (jobs_p)
+												{
+													const int64 now = GetJobClockTime ();
+
+													if ((admission == JAR_ADMITTED) && (data_p -> lsd_group_jobs_flag) && (kind == JK_SLEEP) && (*num_tasks_p > 1) &&
+														StartGroupedTimedServiceJobs (service_p, jobs_p, *num_tasks_p, now, duration_unit, jobs_manager_p, reservation_p))
+														{
+															/* The whole request is stored and scheduled as a single record */
+															IncrementLongRunningStatsCounter (stats_p, LRSC_JOBS_SUBMITTED, *num_tasks_p);
+														}
+													else if (admission == JAR_ADMITTED)
+														{
+															StartTimedServiceJobSet (service_p, jobs_p, *num_tasks_p, kind, now, true, jobs_manager_p, reservation_p);
+														}
+													else
+														{
+															/*
+															 * Too many jobs are running, so rather than starting these
+															 * ones here, store them as waiting and leave it to the
+															 * JobAdmission to start them once there is room.
+															 */
+															IncrementLongRunningStatsCounter (stats_p, LRSC_JOBS_SUBMITTED, *num_tasks_p);
+															IncrementLongRunningStatsCounter (stats_p, LRSC_REQUESTS_DEFERRED, 1);
+															DeferTimedServiceJobs (service_p, jobs_p, *num_tasks_p, jobs_manager_p, user_s, kind);
+														}
+												}		/* if (jobs_p) */
+											else if (admission == JAR_DEFERRED)
+												{
+													/*
+													 * Give up the places that the jobs were waiting in. If they had been
+													 * admitted, their places are given up when their reservation is
+													 * finished below.
+													 */
+													CancelDeferredJobs (& (shared_p -> lss_admission), *num_tasks_p);
+												}
+										}
+
+									/*
+									 * The jobs that were started here are counted until they finish and
+									 * the rest, if any, stop being counted now.
+									 */
+									FinishTimedServiceJobReservation (service_p, reservation_p);
+
+									service_p -> se_jobs_p = jobs_p;
+								}		/* if (IsJobRequestAllowed) else */
+
+						}
+				}
+
+
+		}		/* if (GetParameterValueFromParameterSet (param_set_p, TAG_LONG_RUNNING_NUM_JOBS, &param_value, true)) */
+
+	AddLongRunningStatsLatency (stats_p, LRSO_SUBMIT, start_ns);
+
+	return service_p -> se_jobs_p;
+}
+
+
+static ParameterSet *IsFileForLongRunningService (Service * UNUSED_PARAM (service_p), DataResource * UNUSED_PARAM (resource_p), Handler * UNUSED_PARAM (handler_p))
+{
+	return NULL;
+}
+
+
+static OperationStatus GetLongRunningServiceStatus (Service *service_p, const uuid_t job_id)
+{
+	const uint64 start_ns = GetLongRunningStatsTime ();
+	OperationStatus status = OS_ERROR;
+
+	GetTimedServiceJobCurrentStatus (service_p, job_id, true, &status);
+
+	AddLongRunningStatsLatency (GetProcessStats (), LRSO_STATUS, start_ns);
+
+	return status;
+}
+
+
+bool GetLongRunningServiceOwnedStatus (Service *service_p, const uuid_t job_id, OperationStatus *status_p)
+{
+	const uint64 start_ns = GetLongRunningStatsTime ();
+	const bool found_flag = GetTimedServiceJobCurrentStatus (service_p, job_id, false, status_p);
+
+	AddLongRunningStatsLatency (GetProcessStats (), LRSO_STATUS, start_ns);
+
+	return found_flag;
+}
+
+
+/*
+ * Get the current status of a job, from the cache if it is there, then
+ * from the server that owns it if that is another one and forward_flag
+ * is true, and otherwise from the JobsManager.
+ */
+static bool GetTimedServiceJobCurrentStatus (Service *service_p, const uuid_t job_id, const bool forward_flag, OperationStatus *status_p)
+{
+	JobCacheEntry entry;
+	uuid_t group_id;
+	uint32 index;
+	bool found_flag = true;
+
+	if (GetCachedTimedServiceJob (service_p, job_id, GetJobClockTime (), &entry))
+		{
+			*status_p = entry.jce_status;
+		}
+	else if (GetRetainedTimedServiceJobStatus (service_p, job_id, status_p))
+		{
+			/* The job has finished and only its tombstone is left */
+		}
+	else if (IsTimedServiceJobSubmissionQueued (service_p, job_id))
+		{
+			/* The job is the record of a request whose jobs haven't all been started yet */
+			*status_p = OS_PENDING;
+		}
+	else if (forward_flag && ForwardTimedServiceJobStatus (service_p, job_id, status_p))
+		{
+			/* The status came from the server that owns the job */
+		}
+	else if (GetJobGroupIdFromJobId (job_id, group_id, &index) && GetGroupedTimedServiceJobStatus (service_p, group_id, index, GetJobClockTime (), status_p))
+		{
+			/* The job is one of a group and its status came from the group's parent */
+		}
+	else
+		{
+			GrassrootsServer *grassroots_p = GetGrassrootsServerFromService (service_p);
+			JobsManager *jobs_manager_p = GetJobsManager (grassroots_p);
+			ServiceJob *job_p = GetServiceJobFromJobsManager (jobs_manager_p, job_id);
+
+			if (job_p)
+				{
+					*status_p = GetTimedServiceJobStatus (job_p);
+					AddTimedServiceJobToCache (service_p, (TimedServiceJob *) job_p);
+
+					FreeServiceJob (job_p);
+				}		/* if (job_p) */
+			else
+				{
+					char job_id_s [UUID_STRING_BUFFER_SIZE];
+
+					ConvertUUIDToString (job_id, job_id_s);
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get job data for \"%s\"", job_id_s);
+
+					found_flag = false;
+				}
+		}
+
+	return found_flag;
+}
+
+
+/*
+ * Get the statuses of many jobs at once. The jobs that this Service is running
+ * are checked first with a single pass over its ServiceJobSet and only the
+ * remaining ids are found in the cache, asked of the servers that own them
+ * or fetched from the JobsManager. All of the statuses that are worked out
+ * here are against the same point in time.
+ */
+uint32 GetLongRunningServiceStatuses (Service *service_p, const uuid_t *job_ids_p, const uint32 num_jobs, OperationStatus *statuses_p)
+{
+	const uint64 start_ns = GetLongRunningStatsTime ();
+	uint32 num_found = 0;
+	JobStatusRequest *requests_p = NULL;
+	const int64 now = GetJobClockTime ();
+	uint32 i;
+
+	if (num_jobs == 0)
+		{
+			return 0;
+		}
+
+	requests_p = (JobStatusRequest *) AllocMemoryArray (num_jobs, sizeof (JobStatusRequest));
+
+	if (!requests_p)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate status requests for " UINT32_FMT " jobs", num_jobs);
+			return 0;
+		}
+
+	for (i = 0; i < num_jobs; ++ i)
+		{
+			requests_p [i].jsr_id_p = job_ids_p [i];
+			requests_p [i].jsr_index = i;
+			requests_p [i].jsr_found_flag = false;
+
+			statuses_p [i] = OS_ERROR;
+		}
+
+	qsort (requests_p, num_jobs, sizeof (JobStatusRequest), CompareJobStatusRequests);
+
+	/*
+	 * Check the jobs that we have in memory first
+	 */
+	if (service_p -> se_jobs_p)
+		{
+			ServiceJobSetIterator iterator;
+			ServiceJob *job_p = NULL;
+
+			InitServiceJobSetIterator (&iterator, service_p -> se_jobs_p);
+			job_p = GetNextServiceJobFromServiceJobSetIterator (&iterator);
+
+			while (job_p && (num_found < num_jobs))
+				{
+					JobStatusRequest key;
+					JobStatusRequest *match_p;
+
+					key.jsr_id_p = job_p -> sj_id;
+					match_p = (JobStatusRequest *) bsearch (&key, requests_p, num_jobs, sizeof (JobStatusRequest), CompareJobStatusRequests);
+
+					if (match_p && ! (match_p -> jsr_found_flag))
+						{
+							num_found += SetJobStatusRequestStatuses (requests_p, num_jobs, match_p, GetTimedServiceJobStatusAtTime (job_p, now), statuses_p);
+						}
+
+					job_p = GetNextServiceJobFromServiceJobSetIterator (&iterator);
+				}
+		}
+
+	/*
+	 * Then go to the JobsManager for the remainder
+	 */
+	if (num_found < num_jobs)
+		{
+			GrassrootsServer *grassroots_p = GetGrassrootsServerFromService (service_p);
+			JobsManager *jobs_manager_p = GetJobsManager (grassroots_p);
+
+			/*
+			 * The ids of the jobs in a group only differ in their last bytes,
+			 * so once sorted they are next to each other and the group's
+			 * parent record is read once and then found in lss_group_cache
+			 * for the rest of them.
+			 */
+			for (i = 0; i < num_jobs; ++ i)
+				{
+					JobStatusRequest *request_p = requests_p + i;
+
+					if (! (request_p -> jsr_found_flag))
+						{
+							JobCacheEntry entry;
+							ServiceJob *job_p = NULL;
+							OperationStatus status;
+							uuid_t group_id;
+							uint32 index;
+
+							if (GetCachedTimedServiceJob (service_p, request_p -> jsr_id_p, now, &entry))
+								{
+									num_found += SetJobStatusRequestStatuses (requests_p, num_jobs, request_p, entry.jce_status, statuses_p);
+								}
+							else if (GetRetainedTimedServiceJobStatus (service_p, request_p -> jsr_id_p, &status))
+								{
+									num_found += SetJobStatusRequestStatuses (requests_p, num_jobs, request_p, status, statuses_p);
+								}
+							else if (IsTimedServiceJobSubmissionQueued (service_p, request_p -> jsr_id_p))
+								{
+									num_found += SetJobStatusRequestStatuses (requests_p, num_jobs, request_p, OS_PENDING, statuses_p);
+								}
+							else if (ForwardTimedServiceJobStatus (service_p, request_p -> jsr_id_p, &status))
+								{
+									num_found += SetJobStatusRequestStatuses (requests_p, num_jobs, request_p, status, statuses_p);
+								}
+							else if (GetJobGroupIdFromJobId (request_p -> jsr_id_p, group_id, &index) && GetGroupedTimedServiceJobStatus (service_p, group_id, index, now, &status))
+								{
+									num_found += SetJobStatusRequestStatuses (requests_p, num_jobs, request_p, status, statuses_p);
+								}
+							else if ((job_p = GetServiceJobFromJobsManager (jobs_manager_p, request_p -> jsr_id_p)) != NULL)
+								{
+									num_found += SetJobStatusRequestStatuses (requests_p, num_jobs, request_p, GetTimedServiceJobStatusAtTime (job_p, now), statuses_p);
+									AddTimedServiceJobToCache (service_p, (TimedServiceJob *) job_p);
+
+									FreeServiceJob (job_p);
+								}
+							else
+								{
+									char job_id_s [UUID_STRING_BUFFER_SIZE];
+
+									ConvertUUIDToString (request_p -> jsr_id_p, job_id_s);
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get job data for \"%s\"", job_id_s);
+
+									/* Don't look this one up again if it was requested more than once */
+									SetJobStatusRequestStatuses (requests_p, num_jobs, request_p, OS_ERROR, statuses_p);
+								}
+						}
+				}
+		}
+
+	FreeMemory (requests_p);
+
+	AddLongRunningStatsLatency (GetProcessStats (), LRSO_STATUS, start_ns);
+
+	return num_found;
+}
+
+
+static int CompareJobStatusRequests (const void *v0_p, const void *v1_p)
+{
+	const JobStatusRequest *r0_p = (const JobStatusRequest *) v0_p;
+	const JobStatusRequest *r1_p = (const JobStatusRequest *) v1_p;
+
+	return memcmp (r0_p -> jsr_id_p, r1_p -> jsr_id_p, sizeof (uuid_t));
+}
+
+
+/*
+ * Set the given status for a matched request along with any other requests
+ * for the same id, since the caller's array might contain duplicates.
+ *
+ * Returns the number of requests that were updated.
+ */
+static uint32 SetJobStatusRequestStatuses (JobStatusRequest *requests_p, const uint32 num_requests, JobStatusRequest *match_p, const OperationStatus status, OperationStatus *statuses_p)
+{
+	JobStatusRequest *request_p = match_p;
+	const JobStatusRequest * const end_p = requests_p + num_requests;
+	uint32 num_set = 0;
+
+	/* go back to the first request for this id */
+	while ((request_p > requests_p) && (CompareJobStatusRequests (request_p - 1, match_p) == 0))
+		{
+			-- request_p;
+		}
+
+	while ((request_p < end_p) && (CompareJobStatusRequests (request_p, match_p) == 0))
+		{
+			statuses_p [request_p -> jsr_index] = status;
+			request_p -> jsr_found_flag = true;
+			++ request_p;
+			++ num_set;
+		}
+
+	return num_set;
+}
+
+
+static void StartTimedServiceJob (TimedServiceJob *job_p, const int64 now)
+{
+	SetTimedServiceJobTimes (job_p, now, now + (job_p -> tsj_interval.ti_duration));
+
+	SetServiceJobStatus (& (job_p -> tsj_job), OS_STARTED);
+}
+
+
+/*
+ * Set the start and end times of a job.
+ */
+static void SetTimedServiceJobTimes (TimedServiceJob *job_p, const int64 start, const int64 end)
+{
+	job_p -> tsj_interval.ti_start = start;
+	job_p -> tsj_interval.ti_end = end;
+}
+
+
+
+static OperationStatus GetTimedServiceJobStatus (ServiceJob *job_p)
+{
+	return GetTimedServiceJobStatusAtTime (job_p, GetJobClockTime ());
+}
+
+
+/*
+ * Check whether a job's status is one that it keeps whatever the time is,
+ * because the job, or some of the jobs that it stands for, never started.
+ */
+static bool IsFixedTimedServiceJobStatus (const OperationStatus status)
+{
+	return ((status == OS_FAILED_TO_START) || (status == OS_PARTIALLY_SUCCEEDED));
+}
+
+
+/*
+ * Work out the status of a TimedServiceJob at the given time. The job's
+ * stored status is only updated if it has changed.
+ */
+static OperationStatus GetTimedServiceJobStatusAtTime (ServiceJob *job_p, const int64 now)
+{
+	TimedServiceJob *timed_job_p = (TimedServiceJob *) job_p;
+	TimeInterval * const ti_p = & (timed_job_p -> tsj_interval);
+	OperationStatus status;
+
+	if ((ti_p -> ti_start == 0) && (job_p -> sj_status == OS_PENDING))
+		{
+			RefreshDeferredTimedServiceJob (timed_job_p);
+		}
+
+	if (IsFixedTimedServiceJobStatus (job_p -> sj_status))
+		{
+			/* A job that never started, or only partly did, can't make any progress */
+			status = job_p -> sj_status;
+		}
+	else if (job_p -> sj_status == OS_SUCCEEDED)
+		{
+			/*
+			 * The job's final status has been written back, which for the
+			 * jobs that our workers ran may be before their stored end times.
+			 */
+			status = OS_SUCCEEDED;
+		}
+	else if ((ti_p -> ti_start == 0) && (job_p -> sj_status == OS_PENDING))
+		{
+			/* The job is still waiting for the JobAdmission to start it */
+			status = OS_PENDING;
+		}
+	else if (GetTimedServiceJobWorkStatus (job_p -> sj_service_p, job_p -> sj_id, &status))
+		{
+			/* A worker is running the job or it is waiting for one */
+		}
+	else if (timed_job_p -> tsj_worked_flag)
+		{
+			/*
+			 * The job was given to our workers and they no longer have it,
+			 * so it has finished.
+			 */
+			status = OS_SUCCEEDED;
+		}
+	else
+		{
+			/*
+			 * Either it's a JK_SLEEP job or another process is running it, in
+			 * which case the best we can do is to use the times that it was
+			 * stored with.
+			 */
+			status = GetTimeIntervalStatus (ti_p -> ti_start, ti_p -> ti_end, now);
+		}
+
+	if (job_p -> sj_status != status)
+		{
+			SetServiceJobStatus (job_p, status);
+		}
+
+	return status;
+}
+
+
+/*
+ * If one of the shared JobWorkers is running a job or it is waiting for
+ * one, get its status from there rather than from the clock.
+ */
+static bool GetTimedServiceJobWorkStatus (Service *service_p, const uuid_t job_id, OperationStatus *status_p)
+{
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+	JobWorkState state;
+
+	if ((data_p -> lsd_shared_p -> lss_workers_flag) && GetJobWorkState (& (data_p -> lsd_shared_p -> lss_workers), job_id, &state, NULL))
+		{
+			*status_p = (state == JWS_RUNNING) ? OS_STARTED : OS_PENDING;
+			return true;
+		}
+
+	return false;
+}
+
+
+/*
+ * Work out the status at the given time of a job with the given start and end times.
+ */
+static OperationStatus GetTimeIntervalStatus (const int64 start, const int64 end, const int64 now)
+{
+	OperationStatus status = OS_IDLE;
+
+	if (start != end)
+		{
+			if (now >= start)
+				{
+					if (now <= end)
+						{
+							status = OS_STARTED;
+						}
+					else
+						{
+							status = OS_SUCCEEDED;
+						}
+				}
+			else
+				{
+					status = OS_ERROR;
+				}
+		}
+
+	return status;
+}
+
+
+/*
+ * Look for a job in the shared JobCache and if it is there, work out its
+ * current status from its cached times and store it in entry_p. If the job has
+ * finished since it was cached, it is written back to the JobsManager just
+ * as UpdateDeserialisedTimedServiceJobStatus would have done if it had been
+ * fetched again.
+ */
+static bool GetCachedTimedServiceJob (Service *service_p, const uuid_t job_id, const int64 now, JobCacheEntry *entry_p)
+{
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+
+	if (FindJobInCache (& (data_p -> lsd_shared_p -> lss_job_cache), job_id, entry_p))
+		{
+			OperationStatus status;
+
+			/*
+			 * The workers' jobs finish when the work does rather than at their
+			 * cached end times, and they update the cache themselves when they do.
+			 */
+			if (GetTimedServiceJobWorkStatus (service_p, job_id, &status))
+				{
+					entry_p -> jce_status = status;
+					return true;
+				}
+
+			status = GetTimeIntervalStatus (entry_p -> jce_start, entry_p -> jce_end, now);
+
+			if ((status != entry_p -> jce_status) && (!IsFixedTimedServiceJobStatus (entry_p -> jce_status)))
+				{
+					/*
+					 * Only the thread that makes the change needs to update
+					 * the JobsManager.
+					 */
+					if (ChangeJobCacheStatus (& (data_p -> lsd_shared_p -> lss_job_cache), job_id, entry_p -> jce_status, status))
+						{
+							if (entry_p -> jce_status == OS_STARTED)
+								{
+									WriteBackFinishedTimedServiceJob (data_p -> lsd_shared_p, job_id);
+								}
+						}
+
+					entry_p -> jce_status = status;
+				}
+
+			return true;
+		}
+
+	return false;
+}
+
+
+/*
+ * Store the details of a job that has been fetched from the JobsManager
+ * in the shared JobCache. Jobs that are waiting to be started by the
+ * JobAdmission aren't cached, since the copy that was fetched could be
+ * older than the one that the JobAdmission caches when it starts the job.
+ */
+static void AddTimedServiceJobToCache (Service *service_p, TimedServiceJob *job_p)
+{
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+
+	if (job_p -> tsj_interval.ti_start != 0)
+		{
+			AddJobToCache (& (data_p -> lsd_shared_p -> lss_job_cache), job_p -> tsj_job.sj_id, job_p -> tsj_interval.ti_start, job_p -> tsj_interval.ti_end, GetServiceJobStatus (& (job_p -> tsj_job)));
+		}
+}
+
+
+/*
+ * Store the details of all of the TimedServiceJobs in a ServiceJobSet that
+ * were added to the JobsManager in the shared JobCache.
+ */
+static void CacheTimedServiceJobs (Service *service_p, ServiceJobSet *jobs_p)
+{
+	ServiceJobSetIterator iterator;
+	TimedServiceJob *job_p = NULL;
+
+	InitServiceJobSetIterator (&iterator, jobs_p);
+	job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+
+	while (job_p)
+		{
+			if (job_p -> tsj_added_flag)
+				{
+					AddTimedServiceJobToCache (service_p, job_p);
+				}
+
+			job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+		}
+}
+
+
+/*
+ * If the Service shares its jobs with other servers, give a new job an id
+ * that this server owns, so that the server that starts each job is the
+ * one that the others ask about it. With n servers this takes n tries on
+ * average, so after LRS_MAX_ID_ATTEMPTS the job just keeps the last one.
+ */
+static void ClaimTimedServiceJobId (TimedServiceJob *job_p, Service *service_p)
+{
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+
+	if (data_p -> lsd_shards_flag)
+		{
+			uint32 i = 0;
+
+			while ((!IsLocalJobShard (& (data_p -> lsd_shards), job_p -> tsj_job.sj_id)) && (i < LRS_MAX_ID_ATTEMPTS))
+				{
+					uuid_generate (job_p -> tsj_job.sj_id);
+					++ i;
+				}
+		}
+}
+
+
+/*
+ * If another server owns a job, ask it for the job's status rather than
+ * reading the job from the JobsManager.
+ */
+static bool ForwardTimedServiceJobStatus (Service *service_p, const uuid_t job_id, OperationStatus *status_p)
+{
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+
+	if ((data_p -> lsd_shards_flag) && (data_p -> lsd_forwarder_fn))
+		{
+			const uint32 owner = GetJobShardOwner (& (data_p -> lsd_shards), job_id);
+
+			if (owner != data_p -> lsd_shards.js_local_node)
+				{
+					if (data_p -> lsd_forwarder_fn (GetJobShardNodeName (& (data_p -> lsd_shards), owner), job_id, status_p, data_p -> lsd_forwarder_data_p))
+						{
+							IncrementLongRunningStatsCounter (GetProcessStats (), LRSC_STATUSES_FORWARDED, 1);
+							return true;
+						}
+				}
+		}
+
+	return false;
+}
+
+
+/*
+ * Work out the statuses of all of the TimedServiceJobs in a ServiceJobSet
+ * against a single point in time, so that the results are consistent
+ * with each other, and store the summary in status_p.
+ */
+static void GetTimedServiceJobSetStatus (ServiceJobSet *jobs_p, const int64 now, TimedServiceJobSetStatus *status_p)
+{
+	ServiceJobSetIterator iterator;
+	ServiceJob *job_p = NULL;
+
+	memset (status_p, 0, sizeof (TimedServiceJobSetStatus));
+	status_p -> tsjss_time = now;
+
+	InitServiceJobSetIterator (&iterator, jobs_p);
+	job_p = GetNextServiceJobFromServiceJobSetIterator (&iterator);
+
+	while (job_p)
+		{
+			OperationStatus status = GetTimedServiceJobStatusAtTime (job_p, now);
+
+			switch (status)
+				{
+					case OS_PENDING:
+					case OS_STARTED:
+						++ (status_p -> tsjss_num_running);
+						break;
+
+					case OS_SUCCEEDED:
+						++ (status_p -> tsjss_num_succeeded);
+						break;
+
+					default:
+						++ (status_p -> tsjss_num_other);
+						break;
+				}
+
+			++ (status_p -> tsjss_num_jobs);
+
+			job_p = GetNextServiceJobFromServiceJobSetIterator (&iterator);
+		}		/* while (job_p) */
+}
+
+
+
+/*
+ * Refresh the job's status, from its worker if it has one, so that the
+ * caller sees how far it has got.
+ */
+static bool UpdateTimedServiceJob (struct ServiceJob *job_p)
+{
+	GetTimedServiceJobStatus (job_p);
+
+	return true;
+}
+
+
+static TimedServiceJob *AllocateTimedServiceJob (Service *service_p, TimedServiceJobArena *arena_p, const char * const job_name_s, const char * const job_description_s, const int64 duration)
+{
+	TimedServiceJob *job_p = NULL;
+
+	if (arena_p)
+		{
+			if (arena_p -> tsja_num_used < arena_p -> tsja_num_jobs)
+				{
+					job_p = (arena_p -> tsja_jobs_p) + (arena_p -> tsja_num_used);
+					TakeTimedServiceJobsFromArena (arena_p, 1);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "TimedServiceJobArena is full, all " UINT32_FMT " jobs have been used", arena_p -> tsja_num_jobs);
+				}
+		}
+	else
+		{
+			job_p = (TimedServiceJob *) AllocMemory (sizeof (TimedServiceJob));
+		}
+
+	if (job_p)
+		{
+			if (!InitTimedServiceJob (job_p, service_p, arena_p, job_name_s, job_description_s, duration))
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise TimedServiceJob");
+
+					/* The job's place in the arena is left unused */
+					if (arena_p)
+						{
+							ReleaseTimedServiceJobArena (arena_p);
+						}
+					else
+						{
+							FreeMemory (job_p);
+						}
+
+					job_p = NULL;
+				}
+		}		/* if (job_p) */
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate TimedServiceJob");
+		}
+
+	return job_p;
+}
+
+
+/*
+ * Initialise a TimedServiceJob in place. If the base ServiceJob can't be
+ * initialised, false is returned and the job must not be freed.
+ */
+static bool InitTimedServiceJob (TimedServiceJob *job_p, Service *service_p, TimedServiceJobArena *arena_p, const char * const job_name_s, const char * const job_description_s, const int64 duration)
+{
+	job_p -> tsj_interval.ti_duration = duration;
+
+	job_p -> tsj_arena_p = arena_p;
+	SetTimedServiceJobTimes (job_p, 0, 0);
+
+	job_p -> tsj_kind = JK_SLEEP;
+	job_p -> tsj_added_flag = false;
+	job_p -> tsj_worked_flag = false;
+	job_p -> tsj_loaded_flag = false;
+	job_p -> tsj_compact_names_flag = false;
+	job_p -> tsj_duration_ms_flag = false;
+	job_p -> tsj_index = 0;
+	job_p -> tsj_group_p = NULL;
+	job_p -> tsj_submission_num_jobs = 0;
+	job_p -> tsj_submission_num_started = 0;
+
+	if (InitServiceJob (& (job_p -> tsj_job), service_p, job_name_s, job_description_s, UpdateTimedServiceJob, NULL, FreeTimedServiceJob, NULL, LRS_SERVICE_JOB_TYPE_S))
+		{
+			/*
+			 * Jobs that live in an arena must never be passed to FreeMemory directly
+			 * so make sure that they always get released through FreeTimedServiceJob.
+			 */
+			job_p -> tsj_job.sj_free_fn = FreeTimedServiceJob;
+
+			return true;
+		}
+
+	return false;
+}
+
+
+static void FreeTimedServiceJob (ServiceJob *job_p)
+{
+	TimedServiceJob *timed_job_p = (TimedServiceJob *) job_p;
+	TimedServiceJobArena *arena_p = timed_job_p -> tsj_arena_p;
+
+	if (timed_job_p -> tsj_group_p)
+		{
+			ClearJobGroup (timed_job_p -> tsj_group_p);
+			FreeMemory (timed_job_p -> tsj_group_p);
+			timed_job_p -> tsj_group_p = NULL;
+		}
+
+	if (arena_p)
+		{
+			ClearServiceJob (job_p);
+			ReleaseTimedServiceJobArena (arena_p);
+		}
+	else
+		{
+			FreeBaseServiceJob (job_p);
+		}
+}
+
+
+/*
+ * Get the name of a job. For jobs with compact names, this is written
+ * into buffer_s, which must have at least LRS_JOB_STRING_BUFFER_SIZE bytes,
+ * and the returned value is only valid for as long as buffer_s is.
+ */
+static const char *GetTimedServiceJobName (const TimedServiceJob *job_p, char *buffer_s)
+{
+	if (job_p -> tsj_compact_names_flag)
+		{
+			snprintf (buffer_s, LRS_JOB_STRING_BUFFER_SIZE, "job " UINT32_FMT, job_p -> tsj_index);
+			return buffer_s;
+		}
+
+	return job_p -> tsj_job.sj_name_s;
+}
+
+
+/*
+ * Get the description of a job in the same way as GetTimedServiceJobName.
+ */
+static const char *GetTimedServiceJobDescription (const TimedServiceJob *job_p, char *buffer_s)
+{
+	if (job_p -> tsj_compact_names_flag)
+		{
+			if (job_p -> tsj_duration_ms_flag)
+				{
+					snprintf (buffer_s, LRS_JOB_STRING_BUFFER_SIZE, "duration " INT64_FMT " ms", (int64) ((job_p -> tsj_interval.ti_duration) / LRS_NANOS_PER_MILLISECOND));
+				}
+			else
+				{
+					snprintf (buffer_s, LRS_JOB_STRING_BUFFER_SIZE, "duration " INT64_FMT, (int64) ((job_p -> tsj_interval.ti_duration) / LRS_NANOS_PER_SECOND));
+				}
+
+			return buffer_s;
+		}
+
+	return job_p -> tsj_job.sj_description_s;
+}
+
+
+/*
+ * Since GetServiceJobAsJSON can only add the names that are stored in
+ * the ServiceJob, add the produced ones for jobs with compact names.
+ * When the job is read back, it will have the names stored as normal.
+ */
+static bool AddCompactTimedServiceJobNamesToJSON (const TimedServiceJob *job_p, json_t *json_p)
+{
+	if (job_p -> tsj_compact_names_flag)
+		{
+			char buffer_s [LRS_JOB_STRING_BUFFER_SIZE];
+
+			if (!SetJSONString (json_p, JOB_NAME_S, GetTimedServiceJobName (job_p, buffer_s)))
+				{
+					PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, json_p, "Failed to add %s \"%s\" to json", JOB_NAME_S, buffer_s);
+					return false;
+				}
+
+			if (!SetJSONString (json_p, JOB_DESCRIPTION_S, GetTimedServiceJobDescription (job_p, buffer_s)))
+				{
+					PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, json_p, "Failed to add %s \"%s\" to json", JOB_DESCRIPTION_S, buffer_s);
+					return false;
+				}
+		}
+
+	return true;
+}
+
+
+/*
+ * If the job is the parent record of a group, add the times of all of
+ * the group's jobs to its JSON.
+ */
+static bool AddTimedServiceJobGroupToJSON (const TimedServiceJob *job_p, json_t *json_p)
+{
+	if (job_p -> tsj_group_p)
+		{
+			json_t *group_json_p = GetJobGroupAsJSON (job_p -> tsj_group_p);
+
+			if (group_json_p)
+				{
+					if (json_object_set_new (json_p, LRS_GROUP_S, group_json_p) == 0)
+						{
+							return true;
+						}
+					else
+						{
+							PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, json_p, "Failed to add %s of " UINT32_FMT " jobs to json", LRS_GROUP_S, job_p -> tsj_group_p -> jg_num_jobs);
+						}
+				}
+
+			return false;
+		}
+
+	return true;
+}
+
+
+/*
+ * If the JSON is for the parent record of a group, load the times of
+ * all of the group's jobs into the TimedServiceJob.
+ */
+static bool GetTimedServiceJobGroupFromJSON (TimedServiceJob *job_p, const json_t *json_p)
+{
+	const json_t *group_json_p = json_object_get (json_p, LRS_GROUP_S);
+
+	if (group_json_p)
+		{
+			JobGroup *group_p = (JobGroup *) AllocMemory (sizeof (JobGroup));
+
+			if (group_p)
+				{
+					if (InitJobGroupFromJSON (group_p, group_json_p))
+						{
+							job_p -> tsj_group_p = group_p;
+
+							/* The base ServiceJob's free function doesn't know about the group */
+							job_p -> tsj_job.sj_free_fn = FreeTimedServiceJob;
+
+							return true;
+						}
+
+					FreeMemory (group_p);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate JobGroup");
+				}
+
+			return false;
+		}
+
+	return true;
+}
+
+
+/*
+ * If the job is the record for a request whose jobs are submitted in the
+ * background, add how many of them there are and how many have been
+ * started to the JSON. While the JobSubmissionQueue is still starting
+ * them, it has the latest counts rather than the record.
+ */
+static bool AddTimedServiceJobSubmissionToJSON (Service *service_p, const uuid_t job_id, const TimedServiceJob *job_p, json_t *json_p)
+{
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+	uint32 num_jobs = 0;
+	uint32 num_started = 0;
+
+	if (job_p)
+		{
+			num_jobs = job_p -> tsj_submission_num_jobs;
+			num_started = job_p -> tsj_submission_num_started;
+		}
+
+	if (data_p -> lsd_shared_p -> lss_submissions_flag)
+		{
+			GetJobSubmissionProgress (& (data_p -> lsd_shared_p -> lss_submissions), job_id, &num_jobs, &num_started);
+		}
+
+	if (num_jobs > 0)
+		{
+			json_error_t error;
+			json_t *submission_json_p = json_pack_ex (&error, 0, "{s:I,s:I}",
+				LRS_SUBMISSION_NUM_JOBS_S, (json_int_t) num_jobs,
+				LRS_SUBMISSION_NUM_STARTED_S, (json_int_t) num_started);
+
+			if (submission_json_p)
+				{
+					if (json_object_set_new (json_p, LRS_SUBMISSION_S, submission_json_p) == 0)
+						{
+							return true;
+						}
+					else
+						{
+							PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, json_p, "Failed to add %s of " UINT32_FMT " jobs to json", LRS_SUBMISSION_S, num_jobs);
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create %s of " UINT32_FMT " jobs, \"%s\"", LRS_SUBMISSION_S, num_jobs, error.text);
+				}
+
+			return false;
+		}
+
+	return true;
+}
+
+
+/*
+ * If the JSON is for the record of a request whose jobs are submitted in
+ * the background, load how many of them there are and how many were
+ * started. Records stored before these were added have neither.
+ */
+static void GetTimedServiceJobSubmissionFromJSON (TimedServiceJob *job_p, const json_t *json_p)
+{
+	const json_t *submission_json_p = json_object_get (json_p, LRS_SUBMISSION_S);
+
+	if (submission_json_p)
+		{
+			uint32 u;
+
+			if (GetJSONUnsignedInteger (submission_json_p, LRS_SUBMISSION_NUM_JOBS_S, &u))
+				{
+					job_p -> tsj_submission_num_jobs = u;
+				}
+
+			if (GetJSONUnsignedInteger (submission_json_p, LRS_SUBMISSION_NUM_STARTED_S, &u))
+				{
+					job_p -> tsj_submission_num_started = u;
+				}
+		}
+}
+
+
+static TimedServiceJobArena *AllocateTimedServiceJobArena (const uint32 num_jobs)
+{
+	TimedServiceJobArena *arena_p = (TimedServiceJobArena *) AllocMemory (sizeof (TimedServiceJobArena));
+
+	if (arena_p)
+		{
+			arena_p -> tsja_jobs_p = (TimedServiceJob *) AllocMemoryArray (num_jobs, sizeof (TimedServiceJob));
+
+			if (arena_p -> tsja_jobs_p)
+				{
+					arena_p -> tsja_num_jobs = num_jobs;
+					arena_p -> tsja_num_used = 0;
+
+					/* The reference for the caller */
+					arena_p -> tsja_num_references = 1;
+
+					return arena_p;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate block of " UINT32_FMT " TimedServiceJobs", num_jobs);
+				}
+
+			FreeMemory (arena_p);
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Mark the next num_jobs jobs in an arena as used, each of which takes a
+ * reference to the arena.
+ */
+static void TakeTimedServiceJobsFromArena (TimedServiceJobArena *arena_p, const uint32 num_jobs)
+{
+	arena_p -> tsja_num_used += num_jobs;
+	arena_p -> tsja_num_references += num_jobs;
+}
+
+
+static void ReleaseTimedServiceJobArena (TimedServiceJobArena *arena_p)
+{
+	-- (arena_p -> tsja_num_references);
+
+	if (arena_p -> tsja_num_references == 0)
+		{
+			FreeMemory (arena_p -> tsja_jobs_p);
+			FreeMemory (arena_p);
+		}
+}
+
+
+
+static json_t *GetTimedServiceJobAsJSON (TimedServiceJob *job_p)
+{
+	/*
+	 * Get the JSON for the ServiceJob base class.
+	 */
+	json_t *json_p = GetServiceJobAsJSON (& (job_p -> tsj_job), false);
+
+	if (json_p)
+		{
+			/*
+			 * Now we add our extra data which is the start and end time of the TimeInterval
+			 * for the given TimedServiceJob, both in whole seconds and in nanoseconds,
+			 * and the kind of the job.
+			 */
+			if (json_object_set_new (json_p, LRS_START_S, json_integer ((json_int_t) GetJobClockSeconds (job_p -> tsj_interval.ti_start))) == 0)
+				{
+					if (json_object_set_new (json_p, LRS_END_S, json_integer ((json_int_t) GetJobClockSeconds (job_p -> tsj_interval.ti_end))) == 0)
+						{
+							if (json_object_set_new (json_p, LRS_START_NS_S, json_integer ((json_int_t) (job_p -> tsj_interval.ti_start))) == 0)
+								{
+									if (json_object_set_new (json_p, LRS_END_NS_S, json_integer ((json_int_t) (job_p -> tsj_interval.ti_end))) == 0)
+										{
+											if (SetJSONString (json_p, LRS_KIND_S, GetJobKindAsString (job_p -> tsj_kind)))
+												{
+													if (SetJSONBoolean (json_p, LRS_ADDED_FLAG_S, job_p -> tsj_added_flag))
+														{
+															if (AddCompactTimedServiceJobNamesToJSON (job_p, json_p) && AddTimedServiceJobGroupToJSON (job_p, json_p) && AddTimedServiceJobSubmissionToJSON (job_p -> tsj_job.sj_service_p, job_p -> tsj_job.sj_id, job_p, json_p))
+																{
+																	return json_p;
+																}
+														}
+													else
+														{
+															PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, json_p, "Failed to add %s to json", LRS_ADDED_FLAG_S);
+														}
+												}
+											else
+												{
+													PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, json_p, "Failed to add %s \"%s\" to json", LRS_KIND_S, GetJobKindAsString (job_p -> tsj_kind));
+												}
+										}
+									else
+										{
+											PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, json_p, "Failed to add %s " INT64_FMT " to json", LRS_END_NS_S, job_p -> tsj_interval.ti_end);
+										}
+								}
+							else
+								{
+									PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, json_p, "Failed to add %s " INT64_FMT " to json", LRS_START_NS_S, job_p -> tsj_interval.ti_start);
+								}
+
+						}		/* if (json_object_set_new (json_p, LRS_END_S, ...) == 0) */
+					else
+						{
+							PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, json_p, "Failed to add %s " INT64_FMT " to json", LRS_END_S, job_p -> tsj_interval.ti_end);
+						}
+
+				}		/* if (json_object_set_new (json_p, LRS_START_S, ...) == 0) */
+			else
+				{
+					PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, json_p, "Failed to add %s " INT64_FMT " to json", LRS_START_S, job_p -> tsj_interval.ti_start);
+				}
+
+			json_decref (json_p);
+		}		/* if (json_p) */
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create JSON for TimedServiceJob");
+		}
+
+	return NULL;
+}
+
+
+static TimedServiceJob *GetTimedServiceJobFromJSON (Service *service_p, const json_t *json_p)
+{
+	/* allocate the memory for the TimedServiceJob */
+	TimedServiceJob *job_p = (TimedServiceJob *) AllocMemory (sizeof (TimedServiceJob));
+
+	if (job_p)
+		{
+			GrassrootsServer *grassroots_p = GetGrassrootsServerFromService (service_p);
+
+			job_p -> tsj_arena_p = NULL;
+			job_p -> tsj_job.sj_service_p = service_p;
+			job_p -> tsj_worked_flag = false;
+			job_p -> tsj_loaded_flag = true;
+			job_p -> tsj_compact_names_flag = false;
+			job_p -> tsj_duration_ms_flag = false;
+			job_p -> tsj_index = 0;
+			job_p -> tsj_group_p = NULL;
+			job_p -> tsj_submission_num_jobs = 0;
+			job_p -> tsj_submission_num_started = 0;
+
+			/* initialise the base ServiceJob from the JSON fragment */
+			if (InitServiceJobFromJSON (& (job_p -> tsj_job), json_p, service_p, grassroots_p))
+				{
+					/*
+					 * We now need to get the start and end times for the TimeInterval
+					 * from the JSON.
+					 */
+					if (GetJSONJobTime (json_p, LRS_START_NS_S, LRS_START_S, & (job_p -> tsj_interval.ti_start)))
+						{
+							if (GetJSONJobTime (json_p, LRS_END_NS_S, LRS_END_S, & (job_p -> tsj_interval.ti_end)))
+								{
+									bool b;
+
+									job_p -> tsj_interval.ti_duration = (job_p -> tsj_interval.ti_end) - (job_p -> tsj_interval.ti_start);
+
+									/* Jobs stored before the kinds were added are all JK_SLEEP */
+									if (!GetJobKindFromString (GetJSONString (json_p, LRS_KIND_S), & (job_p -> tsj_kind)))
+										{
+											job_p -> tsj_kind = JK_SLEEP;
+										}
+
+									if (GetJSONBoolean (json_p, LRS_ADDED_FLAG_S, &b))
+										{
+											job_p -> tsj_added_flag = b;
+										}
+									else
+										{
+											job_p -> tsj_added_flag = false;
+										}
+
+									if (GetTimedServiceJobGroupFromJSON (job_p, json_p))
+										{
+											GetTimedServiceJobSubmissionFromJSON (job_p, json_p);
+											UpdateDeserialisedTimedServiceJobStatus (job_p);
+
+											return job_p;
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get %s from JSON", LRS_GROUP_S);
+										}
+								}		/* if (GetJSONJobTime (json_p, LRS_END_NS_S, LRS_END_S, & (job_p -> tsj_interval.ti_end))) */
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get %s from JSON", LRS_END_S);
+								}
+
+						}		/* if (GetJSONJobTime (json_p, LRS_START_NS_S, LRS_START_S, & (job_p -> tsj_interval.ti_start))) */
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get %s from JSON", LRS_START_S);
+						}
+				}		/* if (InitServiceJobFromJSON (& (job_p -> tsj_job), json_p)) */
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to init ServiceJob from JSON");
+					PrintJSONToLog (STM_LEVEL_SEVERE, __FILE__, __LINE__, json_p, "Init ServiceJob failure: ");
+				}
+
+			FreeTimedServiceJob ((ServiceJob *) job_p);
+		}		/* if (job_p) */
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate TimedServiceJob");
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Get one of a job's times from its JSON. Jobs stored by earlier versions of
+ * this service only have the time in whole seconds, so if the nanosecond value
+ * is missing then the seconds are used instead.
+ */
+static bool GetJSONJobTime (const json_t *json_p, const char * const ns_key_s, const char * const seconds_key_s, int64 *time_p)
+{
+	const json_t *value_p = json_object_get (json_p, ns_key_s);
+
+	if (value_p && json_is_integer (value_p))
+		{
+			*time_p = (int64) json_integer_value (value_p);
+			return true;
+		}
+	else
+		{
+			long seconds;
+
+			if (GetJSONLong (json_p, seconds_key_s, &seconds))
+				{
+					*time_p = ((int64) seconds) * LRS_NANOS_PER_SECOND;
+					return true;
+				}
+		}
+
+	return false;
+}
+
+
+
+/*
+ * Once a job has been loaded, check whether it has finished since it was
+ * stored and if so, write its new status back to the JobsManager. The job's
+ * in-memory status is updated straight away, so the caller sees the new
+ * status even if the JobsManager is updated later.
+ */
+static void UpdateDeserialisedTimedServiceJobStatus (TimedServiceJob *job_p)
+{
+	OperationStatus old_status = GetServiceJobStatus (& (job_p -> tsj_job));
+
+	if (old_status == OS_STARTED)
+		{
+			OperationStatus new_status = GetTimedServiceJobStatus (& (job_p -> tsj_job));
+
+			/*
+			 * A job that one of our workers has queued is OS_PENDING even
+			 * though it was stored as OS_STARTED, but it hasn't finished.
+			 */
+			if ((new_status != old_status) && (new_status != OS_PENDING))
+				{
+					Service *service_p = job_p -> tsj_job.sj_service_p;
+					LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+					JobCache *cache_p = & (data_p -> lsd_shared_p -> lss_job_cache);
+					JobCacheEntry entry;
+					bool update_flag = true;
+
+					/*
+					 * As for the cached jobs, only the thread that makes the change
+					 * writes it back. This also stops the write back from starting
+					 * another one when it loads the job to store its new status.
+					 */
+					if (FindJobInCache (cache_p, job_p -> tsj_job.sj_id, &entry))
+						{
+							update_flag = ((entry.jce_status == OS_STARTED) || (entry.jce_status == OS_PENDING)) && ChangeJobCacheStatus (cache_p, job_p -> tsj_job.sj_id, entry.jce_status, new_status);
+						}
+					else
+						{
+							AddJobToCache (cache_p, job_p -> tsj_job.sj_id, job_p -> tsj_interval.ti_start, job_p -> tsj_interval.ti_end, new_status);
+						}
+
+					if (update_flag)
+						{
+							WriteBackFinishedTimedServiceJob (data_p -> lsd_shared_p, job_p -> tsj_job.sj_id);
+						}
+				}
+		}
+}
+
+
+/*
+ * Write the status of a job that has finished back to the JobsManager once.
+ * Unless the Services have been configured to do this synchronously, the write
+ * is queued for the shared StatusFlusher so that the read that noticed the
+ * change doesn't have to wait on the JobsManager. If the queue is full, it is
+ * done here instead. The record is left in the JobsManager until the job's
+ * tombstone is evicted. If no tombstones are kept, the record is removed
+ * instead, since nothing would remove it later.
+ */
+static void WriteBackFinishedTimedServiceJob (LongRunningSharedData *shared_p, const uuid_t job_id)
+{
+	uuid_t group_id;
+	uint32 index;
+
+	/*
+	 * The alias record of a job in a group keeps the times that it was
+	 * stored with and is removed along with the group's parent record.
+	 */
+	if (GetJobGroupIdFromJobId (job_id, group_id, &index))
+		{
+			return;
+		}
+
+	if (! (shared_p -> lss_retention_flag))
+		{
+			IncrementLongRunningStatsCounter (GetProcessStats (), LRSC_JOBS_MANAGER_REMOVALS, RemoveFinishedTimedServiceJob (shared_p, job_id));
+			return;
+		}
+
+	/*
+	 * The parent record of a group is kept once the group has finished,
+	 * since it is the only place where the times of its jobs are stored.
+	 * It is removed when the group's tombstone is evicted.
+	 */
+	if (IsJobGroupId (job_id))
+		{
+			return;
+		}
+
+	if (! ((shared_p -> lss_lazy_write_back_flag) && (QueueStatusFlush (& (shared_p -> lss_flusher), job_id))))
+		{
+			StoreFinishedTimedServiceJobs ((const uuid_t *) job_id, 1, shared_p);
+		}
+}
+
+
+/*
+ * Store OS_SUCCEEDED as the status of a batch of finished jobs in the
+ * JobsManager. This is the callback for the shared StatusFlusher. A job
+ * whose record has already gone, because it was never stored or because
+ * its tombstone has been evicted, is skipped.
+ *
+ * The JobsManager has no calls for reading or storing several jobs at once,
+ * so each job still costs one GetServiceJobFromJobsManager () and one
+ * AddServiceJobToJobsManager () call. The batch only gathers these writes
+ * onto the flusher's thread, off the path of the requests that noticed
+ * the jobs had finished.
+ */
+static void StoreFinishedTimedServiceJobs (const uuid_t *job_ids_p, const uint32 num_jobs, void *data_p)
+{
+	LongRunningSharedData *shared_p = (LongRunningSharedData *) data_p;
+	LongRunningStats *stats_p = GetProcessStats ();
+	JobsManager *jobs_manager_p = GetJobsManager (shared_p -> lss_grassroots_p);
+	uint32 num_stored = 0;
+	uint32 i;
+
+	for (i = 0; i < num_jobs; ++ i)
+		{
+			ServiceJob *job_p = GetServiceJobFromJobsManager (jobs_manager_p, job_ids_p [i]);
+
+			if (job_p)
+				{
+					SetServiceJobStatus (job_p, OS_SUCCEEDED);
+
+					if (AddServiceJobToJobsManager (jobs_manager_p, job_p -> sj_id, job_p))
+						{
+							++ num_stored;
+						}
+					else
+						{
+							char job_id_s [UUID_STRING_BUFFER_SIZE];
+
+							ConvertUUIDToString (job_p -> sj_id, job_id_s);
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to write back the status of job \"%s\" to JobsManager", job_id_s);
+							IncrementLongRunningStatsCounter (stats_p, LRSC_JOBS_MANAGER_ADD_FAILURES, 1);
+						}
+
+					FreeServiceJob (job_p);
+				}
+		}
+
+	if (num_stored > 0)
+		{
+			IncrementLongRunningStatsCounter (stats_p, LRSC_STATUSES_WRITTEN_BACK, num_stored);
+		}
+}
+
+
+/*
+ * Keep the tombstone of a job that has finished, if the Services are
+ * retaining them. The stored_flag says whether the job's record has been
+ * left in the JobsManager, as it is for every job that was stored there,
+ * so that it is removed when the tombstone is evicted.
+ *
+ * If no tombstones are kept, nothing would ever remove the record, so it is
+ * removed now instead. The records of the jobs that succeeded are removed
+ * when they are written back, see WriteBackFinishedTimedServiceJob, so only
+ * those of the jobs that failed are removed here.
+ */
+static void RetainTimedServiceJob (LongRunningSharedData *shared_p, const uuid_t job_id, const int64 start, const int64 end, const OperationStatus status, const bool stored_flag)
+{
+	if (shared_p -> lss_retention_flag)
+		{
+			AddJobTombstone (& (shared_p -> lss_retention), job_id, start, end, status, stored_flag);
+		}
+	else if ((stored_flag) && (status != OS_SUCCEEDED))
+		{
+			IncrementLongRunningStatsCounter (GetProcessStats (), LRSC_JOBS_MANAGER_REMOVALS, RemoveFinishedTimedServiceJob (shared_p, job_id));
+		}
+}
+
+
+/*
+ * Remove the record of a finished job from the JobsManager. If it is the
+ * parent of a group, the group is dropped from the cache of groups and the
+ * alias records of all of its jobs are removed too, the number of which
+ * is taken from the parent record as it is removed.
+ *
+ * Returns the number of records that were removed, or asked to be.
+ */
+static uint32 RemoveFinishedTimedServiceJob (LongRunningSharedData *shared_p, const uuid_t job_id)
+{
+	JobsManager *jobs_manager_p = GetJobsManager (shared_p -> lss_grassroots_p);
+	uint32 num_removals = 1;
+
+	if (IsJobGroupId (job_id))
+		{
+			TimedServiceJob *parent_p = (TimedServiceJob *) RemoveServiceJobFromJobsManager (jobs_manager_p, job_id, true);
+
+			if (shared_p -> lss_group_cache_flag)
+				{
+					RemoveJobGroupFromCache (& (shared_p -> lss_group_cache), job_id);
+				}
+
+			if (parent_p)
+				{
+					if (parent_p -> tsj_group_p)
+						{
+							const uint32 num_jobs = parent_p -> tsj_group_p -> jg_num_jobs;
+							uint32 i;
+
+							for (i = 0; i < num_jobs; ++ i)
+								{
+									uuid_t alias_id;
+
+									GetJobGroupJobId (job_id, i, alias_id);
+									RemoveServiceJobFromJobsManager (jobs_manager_p, alias_id, false);
+								}
+
+							num_removals += num_jobs;
+						}
+
+					FreeServiceJob ((ServiceJob *) parent_p);
+				}
+		}
+	else
+		{
+			RemoveServiceJobFromJobsManager (jobs_manager_p, job_id, false);
+		}
+
+	return num_removals;
+}
+
+
+/*
+ * This is the callback for the shared JobRetention. It drops each
+ * evicted job from the cache and removes any record of it that was left
+ * in the JobsManager, so that nothing is kept for it after this.
+ */
+static void EvictTimedServiceJobTombstones (const JobTombstone *tombstones_p, const uint32 num_tombstones, void *data_p)
+{
+	LongRunningSharedData *shared_p = (LongRunningSharedData *) data_p;
+	uint32 num_removals = 0;
+	uint32 i;
+
+	for (i = 0; i < num_tombstones; ++ i)
+		{
+			const JobTombstone *tombstone_p = tombstones_p + i;
+
+			RemoveJobFromCache (& (shared_p -> lss_job_cache), tombstone_p -> jt_id);
+
+			if (tombstone_p -> jt_stored_flag)
+				{
+					num_removals += RemoveFinishedTimedServiceJob (shared_p, tombstone_p -> jt_id);
+				}
+			else if ((shared_p -> lss_group_cache_flag) && IsJobGroupId (tombstone_p -> jt_id))
+				{
+					RemoveJobGroupFromCache (& (shared_p -> lss_group_cache), tombstone_p -> jt_id);
+				}
+		}
+
+	IncrementLongRunningStatsCounter (GetProcessStats (), LRSC_JOBS_EVICTED, num_tombstones);
+
+	if (num_removals > 0)
+		{
+			IncrementLongRunningStatsCounter (GetProcessStats (), LRSC_JOBS_MANAGER_REMOVALS, num_removals);
+		}
+}
+
+
+static bool FindTimedServiceJobTombstone (Service *service_p, const uuid_t job_id, JobTombstone *tombstone_p)
+{
+	LongRunningSharedData *shared_p = ((LongRunningServiceData *) (service_p -> se_data_p)) -> lsd_shared_p;
+
+	return ((shared_p -> lss_retention_flag) && FindJobTombstone (& (shared_p -> lss_retention), job_id, tombstone_p));
+}
+
+
+/*
+ * Get the status of a finished job from its tombstone. Every job in a
+ * group has finished once the group has, so the group's tombstone answers
+ * for all of them without fetching its parent record.
+ */
+static bool GetRetainedTimedServiceJobStatus (Service *service_p, const uuid_t job_id, OperationStatus *status_p)
+{
+	JobTombstone tombstone;
+	uuid_t group_id;
+	uint32 index;
+
+	if (FindTimedServiceJobTombstone (service_p, job_id, &tombstone))
+		{
+			*status_p = tombstone.jt_status;
+			return true;
+		}
+	else if (GetJobGroupIdFromJobId (job_id, group_id, &index) && FindTimedServiceJobTombstone (service_p, group_id, &tombstone))
+		{
+			*status_p = tombstone.jt_status;
+			return true;
+		}
+
+	return false;
+}
+
+
+static ServiceJob *BuildTimedServiceJob (Service *service_p, const json_t *service_job_json_p)
+{
+	const uint64 start_ns = GetLongRunningStatsTime ();
+	TimedServiceJob *job_p = GetTimedServiceJobFromJSON (service_p, service_job_json_p);
+
+	AddDeserialisationStats (service_p, job_p, start_ns);
+
+	return ((ServiceJob* ) job_p);
+}
+
+
+static json_t *BuildTimedServiceJobJSON (Service *service_p, ServiceJob *service_job_p, bool omit_results_flag)
+{
+	const uint64 start_ns = GetLongRunningStatsTime ();
+	json_t *job_json_p = GetTimedServiceJobAsJSON ((TimedServiceJob *) service_job_p);
+
+	AddLongRunningStatsLatency (GetProcessStats (), LRSO_SERIALISE, start_ns);
+
+	return job_json_p;
+}
+
+
+/*
+ * Record the latency of rebuilding a job from the JobsManager and
+ * whether it succeeded.
+ */
+static void AddDeserialisationStats (Service *service_p, const TimedServiceJob *job_p, const uint64 start_ns)
+{
+	LongRunningStats *stats_p = GetProcessStats ();
+
+	IncrementLongRunningStatsCounter (stats_p, job_p ? LRSC_JOBS_DESERIALISED : LRSC_DESERIALISE_FAILURES, 1);
+	AddLongRunningStatsLatency (stats_p, LRSO_DESERIALISE, start_ns);
+}
+
+
+
+static void CustomiseTimedServiceJob (Service *service_p, ServiceJob *job_p)
+{
+	job_p -> sj_update_fn = NULL;
+	job_p -> sj_free_fn = NULL;
+}
+
+
+
+/*
+ * This is handed to InitialiseService () and the Service takes ownership
+ * of the ServiceMetadata that it returns, freeing it along with itself.
+ * Since GetServices () creates a Service for each request, this builds
+ * a ServiceMetadata for each of them too. They can't share one, as every
+ * Service that was closed would free it, and ServiceMetadata has no
+ * reference count or copy call that would let one be handed out safely.
+ */
+static ServiceMetadata *GetLongRunningServiceMetadata (Service *service_p)
+{
+	const char *term_url_s = CONTEXT_PREFIX_EDAM_ONTOLOGY_S "operation_0304";
+	SchemaTerm *category_p = AllocateSchemaTerm (term_url_s, "Query and retrieval", "Search or query a data resource and retrieve entries and / or annotation.");
+
+	if (category_p)
+		{
+			ServiceMetadata *metadata_p = AllocateServiceMetadata (category_p, NULL);
+
+			if (metadata_p)
+				{
+					return metadata_p;
+				}		/* if (metadata_p) */
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate service metadata");
+				}
+
+			FreeSchemaTerm (category_p);
+		}		/* if (category_p) */
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate category term %s for service metadata", term_url_s);
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Set the function that CompleteTimedServiceJob calls for each finished job.
+ * The jobs are finished by the shared CompletionScheduler, so this is set
+ * for every Service in the process, not just service_p.
+ */
+void SetLongRunningServiceCompletionCallback (Service * UNUSED_PARAM (service_p), LongRunningJobCompletionCallback callback_fn, void *callback_data_p)
+{
+	pthread_once (&s_shared_data_once, InitSharedLongRunningDataLock);
+	pthread_mutex_lock (& (s_shared_data.lss_completion_lock));
+
+	s_shared_data.lss_completion_fn = callback_fn;
+	s_shared_data.lss_completion_data_p = callback_data_p;
+
+	pthread_mutex_unlock (& (s_shared_data.lss_completion_lock));
+}
+
+
+void SetLongRunningServiceStatusForwarder (Service *service_p, LongRunningStatusForwarder forwarder_fn, void *forwarder_data_p)
+{
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+
+	data_p -> lsd_forwarder_fn = forwarder_fn;
+	data_p -> lsd_forwarder_data_p = forwarder_data_p;
+}
+
+
+const char *GetLongRunningServiceJobOwner (Service *service_p, const uuid_t job_id)
+{
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+
+	if (data_p -> lsd_shards_flag)
+		{
+			return GetJobShardNodeName (& (data_p -> lsd_shards), GetJobShardOwner (& (data_p -> lsd_shards), job_id));
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Give each running job that generates a load to the JobWorkers. While a
+ * job is queued it is OS_PENDING and it only becomes OS_STARTED once a
+ * worker picks it up. If the workers already have as many jobs as they
+ * can take, the job is marked as OS_FAILED_TO_START and, if it is in
+ * the JobsManager, the stored copy is updated to match. Each job that is
+ * queued is counted in reservation_p until its work has finished.
+ *
+ * Returns the number of jobs that failed to start.
+ */
+static uint32 QueueTimedServiceJobWork (Service *service_p, ServiceJobSet *jobs_p, JobsManager *jobs_manager_p, JobAdmissionReservation *reservation_p)
+{
+	LongRunningSharedData *shared_p = ((LongRunningServiceData *) (service_p -> se_data_p)) -> lsd_shared_p;
+	ServiceJobSetIterator iterator;
+	TimedServiceJob *job_p = NULL;
+	uint32 num_failures = 0;
+
+	InitServiceJobSetIterator (&iterator, jobs_p);
+	job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+
+	while (job_p)
+		{
+			if ((job_p -> tsj_kind != JK_SLEEP) && (GetServiceJobStatus (& (job_p -> tsj_job)) == OS_STARTED))
+				{
+					if (QueueTimedServiceJobWorkItem (service_p, job_p -> tsj_job.sj_id, job_p -> tsj_kind, job_p -> tsj_interval.ti_duration, reservation_p))
+						{
+							job_p -> tsj_worked_flag = true;
+							SetServiceJobStatus (& (job_p -> tsj_job), OS_PENDING);
+						}
+					else
+						{
+							SetServiceJobStatus (& (job_p -> tsj_job), OS_FAILED_TO_START);
+
+							if (job_p -> tsj_added_flag)
+								{
+									if (!AddServiceJobToJobsManager (jobs_manager_p, job_p -> tsj_job.sj_id, (ServiceJob *) job_p))
+										{
+											char name_s [LRS_JOB_STRING_BUFFER_SIZE];
+
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to store that \"%s\" failed to start", GetTimedServiceJobName (job_p, name_s));
+										}
+								}
+
+							RetainTimedServiceJob (shared_p, job_p -> tsj_job.sj_id, job_p -> tsj_interval.ti_start, job_p -> tsj_interval.ti_end, OS_FAILED_TO_START, job_p -> tsj_added_flag);
+							++ num_failures;
+						}
+				}
+
+			job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+		}		/* while (job_p) */
+
+	return num_failures;
+}
+
+
+/*
+ * Queue a job on the shared JobWorkers, counting it against this Service
+ * until its work has finished so that the Service isn't closed while the
+ * workers can still call back into it. The job is added to reservation_p
+ * before it is queued since it can finish before QueueJobWork returns.
+ */
+static bool QueueTimedServiceJobWorkItem (Service *service_p, const uuid_t job_id, const JobKind kind, const int64 duration, JobAdmissionReservation *reservation_p)
+{
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+	LongRunningSharedData *shared_p = data_p -> lsd_shared_p;
+
+	if (shared_p -> lss_workers_flag)
+		{
+			AddTimedServiceJobToReservation (service_p, reservation_p, job_id, 1);
+			__atomic_add_fetch (& (data_p -> lsd_num_worker_jobs), 1, __ATOMIC_ACQ_REL);
+
+			if (QueueJobWork (& (shared_p -> lss_workers), job_id, kind, duration, service_p))
+				{
+					return true;
+				}
+
+			__atomic_sub_fetch (& (data_p -> lsd_num_worker_jobs), 1, __ATOMIC_ACQ_REL);
+			ReleaseTimedServiceJobAdmission (data_p -> lsd_shared_p, job_id);
+		}
+
+	return false;
+}
+
+
+/*
+ * Add a timer for each job that is running and has been stored in the
+ * JobsManager so that CompleteTimedServiceJob is called as soon as it
+ * finishes. Jobs that have been given to the JobWorkers are OS_PENDING
+ * rather than OS_STARTED at this point, so they are skipped since the
+ * workers call CompleteTimedServiceJob themselves.
+ */
+static void ScheduleTimedServiceJobCompletions (Service *service_p, ServiceJobSet *jobs_p, JobAdmissionReservation *reservation_p)
+{
+	ServiceJobSetIterator iterator;
+	TimedServiceJob *job_p = NULL;
+
+	InitServiceJobSetIterator (&iterator, jobs_p);
+	job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+
+	while (job_p)
+		{
+			if ((job_p -> tsj_added_flag) && (GetServiceJobStatus (& (job_p -> tsj_job)) == OS_STARTED))
+				{
+					if (!ScheduleTimedServiceJobCompletion (service_p, job_p -> tsj_job.sj_id, job_p -> tsj_interval.ti_start, job_p -> tsj_interval.ti_end, reservation_p, 1))
+						{
+							char name_s [LRS_JOB_STRING_BUFFER_SIZE];
 
-	if (close_flag)
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to schedule completion of \"%s\", its status will only change when polled", GetTimedServiceJobName (job_p, name_s));
+						}
+				}
+
+			job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+		}		/* while (job_p) */
+}
+
+
+/*
+ * Store all of the jobs in a ServiceJobSet as OS_PENDING, without any start
+ * or end times, and give them to the JobAdmission to start once there is
+ * room for them. Any jobs that can't be stored or if the JobAdmission can't
+ * take them are marked as OS_FAILED_TO_START instead.
+ */
+static void DeferTimedServiceJobs (Service *service_p, ServiceJobSet *jobs_p, const uint32 num_jobs, JobsManager *jobs_manager_p, const char *user_s, const JobKind kind)
+{
+	LongRunningSharedData *shared_p = ((LongRunningServiceData *) (service_p -> se_data_p)) -> lsd_shared_p;
+	LongRunningStats *stats_p = GetProcessStats ();
+	JobAdmissionItem *items_p = (JobAdmissionItem *) AllocMemoryArray (num_jobs, sizeof (JobAdmissionItem));
+	ServiceJobSetIterator iterator;
+	TimedServiceJob *job_p = NULL;
+	uint32 num_failures;
+	uint32 num_items = 0;
+	bool deferred_flag = false;
+
+	InitServiceJobSetIterator (&iterator, jobs_p);
+	job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+
+	while (job_p)
 		{
-			FreeLongRunningServiceData (data_p);
+			SetServiceJobStatus (& (job_p -> tsj_job), OS_PENDING);
+			job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
 		}
 
-	return close_flag;
+	num_failures = AddEachTimedServiceJobToJobsManager (jobs_manager_p, jobs_p);
+
+	if (num_failures > 0)
+		{
+			IncrementLongRunningStatsCounter (stats_p, LRSC_JOBS_MANAGER_ADD_FAILURES, num_failures);
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add " UINT32_FMT " of " UINT32_FMT " jobs to JobsManager", num_failures, num_jobs);
+		}
+
+	if (items_p)
+		{
+			/* Only the stored jobs can be started later */
+			InitServiceJobSetIterator (&iterator, jobs_p);
+			job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+
+			while (job_p)
+				{
+					if (job_p -> tsj_added_flag)
+						{
+							JobAdmissionItem *item_p = items_p + num_items;
+
+							memcpy (item_p -> jai_id, job_p -> tsj_job.sj_id, sizeof (uuid_t));
+							item_p -> jai_duration = job_p -> tsj_interval.ti_duration;
+							++ num_items;
+						}
+
+					job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+				}
+
+			if (num_items > 0)
+				{
+					deferred_flag = DeferTimedServiceJobRequest (service_p, user_s, items_p, num_items, num_items, kind);
+				}
+
+			FreeMemory (items_p);
+		}
+
+	/*
+	 * Give up the places of any jobs that weren't passed to DeferJobs,
+	 * which gives up the places for the rest itself if it fails.
+	 */
+	if (num_jobs > num_items)
+		{
+			CancelDeferredJobs (& (shared_p -> lss_admission), num_jobs - num_items);
+		}
+
+	/*
+	 * Mark the jobs that will never be started so that they aren't
+	 * left waiting forever.
+	 */
+	InitServiceJobSetIterator (&iterator, jobs_p);
+	job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+	num_failures = 0;
+
+	while (job_p)
+		{
+			if (! ((deferred_flag) && (job_p -> tsj_added_flag)))
+				{
+					SetServiceJobStatus (& (job_p -> tsj_job), OS_FAILED_TO_START);
+
+					if (job_p -> tsj_added_flag)
+						{
+							if (!AddServiceJobToJobsManager (jobs_manager_p, job_p -> tsj_job.sj_id, (ServiceJob *) job_p))
+								{
+									char name_s [LRS_JOB_STRING_BUFFER_SIZE];
+
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to store that \"%s\" failed to start", GetTimedServiceJobName (job_p, name_s));
+								}
+						}
+
+					RetainTimedServiceJob (shared_p, job_p -> tsj_job.sj_id, job_p -> tsj_interval.ti_start, job_p -> tsj_interval.ti_end, OS_FAILED_TO_START, job_p -> tsj_added_flag);
+					++ num_failures;
+				}
+
+			job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+		}
+
+	if (num_failures > 0)
+		{
+			IncrementLongRunningStatsCounter (stats_p, LRSC_JOBS_FAILED_TO_START, num_failures);
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, UINT32_FMT " of " UINT32_FMT " deferred jobs failed to start", num_failures, num_jobs);
+		}
 }
- 
- 
-static const char *GetLongRunningServiceName (const Service * UNUSED_PARAM (service_p))
+
+
+/*
+ * Start all of the jobs in a ServiceJobSet, register them with the
+ * JobsManager and schedule their completions. Their deadlines are only
+ * added if deadlines_flag is true, since the background submissions are
+ * tracked by their own records rather than by the deadlines of their jobs.
+ * Each job that will be completed is counted in reservation_p until it has
+ * finished.
+ *
+ * Returns the time that the last of the jobs is due to finish.
+ */
+static int64 StartTimedServiceJobSet (Service *service_p, ServiceJobSet *jobs_p, const uint32 num_jobs, const JobKind kind, const int64 now, const bool deadlines_flag, JobsManager *jobs_manager_p, JobAdmissionReservation *reservation_p)
 {
-	return "Long Running service";
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+	LongRunningStats *stats_p = GetProcessStats ();
+	ServiceJobSetIterator iterator;
+	TimedServiceJob *job_p = NULL;
+	int64 latest_end = now;
+	uint32 num_failures;
+
+	if (deadlines_flag)
+		{
+			ReserveTimedServiceJobDeadlines (data_p, num_jobs);
+		}
+
+	/*
+	 * Start all of the jobs first so that none of them are
+	 * held up waiting on the JobsManager ...
+	 */
+	InitServiceJobSetIterator (&iterator, jobs_p);
+	job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+
+	while (job_p)
+		{
+			StartTimedServiceJob (job_p, now);
+
+			if (job_p -> tsj_interval.ti_end > latest_end)
+				{
+					latest_end = job_p -> tsj_interval.ti_end;
+				}
+
+			/*
+			 * The jobs that generate a load finish whenever their workers
+			 * do, so only the sleeping ones have a fixed deadline.
+			 */
+			if (deadlines_flag && (job_p -> tsj_kind == JK_SLEEP) && (GetTimedServiceJobStatusAtTime ((ServiceJob *) job_p, now) == OS_STARTED))
+				{
+					if (!AddTimedServiceJobDeadline (data_p, job_p -> tsj_interval.ti_end))
+						{
+							char name_s [LRS_JOB_STRING_BUFFER_SIZE];
+
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add deadline for \"%s\"", GetTimedServiceJobName (job_p, name_s));
+						}
+				}
+
+			job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+		}		/* while (job_p) */
+
+	/*
+	 * ... and then add them to the JobsManager once they have all started.
+	 */
+	num_failures = AddEachTimedServiceJobToJobsManager (jobs_manager_p, jobs_p);
+
+	IncrementLongRunningStatsCounter (stats_p, LRSC_JOBS_SUBMITTED, num_jobs);
+
+	/*
+	 * The jobs are only given to the workers once they are in the
+	 * JobsManager, otherwise a short job could finish and try to
+	 * update the JobsManager before it had been added.
+	 */
+	if (kind != JK_SLEEP)
+		{
+			const uint32 num_not_started = QueueTimedServiceJobWork (service_p, jobs_p, jobs_manager_p, reservation_p);
+
+			if (num_not_started > 0)
+				{
+					IncrementLongRunningStatsCounter (stats_p, LRSC_JOBS_FAILED_TO_START, num_not_started);
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Only " UINT32_FMT " of " UINT32_FMT " jobs could be given to the workers, the rest failed to start", num_jobs - num_not_started, num_jobs);
+				}
+		}
+
+	/*
+	 * The other servers forward their status requests for
+	 * these jobs here, so keep them where they can be
+	 * answered without going to the JobsManager.
+	 */
+	if ((data_p -> lsd_shards_flag) && (kind == JK_SLEEP))
+		{
+			CacheTimedServiceJobs (service_p, jobs_p);
+		}
+
+	ScheduleTimedServiceJobCompletions (service_p, jobs_p, reservation_p);
+
+	if (num_failures > 0)
+		{
+			IncrementLongRunningStatsCounter (stats_p, LRSC_JOBS_MANAGER_ADD_FAILURES, num_failures);
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add " UINT32_FMT " of " UINT32_FMT " jobs to JobsManager", num_failures, num_jobs);
+		}
+
+	return latest_end;
 }
 
 
-static const char *GetLongRunningServiceDescription (const Service * UNUSED_PARAM (service_p))
+/*
+ * Rather than building and starting all of a request's jobs here, store a
+ * single record that stands for the whole request and leave the
+ * JobSubmissionQueue to build and start the jobs in the background. The
+ * ServiceJobSet that is returned holds just this record, which stays
+ * OS_PENDING until all of the jobs have been started, so the time that this
+ * takes doesn't depend upon the number of jobs.
+ *
+ * The caller only gets the record's id and not those of the jobs. Handing
+ * back the jobs' ids would mean adding a pending job to the JobsManager for
+ * each of them here, which is the same per-job cost of building and storing
+ * them that this is meant to take off the request.
+ *
+ * If the JobAdmission has deferred the request, the record is also the only
+ * thing that waits for admission. It holds the places of all of the jobs and
+ * the JobSubmissionQueue doesn't build any of them until the JobAdmission
+ * starts it, see StartDeferredTimedServiceJobs. If this fails for a deferred
+ * request, the jobs' places are given up. Otherwise reservation_p, if there
+ * is one, is passed on with the request and the JobSubmissionQueue finishes
+ * it once all of the jobs have been started.
+ */
+static ServiceJobSet *SubmitTimedServiceJobs (Service *service_p, const uint32 num_jobs, const int32 min_duration, const int64 duration_unit, const JobKind kind, const uint32 seed, const bool deferred_flag, const char *user_s, const int64 max_duration, JobsManager *jobs_manager_p, JobAdmissionReservation *reservation_p)
 {
-	return "A service to test long-running asynchronous services";
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+	ServiceJobSet *jobs_p = AllocateServiceJobSet (service_p);
+	bool waiting_flag = deferred_flag;
+
+	if (jobs_p)
+		{
+			char name_s [LRS_JOB_STRING_BUFFER_SIZE];
+			TimedServiceJob *record_p = NULL;
+
+			snprintf (name_s, LRS_JOB_STRING_BUFFER_SIZE, "submission of " UINT32_FMT " jobs", num_jobs);
+			record_p = AllocateTimedServiceJob (service_p, NULL, name_s, LRS_SUBMISSION_DESCRIPTION_S, 0);
+
+			if (record_p)
+				{
+					ClaimTimedServiceJobId (record_p, service_p);
+					SetServiceJobStatus (& (record_p -> tsj_job), OS_PENDING);
+					record_p -> tsj_added_flag = true;
+					record_p -> tsj_submission_num_jobs = num_jobs;
+
+					if (AddServiceJobToServiceJobSet (jobs_p, (ServiceJob *) record_p))
+						{
+							/* The record is stored before it is queued so that the queue's final copy replaces it */
+							if (AddServiceJobToJobsManager (jobs_manager_p, record_p -> tsj_job.sj_id, (ServiceJob *) record_p))
+								{
+									/* This Service can't be closed until the request has been run */
+									__atomic_add_fetch (& (data_p -> lsd_num_submissions), 1, __ATOMIC_ACQ_REL);
+
+									if (QueueJobSubmission (& (data_p -> lsd_shared_p -> lss_submissions), record_p -> tsj_job.sj_id, num_jobs, min_duration, duration_unit, kind, seed, deferred_flag, reservation_p, service_p))
+										{
+											if (deferred_flag)
+												{
+													JobAdmissionItem item;
+
+													memcpy (item.jai_id, record_p -> tsj_job.sj_id, sizeof (uuid_t));
+													item.jai_duration = max_duration;
+
+													if (DeferTimedServiceJobRequest (service_p, user_s, &item, 1, num_jobs, kind))
+														{
+															IncrementLongRunningStatsCounter (GetProcessStats (), LRSC_REQUESTS_DEFERRED, 1);
+															IncrementLongRunningStatsCounter (GetProcessStats (), LRSC_REQUESTS_QUEUED, 1);
+															return jobs_p;
+														}
+
+													/* DeferJobs has given up the jobs' places */
+													waiting_flag = false;
+													ReleaseJobSubmission (& (data_p -> lsd_shared_p -> lss_submissions), record_p -> tsj_job.sj_id, false, NULL);
+												}
+											else
+												{
+													IncrementLongRunningStatsCounter (GetProcessStats (), LRSC_REQUESTS_QUEUED, 1);
+													return jobs_p;
+												}
+										}
+
+									__atomic_sub_fetch (& (data_p -> lsd_num_submissions), 1, __ATOMIC_ACQ_REL);
+									RemoveServiceJobFromJobsManager (jobs_manager_p, record_p -> tsj_job.sj_id, false);
+								}
+							else
+								{
+									IncrementLongRunningStatsCounter (GetProcessStats (), LRSC_JOBS_MANAGER_ADD_FAILURES, 1);
+								}
+						}
+					else
+						{
+							FreeTimedServiceJob ((ServiceJob *) record_p);
+						}
+				}
+
+			FreeServiceJobSet (jobs_p);
+		}
+
+	if (waiting_flag)
+		{
+			CancelDeferredJobs (& (data_p -> lsd_shared_p -> lss_admission), num_jobs);
+		}
+
+	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to queue the submission of " UINT32_FMT " jobs", num_jobs);
+
+	return NULL;
 }
 
 
-static const char *GetLongRunningServiceAlias (const Service * UNUSED_PARAM (service_p))
+/*
+ * This is called on the JobSubmissionQueue's thread to build and start the
+ * jobs for a request that SubmitTimedServiceJobs queued. This is done in
+ * pieces of lsd_submission_chunk_size jobs, so the first jobs start without
+ * waiting for the rest to be built and the memory used at once doesn't grow
+ * with the size of the request. Each piece is freed once it has been
+ * started, since from then on its jobs are only needed by their ids. The
+ * request's reservation, if it has one, is finished once all of the
+ * pieces have been started.
+ *
+ * The queue is shared by every Service in the process, so the Service that
+ * the request was made to comes with it. That Service stays open until the
+ * request has finished here, and from then on it waits for the deadline of
+ * the last of the request's jobs.
+ */
+static void RunTimedServiceJobSubmission (JobSubmission *submission_p, void *data_p)
 {
-	return "example" SERVICE_GROUP_ALIAS_SEPARATOR "run";
+	Service *service_p = (Service *) data_p;
+	LongRunningServiceData *service_data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+	JobsManager *jobs_manager_p = GetJobsManager (GetGrassrootsServerFromService (service_p));
+	const uint32 chunk_size = service_data_p -> lsd_submission_chunk_size;
+	uint32 first_index = 0;
+	uint32 num_started = 0;
+	int64 start = 0;
+	int64 end = 0;
+
+	while (first_index < submission_p -> jsb_num_jobs)
+		{
+			const uint32 num_left = (submission_p -> jsb_num_jobs) - first_index;
+			const uint32 num_jobs = (num_left < chunk_size) ? num_left : chunk_size;
+			ServiceJobSet *jobs_p = GetServiceJobSet (service_p, first_index, num_jobs, submission_p -> jsb_min_duration, submission_p -> jsb_duration_unit, submission_p -> jsb_kind, submission_p -> jsb_seed);
+
+			if (jobs_p)
+				{
+					const int64 now = GetJobClockTime ();
+					const int64 latest_end = StartTimedServiceJobSet (service_p, jobs_p, num_jobs, submission_p -> jsb_kind, now, false, jobs_manager_p, submission_p -> jsb_reservation_p);
+
+					if (start == 0)
+						{
+							start = now;
+						}
+
+					if (latest_end > end)
+						{
+							end = latest_end;
+						}
+
+					num_started += num_jobs;
+
+					FreeServiceJobSet (jobs_p);
+				}
+			else
+				{
+					IncrementLongRunningStatsCounter (GetProcessStats (), LRSC_JOBS_FAILED_TO_START, num_jobs);
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to build jobs " UINT32_FMT " to " UINT32_FMT " of a submission", first_index, first_index + num_jobs - 1);
+				}
+
+			first_index += num_jobs;
+			SetJobSubmissionProgress (& (service_data_p -> lsd_shared_p -> lss_submissions), submission_p, num_started, end);
+		}
+
+	FinishTimedServiceJobSubmission (service_p, submission_p, num_started, start, end, jobs_manager_p);
+	FinishTimedServiceJobReservation (service_p, submission_p -> jsb_reservation_p);
+
+	if ((num_started > 0) && (!AddTimedServiceJobDeadline (service_data_p, end)))
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add the deadline of a submission of " UINT32_FMT " jobs", submission_p -> jsb_num_jobs);
+		}
+
+	__atomic_sub_fetch (& (service_data_p -> lsd_num_submissions), 1, __ATOMIC_ACQ_REL);
 }
 
-static ParameterSet *GetLongRunningServiceParameters (Service *service_p, DataResource * UNUSED_PARAM (resource_p), User * UNUSED_PARAM (user_p))
+
+/*
+ * Once all of a submission's jobs have been started, replace its record
+ * with one that runs from when the first of them started until the last of
+ * them is due to finish, so that the record's status follows the jobs'. If
+ * only some of them could be started, the record is marked as
+ * OS_PARTIALLY_SUCCEEDED straight away and if none of them could be, it
+ * is marked as OS_FAILED_TO_START.
+ */
+static void FinishTimedServiceJobSubmission (Service *service_p, const JobSubmission *submission_p, const uint32 num_started, const int64 start, const int64 end, JobsManager *jobs_manager_p)
 {
-	ParameterSet *param_set_p = AllocateParameterSet ("LongRunning service parameters", "The parameters used for the LongRunning service");
-	
-	if (param_set_p)
+	LongRunningSharedData *shared_p = ((LongRunningServiceData *) (service_p -> se_data_p)) -> lsd_shared_p;
+	char name_s [LRS_JOB_STRING_BUFFER_SIZE];
+	TimedServiceJob *record_p = NULL;
+
+	snprintf (name_s, LRS_JOB_STRING_BUFFER_SIZE, "submission of " UINT32_FMT " jobs", submission_p -> jsb_num_jobs);
+	record_p = AllocateTimedServiceJob (service_p, NULL, name_s, LRS_SUBMISSION_DESCRIPTION_S, end - start);
+
+	if (record_p)
 		{
-			/*
-			 * We will have a single parameter specifying the number of jobs to run.
-			 */
-			Parameter *param_p = NULL;
-			LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+			memcpy (record_p -> tsj_job.sj_id, submission_p -> jsb_id, sizeof (uuid_t));
+			record_p -> tsj_added_flag = true;
+			record_p -> tsj_submission_num_jobs = submission_p -> jsb_num_jobs;
+			record_p -> tsj_submission_num_started = num_started;
+
+			if (num_started == submission_p -> jsb_num_jobs)
+				{
+					SetTimedServiceJobTimes (record_p, start, end);
+					SetServiceJobStatus (& (record_p -> tsj_job), OS_STARTED);
+				}
+			else if (num_started > 0)
+				{
+					/*
+					 * The jobs that were started still run to their end times
+					 * but the request as a whole can no longer succeed.
+					 */
+					SetTimedServiceJobTimes (record_p, start, end);
+					SetServiceJobStatus (& (record_p -> tsj_job), OS_PARTIALLY_SUCCEEDED);
+				}
+			else
+				{
+					/* Give the record some times so that anything polling it sees that it has ended */
+					const int64 now = GetJobClockTime ();
+
+					SetTimedServiceJobTimes (record_p, now, now);
+					SetServiceJobStatus (& (record_p -> tsj_job), OS_FAILED_TO_START);
+				}
+
+			if (AddServiceJobToJobsManager (jobs_manager_p, record_p -> tsj_job.sj_id, (ServiceJob *) record_p))
+				{
+					/*
+					 * The copy of the record that was returned for the request finds
+					 * its times here, see RefreshDeferredTimedServiceJob.
+					 */
+					AddTimedServiceJobToCache (service_p, record_p);
+
+					if (num_started < submission_p -> jsb_num_jobs)
+						{
+							RetainTimedServiceJob (shared_p, record_p -> tsj_job.sj_id, record_p -> tsj_interval.ti_start, record_p -> tsj_interval.ti_end, GetServiceJobStatus (& (record_p -> tsj_job)), true);
+						}
+
+					if (GetTimedServiceJobStatus ((ServiceJob *) record_p) == OS_STARTED)
+						{
+							if (!ScheduleTimedServiceJobCompletion (service_p, record_p -> tsj_job.sj_id, start, end, NULL, 0))
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to schedule completion of \"%s\", its status will only change when polled", name_s);
+								}
+						}
+				}
+			else
+				{
+					char job_id_s [UUID_STRING_BUFFER_SIZE];
+
+					ConvertUUIDToString (record_p -> tsj_job.sj_id, job_id_s);
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to store the times of submission \"%s\"", job_id_s);
+
+					IncrementLongRunningStatsCounter (GetProcessStats (), LRSC_JOBS_MANAGER_ADD_FAILURES, 1);
+				}
+
+			FreeTimedServiceJob ((ServiceJob *) record_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate the final record for a submission of " UINT32_FMT " jobs", submission_p -> jsb_num_jobs);
+		}
+}
+
+
+/*
+ * Check whether a job is the record of a request whose jobs the
+ * JobSubmissionQueue is still building and starting.
+ */
+static bool IsTimedServiceJobSubmissionQueued (Service *service_p, const uuid_t job_id)
+{
+	LongRunningSharedData *shared_p = ((LongRunningServiceData *) (service_p -> se_data_p)) -> lsd_shared_p;
+	uint32 num_jobs;
+	uint32 num_started;
+
+	return ((shared_p -> lss_submissions_flag) && GetJobSubmissionProgress (& (shared_p -> lss_submissions), job_id, &num_jobs, &num_started));
+}
+
+
+bool GetLongRunningServiceSubmissionStatus (Service *service_p, const uuid_t job_id, LongRunningSubmissionStatus *status_p)
+{
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+
+	memset (status_p, 0, sizeof (LongRunningSubmissionStatus));
+
+	return ((data_p -> lsd_configured_flag) && (data_p -> lsd_shared_p -> lss_submissions_flag) && GetJobSubmissionProgress (& (data_p -> lsd_shared_p -> lss_submissions), job_id, & (status_p -> lrss_num_jobs), & (status_p -> lrss_num_started)));
+}
+
+
+bool GetLongRunningServiceJobDeadlines (Service *service_p, time_t *earliest_p, time_t *latest_p)
+{
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+	bool outstanding_flag;
 
-			if ((param_p = EasyCreateAndAddUnsignedIntParameterToParameterSet (service_p -> se_data_p, param_set_p, NULL, LRS_NUMBER_OF_JOBS.npt_name_s, "Number of jobs", "Number of jobs to run",  & (data_p -> lsd_default_number_of_jobs), PL_ALL)) != NULL)
+	pthread_mutex_lock (& (data_p -> lsd_deadlines_lock));
+
+	/* This drops the deadlines that have already passed */
+	outstanding_flag = HasOutstandingDeadlines (& (data_p -> lsd_deadlines), GetJobClockSeconds (GetJobClockTime ()));
+
+	if (outstanding_flag)
+		{
+			if (earliest_p)
 				{
-					param_p -> pa_required_flag = true;
+					*earliest_p = GetEarliestDeadline (& (data_p -> lsd_deadlines));
+				}
 
-					if ((param_p = EasyCreateAndAddSignedIntParameterToParameterSet (service_p -> se_data_p, param_set_p, NULL, LRS_MIN_DURATION.npt_type, LRS_MIN_DURATION.npt_name_s, "Minimum time", "Minimum duration of each job",  NULL, PL_ALL)) != NULL)
-						{
-							return param_set_p;
-						}
+			if (latest_p)
+				{
+					*latest_p = GetLatestDeadline (& (data_p -> lsd_deadlines));
 				}
+		}
 
-			FreeParameterSet (param_set_p);
-		}		/* if (param_set_p) */
-		
-	return NULL;
+	pthread_mutex_unlock (& (data_p -> lsd_deadlines_lock));
+
+	return outstanding_flag;
 }
 
 
-static bool GetLongRunningServiceParameterTypesForNamedParameters (const Service *service_p, const char *param_name_s, ParameterType *pt_p)
+/*
+ * Store a single parent record holding the times of all of a request's
+ * jobs. Each job is given an id derived from its parent's, so this Service
+ * looks it up through the parent, and only a single deadline and completion
+ * are needed for the whole request. So that the Grassroots server can still
+ * find every job id that it was given, each job also gets an alias record
+ * under its own id, see AddTimedServiceJobGroupAliases. The parent stands
+ * for all of the jobs in reservation_p, so they are all counted until it
+ * has finished.
+ *
+ * Returns false, without having changed any of the jobs, if the parent
+ * record couldn't be built, in which case the caller should start the
+ * jobs individually.
+ */
+static bool StartGroupedTimedServiceJobs (Service *service_p, ServiceJobSet *jobs_p, const uint32 num_jobs, const int64 now, const int64 duration_unit, JobsManager *jobs_manager_p, JobAdmissionReservation *reservation_p)
 {
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+	JobGroup *group_p = (JobGroup *) AllocMemory (sizeof (JobGroup));
 	bool success_flag = false;
 
-	if (strcmp (param_name_s, LRS_NUMBER_OF_JOBS.npt_name_s) == 0)
-		{
-			*pt_p = LRS_NUMBER_OF_JOBS.npt_type;
-			success_flag = true;
-		}
-	else if (strcmp (param_name_s, LRS_MIN_DURATION.npt_name_s) == 0)
+	if (!group_p)
 		{
-			*pt_p = LRS_MIN_DURATION.npt_type;
-			success_flag = true;
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate JobGroup for " UINT32_FMT " jobs", num_jobs);
+			return false;
 		}
 
-	return success_flag;
-}
+	if (InitJobGroup (group_p, num_jobs, now, duration_unit))
+		{
+			ServiceJobSetIterator iterator;
+			TimedServiceJob *job_p = NULL;
+			uint32 i = 0;
 
-static void ReleaseLongRunningServiceParameters (Service * UNUSED_PARAM (service_p), ParameterSet *params_p)
-{
-	FreeParameterSet (params_p);
-}
+			InitServiceJobSetIterator (&iterator, jobs_p);
+			job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
 
+			/* Every duration is a whole number of units, see BuildTimedServiceJobs */
+			while (job_p && (i < num_jobs))
+				{
+					const int64 units = (job_p -> tsj_interval.ti_duration) / duration_unit;
 
-static json_t *GetLongRunningResultsAsJSON (Service *service_p, const uuid_t job_id)
-{
-	GrassrootsServer *grassroots_p = GetGrassrootsServerFromService (service_p);
-	JobsManager *jobs_mananger_p = GetJobsManager (grassroots_p);
-	TimedServiceJob *job_p = (TimedServiceJob *) GetServiceJobFromJobsManager (jobs_mananger_p, job_id);
-	json_t *results_array_p = NULL;
+					if ((units < 0) || (units > UINT32_MAX) || (units * duration_unit != job_p -> tsj_interval.ti_duration))
+						{
+							break;
+						}
 
+					group_p -> jg_durations_p [i] = (uint32) units;
 
-	if (job_p)
-		{
-			json_error_t error;
-			json_t *result_p = json_pack_ex (&error, 0, "{s:i,s:i}", "start", job_p -> tsj_interval_p -> ti_start, "end", job_p -> tsj_interval_p -> ti_end);
+					++ i;
+					job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+				}
 
-			if (result_p)
+			if ((i == num_jobs) && (!job_p))
 				{
-					json_t *resource_json_p = GetDataResourceAsJSONByParts (PROTOCOL_INLINE_S, NULL, "Long Runner", result_p);
+					char name_s [LRS_JOB_STRING_BUFFER_SIZE];
+					TimedServiceJob *parent_p = NULL;
 
-					if (resource_json_p)
+					snprintf (name_s, LRS_JOB_STRING_BUFFER_SIZE, "group of " UINT32_FMT " jobs", num_jobs);
+					parent_p = AllocateTimedServiceJob (service_p, NULL, name_s, "The times of all of the jobs for a request", GetJobGroupEnd (group_p) - now);
+
+					if (parent_p)
 						{
-							json_decref (result_p);
+							/* Only the start of the id decides its owner and MakeJobGroupId keeps that */
+							ClaimTimedServiceJobId (parent_p, service_p);
+							MakeJobGroupId (parent_p -> tsj_job.sj_id);
+							parent_p -> tsj_group_p = group_p;
+							group_p = NULL;
+
+							StartTimedServiceJob (parent_p, now);
+
+							/* Now that the parent has its id, its jobs can take theirs from it */
+							i = 0;
+							InitServiceJobSetIterator (&iterator, jobs_p);
+							job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
 
-							results_array_p = json_array ();
+							while (job_p)
+								{
+									GetJobGroupJobId (parent_p -> tsj_job.sj_id, i, job_p -> tsj_job.sj_id);
+									StartTimedServiceJob (job_p, now);
+
+									++ i;
+									job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+								}
 
-							if (results_array_p)
+							if (GetTimedServiceJobStatusAtTime ((ServiceJob *) parent_p, now) == OS_STARTED)
 								{
-									if (json_array_append_new (results_array_p, result_p) != 0)
+									if (!AddTimedServiceJobDeadline (data_p, parent_p -> tsj_interval.ti_end))
 										{
-											json_decref (result_p);
-											json_decref (results_array_p);
-											results_array_p = NULL;
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add deadline for \"%s\"", parent_p -> tsj_job.sj_name_s);
 										}
 								}
 
-						}
+							parent_p -> tsj_added_flag = true;
+
+							if (AddServiceJobToJobsManager (jobs_manager_p, parent_p -> tsj_job.sj_id, (ServiceJob *) parent_p))
+								{
+									/*
+									 * The aliases are removed with the parent, so they are all stored
+									 * before its completion can fire and remove it.
+									 */
+									const uint32 num_aliases = AddTimedServiceJobGroupAliases (jobs_manager_p, jobs_p);
+
+									if (num_aliases < num_jobs)
+										{
+											IncrementLongRunningStatsCounter (GetProcessStats (), LRSC_JOBS_MANAGER_ADD_FAILURES, num_jobs - num_aliases);
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Only " UINT32_FMT " of the " UINT32_FMT " jobs in \"%s\" could be stored, the server won't find the rest", num_aliases, num_jobs, parent_p -> tsj_job.sj_name_s);
+										}
+
+									if (GetServiceJobStatus (& (parent_p -> tsj_job)) == OS_STARTED)
+										{
+											if (!ScheduleTimedServiceJobCompletion (service_p, parent_p -> tsj_job.sj_id, parent_p -> tsj_interval.ti_start, parent_p -> tsj_interval.ti_end, reservation_p, num_jobs))
+												{
+													PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to schedule completion of \"%s\", its status will only change when polled", parent_p -> tsj_job.sj_name_s);
+												}
+										}
+
+									if (data_p -> lsd_shards_flag)
+										{
+											AddTimedServiceJobToCache (service_p, parent_p);
+										}
+								}
+							else
+								{
+									char job_id_s [UUID_STRING_BUFFER_SIZE];
+
+									ConvertUUIDToString (parent_p -> tsj_job.sj_id, job_id_s);
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add the group of " UINT32_FMT " jobs \"%s\" to JobsManager", num_jobs, job_id_s);
+
+									IncrementLongRunningStatsCounter (GetProcessStats (), LRSC_JOBS_MANAGER_ADD_FAILURES, num_jobs);
+								}
+
+							FreeTimedServiceJob ((ServiceJob *) parent_p);
+							success_flag = true;
+						}		/* if (parent_p) */
 				}
 
-		}		/* if (job_p) */
-	else
+			if (group_p)
+				{
+					ClearJobGroup (group_p);
+				}
+		}		/* if (InitJobGroup (group_p, num_jobs, now, duration_unit)) */
+
+	if (group_p)
 		{
-			char job_id_s [UUID_STRING_BUFFER_SIZE];
+			FreeMemory (group_p);
+		}
 
-			ConvertUUIDToString (job_id, job_id_s);
-			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get job data for \"%s\"", job_id_s);
+	return success_flag;
+}
+
+
+/*
+ * Store an alias record for each of the jobs in a group under the job's own
+ * id. This is the job with the times that it started with, so the server
+ * can load it and work out its status like any other job. Its id names its
+ * group, so it is never written back on its own and is removed along with
+ * the group's parent record, see RemoveFinishedTimedServiceJob. This stops
+ * at the first job that can't be stored, so that the aliases are always
+ * those of the first jobs in the group.
+ *
+ * Returns the number of aliases that were stored.
+ */
+static uint32 AddTimedServiceJobGroupAliases (JobsManager *jobs_manager_p, ServiceJobSet *jobs_p)
+{
+	ServiceJobSetIterator iterator;
+	TimedServiceJob *job_p = NULL;
+	uint32 num_added = 0;
+
+	InitServiceJobSetIterator (&iterator, jobs_p);
+	job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+
+	while (job_p)
+		{
+			job_p -> tsj_added_flag = true;
+
+			if (!AddServiceJobToJobsManager (jobs_manager_p, job_p -> tsj_job.sj_id, (ServiceJob *) job_p))
+				{
+					job_p -> tsj_added_flag = false;
+					break;
+				}
+
+			++ num_added;
+			job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
 		}
 
-	return results_array_p;
+	return num_added;
 }
 
 
 /*
- * This is where we create our TimedServiceJob structures prior to running the Service.
+ * Fetch the parent record of a group of jobs from the JobsManager. This is
+ * cached like any other job, so the group's status can be worked out from
+ * the cache once it has finished.
  */
-static ServiceJobSet *GetServiceJobSet (Service *service_p, const uint32 num_jobs, const int32 min_duration)
+static TimedServiceJob *GetTimedServiceJobGroup (Service *service_p, const uuid_t group_id)
 {
-	/*
-	 * If we were just runnig a single generic ServiceJob, we could use the
-	 * AllocateSimpleServiceJobSet() function. However we need multiple custom
-	 * ServiceJobs, so we need to build these.
-	 */
-	ServiceJobSet *jobs_p = AllocateServiceJobSet (service_p);
+	JobsManager *jobs_manager_p = GetJobsManager (GetGrassrootsServerFromService (service_p));
+	TimedServiceJob *parent_p = (TimedServiceJob *) GetServiceJobFromJobsManager (jobs_manager_p, group_id);
 
-	if (jobs_p)
+	if (parent_p)
 		{
-			uint32 i = 0;
-			bool loop_flag = (i < num_jobs);
-			bool success_flag = true;
+			AddTimedServiceJobToCache (service_p, parent_p);
 
-			while (loop_flag && success_flag)
+			if (parent_p -> tsj_group_p)
 				{
-					TimedServiceJob *job_p = NULL;
-					char job_name_s [256];
-					char job_description_s [256];
+					return parent_p;
+				}
+			else
+				{
+					char job_id_s [UUID_STRING_BUFFER_SIZE];
 
-					/*
-					 * Get a duration for our task that is between 1 and 60 seconds.
-					 */
-					const int duration = min_duration + (rand () % 60);
+					ConvertUUIDToString (group_id, job_id_s);
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "\"%s\" is not the record of a group of jobs", job_id_s);
+				}
 
-					sprintf (job_name_s, "job " INT32_FMT, i);
-					sprintf (job_description_s, "duration " SIZET_FMT, (size_t) duration);
+			FreeServiceJob ((ServiceJob *) parent_p);
+		}
 
-					job_p = AllocateTimedServiceJob (service_p, job_name_s, job_description_s, duration);
+	return NULL;
+}
 
-					if (job_p)
-						{
-							if (AddServiceJobToService (service_p, (ServiceJob *) job_p))
-								{
-									++ i;
-									loop_flag = (i < num_jobs);
-								}		/* if (AddServiceJobToService (service_p, (ServiceJob *) job_p)) */
-							else
-								{
-									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add TimedServiceJob to ServiceJobSet");
-									FreeTimedServiceJob ((ServiceJob *) job_p);
-									success_flag = false;
-								}
 
-						}		/* if (job_p) */
-					else
-						{
-							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate TimedServiceJob");
-							success_flag = false;
-						}
+/*
+ * Get the status at the given time of one of the jobs in a group. Once the
+ * whole group has finished, so has the job, which can be seen from the
+ * cached parent. Otherwise the job's own times are read from the group.
+ */
+static bool GetGroupedTimedServiceJobStatus (Service *service_p, const uuid_t group_id, const uint32 index, const int64 now, OperationStatus *status_p)
+{
+	JobCacheEntry entry;
+	int64 start;
+	int64 end;
 
-				}		/* while (loop_flag && success_flag) */
+	if (GetCachedTimedServiceJob (service_p, group_id, now, &entry) && (entry.jce_status != OS_STARTED))
+		{
+			*status_p = entry.jce_status;
+			return true;
+		}
 
-			if (!success_flag)
+	if (GetGroupedTimedServiceJobTimes (service_p, group_id, index, &start, &end))
+		{
+			*status_p = GetTimeIntervalStatus (start, end, now);
+			return true;
+		}
+
+	return false;
+}
+
+
+/*
+ * Get the times of one of the jobs in a group. The group is taken from
+ * lss_group_cache if it is there. Otherwise its parent record is read
+ * from the JobsManager and its group is moved into lss_group_cache, so
+ * the other jobs in the group don't need to read it again.
+ */
+static bool GetGroupedTimedServiceJobTimes (Service *service_p, const uuid_t group_id, const uint32 index, int64 *start_p, int64 *end_p)
+{
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+	TimedServiceJob *parent_p = NULL;
+	bool success_flag = false;
+
+	if ((data_p -> lsd_shared_p -> lss_group_cache_flag) && GetCachedJobGroupJobTimes (& (data_p -> lsd_shared_p -> lss_group_cache), group_id, index, start_p, end_p))
+		{
+			return true;
+		}
+
+	parent_p = GetTimedServiceJobGroup (service_p, group_id);
+
+	if (parent_p)
+		{
+			if (index < parent_p -> tsj_group_p -> jg_num_jobs)
 				{
-					FreeServiceJobSet (jobs_p);
-					jobs_p = NULL;
+					GetJobGroupJobTimes (parent_p -> tsj_group_p, index, start_p, end_p);
+					success_flag = true;
 				}
 
-		}		/* if (jobs_p) */
+			if (data_p -> lsd_shared_p -> lss_group_cache_flag)
+				{
+					AddJobGroupToCache (& (data_p -> lsd_shared_p -> lss_group_cache), group_id, parent_p -> tsj_group_p);
+					parent_p -> tsj_group_p = NULL;
+				}
 
-	return jobs_p;
+			FreeServiceJob ((ServiceJob *) parent_p);
+		}
+
+	return success_flag;
 }
 
 
-static ServiceJobSet *RunLongRunningService (Service *service_p, ParameterSet *param_set_p, User * UNUSED_PARAM (user_p), ProvidersStateTable * UNUSED_PARAM (providers_p))
+/*
+ * Get the summary of the statuses of all of the jobs in a group from a
+ * single read of its parent record.
+ */
+bool GetLongRunningServiceGroupStatus (Service *service_p, const uuid_t job_id, LongRunningGroupStatus *status_p)
 {
-	const uint32 *num_tasks_p = NULL;
+	const uint64 start_ns = GetLongRunningStatsTime ();
+	TimedServiceJob *parent_p = NULL;
+	uuid_t group_id;
+	uint32 index;
+	bool success_flag = false;
 
-	if (GetCurrentUnsignedIntParameterValueFromParameterSet (param_set_p, LRS_NUMBER_OF_JOBS.npt_name_s, &num_tasks_p))
+	memset (status_p, 0, sizeof (LongRunningGroupStatus));
+
+	if (IsJobGroupId (job_id))
 		{
-			if (num_tasks_p != NULL)
+			memcpy (group_id, job_id, sizeof (uuid_t));
+			parent_p = GetTimedServiceJobGroup (service_p, group_id);
+		}
+	else if (GetJobGroupIdFromJobId (job_id, group_id, &index))
+		{
+			parent_p = GetTimedServiceJobGroup (service_p, group_id);
+		}
+
+	if (parent_p)
+		{
+			const JobGroup *group_p = parent_p -> tsj_group_p;
+			const int64 now = GetJobClockTime ();
+			uint32 i;
+
+			for (i = 0; i < group_p -> jg_num_jobs; ++ i)
 				{
-					if (*num_tasks_p > 0)
+					int64 start;
+					int64 end;
+
+					GetJobGroupJobTimes (group_p, i, &start, &end);
+
+					switch (GetTimeIntervalStatus (start, end, now))
 						{
-							const int32 *min_duration_p = NULL;
+							case OS_STARTED:
+								++ (status_p -> lrgs_num_running);
+								break;
 
-							GetCurrentSignedIntParameterValueFromParameterSet (param_set_p, LRS_MIN_DURATION.npt_name_s, &min_duration_p);
+							case OS_SUCCEEDED:
+								++ (status_p -> lrgs_num_succeeded);
+								break;
 
-							service_p -> se_jobs_p = GetServiceJobSet (service_p, *num_tasks_p, min_duration_p ? *min_duration_p : 1);
+							default:
+								++ (status_p -> lrgs_num_other);
+								break;
+						}
+				}
 
-							if (service_p -> se_jobs_p)
-								{
-									ServiceJobSetIterator iterator;
-									GrassrootsServer *grassroots_p = GetGrassrootsServerFromService (service_p);
-									JobsManager *jobs_manager_p = GetJobsManager (grassroots_p);
-									TimedServiceJob *job_p = NULL;
-									int32 i = 0;
-									bool loop_flag;
+			status_p -> lrgs_num_jobs = group_p -> jg_num_jobs;
+			status_p -> lrgs_time = now;
 
-									InitServiceJobSetIterator (&iterator, service_p -> se_jobs_p);
-									job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+			FreeServiceJob ((ServiceJob *) parent_p);
+			success_flag = true;
+		}		/* if (parent_p) */
+	else
+		{
+			char job_id_s [UUID_STRING_BUFFER_SIZE];
 
-									loop_flag = (job_p != NULL);
+			ConvertUUIDToString (job_id, job_id_s);
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get the group for \"%s\"", job_id_s);
+		}
 
-									while (loop_flag)
-										{
-											StartTimedServiceJob (job_p);
+	AddLongRunningStatsLatency (GetProcessStats (), LRSO_STATUS, start_ns);
 
-											SetServiceJobStatus (& (job_p -> tsj_job), GetTimedServiceJobStatus ((ServiceJob *) job_p));
+	return success_flag;
+}
 
-											job_p -> tsj_added_flag = true;
 
+/*
+ * This is called by the JobAdmission's thread once there is room for a
+ * request that had to wait. Each job is fetched from the JobsManager, given
+ * its start and end times from now and stored again before it is given to
+ * the JobWorkers or the CompletionScheduler, just as RunLongRunningService
+ * would have done. The job is also cached so that this process's status
+ * requests see that it has started without going to the JobsManager. Each
+ * job is counted in reservation_p until it has finished and the request
+ * stops holding up the Service's closure once they have all been started.
+ */
+static void StartDeferredTimedServiceJobs (const JobAdmissionItem *items_p, const uint32 num_items, const JobKind kind, JobAdmissionReservation *reservation_p, void *data_p)
+{
+	Service *service_p = (Service *) data_p;
+	LongRunningServiceData *service_data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+	JobsManager *jobs_manager_p = GetJobsManager (GetGrassrootsServerFromService (service_p));
+	const int64 now = GetJobClockTime ();
+	uint32 num_failures = 0;
+	uint32 i;
 
-											if (!AddServiceJobToJobsManager (jobs_manager_p, job_p -> tsj_job.sj_id, (ServiceJob *) job_p))
-												{
-													char job_id_s [UUID_STRING_BUFFER_SIZE];
+	/*
+	 * A request whose jobs haven't been built yet waits as a single item
+	 * with the id of its record, see SubmitTimedServiceJobs, and the
+	 * JobSubmissionQueue builds and starts its jobs once it is released.
+	 */
+	if ((num_items == 1) && (service_data_p -> lsd_shared_p -> lss_submissions_flag) && ReleaseJobSubmission (& (service_data_p -> lsd_shared_p -> lss_submissions), items_p -> jai_id, true, reservation_p))
+		{
+			__atomic_sub_fetch (& (service_data_p -> lsd_num_deferred_requests), 1, __ATOMIC_ACQ_REL);
+			return;
+		}
 
-													ConvertUUIDToString (job_p -> tsj_job.sj_id, job_id_s);
-													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add job \"%s\" to JobsManager", job_id_s);
+	for (i = 0; i < num_items; ++ i)
+		{
+			const JobAdmissionItem *item_p = items_p + i;
+			TimedServiceJob *job_p = (TimedServiceJob *) GetServiceJobFromJobsManager (jobs_manager_p, item_p -> jai_id);
 
-													job_p -> tsj_added_flag = false;
-												}
+			if (job_p)
+				{
+					if ((job_p -> tsj_interval.ti_start == 0) && (GetServiceJobStatus (& (job_p -> tsj_job)) == OS_PENDING))
+						{
+							/* The stored copy can't record the duration without any times */
+							job_p -> tsj_interval.ti_duration = item_p -> jai_duration;
+							StartTimedServiceJob (job_p, now);
+							job_p -> tsj_added_flag = true;
 
-											job_p = (TimedServiceJob *) GetNextServiceJobFromServiceJobSetIterator (&iterator);
+							if (AddServiceJobToJobsManager (jobs_manager_p, job_p -> tsj_job.sj_id, (ServiceJob *) job_p))
+								{
+									AddTimedServiceJobToCache (service_p, job_p);
 
-											if (job_p)
+									if (kind == JK_SLEEP)
+										{
+											if (!ScheduleTimedServiceJobCompletion (service_p, job_p -> tsj_job.sj_id, job_p -> tsj_interval.ti_start, job_p -> tsj_interval.ti_end, reservation_p, 1))
 												{
-													++ i;
+													char name_s [LRS_JOB_STRING_BUFFER_SIZE];
+
+													PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to schedule completion of \"%s\", its status will only change when polled", GetTimedServiceJobName (job_p, name_s));
 												}
-											else
+										}
+									else if (!QueueTimedServiceJobWorkItem (service_p, job_p -> tsj_job.sj_id, kind, job_p -> tsj_interval.ti_duration, reservation_p))
+										{
+											SetServiceJobStatus (& (job_p -> tsj_job), OS_FAILED_TO_START);
+
+											if (!AddServiceJobToJobsManager (jobs_manager_p, job_p -> tsj_job.sj_id, (ServiceJob *) job_p))
 												{
-													loop_flag = false;
-												}
+													char name_s [LRS_JOB_STRING_BUFFER_SIZE];
 
-										}		/* while (loop_flag) */
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to store that \"%s\" failed to start", GetTimedServiceJobName (job_p, name_s));
+												}
 
-								}		/* if (service_p -> se_jobs_p) */
+											AddTimedServiceJobToCache (service_p, job_p);
+											RetainTimedServiceJob (service_data_p -> lsd_shared_p, job_p -> tsj_job.sj_id, job_p -> tsj_interval.ti_start, job_p -> tsj_interval.ti_end, OS_FAILED_TO_START, true);
+											++ num_failures;
+										}
+								}
+							else
+								{
+									char name_s [LRS_JOB_STRING_BUFFER_SIZE];
 
+									IncrementLongRunningStatsCounter (GetProcessStats (), LRSC_JOBS_MANAGER_ADD_FAILURES, 1);
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to store that \"%s\" has started", GetTimedServiceJobName (job_p, name_s));
+								}
 						}
-				}
 
+					FreeServiceJob ((ServiceJob *) job_p);
+				}
+			else
+				{
+					char job_id_s [UUID_STRING_BUFFER_SIZE];
 
-		}		/* if (GetParameterValueFromParameterSet (param_set_p, TAG_LONG_RUNNING_NUM_JOBS, &param_value, true)) */
-
+					ConvertUUIDToString (item_p -> jai_id, job_id_s);
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get deferred job \"%s\" to start it", job_id_s);
+				}
+		}
 
-	return service_p -> se_jobs_p;
-}
+	if (num_failures > 0)
+		{
+			IncrementLongRunningStatsCounter (GetProcessStats (), LRSC_JOBS_FAILED_TO_START, num_failures);
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Only " UINT32_FMT " of " UINT32_FMT " deferred jobs could be given to the workers, the rest failed to start", num_items - num_failures, num_items);
+		}
 
+	FinishTimedServiceJobReservation (service_p, reservation_p);
 
-static ParameterSet *IsFileForLongRunningService (Service * UNUSED_PARAM (service_p), DataResource * UNUSED_PARAM (resource_p), Handler * UNUSED_PARAM (handler_p))
-{
-	return NULL;
+	/* This must be last since the Service can be freed as soon as it is done */
+	__atomic_sub_fetch (& (service_data_p -> lsd_num_deferred_requests), 1, __ATOMIC_ACQ_REL);
 }
 
 
-static OperationStatus GetLongRunningServiceStatus (Service *service_p, const uuid_t job_id)
+/*
+ * A job in this Service's ServiceJobSet that had to wait for the JobAdmission,
+ * or the record of a request that was submitted in the background, doesn't
+ * know when it was started, so get its times from the JobCache, where
+ * StartDeferredTimedServiceJobs and FinishTimedServiceJobSubmission put them,
+ * or if it has since been dropped from there, from its tombstone or the
+ * JobsManager. A job that was itself loaded from the JobsManager is never
+ * read from there again.
+ */
+static void RefreshDeferredTimedServiceJob (TimedServiceJob *job_p)
 {
-	OperationStatus status = OS_ERROR;
-	GrassrootsServer *grassroots_p = GetGrassrootsServerFromService (service_p);
-	JobsManager *jobs_manager_p = GetJobsManager (grassroots_p);
-	ServiceJob *job_p = GetServiceJobFromJobsManager (jobs_manager_p, job_id);
+	Service *service_p = job_p -> tsj_job.sj_service_p;
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+	JobCacheEntry entry;
+	JobTombstone tombstone;
+	bool found_flag = false;
+	bool counted_flag = job_p -> tsj_loaded_flag;
 
-	if (job_p)
+	if (FindJobInCache (& (data_p -> lsd_shared_p -> lss_job_cache), job_p -> tsj_job.sj_id, &entry))
 		{
-			status = GetTimedServiceJobStatus (job_p);
-		}		/* if (job_p) */
-	else
+			found_flag = true;
+		}
+	else if (FindTimedServiceJobTombstone (service_p, job_p -> tsj_job.sj_id, &tombstone))
+		{
+			entry.jce_start = tombstone.jt_start;
+			entry.jce_end = tombstone.jt_end;
+			entry.jce_status = tombstone.jt_status;
+			found_flag = true;
+		}
+	else if (IsTimedServiceJobSubmissionQueued (service_p, job_p -> tsj_job.sj_id))
+		{
+			/* The record of a request whose jobs are still being started has no times yet */
+		}
+	else if (job_p -> tsj_loaded_flag)
+		{
+			/* The job has just been read from the JobsManager, which doesn't have its times yet */
+		}
+	else if (! ((data_p -> lsd_shared_p -> lss_admission_flag) && IsJobDeferred (& (data_p -> lsd_shared_p -> lss_admission), job_p -> tsj_job.sj_id)))
 		{
-			char job_id_s [UUID_STRING_BUFFER_SIZE];
+			JobsManager *jobs_manager_p = GetJobsManager (GetGrassrootsServerFromService (service_p));
+			TimedServiceJob *stored_job_p = (TimedServiceJob *) GetServiceJobFromJobsManager (jobs_manager_p, job_p -> tsj_job.sj_id);
 
-			ConvertUUIDToString (job_id, job_id_s);
-			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get job data for \"%s\"", job_id_s);
+			if (stored_job_p)
+				{
+					entry.jce_start = stored_job_p -> tsj_interval.ti_start;
+					entry.jce_end = stored_job_p -> tsj_interval.ti_end;
+					entry.jce_status = GetServiceJobStatus (& (stored_job_p -> tsj_job));
+					job_p -> tsj_submission_num_started = stored_job_p -> tsj_submission_num_started;
+					found_flag = (entry.jce_start != 0);
+					counted_flag = true;
+
+					FreeServiceJob ((ServiceJob *) stored_job_p);
+				}
 		}
 
-	return status;
+	if (found_flag)
+		{
+			SetTimedServiceJobTimes (job_p, entry.jce_start, entry.jce_end);
+
+			/*
+			 * If only some of a submission's jobs were started, then only its
+			 * stored record knows how many.
+			 */
+			if ((!counted_flag) && (job_p -> tsj_submission_num_jobs > 0))
+				{
+					if (entry.jce_status == OS_PARTIALLY_SUCCEEDED)
+						{
+							JobsManager *jobs_manager_p = GetJobsManager (GetGrassrootsServerFromService (service_p));
+							TimedServiceJob *stored_job_p = (TimedServiceJob *) GetServiceJobFromJobsManager (jobs_manager_p, job_p -> tsj_job.sj_id);
+
+							if (stored_job_p)
+								{
+									job_p -> tsj_submission_num_started = stored_job_p -> tsj_submission_num_started;
+									FreeServiceJob ((ServiceJob *) stored_job_p);
+								}
+						}
+					else if (entry.jce_status != OS_FAILED_TO_START)
+						{
+							job_p -> tsj_submission_num_started = job_p -> tsj_submission_num_jobs;
+						}
+				}
+
+			if (IsFixedTimedServiceJobStatus (entry.jce_status))
+				{
+					SetServiceJobStatus (& (job_p -> tsj_job), entry.jce_status);
+				}
+			else
+				{
+					/*
+					 * Once the workers no longer have a job that generates a load,
+					 * it has finished, just as for the jobs that they were given
+					 * straight away.
+					 */
+					job_p -> tsj_worked_flag = ((job_p -> tsj_kind != JK_SLEEP) && (data_p -> lsd_shared_p -> lss_workers_flag));
+					SetServiceJobStatus (& (job_p -> tsj_job), OS_STARTED);
+				}
+		}
 }
 
 
-static void StartTimedServiceJob (TimedServiceJob *job_p)
+/*
+ * This is called by the shared JobWorkers' thread that ran a job once its
+ * work has finished. The job stops counting against its Service only after
+ * it has been completed, since the Service may be freed as soon as it does.
+ */
+static void CompleteWorkedTimedServiceJob (const uuid_t job_id, const int64 start, const int64 end, void *data_p)
 {
-	TimeInterval *ti_p = job_p -> tsj_interval_p;
+	Service *service_p = (Service *) data_p;
+	LongRunningServiceData *service_data_p = (LongRunningServiceData *) (service_p -> se_data_p);
 
-	time (& (ti_p -> ti_start));
-	ti_p -> ti_end = (ti_p -> ti_start) + (ti_p -> ti_duration);
+	CompleteTimedServiceJob (job_id, start, end, service_data_p -> lsd_shared_p);
 
-	SetServiceJobStatus (& (job_p -> tsj_job), OS_STARTED);
+	__atomic_sub_fetch (& (service_data_p -> lsd_num_worker_jobs), 1, __ATOMIC_ACQ_REL);
 }
 
 
-
-static OperationStatus GetTimedServiceJobStatus (ServiceJob *job_p)
+/*
+ * This is called by the shared CompletionScheduler's thread, or for the jobs
+ * that generate a load by the JobWorkers thread that ran it, when a job has
+ * finished. The job is moved out of OS_STARTED once, in the same way as it
+ * would be when next polled, and the cache is updated so that the pollers see
+ * its final status without having to go to the JobsManager.
+ *
+ * The data is the LongRunningSharedData rather than the Service that started
+ * the job, since that Service may have been closed by the time its job ends.
+ */
+static void CompleteTimedServiceJob (const uuid_t job_id, const int64 start, const int64 end, void *data_p)
 {
-	TimedServiceJob *timed_job_p = (TimedServiceJob *) job_p;
-	OperationStatus status = OS_IDLE;
-	TimeInterval * const ti_p = timed_job_p -> tsj_interval_p;
+	LongRunningSharedData *shared_p = (LongRunningSharedData *) data_p;
+	JobCache *cache_p = & (shared_p -> lss_job_cache);
+	LongRunningJobCompletionCallback completion_fn;
+	void *completion_data_p;
+	JobCacheEntry entry;
+	bool update_flag = true;
 
-	if (ti_p -> ti_start != ti_p -> ti_end)
+	/*
+	 * If the job has been cached, then a status request may have already
+	 * seen that it has finished and updated the JobsManager.
+	 */
+	if (FindJobInCache (cache_p, job_id, &entry))
 		{
-			time_t t = time (NULL);
-
-			if (t >= ti_p -> ti_start)
+			/*
+			 * The jobs from our workers might have been cached while they
+			 * were still waiting for a worker.
+			 */
+			if ((entry.jce_status == OS_STARTED) || (entry.jce_status == OS_PENDING))
 				{
-					if (t <= ti_p -> ti_end)
-						{
-							status = OS_STARTED;
-						}
-					else
-						{
-							status = OS_SUCCEEDED;
-						}
+					update_flag = ChangeJobCacheStatus (cache_p, job_id, entry.jce_status, OS_SUCCEEDED);
 				}
 			else
 				{
-					status = OS_ERROR;
+					update_flag = false;
 				}
 		}
+	else
+		{
+			AddJobToCache (cache_p, job_id, start, end, OS_SUCCEEDED);
+		}
 
-	SetServiceJobStatus (job_p, status);
+	if (update_flag)
+		{
+			WriteBackFinishedTimedServiceJob (shared_p, job_id);
+		}
 
-	return status;
-}
+	/*
+	 * The job's record with its final status is left in the JobsManager until
+	 * its tombstone is evicted or, if none are kept, was removed by the write back.
+	 */
+	RetainTimedServiceJob (shared_p, job_id, start, end, OS_SUCCEEDED, true);
 
+	if (shared_p -> lss_journal_p)
+		{
+			JournalJobFinished (shared_p -> lss_journal_p, job_id);
+		}
 
+	IncrementLongRunningStatsCounter (GetProcessStats (), LRSC_JOBS_COMPLETED, 1);
 
-static bool UpdateTimedServiceJob (struct ServiceJob *job_p)
-{
-	return true;
+	/* Make room for the requests that are waiting to start */
+	ReleaseTimedServiceJobAdmission (shared_p, job_id);
+
+	/* The callback is called without the lock so that the finishing jobs don't wait on each other */
+	pthread_mutex_lock (& (shared_p -> lss_completion_lock));
+	completion_fn = shared_p -> lss_completion_fn;
+	completion_data_p = shared_p -> lss_completion_data_p;
+	pthread_mutex_unlock (& (shared_p -> lss_completion_lock));
+
+	if (completion_fn)
+		{
+			completion_fn (job_id, OS_SUCCEEDED, completion_data_p);
+		}
 }
 
 
-static TimedServiceJob *AllocateTimedServiceJob (Service *service_p, const char * const job_name_s, const char * const job_description_s, const time_t duration)
+/*
+ * Add a timer for a job so that CompleteTimedServiceJob is called when it
+ * finishes, recording in the journal, if there is one, that it has started
+ * so the timer can be added again after a restart. The job stands for
+ * num_jobs of the jobs in reservation_p, which are counted until it
+ * finishes, so it is added to the reservation before its timer can fire.
+ */
+static bool ScheduleTimedServiceJobCompletion (Service *service_p, const uuid_t job_id, const int64 start, const int64 end, JobAdmissionReservation *reservation_p, const uint32 num_jobs)
 {
-	TimedServiceJob *job_p = NULL;
-	TimeInterval *interval_p = (TimeInterval *) AllocMemory (sizeof (TimeInterval));
+	LongRunningSharedData *shared_p = ((LongRunningServiceData *) (service_p -> se_data_p)) -> lsd_shared_p;
 
-	if (interval_p)
+	if (shared_p -> lss_journal_p)
 		{
-			job_p = (TimedServiceJob *) AllocMemory (sizeof (TimedServiceJob));
-
-			if (job_p)
+			if (!JournalJobStarted (shared_p -> lss_journal_p, job_id, start, end))
 				{
-					interval_p -> ti_start = 0;
-					interval_p -> ti_end = 0;
-					interval_p -> ti_duration = duration;
-
-					job_p -> tsj_interval_p = interval_p;
-					job_p -> tsj_added_flag = false;
-
-					InitServiceJob (& (job_p -> tsj_job), service_p, job_name_s, job_description_s, UpdateTimedServiceJob, NULL, FreeTimedServiceJob, NULL, LRS_SERVICE_JOB_TYPE_S);
+					char job_id_s [UUID_STRING_BUFFER_SIZE];
 
-				}		/* if (job_p) */
-			else
-				{
-					FreeMemory (interval_p);
-					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate TimedServiceJob");
+					ConvertUUIDToString (job_id, job_id_s);
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to journal the start of \"%s\", it won't be recovered after a restart", job_id_s);
 				}
+		}
 
-		}		/* if (interval_p) */
-	else
+	AddTimedServiceJobToReservation (service_p, reservation_p, job_id, num_jobs);
+
+	if (ScheduleJobCompletion (& (shared_p -> lss_completions), job_id, start, end))
 		{
-			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate TimeInterval");
+			return true;
 		}
 
-	return job_p;
+	ReleaseTimedServiceJobAdmission (shared_p, job_id);
+
+	return false;
 }
 
 
-static void FreeTimedServiceJob (ServiceJob *job_p)
+/*
+ * Count a job that has been started against the reservation that its
+ * request was admitted in until ReleaseTimedServiceJobAdmission is called
+ * for it. The jobs that are never added, such as those that failed to start,
+ * stop being counted once the reservation is finished.
+ */
+static void AddTimedServiceJobToReservation (Service *service_p, JobAdmissionReservation *reservation_p, const uuid_t job_id, const uint32 num_jobs)
 {
-	TimedServiceJob *timed_job_p = (TimedServiceJob *) job_p;
+	LongRunningSharedData *shared_p = ((LongRunningServiceData *) (service_p -> se_data_p)) -> lsd_shared_p;
 
-	if (timed_job_p -> tsj_interval_p)
+	if (shared_p -> lss_admission_flag)
 		{
-			FreeMemory (timed_job_p -> tsj_interval_p);
+			AddJobToReservation (& (shared_p -> lss_admission), reservation_p, job_id, num_jobs);
 		}
-
-	FreeBaseServiceJob (job_p);
 }
 
 
-
-static json_t *GetTimedServiceJobAsJSON (TimedServiceJob *job_p)
+/*
+ * Stop counting a job that has finished, or could not be started after all,
+ * so that any requests that are waiting for room can be started.
+ */
+static void ReleaseTimedServiceJobAdmission (LongRunningSharedData *shared_p, const uuid_t job_id)
 {
-	/*
-	 * Get the JSON for the ServiceJob base class.
-	 */
-	json_t *json_p = GetServiceJobAsJSON (& (job_p -> tsj_job), false);
-
-	if (json_p)
+	if (shared_p -> lss_admission_flag)
 		{
-			/*
-			 * Now we add our extra data which is the start and end time of the TimeInterval
-			 * for the given TimedServiceJob.
-			 */
-			if (json_object_set_new (json_p, LRS_START_S, json_integer (job_p -> tsj_interval_p -> ti_start)) == 0)
-				{
-					if (json_object_set_new (json_p, LRS_END_S, json_integer (job_p -> tsj_interval_p -> ti_end)) == 0)
-						{
-							return json_p;
-						}		/* if (json_object_set_new (json_p, LRS_END_S, json_integer (job_p -> tsj_interval_p -> ti_end)) == 0) */
-					else
-						{
-							PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, json_p, "Failed to add %s " SIZET_FMT " to json", LRS_END_S, job_p -> tsj_interval_p -> ti_end);
-						}
+			ReleaseAdmittedJob (& (shared_p -> lss_admission), job_id);
+		}
+}
 
-				}		/* if (json_object_set_new (json_p, LRS_START_S, json_integer (job_p -> tsj_interval_p -> ti_start)) == 0) */
-			else
-				{
-					PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, json_p, "Failed to add %s " SIZET_FMT " to json", LRS_END_S, job_p -> tsj_interval_p -> ti_end);
-				}
 
-			json_decref (json_p);
-		}		/* if (json_p) */
-	else
+/*
+ * Once all of a request's jobs have been started, stop counting those that
+ * weren't added to its reservation.
+ */
+static void FinishTimedServiceJobReservation (Service *service_p, JobAdmissionReservation *reservation_p)
+{
+	LongRunningSharedData *shared_p = ((LongRunningServiceData *) (service_p -> se_data_p)) -> lsd_shared_p;
+
+	if (shared_p -> lss_admission_flag)
 		{
-			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create JSON for TimedServiceJob");
+			FinishJobReservation (& (shared_p -> lss_admission), reservation_p);
 		}
-
-	return NULL;
 }
 
 
+/*
+ * Give a request to the shared JobAdmission to start once there is room
+ * for it. The request holds up the Service's closure until it has been
+ * started, since the JobAdmission calls back into the Service to do so.
+ */
+static bool DeferTimedServiceJobRequest (Service *service_p, const char *user_s, const JobAdmissionItem *items_p, const uint32 num_items, const uint32 num_jobs, const JobKind kind)
+{
+	LongRunningServiceData *data_p = (LongRunningServiceData *) (service_p -> se_data_p);
+
+	__atomic_add_fetch (& (data_p -> lsd_num_deferred_requests), 1, __ATOMIC_ACQ_REL);
+
+	if (DeferJobs (& (data_p -> lsd_shared_p -> lss_admission), user_s, items_p, num_items, num_jobs, kind, service_p))
+		{
+			return true;
+		}
+
+	__atomic_sub_fetch (& (data_p -> lsd_num_deferred_requests), 1, __ATOMIC_ACQ_REL);
 
+	return false;
+}
 
 
-static unsigned char *SerialiseTimedServiceJob (ServiceJob *base_job_p, unsigned int *value_length_p)
+/*
+ * Make room in the Service's DeadlineHeap for the deadlines of the given
+ * number of jobs, so that they can be added without it growing each time.
+ */
+static void ReserveTimedServiceJobDeadlines (LongRunningServiceData *data_p, const uint32 num_jobs)
 {
-	TimedServiceJob *job_p = (TimedServiceJob *) base_job_p;
-	unsigned char *value_p = NULL;
-	json_t *job_json_p = GetTimedServiceJobAsJSON (job_p);
+	pthread_mutex_lock (& (data_p -> lsd_deadlines_lock));
 
-	if (job_json_p)
+	if (!ReserveDeadlineHeap (& (data_p -> lsd_deadlines), num_jobs))
 		{
-			char *job_s = json_dumps (job_json_p, JSON_INDENT (2));
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to reserve " UINT32_FMT " deadlines", num_jobs);
+		}
 
-			if (job_s)
-				{
-					/*
-					 * include the terminating \0 to make sure
-					 * the value as a valid c-style string
-					 */
-					*value_length_p = strlen (job_s) + 1;
-					value_p = (unsigned char *) job_s;
-				}		/* if (job_s) */
-			else
-				{
-					char uuid_s [UUID_STRING_BUFFER_SIZE];
+	pthread_mutex_unlock (& (data_p -> lsd_deadlines_lock));
+}
 
-					ConvertUUIDToString (job_p -> tsj_job.sj_id, uuid_s);
-					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "json_dumps failed for \"%s\"", uuid_s);
-				}
 
-			json_decref (job_json_p);
-		}		/* if (job_json_p) */
-	else
-		{
-			char uuid_s [UUID_STRING_BUFFER_SIZE];
+/*
+ * Add the deadline of a job that finishes at the given job clock time
+ * to the Service's DeadlineHeap.
+ */
+static bool AddTimedServiceJobDeadline (LongRunningServiceData *data_p, const int64 end)
+{
+	bool success_flag;
 
-			ConvertUUIDToString (job_p -> tsj_job.sj_id, uuid_s);
-			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "GetTimedServiceJobAsJSON failed for \"%s\"", uuid_s);
-		}
+	pthread_mutex_lock (& (data_p -> lsd_deadlines_lock));
+	success_flag = AddToDeadlineHeap (& (data_p -> lsd_deadlines), GetJobClockSeconds (end));
+	pthread_mutex_unlock (& (data_p -> lsd_deadlines_lock));
 
-	return value_p;
+	return success_flag;
 }
 
 
-static TimedServiceJob *GetTimedServiceJobFromJSON (Service *service_p, const json_t *json_p)
+/*
+ * Check whether any of the jobs with deadlines are still running.
+ */
+static bool HasOutstandingTimedServiceJobDeadlines (LongRunningServiceData *data_p)
 {
-	/* allocate the memory for the TimedServiceJob */
-	TimedServiceJob *job_p = (TimedServiceJob *) AllocMemory (sizeof (TimedServiceJob));
+	bool outstanding_flag;
 
-	if (job_p)
-		{
-			/* allocate the memory for the TimeInterval */
-			job_p -> tsj_interval_p = (TimeInterval *) AllocMemory (sizeof (TimeInterval));
-
-			if (job_p -> tsj_interval_p)
-				{
-					GrassrootsServer *grassroots_p = GetGrassrootsServerFromService (service_p);
+	pthread_mutex_lock (& (data_p -> lsd_deadlines_lock));
+	outstanding_flag = HasOutstandingDeadlines (& (data_p -> lsd_deadlines), GetJobClockSeconds (GetJobClockTime ()));
+	pthread_mutex_unlock (& (data_p -> lsd_deadlines_lock));
 
-					job_p -> tsj_job.sj_service_p = service_p;
+	return outstanding_flag;
+}
 
-					/* initialise the base ServiceJob from the JSON fragment */
-					if (InitServiceJobFromJSON (& (job_p -> tsj_job), json_p, service_p, grassroots_p))
-						{
-							/*
-							 * We now need to get the start and end times for the TimeInterval
-							 * from the JSON.
-							 */
-							if (GetJSONLong (json_p, LRS_START_S, & (job_p -> tsj_interval_p -> ti_start)))
-								{
-									if (GetJSONLong (json_p, LRS_END_S, & (job_p -> tsj_interval_p -> ti_end)))
-										{
-											bool b;
-											OperationStatus old_status = GetServiceJobStatus (& (job_p -> tsj_job));
 
-											if (GetJSONBoolean (json_p, LRS_ADDED_FLAG_S, &b))
-												{
-													job_p -> tsj_added_flag = b;
-												}
-											else
-												{
-													job_p -> tsj_added_flag = false;
-												}
+/*
+ * Restore the jobs from the JobJournal that were still running when the
+ * process last stopped. Their deadlines, cache entries and completion
+ * timers are rebuilt in the shared parts from the journal alone, so none
+ * of them need to be read back from the JobsManager, and no Service has
+ * to stay open until they finish. Any that have finished since are
+ * completed, and removed from the JobsManager, the next time that the
+ * CompletionScheduler's wheel turns.
+ *
+ * This is called with s_shared_data_lock held.
+ */
+static void RecoverJournalledTimedServiceJobs (LongRunningSharedData *shared_p, const JobJournalEntry *entries_p, const uint32 num_entries)
+{
+	uint32 num_failures = 0;
+	uint32 i;
 
-											/* Update the job status */
-											if (old_status == OS_STARTED)
-												{
-													OperationStatus new_status = GetTimedServiceJobStatus (& (job_p -> tsj_job));
+	shared_p -> lss_deadlines_flag = InitDeadlineHeap (& (shared_p -> lss_deadlines), num_entries);
 
-													if (new_status != old_status)
-														{
-															JobsManager *jobs_manager_p = GetJobsManager (grassroots_p);
-															RemoveServiceJobFromJobsManager (jobs_manager_p, job_p -> tsj_job.sj_id, false);
-														}
-												}
+	for (i = 0; i < num_entries; ++ i)
+		{
+			const JobJournalEntry *entry_p = entries_p + i;
 
-											return job_p;
-										}		/* if (GetJSONLong (json_p,  LRS_END_S, & (job_p -> tsj_interval_p -> ti_start))) */
-									else
-										{
-											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get %s from JSON", LRS_END_S);
-										}
+			AddJobToCache (& (shared_p -> lss_job_cache), entry_p -> jje_id, entry_p -> jje_start, entry_p -> jje_end, OS_STARTED);
 
-								}		/* if (GetJSONLong (json_p,  LRS_START_S, & (job_p -> tsj_interval_p -> ti_start))) */
-							else
-								{
-									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get %s from JSON", LRS_START_S);
-								}
-						}		/* if (InitServiceJobFromJSON (& (job_p -> tsj_job), json_p)) */
-					else
-						{
-							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to init ServiceJob from JSON");
-							PrintJSONToLog (STM_LEVEL_SEVERE, __FILE__, __LINE__, json_p, "Init ServiceJob failure: ");
-						}
+			if (! ((shared_p -> lss_deadlines_flag) && AddToDeadlineHeap (& (shared_p -> lss_deadlines), GetJobClockSeconds (entry_p -> jje_end))))
+				{
+					++ num_failures;
+				}
 
-				}		/* if (job_p -> tsj_interval_p) */
-			else
+			if (!ScheduleJobCompletion (& (shared_p -> lss_completions), entry_p -> jje_id, entry_p -> jje_start, entry_p -> jje_end))
 				{
-					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate TimeInterval");
+					++ num_failures;
 				}
+		}
 
-			FreeTimedServiceJob ((ServiceJob *) job_p);
-		}		/* if (job_p) */
-	else
+	if (num_failures > 0)
 		{
-			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate TimedServiceJob");
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to restore " UINT32_FMT " deadlines and completions for " UINT32_FMT " recovered jobs", num_failures, num_entries);
 		}
 
-	return NULL;
+	IncrementLongRunningStatsCounter (GetProcessStats (), LRSC_JOBS_RECOVERED, num_entries);
 }
 
 
-
-static ServiceJob *BuildTimedServiceJob (Service *service_p, const json_t *service_job_json_p)
+/*
+ * Get a snapshot of the counters and latency histograms for every
+ * Service in the process.
+ */
+json_t *GetLongRunningServiceStats (Service * UNUSED_PARAM (service_p))
 {
-	return ((ServiceJob* ) GetTimedServiceJobFromJSON (service_p, service_job_json_p));
+	return GetLongRunningStatsAsJSON (GetProcessStats ());
 }
 
 
-static json_t *BuildTimedServiceJobJSON (Service *service_p, ServiceJob *service_job_p, bool omit_results_flag)
+/*
+ * The server calls GetServices () for each request that it handles, so
+ * rather than each Service counting just its own requests, every Service
+ * in the process updates the same counters and histograms. These last for
+ * as long as the process does, so they aren't lost as each Service is
+ * closed.
+ */
+static LongRunningStats *GetProcessStats (void)
 {
-	return GetTimedServiceJobAsJSON ((TimedServiceJob *) service_job_p);
-}
+	pthread_once (&s_process_stats_once, InitProcessStats);
 
+	return &s_process_stats;
+}
 
 
-static void CustomiseTimedServiceJob (Service *service_p, ServiceJob *job_p)
+static void InitProcessStats (void)
 {
-	job_p -> sj_update_fn = NULL;
-	job_p -> sj_free_fn = NULL;
+	InitLongRunningStats (&s_process_stats);
 }
 
 
-
-static ServiceMetadata *GetLongRunningServiceMetadata (Service *service_p)
+/*
+ * Get the ServiceJobSet for a request for the statistics rather than for
+ * any jobs. This is a single job that has already succeeded and whose
+ * result is the same JSON that GetLongRunningServiceStats () gives, so
+ * the statistics can be read through the server like any other results.
+ * The job isn't added to the JobsManager since it has nothing to run.
+ */
+static ServiceJobSet *GetStatsServiceJobSet (Service *service_p)
 {
-	const char *term_url_s = CONTEXT_PREFIX_EDAM_ONTOLOGY_S "operation_0304";
-	SchemaTerm *category_p = AllocateSchemaTerm (term_url_s, "Query and retrieval", "Search or query a data resource and retrieve entries and / or annotation.");
+	ServiceJobSet *jobs_p = AllocateServiceJobSet (service_p);
 
-	if (category_p)
+	if (jobs_p)
 		{
-			ServiceMetadata *metadata_p = AllocateServiceMetadata (category_p, NULL);
+			TimedServiceJob *job_p = AllocateTimedServiceJob (service_p, NULL, "statistics", LRS_STATS_DESCRIPTION_S, 0);
 
-			if (metadata_p)
-				{
-					return metadata_p;
-				}		/* if (metadata_p) */
-			else
+			if (job_p)
 				{
-					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate service metadata");
+					if (AddServiceJobToServiceJobSet (jobs_p, (ServiceJob *) job_p))
+						{
+							json_t *stats_json_p = GetLongRunningStatsAsJSON (GetProcessStats ());
+
+							if (stats_json_p)
+								{
+									json_t *resource_json_p = GetDataResourceAsJSONByParts (PROTOCOL_INLINE_S, NULL, "Long Runner statistics", stats_json_p);
+
+									/* The resource holds its own reference to stats_json_p */
+									json_decref (stats_json_p);
+
+									if (resource_json_p)
+										{
+											if (AddResultToServiceJob (& (job_p -> tsj_job), resource_json_p))
+												{
+													const int64 now = GetJobClockTime ();
+
+													/* Give the job some times so that it is never mistaken for one that is waiting to start */
+													SetTimedServiceJobTimes (job_p, now, now);
+													SetServiceJobStatus (& (job_p -> tsj_job), OS_SUCCEEDED);
+
+													return jobs_p;
+												}
+											else
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add the statistics to their job");
+													json_decref (resource_json_p);
+												}
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create resource for the statistics");
+										}
+								}
+						}
+					else
+						{
+							FreeTimedServiceJob ((ServiceJob *) job_p);
+						}
 				}
 
-			FreeSchemaTerm (category_p);
-		}		/* if (category_p) */
-	else
-		{
-			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate category term %s for service metadata", term_url_s);
+			FreeServiceJobSet (jobs_p);
 		}
 
 	return NULL;
 }
-
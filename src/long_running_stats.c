@@ -0,0 +1,270 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+#include <string.h>
+#include <time.h>
+
+#include "long_running_stats.h"
+#include "streams.h"
+
+
+/*
+ * The keys used in the JSON from GetLongRunningStatsAsJSON. These must be in
+ * the same order as the values of LongRunningStatsOperation and
+ * LongRunningStatsCounter respectively.
+ */
+static const char * const S_OPERATION_NAMES [LRSO_NUM_OPERATIONS] =
+{
+	"submit",
+	"status",
+	"results",
+	"serialise",
+	"deserialise"
+};
+
+
+static const char * const S_COUNTER_NAMES [LRSC_NUM_COUNTERS] =
+{
+	"jobs_submitted",
+	"jobs_deserialised",
+	"deserialise_failures",
+	"jobs_manager_add_failures",
+	"jobs_manager_removals",
+	"statuses_written_back",
+	"jobs_completed",
+	"jobs_failed_to_start",
+	"requests_rejected",
+	"requests_deferred",
+	"jobs_recovered",
+	"statuses_forwarded",
+	"requests_queued",
+	"jobs_evicted"
+};
+
+
+static uint32 GetLatencyBucket (uint64 latency_ns);
+
+static uint64 GetLatencyPercentile (const uint64 *buckets_p, const uint64 count, const uint32 percentile);
+
+static json_t *GetLatencyHistogramAsJSON (LatencyHistogram *histogram_p);
+
+
+
+void InitLongRunningStats (LongRunningStats *stats_p)
+{
+	memset (stats_p, 0, sizeof (LongRunningStats));
+}
+
+
+uint64 GetLongRunningStatsTime (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return (((uint64) ts.tv_sec) * 1000000000ULL) + (uint64) ts.tv_nsec;
+}
+
+
+void AddLongRunningStatsLatency (LongRunningStats *stats_p, const LongRunningStatsOperation op, const uint64 start_ns)
+{
+	LatencyHistogram *histogram_p = (stats_p -> lrs_latencies) + op;
+	const uint64 end_ns = GetLongRunningStatsTime ();
+	const uint64 latency_ns = (end_ns > start_ns) ? end_ns - start_ns : 0;
+	uint64 max_ns = __atomic_load_n (& (histogram_p -> lh_max_ns), __ATOMIC_RELAXED);
+
+	__atomic_fetch_add ((histogram_p -> lh_buckets) + GetLatencyBucket (latency_ns), 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add (& (histogram_p -> lh_count), 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add (& (histogram_p -> lh_total_ns), latency_ns, __ATOMIC_RELAXED);
+
+	/* On failure, max_ns is updated with the current value so we can just try again */
+	while ((latency_ns > max_ns) && (!__atomic_compare_exchange_n (& (histogram_p -> lh_max_ns), &max_ns, latency_ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)))
+		{
+		}
+}
+
+
+void IncrementLongRunningStatsCounter (LongRunningStats *stats_p, const LongRunningStatsCounter counter, const uint64 value)
+{
+	__atomic_fetch_add ((stats_p -> lrs_counters) + counter, value, __ATOMIC_RELAXED);
+}
+
+
+json_t *GetLongRunningStatsAsJSON (LongRunningStats *stats_p)
+{
+	json_t *stats_json_p = json_object ();
+
+	if (stats_json_p)
+		{
+			json_t *counters_p = json_object ();
+
+			if (counters_p)
+				{
+					if (json_object_set_new (stats_json_p, "counters", counters_p) == 0)
+						{
+							json_t *latencies_p = json_object ();
+
+							if (latencies_p)
+								{
+									if (json_object_set_new (stats_json_p, "latencies", latencies_p) == 0)
+										{
+											bool success_flag = true;
+											uint32 i;
+
+											for (i = 0; i < LRSC_NUM_COUNTERS && success_flag; ++ i)
+												{
+													const uint64 value = __atomic_load_n ((stats_p -> lrs_counters) + i, __ATOMIC_RELAXED);
+
+													if (json_object_set_new (counters_p, S_COUNTER_NAMES [i], json_integer ((json_int_t) value)) != 0)
+														{
+															success_flag = false;
+														}
+												}
+
+											for (i = 0; i < LRSO_NUM_OPERATIONS && success_flag; ++ i)
+												{
+													json_t *histogram_json_p = GetLatencyHistogramAsJSON ((stats_p -> lrs_latencies) + i);
+
+													if (!histogram_json_p || (json_object_set_new (latencies_p, S_OPERATION_NAMES [i], histogram_json_p) != 0))
+														{
+															success_flag = false;
+														}
+												}
+
+											if (success_flag)
+												{
+													return stats_json_p;
+												}
+										}
+									else
+										{
+											json_decref (latencies_p);
+										}
+								}
+						}
+					else
+						{
+							json_decref (counters_p);
+						}
+				}
+
+			json_decref (stats_json_p);
+		}		/* if (stats_json_p) */
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create stats JSON");
+
+	return NULL;
+}
+
+
+/*
+ * Get the index of the bucket that holds a given latency, which is simply
+ * the position of its highest set bit.
+ */
+static uint32 GetLatencyBucket (uint64 latency_ns)
+{
+	uint32 bucket = 0;
+
+	while ((latency_ns >>= 1) != 0)
+		{
+			++ bucket;
+		}
+
+	return (bucket < LRS_NUM_LATENCY_BUCKETS) ? bucket : LRS_NUM_LATENCY_BUCKETS - 1;
+}
+
+
+/*
+ * Get an estimate of a percentile from a set of bucket counts. Since we
+ * only know which bucket each latency fell into, this returns the upper
+ * bound of the bucket containing the percentile.
+ */
+static uint64 GetLatencyPercentile (const uint64 *buckets_p, const uint64 count, const uint32 percentile)
+{
+	if (count > 0)
+		{
+			/* The number of latencies at or below the percentile, rounded up */
+			const uint64 target = ((count * percentile) + 99) / 100;
+			uint64 total = 0;
+			uint32 i;
+
+			for (i = 0; i < LRS_NUM_LATENCY_BUCKETS; ++ i)
+				{
+					total += buckets_p [i];
+
+					if (total >= target)
+						{
+							return (((uint64) 1) << (i + 1)) - 1;
+						}
+				}
+		}
+
+	return 0;
+}
+
+
+static json_t *GetLatencyHistogramAsJSON (LatencyHistogram *histogram_p)
+{
+	uint64 buckets [LRS_NUM_LATENCY_BUCKETS];
+	uint64 count = 0;
+	uint64 total_ns;
+	uint64 max_ns;
+	uint64 p50_ns;
+	uint64 p99_ns;
+	json_error_t error;
+	json_t *histogram_json_p = NULL;
+	uint32 i;
+
+	/*
+	 * Take a copy of the buckets and use their sum as the count so that
+	 * the percentiles are consistent even while other threads are still
+	 * recording latencies.
+	 */
+	for (i = 0; i < LRS_NUM_LATENCY_BUCKETS; ++ i)
+		{
+			buckets [i] = __atomic_load_n ((histogram_p -> lh_buckets) + i, __ATOMIC_RELAXED);
+			count += buckets [i];
+		}
+
+	total_ns = __atomic_load_n (& (histogram_p -> lh_total_ns), __ATOMIC_RELAXED);
+	max_ns = __atomic_load_n (& (histogram_p -> lh_max_ns), __ATOMIC_RELAXED);
+
+	/* The bucket bounds can overshoot the largest latency that we have actually seen */
+	p50_ns = GetLatencyPercentile (buckets, count, 50);
+	if (p50_ns > max_ns)
+		{
+			p50_ns = max_ns;
+		}
+
+	p99_ns = GetLatencyPercentile (buckets, count, 99);
+	if (p99_ns > max_ns)
+		{
+			p99_ns = max_ns;
+		}
+
+	histogram_json_p = json_pack_ex (&error, 0, "{s:I,s:I,s:I,s:I,s:I}",
+		"count", (json_int_t) count,
+		"mean_ns", (json_int_t) ((count > 0) ? total_ns / count : 0),
+		"p50_ns", (json_int_t) p50_ns,
+		"p99_ns", (json_int_t) p99_ns,
+		"max_ns", (json_int_t) max_ns);
+
+	if (!histogram_json_p)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create latency histogram JSON, \"%s\"", error.text);
+		}
+
+	return histogram_json_p;
+}
@@ -0,0 +1,193 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+** 
+**     http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+#include <string.h>
+#include <time.h>
+
+#include "status_flusher.h"
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+static void *RunStatusFlusher (void *data_p);
+
+static void FlushStatusFlusherBatch (StatusFlusher *flusher_p);
+
+
+
+bool InitStatusFlusher (StatusFlusher *flusher_p, const uint32 batch_size, const uint32 interval_ms, StatusFlusherCallback callback_fn, void *callback_data_p)
+{
+	memset (flusher_p, 0, sizeof (StatusFlusher));
+
+	flusher_p -> sf_capacity = (batch_size > 0) ? batch_size : 256;
+	flusher_p -> sf_interval_ms = (interval_ms > 0) ? interval_ms : 100;
+	flusher_p -> sf_callback_fn = callback_fn;
+	flusher_p -> sf_callback_data_p = callback_data_p;
+
+	flusher_p -> sf_pending_p = (uuid_t *) AllocMemoryArray (flusher_p -> sf_capacity, sizeof (uuid_t));
+
+	if (flusher_p -> sf_pending_p)
+		{
+			flusher_p -> sf_flushing_p = (uuid_t *) AllocMemoryArray (flusher_p -> sf_capacity, sizeof (uuid_t));
+
+			if (flusher_p -> sf_flushing_p)
+				{
+					if (pthread_mutex_init (& (flusher_p -> sf_lock), NULL) == 0)
+						{
+							if (pthread_cond_init (& (flusher_p -> sf_wake_up), NULL) == 0)
+								{
+									if (pthread_create (& (flusher_p -> sf_thread), NULL, RunStatusFlusher, flusher_p) == 0)
+										{
+											return true;
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to start status flusher thread");
+										}
+
+									pthread_cond_destroy (& (flusher_p -> sf_wake_up));
+								}
+
+							pthread_mutex_destroy (& (flusher_p -> sf_lock));
+						}
+
+					FreeMemory (flusher_p -> sf_flushing_p);
+					flusher_p -> sf_flushing_p = NULL;
+				}
+
+			FreeMemory (flusher_p -> sf_pending_p);
+			flusher_p -> sf_pending_p = NULL;
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise status flusher for " UINT32_FMT " jobs", flusher_p -> sf_capacity);
+
+	return false;
+}
+
+
+void ClearStatusFlusher (StatusFlusher *flusher_p)
+{
+	pthread_mutex_lock (& (flusher_p -> sf_lock));
+	flusher_p -> sf_stop_flag = true;
+	pthread_cond_signal (& (flusher_p -> sf_wake_up));
+	pthread_mutex_unlock (& (flusher_p -> sf_lock));
+
+	/* The thread writes back whatever is left before it exits */
+	pthread_join (flusher_p -> sf_thread, NULL);
+
+	pthread_cond_destroy (& (flusher_p -> sf_wake_up));
+	pthread_mutex_destroy (& (flusher_p -> sf_lock));
+
+	FreeMemory (flusher_p -> sf_flushing_p);
+	FreeMemory (flusher_p -> sf_pending_p);
+
+	flusher_p -> sf_flushing_p = NULL;
+	flusher_p -> sf_pending_p = NULL;
+	flusher_p -> sf_num_pending = 0;
+}
+
+
+bool QueueStatusFlush (StatusFlusher *flusher_p, const uuid_t job_id)
+{
+	bool queued_flag = false;
+
+	pthread_mutex_lock (& (flusher_p -> sf_lock));
+
+	if ((flusher_p -> sf_num_pending < flusher_p -> sf_capacity) && (! (flusher_p -> sf_stop_flag)))
+		{
+			memcpy (flusher_p -> sf_pending_p [flusher_p -> sf_num_pending], job_id, sizeof (uuid_t));
+			++ (flusher_p -> sf_num_pending);
+
+			if (flusher_p -> sf_num_pending == flusher_p -> sf_capacity)
+				{
+					pthread_cond_signal (& (flusher_p -> sf_wake_up));
+				}
+
+			queued_flag = true;
+		}
+
+	pthread_mutex_unlock (& (flusher_p -> sf_lock));
+
+	return queued_flag;
+}
+
+
+/*
+ * The entry point for the flusher's thread. This writes back a batch
+ * whenever one fills up or sf_interval_ms has passed since the last one,
+ * whichever happens first.
+ */
+static void *RunStatusFlusher (void *data_p)
+{
+	StatusFlusher *flusher_p = (StatusFlusher *) data_p;
+
+	pthread_mutex_lock (& (flusher_p -> sf_lock));
+
+	while (! (flusher_p -> sf_stop_flag))
+		{
+			if (flusher_p -> sf_num_pending < flusher_p -> sf_capacity)
+				{
+					struct timespec wake_up;
+
+					clock_gettime (CLOCK_REALTIME, &wake_up);
+
+					wake_up.tv_sec += (flusher_p -> sf_interval_ms) / 1000;
+					wake_up.tv_nsec += ((long) ((flusher_p -> sf_interval_ms) % 1000)) * 1000000L;
+
+					if (wake_up.tv_nsec >= 1000000000L)
+						{
+							++ wake_up.tv_sec;
+							wake_up.tv_nsec -= 1000000000L;
+						}
+
+					pthread_cond_timedwait (& (flusher_p -> sf_wake_up), & (flusher_p -> sf_lock), &wake_up);
+				}
+
+			FlushStatusFlusherBatch (flusher_p);
+		}
+
+	/* Write back anything queued before we were told to stop */
+	FlushStatusFlusherBatch (flusher_p);
+
+	pthread_mutex_unlock (& (flusher_p -> sf_lock));
+
+	return NULL;
+}
+
+
+/*
+ * Swap the pending batch out and write it back. This must be called with
+ * the lock held, which is released while the callback runs so more jobs
+ * can be queued in the meantime.
+ */
+static void FlushStatusFlusherBatch (StatusFlusher *flusher_p)
+{
+	const uint32 num_jobs = flusher_p -> sf_num_pending;
+
+	if (num_jobs > 0)
+		{
+			uuid_t *batch_p = flusher_p -> sf_pending_p;
+
+			flusher_p -> sf_pending_p = flusher_p -> sf_flushing_p;
+			flusher_p -> sf_flushing_p = batch_p;
+			flusher_p -> sf_num_pending = 0;
+
+			pthread_mutex_unlock (& (flusher_p -> sf_lock));
+
+			flusher_p -> sf_callback_fn ((const uuid_t *) batch_p, num_jobs, flusher_p -> sf_callback_data_p);
+
+			pthread_mutex_lock (& (flusher_p -> sf_lock));
+		}
+}